@@ -53,6 +53,7 @@ GLSLShader* GLSLShader::New(const GLSLShaderDescriptor& desc)
 GLSLShader::GLSLShader(GLSLShaderDataShared* sharedData)
 {
     this->dataShared = sharedData;
+    this->resourcesHandle = sharedData->getShaderHandle();
     if (ManagerOpenGLState::isGLContextProfileVersion32orGreater())
         this->initUniformBlockInfo();
 }
@@ -96,6 +97,7 @@ GLSLShader& GLSLShader::operator=(const GLSLShader& shader)
         this->activeUniformBlocks.clear();
 
         this->dataShared = shader.dataShared;
+        this->resourcesHandle = shader.resourcesHandle;
 
         for (size_t i = 0; i < shader.getUniforms()->size(); i++)
             this->uniforms.push_back(shader.getUniforms()->at(i)->getCopyOfThisInstance());
@@ -143,9 +145,35 @@ bool GLSLShader::useUniformBlock(const std::string uniformBlockName, GLint unifo
 
 void GLSLShader::bind()
 {
+    //the program was relinked by ManagerShader's hot reload, so the uniforms must be looked up again
+    if (this->dataShared->getShaderHandle() != this->resourcesHandle)
+        this->refreshProgramResources();
+
     ManagerShader::bindShader(this->getHandle());
 }
 
+void GLSLShader::refreshProgramResources()
+{
+    GLuint handle = this->getHandle();
+
+    //recreate every uniform and attribute in place, so subclasses can keep indexing them the same way
+    for (size_t i = 0; i < this->uniforms.size(); i++) {
+        GLSLUniform* old = this->uniforms[i];
+        this->uniforms[i] = new GLSLUniform(old->getName(), old->getUniformType(), handle);
+        delete old;
+    }
+    for (size_t i = 0; i < this->attributes.size(); i++) {
+        GLSLAttribute* old = this->attributes[i];
+        this->attributes[i] = new GLSLAttribute(old->getName(), old->getAttributeType(), this);
+        delete old;
+    }
+
+    this->activeUniformBlocks.clear();
+    this->resourcesHandle = handle;
+    if (ManagerOpenGLState::isGLContextProfileVersion32orGreater())
+        this->initUniformBlockInfo();
+}
+
 void GLSLShader::bind(const Mat4& modelMatrix, const Mat4& normalMatrix, const Camera& cam, const ModelMeshSkin& skin)
 {
     GLSLShader::bind();
@@ -123,6 +123,12 @@ public:
    virtual void bind();
    virtual void bind( const Mat4& modelMatrix, const Mat4& normalMatrix, const Camera& cam, const ModelMeshSkin& skin );
 
+   /**
+      Looks up every uniform, attribute and uniform block again in the current program of the shared data.
+      bind calls this when ManagerShader's hot reload has swapped in a relinked program.
+   */
+   void refreshProgramResources();
+
    /**
       Unbinds this shader and uses the default fixed functionality of the pipeline
    */
@@ -145,6 +151,7 @@ protected:
    GLSLShader& operator =( const GLSLShader& shader );
 
    GLSLShaderDataShared* dataShared;
+   GLuint resourcesHandle; ///< program handle the uniforms and attributes were looked up in
    std::vector< GLSLUniform* > uniforms;
    std::vector< GLSLAttribute* > attributes;
 
@@ -1,13 +1,41 @@
 #include "GLSLShaderDataShared.h"
 #include "AftrUtilities.h"
 #include "GLSLShaderDescriptor.h"
+#include "GLStateCache.h"
 #include "ManagerOpenGLState.h"
 #include "ManagerShader.h"
+#include <algorithm>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
+#include <utility>
 using namespace Aftr;
 
+// deepest #include nesting expandShaderSource follows before giving up
+const static int MAX_SHADER_INCLUDE_DEPTH = 32;
+
+// 64 bit FNV-1a parameters
+const static uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const static uint64_t FNV_PRIME = 1099511628211ull;
+
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+}
+
+static void hashString(uint64_t& hash, const std::string& str)
+{
+    // include the length so adjacent strings can't run into each other
+    uint64_t size = str.size();
+    hashBytes(hash, &size, sizeof(size));
+    hashBytes(hash, str.data(), str.size());
+}
+
 Aftr::GLSLShaderDataShared::GLSLShaderDataShared()
 {
     this->vertexShaderPath = "";
@@ -17,6 +45,12 @@ Aftr::GLSLShaderDataShared::GLSLShaderDataShared()
     this->tessellationEvalShaderPath = "";
     this->computeShaderPath = "";
 
+    this->geomShdrInputPrimType = GL_TRIANGLES;
+    this->geomShdrOutputPrimType = GL_TRIANGLE_STRIP;
+    this->geomShdrOutputMaxVerts = 3;
+    this->tessShdrMaxPatchVerts = 3;
+    this->computeDescriptorHash();
+
     this->vertexShaderHandle = 0;
     this->fragmentShaderHandle = 0;
     this->geometryShaderHandle = 0;
@@ -25,6 +59,11 @@ Aftr::GLSLShaderDataShared::GLSLShaderDataShared()
     this->computeShaderHandle = 0;
 
     this->shaderHandle = 0;
+    this->loadedFromProgramBinary = false;
+    this->instantiationPending = false;
+    this->promptOnError = true;
+    this->stagesLoaded = false;
+    this->programBinaryKey = 0;
 }
 
 Aftr::GLSLShaderDataShared::GLSLShaderDataShared(const GLSLShaderDataShared& shaderData)
@@ -55,11 +94,17 @@ Aftr::GLSLShaderDataShared::GLSLShaderDataShared(const std::string& vertexShader
     this->computeShaderHandle = 0;
 
     this->shaderHandle = 0;
+    this->loadedFromProgramBinary = false;
+    this->instantiationPending = false;
+    this->promptOnError = true;
+    this->stagesLoaded = false;
+    this->programBinaryKey = 0;
 
     this->geomShdrInputPrimType = geometryInputPrimitiveType;
     this->geomShdrOutputPrimType = geometryOutputPrimitiveType;
     this->geomShdrOutputMaxVerts = geometryMaxOutputVerts;
     this->tessShdrMaxPatchVerts = 3;
+    this->computeDescriptorHash();
 }
 
 GLSLShaderDataShared::GLSLShaderDataShared(const GLSLShaderDescriptor& desc)
@@ -70,6 +115,7 @@ GLSLShaderDataShared::GLSLShaderDataShared(const GLSLShaderDescriptor& desc)
     this->tessellationControlShaderPath = desc.tessellationControlShader;
     this->tessellationEvalShaderPath = desc.tessellationEvalShader;
     this->computeShaderPath = desc.computeShader;
+    this->defines = desc.defines;
 
     //A shader can ONLY have a valid computeShader by itself. If a computeShader will be loaded,
     //the vertex, fragment, geometry, etc shaders must be empty ("") or a linker error will occur.
@@ -82,11 +128,17 @@ GLSLShaderDataShared::GLSLShaderDataShared(const GLSLShaderDescriptor& desc)
     this->computeShaderHandle = 0;
 
     this->shaderHandle = 0;
+    this->loadedFromProgramBinary = false;
+    this->instantiationPending = false;
+    this->promptOnError = true;
+    this->stagesLoaded = false;
+    this->programBinaryKey = 0;
 
     this->geomShdrInputPrimType = desc.geometryInputPrimitiveType;
     this->geomShdrOutputPrimType = desc.geometryOutputPrimitiveType;
     this->geomShdrOutputMaxVerts = desc.geometryMaxOutputVerts;
     this->tessShdrMaxPatchVerts = desc.tessellationMaxVerticesPerPatch;
+    this->computeDescriptorHash();
 }
 
 GLSLShaderDataShared::~GLSLShaderDataShared()
@@ -121,6 +173,8 @@ GLSLShaderDataShared& Aftr::GLSLShaderDataShared::operator=(const GLSLShaderData
         this->tessellationControlShaderPath = shaderData.tessellationControlShaderPath;
         this->tessellationEvalShaderPath = shaderData.tessellationEvalShaderPath;
         this->computeShaderPath = shaderData.computeShaderPath;
+        this->defines = shaderData.defines;
+        this->sourceFiles = shaderData.sourceFiles;
 
         this->vertexShaderHandle = shaderData.vertexShaderHandle;
         this->fragmentShaderHandle = shaderData.fragmentShaderHandle;
@@ -133,8 +187,14 @@ GLSLShaderDataShared& Aftr::GLSLShaderDataShared::operator=(const GLSLShaderData
         this->geomShdrOutputPrimType = shaderData.geomShdrOutputPrimType;
         this->geomShdrOutputMaxVerts = shaderData.geomShdrOutputMaxVerts;
         this->tessShdrMaxPatchVerts = shaderData.tessShdrMaxPatchVerts;
+        this->descriptorHash = shaderData.descriptorHash;
 
         this->shaderHandle = shaderData.shaderHandle;
+        this->loadedFromProgramBinary = shaderData.loadedFromProgramBinary;
+        this->instantiationPending = shaderData.instantiationPending;
+        this->promptOnError = shaderData.promptOnError;
+        this->stagesLoaded = shaderData.stagesLoaded;
+        this->programBinaryKey = shaderData.programBinaryKey;
     }
     return (*this);
 }
@@ -143,7 +203,9 @@ bool GLSLShaderDataShared::operator==(const GLSLShaderDataShared& shader) const
 {
     if (this == &shader)
         return true;
-    else if (this->vertexShaderPath == shader.vertexShaderPath && this->fragmentShaderPath == shader.fragmentShaderPath && this->geometryShaderPath == shader.geometryShaderPath && this->tessellationControlShaderPath == shader.tessellationControlShaderPath && this->tessellationEvalShaderPath == shader.tessellationEvalShaderPath && this->geomShdrInputPrimType == shader.geomShdrInputPrimType && this->geomShdrOutputPrimType == shader.geomShdrOutputPrimType && this->geomShdrOutputMaxVerts == shader.geomShdrOutputMaxVerts && this->tessShdrMaxPatchVerts == shader.tessShdrMaxPatchVerts && this->computeShaderPath == shader.computeShaderPath)
+    else if (this->descriptorHash != shader.descriptorHash)
+        return false;
+    else if (this->vertexShaderPath == shader.vertexShaderPath && this->fragmentShaderPath == shader.fragmentShaderPath && this->geometryShaderPath == shader.geometryShaderPath && this->tessellationControlShaderPath == shader.tessellationControlShaderPath && this->tessellationEvalShaderPath == shader.tessellationEvalShaderPath && this->geomShdrInputPrimType == shader.geomShdrInputPrimType && this->geomShdrOutputPrimType == shader.geomShdrOutputPrimType && this->geomShdrOutputMaxVerts == shader.geomShdrOutputMaxVerts && this->tessShdrMaxPatchVerts == shader.tessShdrMaxPatchVerts && this->computeShaderPath == shader.computeShaderPath && this->defines == shader.defines)
         return true;
 
     return false;
@@ -158,14 +220,81 @@ bool Aftr::GLSLShaderDataShared::operator<(const GLSLShaderDataShared& shader) c
 {
     if (this == &shader)
         return false;
-    else {
-        //this will still not work properly if the same vert, frag, geo shader is used w/ diff
-        //geom shader params (ie, geoInputPrim, geoOutputPrim, geoMaxOutputVerts) and
-        //tess shader params (ie, tessMaxPatchSize)
-        std::string myPath = this->vertexShaderPath + this->fragmentShaderPath + this->geometryShaderPath + this->tessellationControlShaderPath + this->tessellationEvalShaderPath + this->computeShaderPath;
-        std::string otherPath = shader.vertexShaderPath + shader.fragmentShaderPath + shader.geometryShaderPath + this->tessellationControlShaderPath + this->tessellationEvalShaderPath + shader.computeShaderPath;
-        return (myPath < otherPath);
+
+    //compares every stage path, then the geometry and tessellation params, so two descriptors
+    //are ordered the same way operator== tells them apart
+    const std::string* myPaths[] = { &this->vertexShaderPath, &this->fragmentShaderPath, &this->geometryShaderPath,
+        &this->tessellationControlShaderPath, &this->tessellationEvalShaderPath, &this->computeShaderPath };
+    const std::string* otherPaths[] = { &shader.vertexShaderPath, &shader.fragmentShaderPath, &shader.geometryShaderPath,
+        &shader.tessellationControlShaderPath, &shader.tessellationEvalShaderPath, &shader.computeShaderPath };
+    for (size_t i = 0; i < 6; ++i) {
+        int c = myPaths[i]->compare(*otherPaths[i]);
+        if (c != 0)
+            return c < 0;
     }
+
+    if (this->geomShdrInputPrimType != shader.geomShdrInputPrimType)
+        return this->geomShdrInputPrimType < shader.geomShdrInputPrimType;
+    if (this->geomShdrOutputPrimType != shader.geomShdrOutputPrimType)
+        return this->geomShdrOutputPrimType < shader.geomShdrOutputPrimType;
+    if (this->geomShdrOutputMaxVerts != shader.geomShdrOutputMaxVerts)
+        return this->geomShdrOutputMaxVerts < shader.geomShdrOutputMaxVerts;
+    if (this->tessShdrMaxPatchVerts != shader.tessShdrMaxPatchVerts)
+        return this->tessShdrMaxPatchVerts < shader.tessShdrMaxPatchVerts;
+    return this->defines < shader.defines;
+}
+
+void GLSLShaderDataShared::computeDescriptorHash()
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    hashString(hash, this->vertexShaderPath);
+    hashString(hash, this->fragmentShaderPath);
+    hashString(hash, this->geometryShaderPath);
+    hashString(hash, this->tessellationControlShaderPath);
+    hashString(hash, this->tessellationEvalShaderPath);
+    hashString(hash, this->computeShaderPath);
+    hashBytes(hash, &this->geomShdrInputPrimType, sizeof(this->geomShdrInputPrimType));
+    hashBytes(hash, &this->geomShdrOutputPrimType, sizeof(this->geomShdrOutputPrimType));
+    hashBytes(hash, &this->geomShdrOutputMaxVerts, sizeof(this->geomShdrOutputMaxVerts));
+    hashBytes(hash, &this->tessShdrMaxPatchVerts, sizeof(this->tessShdrMaxPatchVerts));
+    for (const auto& define : this->defines) {
+        hashString(hash, define.first);
+        hashString(hash, define.second);
+    }
+    this->descriptorHash = hash;
+}
+
+GLSLShaderDescriptor GLSLShaderDataShared::getDescriptor() const
+{
+    GLSLShaderDescriptor desc;
+    desc.vertexShader = this->vertexShaderPath;
+    desc.fragmentShader = this->fragmentShaderPath;
+    desc.geometryShader = this->geometryShaderPath;
+    desc.tessellationControlShader = this->tessellationControlShaderPath;
+    desc.tessellationEvalShader = this->tessellationEvalShaderPath;
+    desc.computeShader = this->computeShaderPath;
+    desc.geometryInputPrimitiveType = this->geomShdrInputPrimType;
+    desc.geometryOutputPrimitiveType = this->geomShdrOutputPrimType;
+    desc.geometryMaxOutputVerts = this->geomShdrOutputMaxVerts;
+    desc.tessellationMaxVerticesPerPatch = this->tessShdrMaxPatchVerts;
+    desc.defines = this->defines;
+    return desc;
+}
+
+void GLSLShaderDataShared::swapProgram(GLSLShaderDataShared& other)
+{
+    std::swap(this->vertexShaderHandle, other.vertexShaderHandle);
+    std::swap(this->fragmentShaderHandle, other.fragmentShaderHandle);
+    std::swap(this->geometryShaderHandle, other.geometryShaderHandle);
+    std::swap(this->tessellationControlShaderHandle, other.tessellationControlShaderHandle);
+    std::swap(this->tessellationEvalShaderHandle, other.tessellationEvalShaderHandle);
+    std::swap(this->computeShaderHandle, other.computeShaderHandle);
+    std::swap(this->shaderHandle, other.shaderHandle);
+    std::swap(this->loadedFromProgramBinary, other.loadedFromProgramBinary);
+    std::swap(this->instantiationPending, other.instantiationPending);
+    std::swap(this->stagesLoaded, other.stagesLoaded);
+    std::swap(this->programBinaryKey, other.programBinaryKey);
+    std::swap(this->sourceFiles, other.sourceFiles);
 }
 
 std::string GLSLShaderDataShared::toString() const
@@ -181,8 +310,10 @@ std::string GLSLShaderDataShared::toString() const
        << "   TessellationControlShaderPath: '" << this->tessellationControlShaderPath << "'...\n"
        << "   TessellationEvalShaderPath: '" << this->tessellationEvalShaderPath << "'...\n"
        << "   TessellationMaxPatchVerts: '" << this->tessShdrMaxPatchVerts << "'...\n"
-       << "   ComputeShaderPath: '" << this->computeShaderPath << "'...\n"
-       << "   GLuint   :'" << this->getShaderHandle() << "'\n";
+       << "   ComputeShaderPath: '" << this->computeShaderPath << "'...\n";
+    for (const auto& define : this->defines)
+        ss << "   Define: '" << define.first << " " << define.second << "'...\n";
+    ss << "   GLuint   :'" << this->getShaderHandle() << "'\n";
     return ss.str();
 }
 
@@ -228,32 +359,46 @@ GLuint GLSLShaderDataShared::getShaderHandle() const
 
 void GLSLShaderDataShared::setVertexShaderPath(const std::string& vertexShaderPath)
 {
-    this->vertexShaderPath = vertexShaderPath;
+    this->setStagePath(this->vertexShaderPath, vertexShaderPath);
 }
 
 void GLSLShaderDataShared::setFragmentShaderPath(const std::string& fragmentShaderPath)
 {
-    this->fragmentShaderPath = fragmentShaderPath;
+    this->setStagePath(this->fragmentShaderPath, fragmentShaderPath);
 }
 
-void GLSLShaderDataShared::setGeometryShaderPath(const std::string& geometryShaderpath)
+void GLSLShaderDataShared::setGeometryShaderPath(const std::string& geometryShaderPath)
 {
-    this->geometryShaderPath = geometryShaderPath;
+    this->setStagePath(this->geometryShaderPath, geometryShaderPath);
 }
 
 void GLSLShaderDataShared::setTessellationControlShaderPath(const std::string& tessControlShaderPath)
 {
-    this->tessellationControlShaderPath = tessControlShaderPath;
+    this->setStagePath(this->tessellationControlShaderPath, tessControlShaderPath);
 }
 
 void GLSLShaderDataShared::setTessellationEvalShaderPath(const std::string& tessEvalShaderPath)
 {
-    this->tessellationEvalShaderPath = tessEvalShaderPath;
+    this->setStagePath(this->tessellationEvalShaderPath, tessEvalShaderPath);
 }
 
 void GLSLShaderDataShared::setComputeShaderPath(const std::string& computeShaderpath)
 {
-    this->computeShaderPath = computeShaderpath;
+    this->setStagePath(this->computeShaderPath, computeShaderpath);
+}
+
+void GLSLShaderDataShared::setStagePath(std::string& stagePath, const std::string& path)
+{
+    if (stagePath == path)
+        return;
+
+    //ManagerShader's set is keyed by the descriptor hash, so a shader it holds leaves the set while its key changes
+    bool registered = ManagerShader::unregisterShaderDataShared(this);
+    stagePath = path;
+    this->computeDescriptorHash();
+    if (registered && !ManagerShader::registerShaderDataShared(this))
+        std::cout << "WARNING: After the path change this shader describes the same program as another loaded shader, ManagerShader no longer shares it...\n"
+                  << this->toString();
 }
 
 std::ostream& Aftr::operator<<(std::ostream& out, const GLSLShaderDataShared& shdrData)
@@ -264,6 +409,15 @@ std::ostream& Aftr::operator<<(std::ostream& out, const GLSLShaderDataShared& sh
 
 bool Aftr::GLSLShaderDataShared::instantiate()
 {
+    if (!this->beginInstantiate())
+        return false;
+    return this->finishInstantiate();
+}
+
+bool Aftr::GLSLShaderDataShared::beginInstantiate(bool promptOnError)
+{
+    this->promptOnError = promptOnError;
+
     if (!((glCreateShader != NULL) && (glShaderSource != NULL) && (glCompileShader != NULL) && (glGetShaderiv != NULL) && //GL 3.0+ changes
             (glGetShaderInfoLog != NULL) && //GL 3.0+ changes
             (glCreateProgram != NULL) && (glAttachShader != NULL) && (glGetProgramiv != NULL) &&
@@ -278,40 +432,102 @@ bool Aftr::GLSLShaderDataShared::instantiate()
         return false;
     }
 
-    printOpenGLErrors(201214, NULL, AFTR_FILE_LINE_STR);
+    AFTR_GL_CHECK(201214);
+
+    // skip compiling and linking entirely if this exact program was linked by an earlier run
+    this->loadedFromProgramBinary = false;
+    this->programBinaryKey = 0;
+    this->sourceFiles.clear();
+    bool hasKey = !ManagerShader::getProgramBinaryCacheDirectory().empty() && this->computeProgramBinaryKey(this->programBinaryKey, &this->sourceFiles);
+    if (hasKey) {
+        this->shaderHandle = glCreateProgram();
+        if (ManagerShader::loadProgramBinary(this->programBinaryKey, this->shaderHandle)) {
+            this->loadedFromProgramBinary = true;
+            this->stagesLoaded = true;
+            this->instantiationPending = false;
+            this->checkMaxPatchVertices();
+            return true;
+        }
+
+        // stale or missing, fall back to compiling from source
+        glDeleteProgram(this->shaderHandle);
+        this->shaderHandle = 0;
+    } else
+        this->programBinaryKey = 0;
+    this->sourceFiles.clear();
 
-    bool hasLoadedSuccessfully = true;
+    // only submit the work here; nothing is queried until finishInstantiate, so a driver compiling
+    // in the background (GL_KHR_parallel_shader_compile) is never waited on
+    this->stagesLoaded = true;
 
     if (this->vertexShaderPath != "")
-        hasLoadedSuccessfully &= this->loadVertexShader(this->vertexShaderPath);
+        this->stagesLoaded &= this->loadVertexShader(this->vertexShaderPath);
 
     if (this->geometryShaderPath != "")
-        hasLoadedSuccessfully &= this->loadGeometryShader(this->geometryShaderPath);
+        this->stagesLoaded &= this->loadGeometryShader(this->geometryShaderPath);
 
     if (this->tessellationControlShaderPath != "")
-        hasLoadedSuccessfully &= this->loadTessellationControlShader(this->tessellationControlShaderPath);
+        this->stagesLoaded &= this->loadTessellationControlShader(this->tessellationControlShaderPath);
 
     if (this->tessellationEvalShaderPath != "")
-        hasLoadedSuccessfully &= this->loadTessellationEvalShader(this->tessellationEvalShaderPath);
+        this->stagesLoaded &= this->loadTessellationEvalShader(this->tessellationEvalShaderPath);
 
     if (this->fragmentShaderPath != "")
-        hasLoadedSuccessfully &= this->loadFragmentShader(this->fragmentShaderPath);
+        this->stagesLoaded &= this->loadFragmentShader(this->fragmentShaderPath);
 
     if (this->computeShaderPath != "")
-        hasLoadedSuccessfully &= this->loadComputeShader(this->computeShaderPath);
+        this->stagesLoaded &= this->loadComputeShader(this->computeShaderPath);
 
-    hasLoadedSuccessfully &= this->createProgramShader();
-    hasLoadedSuccessfully &= this->linkProgramShader();
+    if (!this->stagesLoaded)
+        return false;
 
-    // make sure hardware can support our desired number of patch vertices
-    if (this->tessellationControlShaderPath != "" || this->tessellationEvalShaderPath != "") {
-        GLint data;
-        glGetIntegerv(GL_MAX_PATCH_VERTICES, &data);
-        if (this->tessShdrMaxPatchVerts > static_cast<GLuint>(data)) {
-            std::cout << "Warning: Maximum tessellation shader patch vertices is " << data << ", but " << this->tessShdrMaxPatchVerts << " were requested...\n";
-        }
+    this->stagesLoaded &= this->createProgramShader();
+    if (hasKey)
+        glProgramParameteri(this->shaderHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    this->stagesLoaded &= this->linkProgramShader();
+
+    this->instantiationPending = this->stagesLoaded;
+    return this->stagesLoaded;
+}
+
+bool Aftr::GLSLShaderDataShared::isInstantiationComplete() const
+{
+    if (!this->instantiationPending)
+        return true;
+    if (!ManagerShader::isParallelShaderCompileSupported())
+        return true; // nothing to poll, finishInstantiate simply waits on the driver
+
+    GLint done = GL_FALSE;
+    glGetProgramiv(this->shaderHandle, GL_COMPLETION_STATUS_KHR, &done); // the same enum as GL_COMPLETION_STATUS_ARB
+    return done == GL_TRUE;
+}
+
+bool Aftr::GLSLShaderDataShared::finishInstantiate()
+{
+    if (!this->instantiationPending)
+        return this->stagesLoaded;
+    this->instantiationPending = false;
+
+    bool hasLoadedSuccessfully = true;
+
+    // every stage in the order beginInstantiate submits them
+    const std::string* paths[] = { &this->vertexShaderPath, &this->geometryShaderPath, &this->tessellationControlShaderPath,
+        &this->tessellationEvalShaderPath, &this->fragmentShaderPath, &this->computeShaderPath };
+    GLuint handles[] = { this->vertexShaderHandle, this->geometryShaderHandle, this->tessellationControlShaderHandle,
+        this->tessellationEvalShaderHandle, this->fragmentShaderHandle, this->computeShaderHandle };
+    for (size_t i = 0; i < 6; ++i) {
+        if (handles[i] != 0)
+            hasLoadedSuccessfully &= this->checkShaderCompileStatus(*paths[i], handles[i]);
     }
 
+    hasLoadedSuccessfully &= this->checkProgramLinkStatus();
+    this->stagesLoaded = hasLoadedSuccessfully;
+
+    if (this->programBinaryKey != 0 && hasLoadedSuccessfully)
+        ManagerShader::storeProgramBinary(this->programBinaryKey, this->shaderHandle);
+
+    this->checkMaxPatchVertices();
+
     return hasLoadedSuccessfully;
 
     //if( this->geometryShaderPath == "" )
@@ -327,60 +543,193 @@ bool Aftr::GLSLShaderDataShared::instantiate()
     //   linkProgramShader();
 }
 
-bool GLSLShaderDataShared::loadShader(GLenum shaderType, const std::string& shaderPath, GLuint& handle)
+void GLSLShaderDataShared::checkMaxPatchVertices() const
+{
+    // make sure hardware can support our desired number of patch vertices, whether the program was compiled or loaded from the cache
+    if (this->tessellationControlShaderPath != "" || this->tessellationEvalShaderPath != "") {
+        GLint data;
+        glGetIntegerv(GL_MAX_PATCH_VERTICES, &data);
+        if (this->tessShdrMaxPatchVerts > static_cast<GLuint>(data)) {
+            std::cout << "Warning: Maximum tessellation shader patch vertices is " << data << ", but " << this->tessShdrMaxPatchVerts << " were requested...\n";
+        }
+    }
+}
+
+bool GLSLShaderDataShared::computeProgramBinaryKey(uint64_t& key, std::vector<std::string>* sourceFiles) const
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    // the resolved source of every stage (includes expanded, defines injected) in the order instantiate
+    // attaches them, empty stages included so they can't shift
+    std::vector<std::string> files;
+    const std::string* paths[] = { &this->vertexShaderPath, &this->geometryShaderPath, &this->tessellationControlShaderPath,
+        &this->tessellationEvalShaderPath, &this->fragmentShaderPath, &this->computeShaderPath };
+    for (const std::string* path : paths) {
+        std::string source;
+        if (*path != "" && !GLSLShaderDataShared::preprocessShaderSource(*path, this->defines, source, files))
+            return false;
+        hashString(hash, source);
+    }
+    if (sourceFiles != nullptr)
+        GLSLShaderDataShared::mergeSourceFiles(files, *sourceFiles);
+
+    GLuint params[] = { this->geomShdrInputPrimType, this->geomShdrOutputPrimType, this->geomShdrOutputMaxVerts, this->tessShdrMaxPatchVerts };
+    hashBytes(hash, params, sizeof(params));
+    hashString(hash, ManagerShader::getDriverString());
+
+    key = hash;
+    return true;
+}
+
+bool GLSLShaderDataShared::readShaderSource(const std::string& shaderPath, std::string& source)
 {
     std::ifstream fin;
     fin.open(shaderPath.c_str());
+    if (fin.fail())
+        return false;
+
+    std::string data;
+    std::getline(fin, source);
+    while (!fin.eof()) {
+        source += data;
+        source += '\n';
+        getline(fin, data);
+    }
+    source += data;
+    return true;
+}
+
+bool GLSLShaderDataShared::preprocessShaderSource(const std::string& shaderPath, const std::map<std::string, std::string>& defines,
+    std::string& source, std::vector<std::string>& sourceFiles)
+{
+    source.clear();
+    std::vector<std::string> files;
+    if (!GLSLShaderDataShared::expandShaderSource(shaderPath, defines, 0, source, files))
+        return false;
+    GLSLShaderDataShared::mergeSourceFiles(files, sourceFiles);
+    return true;
+}
 
-    if (fin.fail()) {
+bool GLSLShaderDataShared::expandShaderSource(const std::string& shaderPath, const std::map<std::string, std::string>& defines, int depth,
+    std::string& source, std::vector<std::string>& files)
+{
+    std::string data;
+    if (!GLSLShaderDataShared::readShaderSource(shaderPath, data)) {
         std::cout << "ERROR: The shader " << shaderPath << " failed to open." << std::endl;
-        std::cin.get(); //error get
-    } else {
-        std::string shader;
-        std::string data;
-        std::getline(fin, shader);
-        while (!fin.eof()) {
-            shader += data;
-            shader += '\n';
-            getline(fin, data);
+        return false;
+    }
+
+    //the index of this file in files is its source string number in #line directives (and compile logs)
+    int sourceString = static_cast<int>(files.size());
+    files.push_back(shaderPath);
+
+    std::istringstream lines(data);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        ++lineNumber;
+        size_t start = line.find_first_not_of(" \t");
+        std::string directive = start == std::string::npos ? "" : line.substr(start);
+
+        if (directive.compare(0, 8, "#include") == 0) {
+            size_t open = directive.find('"');
+            size_t close = open == std::string::npos ? std::string::npos : directive.find('"', open + 1);
+            if (close == std::string::npos) {
+                std::cout << "ERROR: " << shaderPath << ":" << lineNumber << ": malformed #include, expected #include \"file\"...\n";
+                return false;
+            }
+            if (depth >= MAX_SHADER_INCLUDE_DEPTH) {
+                std::cout << "ERROR: " << shaderPath << ":" << lineNumber << ": #include nested more than " << MAX_SHADER_INCLUDE_DEPTH << " levels deep...\n";
+                return false;
+            }
+
+            //resolve relative to the including file; every file is included at most once per stage
+            std::filesystem::path included = std::filesystem::path(shaderPath).parent_path() / directive.substr(open + 1, close - open - 1);
+            std::string includedPath = included.lexically_normal().string();
+            if (std::find(files.begin(), files.end(), includedPath) == files.end()) {
+                source += "#line 1 " + std::to_string(files.size()) + "\n";
+                if (!GLSLShaderDataShared::expandShaderSource(includedPath, defines, depth + 1, source, files))
+                    return false;
+            }
+            source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceString) + "\n";
+            continue;
         }
-        shader += data;
-
-        //info for debugging if there are any issues with the shaders
-        GLint logLength = 0;
-        GLint status = 0;
-
-        //creates the storage space for the shader
-        handle = glCreateShader(shaderType);
-
-        //loads the shader information from the c-string
-        const char* str = shader.c_str();
-        std::cout << "Compiling Shader: '" << shaderPath << "'\n";
-        glShaderSource(handle, 1, (const GLchar**)&str, NULL);
-
-        //compiles the shader
-        glCompileShader(handle);
-
-        //prints off any error messages
-        glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &logLength);
-        if (logLength > 0) {
-            GLchar* log = (GLchar*)malloc(logLength);
-            glGetShaderInfoLog(handle, logLength, NULL, log);
-            printf("Vertex Shader compile log:\n%s\n", log);
-            free(log);
+
+        source += line;
+        source += '\n';
+
+        //the defines go right after #version, which has to stay the first line of the stage
+        if (depth == 0 && directive.compare(0, 8, "#version") == 0 && !defines.empty()) {
+            for (const auto& define : defines)
+                source += "#define " + define.first + " " + define.second + "\n";
+            source += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceString) + "\n";
         }
-        printOpenGLErrors(2012141, NULL, AFTR_FILE_LINE_STR);
-        //checks the status of the compilation if there was an issue reports error
-        glGetShaderiv(handle, GL_COMPILE_STATUS, &status);
-        if (status == 0) {
-            printf("Failed to compile shader %d\n", handle);
+    }
+    return true;
+}
+
+void GLSLShaderDataShared::mergeSourceFiles(const std::vector<std::string>& files, std::vector<std::string>& sourceFiles)
+{
+    for (const std::string& file : files) {
+        if (std::find(sourceFiles.begin(), sourceFiles.end(), file) == sourceFiles.end())
+            sourceFiles.push_back(file);
+    }
+}
+
+bool GLSLShaderDataShared::loadShader(GLenum shaderType, const std::string& shaderPath, GLuint& handle)
+{
+    std::string shader;
+    std::vector<std::string> files;
+    if (!GLSLShaderDataShared::preprocessShaderSource(shaderPath, this->defines, shader, files)) {
+        std::cout << "ERROR: The shader " << shaderPath << " failed to load." << std::endl;
+        if (this->promptOnError)
+            std::cin.get(); //error get
+        return false;
+    }
+    GLSLShaderDataShared::mergeSourceFiles(files, this->sourceFiles);
+
+    //creates the storage space for the shader
+    handle = glCreateShader(shaderType);
+
+    //loads the shader information from the c-string
+    const char* str = shader.c_str();
+    std::cout << "Compiling Shader: '" << shaderPath << "'";
+    for (size_t i = 1; i < files.size(); ++i)
+        std::cout << (i == 1 ? " including " : ", ") << "[" << i << "] '" << files[i] << "'";
+    std::cout << "\n";
+    glShaderSource(handle, 1, (const GLchar**)&str, NULL);
+
+    //compiles the shader, the result is checked by checkShaderCompileStatus
+    glCompileShader(handle);
+    return true;
+}
+
+bool GLSLShaderDataShared::checkShaderCompileStatus(const std::string& shaderPath, GLuint handle)
+{
+    //info for debugging if there are any issues with the shaders
+    GLint logLength = 0;
+    GLint status = 0;
+
+    //prints off any error messages
+    glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &logLength);
+    if (logLength > 0) {
+        GLchar* log = (GLchar*)malloc(logLength);
+        glGetShaderInfoLog(handle, logLength, NULL, log);
+        printf("Shader '%s' compile log:\n%s\n", shaderPath.c_str(), log);
+        free(log);
+    }
+    AFTR_GL_CHECK(2012141);
+    //checks the status of the compilation if there was an issue reports error
+    glGetShaderiv(handle, GL_COMPILE_STATUS, &status);
+    if (status == 0) {
+        printf("Failed to compile shader %d\n", handle);
+        if (this->promptOnError) {
             std::cout << "Press ENTER to continue without this shader...\n";
             std::cin.get();
-            return false;
         }
-        return true;
+        return false;
     }
-    return false;
+    return true;
 }
 
 bool GLSLShaderDataShared::loadVertexShader(const std::string& vertexShaderPath)
@@ -410,7 +759,7 @@ bool GLSLShaderDataShared::loadTessellationEvalShader(const std::string& tessEva
 
 bool GLSLShaderDataShared::loadComputeShader(const std::string& computeShaderPath)
 {
-    printOpenGLErrors(0, NULL, AFTR_FILE_LINE_STR);
+    AFTR_GL_CHECK(0);
     return this->loadShader(GL_COMPUTE_SHADER, computeShaderPath, this->computeShaderHandle);
 }
 
@@ -436,15 +785,12 @@ bool Aftr::GLSLShaderDataShared::createProgramShader()
     if (this->computeShaderHandle != 0)
         glAttachShader(this->shaderHandle, this->computeShaderHandle);
 
-    printOpenGLErrors(123456, NULL, AFTR_FILE_LINE_STR);
+    AFTR_GL_CHECK(123456);
     return true;
 }
 
 bool GLSLShaderDataShared::linkProgramShader()
 {
-    GLint logLength = 0;
-    GLint status = 0;
-
     if (this->geometryShaderHandle != 0) {
         if (glProgramParameteriEXT == NULL) {
             std::cout << "glProgramParameteriEXT is NULL, cannot create a geometry shader on this hardware. Geometry Shader\n"
@@ -464,9 +810,16 @@ bool GLSLShaderDataShared::linkProgramShader()
     }
 
     glLinkProgram(shaderHandle);
-    printOpenGLErrors(98765, NULL, AFTR_FILE_LINE_STR);
+    AFTR_GL_CHECK(98765);
 
     std::cout << "Linking!" << std::endl;
+    return true;
+}
+
+bool GLSLShaderDataShared::checkProgramLinkStatus()
+{
+    GLint logLength = 0;
+    GLint status = 0;
 
     glGetProgramiv(shaderHandle, GL_INFO_LOG_LENGTH, &logLength);
     if (logLength > 0) {
@@ -479,8 +832,10 @@ bool GLSLShaderDataShared::linkProgramShader()
     glGetProgramiv(this->shaderHandle, GL_LINK_STATUS, &status);
     if (status == 0) {
         std::cout << "Failed to link program " << shaderHandle << ". Status returned is " << status << std::endl;
-        std::cout << "Hit ENTER to continue normally...Fix this prior to a release...\n";
-        std::cin.get();
+        if (this->promptOnError) {
+            std::cout << "Hit ENTER to continue normally...Fix this prior to a release...\n";
+            std::cin.get();
+        }
         return false;
     } else {
         std::cout << "Link successful for program " << shaderHandle << std::endl;
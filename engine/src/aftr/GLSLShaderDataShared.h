@@ -1,6 +1,7 @@
 #pragma once
 
 #include "AftrOpenGLIncludes.h"
+#include <cstdint>
 #include <string>
 #include <iostream>
 #include <map>
@@ -44,7 +45,8 @@ namespace Aftr
 
       /**
       \return true iff the LHS (Left Hand Side) is lexagraphically less 
-      than the RHS (Right Hand Side); false, otherwise.
+      than the RHS (Right Hand Side); false, otherwise. Compares every stage path,
+      then the geometry and tessellation params.
       */
       bool operator <( const GLSLShaderDataShared& tex ) const;
 
@@ -60,6 +62,7 @@ namespace Aftr
       std::string getTessellationControlShaderPath() const;
       std::string getTessellationEvalShaderPath() const;
       std::string getComputeShaderPath() const;
+      /// The path setters move a shader held by ManagerShader to the key of its new descriptor (see getDescriptorHash).
       void setVertexShaderPath( const std::string& path );
       void setFragmentShaderPath( const std::string& path );
       void setGeometryShaderPath( const std::string& path );
@@ -67,6 +70,22 @@ namespace Aftr
       void setTessellationEvalShaderPath(const std::string& path);
       void setComputeShaderPath( const std::string& path );
 
+      /**
+      \returns a 64 bit FNV-1a hash of every stage path and the geometry and tessellation params, the key
+      ManagerShader looks this shader up by. It is computed once by the constructor; a path setter takes the
+      shader out of ManagerShader's set before recomputing it and puts it back afterwards.
+      */
+      uint64_t getDescriptorHash() const { return this->descriptorHash; }
+
+      /// \returns a descriptor of the stages and parameters of this program.
+      GLSLShaderDescriptor getDescriptor() const;
+
+      /**
+      Exchanges the compiled stages and the linked program with other, leaving the paths and parameters of both
+      untouched. ManagerShader uses this to swap a recompiled program into a shader everyone already references.
+      */
+      void swapProgram( GLSLShaderDataShared& other );
+
       /// \returns the name of the OpenGL texture. That is, this is the value to use in glBindTexture.
       GLuint getShaderHandle() const;
       GLuint getFragmentShaderHandle() const { return fragmentShaderHandle; } 
@@ -83,8 +102,70 @@ namespace Aftr
       */
       friend std::ostream& operator <<( std::ostream& xout, const GLSLShaderDataShared& shdrData );
 
+      /**
+      Compiles and links every stage into the program, or loads the program from the program binary
+      cache of ManagerShader when it holds a binary for the same sources, parameters and driver.
+      Same as beginInstantiate followed by finishInstantiate.
+      \return true iff the program is ready to use.
+      */
       bool instantiate();
 
+      /**
+      Submits every stage for compilation and the program for linking without querying any of their
+      results, so the driver may keep working in the background (GL_KHR_parallel_shader_compile).
+      Loading from the program binary cache completes immediately.
+      \param promptOnError true waits for ENTER when a stage fails to load or compile or the program fails to
+      link (here or in finishInstantiate); false only prints the logs, as hot reloads do.
+      \return false iff a stage could not be read or the hardware cannot create shader programs.
+      */
+      bool beginInstantiate( bool promptOnError = true );
+
+      /**
+      \returns true iff finishInstantiate will not wait on the driver. Without GL_KHR_parallel_shader_compile
+      there is nothing to poll, so this always returns true.
+      */
+      bool isInstantiationComplete() const;
+
+      /**
+      Waits for the work submitted by beginInstantiate, prints the compile and link logs and stores the
+      program in the program binary cache. Only waits for ENTER on a failure if beginInstantiate was asked to.
+      Does nothing if nothing is pending.
+      \return true iff the program is ready to use.
+      */
+      bool finishInstantiate();
+
+      /// \returns true iff beginInstantiate submitted work finishInstantiate has not collected yet.
+      bool isInstantiationPending() const { return this->instantiationPending; }
+
+      /// \returns true iff instantiate loaded the program from the program binary cache instead of compiling it.
+      bool isLoadedFromProgramBinary() const { return this->loadedFromProgramBinary; }
+
+      /**
+      \returns the key of this program in the program binary cache: a 64 bit FNV-1a hash of the resolved source
+      of every stage (see preprocessShaderSource), the geometry and tessellation parameters and the driver string
+      of ManagerShader. Returns false if a stage cannot be read. If sourceFiles is not null, every file read is
+      added to it.
+      */
+      bool computeProgramBinaryKey( uint64_t& key, std::vector< std::string >* sourceFiles = nullptr ) const;
+
+      /// \returns the preprocessor definitions injected into every stage.
+      const std::map< std::string, std::string >& getDefines() const { return this->defines; }
+
+      /// \returns every file the last instantiate read: the stage sources and everything they #include.
+      const std::vector< std::string >& getSourceFiles() const { return this->sourceFiles; }
+
+      /**
+      Reads the source of a stage and resolves it for compilation:
+      - #include "file" lines are replaced by the file, resolved relative to the including file. Every file is
+        included at most once per stage, so include guards are not needed.
+      - every define is inserted as "#define name value" right after the #version line.
+      #line directives keep compile log line numbers pointing into the original files; the source string number
+      of a file is its index among the files of the stage, in the order they were first included (0 is the stage).
+      Every file read is added to sourceFiles. Returns false if a file cannot be read or an #include is malformed.
+      */
+      static bool preprocessShaderSource( const std::string& shaderPath, const std::map< std::string, std::string >& defines,
+                                          std::string& source, std::vector< std::string >& sourceFiles );
+
       ////std::map< std::string, GLint > attributeLocations;
 
    protected:
@@ -107,6 +188,29 @@ namespace Aftr
       GLuint tessShdrMaxPatchVerts;
       GLuint computeShaderHandle;
       GLuint shaderHandle; ///< Actual GLuint handle to server-side texture on graphics card, this is used w/ glBindTexture
+      bool loadedFromProgramBinary; ///< true iff instantiate loaded the program from the program binary cache
+      uint64_t descriptorHash; ///< see getDescriptorHash
+      bool instantiationPending; ///< true between beginInstantiate and finishInstantiate
+      bool promptOnError; ///< see beginInstantiate
+      bool stagesLoaded; ///< false iff a stage or the program failed so far
+      uint64_t programBinaryKey; ///< key the linked program is stored under, 0 if the cache is not used
+      std::map< std::string, std::string > defines; ///< see GLSLShaderDescriptor::defines
+      std::vector< std::string > sourceFiles; ///< see getSourceFiles
+
+      /// Computes descriptorHash from the paths and params.
+      void computeDescriptorHash();
+
+      /// Sets stagePath (one of the stage paths) to path, re-registering this shader with ManagerShader under its new hash.
+      void setStagePath( std::string& stagePath, const std::string& path );
+
+      static bool readShaderSource( const std::string& shaderPath, std::string& source );
+
+      /// Appends shaderPath to source with its #includes expanded (see preprocessShaderSource); files holds the files of the stage so far.
+      static bool expandShaderSource( const std::string& shaderPath, const std::map< std::string, std::string >& defines, int depth,
+                                      std::string& source, std::vector< std::string >& files );
+
+      /// Appends every file of files not in sourceFiles yet.
+      static void mergeSourceFiles( const std::vector< std::string >& files, std::vector< std::string >& sourceFiles );
 
       bool loadVertexShader( const std::string& vertexShaderPath );
       bool loadFragmentShader( const std::string& fragmentShaderPath );
@@ -114,9 +218,12 @@ namespace Aftr
       bool loadTessellationControlShader(const std::string& tessControlShaderPath);
       bool loadTessellationEvalShader(const std::string& tessEvalShaderPath);
       bool loadComputeShader( const std::string& computeShaderPath );
-      bool loadShader( GLenum shaderType, const std::string& shaderPath, GLuint& handle );
+      bool loadShader( GLenum shaderType, const std::string& shaderPath, GLuint& handle ); ///< Submits the stage for compilation
+      bool checkShaderCompileStatus( const std::string& shaderPath, GLuint handle );
       bool createProgramShader();
-      bool linkProgramShader();
+      bool linkProgramShader(); ///< Submits the program for linking
+      bool checkProgramLinkStatus();
+      void checkMaxPatchVertices() const; ///< Warns if the hardware supports fewer patch vertices than requested
 
    };
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <string>
 
 #include "AftrOpenGLIncludes.h"
@@ -25,6 +26,9 @@ namespace Aftr {
         GLuint geometryMaxOutputVerts = 3;
         // properties specific to tessellation shaders
         GLuint tessellationMaxVerticesPerPatch = 3;
+        // preprocessor definitions (name, value) inserted after the #version line of every stage, so
+        // one set of sources can be compiled into specialized variants; each set is a distinct program
+        std::map<std::string, std::string> defines;
     };
 }
 
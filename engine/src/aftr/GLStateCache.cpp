@@ -0,0 +1,121 @@
+#include "GLStateCache.h"
+using namespace Aftr;
+
+GLuint GLStateCache::program = 0;
+bool GLStateCache::programKnown = false;
+GLuint GLStateCache::activeUnit = 0;
+bool GLStateCache::activeUnitKnown = false;
+GLenum GLStateCache::textureTargets[GLStateCache::MAX_TEXTURE_UNITS] = {};
+GLuint GLStateCache::textures[GLStateCache::MAX_TEXTURE_UNITS] = {};
+bool GLStateCache::texturesKnown[GLStateCache::MAX_TEXTURE_UNITS] = {};
+GLint GLStateCache::patchVerts = 0;
+bool GLStateCache::patchVertsKnown = false;
+GLfloat GLStateCache::lineW = 1.0f;
+bool GLStateCache::lineWKnown = false;
+
+unsigned int GLStateCache::numCalls = 0;
+unsigned int GLStateCache::numSkippedCalls = 0;
+unsigned int GLStateCache::numErrorChecks = 0;
+unsigned int GLStateCache::numCallsLastFrame = 0;
+unsigned int GLStateCache::numSkippedCallsLastFrame = 0;
+unsigned int GLStateCache::numErrorChecksLastFrame = 0;
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if (GLStateCache::programKnown && GLStateCache::program == program) {
+        ++GLStateCache::numSkippedCalls;
+        return;
+    }
+
+    glUseProgram(program);
+    GLStateCache::program = program;
+    GLStateCache::programKnown = true;
+    ++GLStateCache::numCalls;
+}
+
+void GLStateCache::activeTexture(GLuint unit)
+{
+    if (GLStateCache::activeUnitKnown && GLStateCache::activeUnit == unit) {
+        ++GLStateCache::numSkippedCalls;
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + unit);
+    GLStateCache::activeUnit = unit;
+    GLStateCache::activeUnitKnown = true;
+    ++GLStateCache::numCalls;
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    //units past the end are passed straight through and never skipped
+    bool tracked = unit < MAX_TEXTURE_UNITS;
+    if (tracked && GLStateCache::texturesKnown[unit] && GLStateCache::textures[unit] == texture && GLStateCache::textureTargets[unit] == target) {
+        ++GLStateCache::numSkippedCalls;
+        return;
+    }
+
+    GLStateCache::activeTexture(unit);
+    glBindTexture(target, texture);
+    ++GLStateCache::numCalls;
+    if (tracked) {
+        //a unit holds one texture per target, only the last one bound is remembered
+        GLStateCache::textureTargets[unit] = target;
+        GLStateCache::textures[unit] = texture;
+        GLStateCache::texturesKnown[unit] = true;
+    }
+}
+
+void GLStateCache::patchVertices(GLint vertices)
+{
+    if (GLStateCache::patchVertsKnown && GLStateCache::patchVerts == vertices) {
+        ++GLStateCache::numSkippedCalls;
+        return;
+    }
+
+    glPatchParameteri(GL_PATCH_VERTICES, vertices);
+    GLStateCache::patchVerts = vertices;
+    GLStateCache::patchVertsKnown = true;
+    ++GLStateCache::numCalls;
+}
+
+void GLStateCache::lineWidth(GLfloat width)
+{
+    if (GLStateCache::lineWKnown && GLStateCache::lineW == width) {
+        ++GLStateCache::numSkippedCalls;
+        return;
+    }
+
+    glLineWidth(width);
+    GLStateCache::lineW = width;
+    GLStateCache::lineWKnown = true;
+    ++GLStateCache::numCalls;
+}
+
+void GLStateCache::invalidate()
+{
+    GLStateCache::programKnown = false;
+    GLStateCache::invalidateTextures();
+    GLStateCache::patchVertsKnown = false;
+    GLStateCache::lineWKnown = false;
+}
+
+void GLStateCache::invalidateTextures()
+{
+    GLStateCache::activeUnitKnown = false;
+    for (bool& known : GLStateCache::texturesKnown)
+        known = false;
+}
+
+void GLStateCache::beginFrame()
+{
+    //the GUI, text and Texture::bind change state behind the cache's back, so no frame trusts the last one's state
+    GLStateCache::invalidate();
+
+    GLStateCache::numCallsLastFrame = GLStateCache::numCalls;
+    GLStateCache::numSkippedCallsLastFrame = GLStateCache::numSkippedCalls;
+    GLStateCache::numErrorChecksLastFrame = GLStateCache::numErrorChecks;
+    GLStateCache::numCalls = 0;
+    GLStateCache::numSkippedCalls = 0;
+    GLStateCache::numErrorChecks = 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+/**
+   AFTR_GL_ERROR_CHECKS selects whether AFTR_GL_CHECK calls printOpenGLErrors. Each check is a glGetError
+   round trip, which stalls the pipeline on many drivers, so checks default to on only in debug builds.
+   Define AFTR_GL_ERROR_CHECKS to 0 or 1 (e.g. with -DAFTR_GL_ERROR_CHECKS=1) to override that.
+*/
+#ifndef AFTR_GL_ERROR_CHECKS
+   #ifdef NDEBUG
+      #define AFTR_GL_ERROR_CHECKS 0
+   #else
+      #define AFTR_GL_ERROR_CHECKS 1
+   #endif
+#endif
+
+#if AFTR_GL_ERROR_CHECKS
+   #define AFTR_GL_CHECK( errCode ) do { Aftr::GLStateCache::countErrorCheck(); printOpenGLErrors( errCode, nullptr, AFTR_FILE_LINE_STR ); } while( 0 )
+#else
+   #define AFTR_GL_CHECK( errCode ) do {} while( 0 )
+#endif
+
+namespace Aftr
+{
+
+/**
+   Remembers the OpenGL state set through it and skips calls that would not change anything: the
+   current program, the active texture unit, the texture bound to each unit, GL_PATCH_VERTICES and
+   the line width. ManagerShader::bindShader binds programs through this cache; the texture, patch and
+   line width state is only set through it by the Earth module's own draws. ModelMeshSkin,
+   Texture::bind and unbind, the GUI and text objects and other engine code call glBindTexture,
+   glActiveTexture, glPatchParameteri, glLineWidth and glUseProgram directly.
+
+   The cache only knows about changes made through it, so beginFrame forgets everything and the cache
+   only skips calls made redundant earlier in the same frame. Code that changes any of this state
+   directly during a frame, or draws a ModelMeshSkin (which binds and unbinds its textures directly),
+   or deletes a texture or program that may still be bound (GL silently unbinds it and may hand its
+   name out again), must call invalidate() (or the matching invalidate method) afterwards, or a later
+   call may be skipped wrongly. By convention texture unit 0 is active outside of code that binds
+   textures.
+
+   Every call made and skipped is counted; beginFrame moves the counts into the LastFrame getters so
+   the reduction can be reported.
+*/
+class GLStateCache
+{
+public:
+   static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+   /// glUseProgram, unless program is already current.
+   static void useProgram( GLuint program );
+   static GLuint getProgram() { return program; }
+
+   /// glActiveTexture( GL_TEXTURE0 + unit ), unless unit is already active.
+   static void activeTexture( GLuint unit );
+
+   /// Makes unit active and binds texture to target on it, unless it is already bound there.
+   static void bindTexture( GLuint unit, GLenum target, GLuint texture );
+
+   /// glPatchParameteri( GL_PATCH_VERTICES, vertices ), unless it is already set.
+   static void patchVertices( GLint vertices );
+
+   /// glLineWidth, unless width is already set.
+   static void lineWidth( GLfloat width );
+
+   /// Forgets everything, the next call of each kind is always made.
+   static void invalidate();
+   static void invalidateProgram() { programKnown = false; }
+   static void invalidateTextures();
+
+   /// Counts a glGetError round trip made by AFTR_GL_CHECK.
+   static void countErrorCheck() { ++numErrorChecks; }
+
+   /// Starts counting a new frame and forgets all state (see invalidate). Call once per frame before rendering.
+   static void beginFrame();
+
+   /// Returns the number of state changing GL calls made through the cache in the last frame.
+   static unsigned int getNumCallsLastFrame() { return numCallsLastFrame; }
+   /// Returns the number of redundant GL calls the cache skipped in the last frame.
+   static unsigned int getNumSkippedCallsLastFrame() { return numSkippedCallsLastFrame; }
+   /// Returns the number of glGetError round trips AFTR_GL_CHECK made in the last frame (0 in release builds).
+   static unsigned int getNumErrorChecksLastFrame() { return numErrorChecksLastFrame; }
+
+protected:
+   static GLuint program;
+   static bool programKnown;
+   static GLuint activeUnit;
+   static bool activeUnitKnown;
+   static GLenum textureTargets[MAX_TEXTURE_UNITS];
+   static GLuint textures[MAX_TEXTURE_UNITS];
+   static bool texturesKnown[MAX_TEXTURE_UNITS];
+   static GLint patchVerts;
+   static bool patchVertsKnown;
+   static GLfloat lineW;
+   static bool lineWKnown;
+
+   static unsigned int numCalls;
+   static unsigned int numSkippedCalls;
+   static unsigned int numErrorChecks;
+   static unsigned int numCallsLastFrame;
+   static unsigned int numSkippedCallsLastFrame;
+   static unsigned int numErrorChecksLastFrame;
+};
+
+} //namespace Aftr
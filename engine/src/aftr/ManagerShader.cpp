@@ -11,14 +11,28 @@
 #include "GLSLShaderDescriptor.h"
 #include "GLSLShaderPointTesselatorBillboard.h"
 #include "GLSLUniform.h"
+#include "GLStateCache.h"
 #include "ManagerEnvironmentConfiguration.h"
 #include "ManagerOpenGLState.h"
 #include "Mat4.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
 #include <vector>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 using namespace Aftr;
 
-GLuint ManagerShader::currentlyBoundShaderHandle = 0;
+// identifies a program binary cache file ("APB1")
+const static uint32_t PROGRAM_BINARY_MAGIC = 0x31425041;
+
+// how often shader sources are checked for changes where inotify is not available
+const static double HOT_RELOAD_POLL_INTERVAL_MS = 250.0;
+
 GLSLShaderDefaultGL32* ManagerShader::DEFAULT_SHADER = nullptr;
 GLSLShaderDefaultSelectionGL32* ManagerShader::DEFAULT_SELECTION_SHADER = nullptr;
 GLSLShaderDefaultBoundingBoxLinesGL32* ManagerShader::DEFAULT_BOUNDING_BOX_LINES = nullptr;
@@ -28,7 +42,22 @@ GLSLShaderDefaultOrthoStencilGL32* ManagerShader::DEFAULT_ORTHO_STENCIL_SHADER =
 
 std::vector<GLSLShader*> ManagerShader::defaultShadersLoadedByManagerAtInit;
 
-std::set<GLSLShaderDataShared*, ShaderSetCompare> ManagerShader::shaders;
+ShaderSet ManagerShader::shaders;
+uint64_t ManagerShader::shaderSetGeneration = 0;
+
+std::string ManagerShader::programBinaryCacheDirectory;
+std::string ManagerShader::driverString;
+double ManagerShader::shaderCreationTimeMs = 0;
+unsigned int ManagerShader::numProgramBinaryCacheHits = 0;
+bool ManagerShader::parallelShaderCompile = false;
+
+bool ManagerShader::hotReloadEnabled = false;
+int ManagerShader::hotReloadInotifyFd = -1;
+uint64_t ManagerShader::hotReloadWatchedGeneration = 0;
+std::map<std::string, std::filesystem::file_time_type> ManagerShader::hotReloadFiles;
+std::map<int, std::string> ManagerShader::hotReloadDirectories;
+std::vector<std::pair<GLSLShaderDataShared*, GLSLShaderDataShared*>> ManagerShader::hotReloads;
+std::chrono::steady_clock::time_point ManagerShader::hotReloadLastPoll;
 
 std::string ManagerShader::toString()
 {
@@ -36,7 +65,7 @@ std::string ManagerShader::toString()
     ss << "ManagerShader:\n";
     ss << ManagerShader::queryShaderSupport() << "\n";
     int i = 0;
-    for (std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.begin(); it != ManagerShader::shaders.end(); it++) {
+    for (ShaderSet::iterator it = ManagerShader::shaders.begin(); it != ManagerShader::shaders.end(); it++) {
         GLSLShaderDataShared* shader = (*it);
         ss << "   [" << i << "]: " << shader->toString() << "\n";
         ++i;
@@ -48,9 +77,21 @@ std::string ManagerShader::toString()
 void ManagerShader::init()
 {
     ManagerShader::shutdown();
+    ManagerShader::initProgramBinaryCache();
+    ManagerShader::initHotReload();
+
+    // Let the driver compile and link on as many threads as it likes. Only the extension guarantees that
+    // GL_COMPLETION_STATUS can be queried, a loaded entry point alone doesn't (GLEW may resolve it regardless).
+    ManagerShader::parallelShaderCompile = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
 
     if (ManagerOpenGLState::isGLContextProfileVersion32orGreater()) {
         ManagerShader::loadGL32DefaultShaders();
+        std::cout << "Created " << ManagerShader::shaders.size() << " default shader programs in " << ManagerShader::shaderCreationTimeMs << " ms ("
+                  << ManagerShader::numProgramBinaryCacheHits << " from the program binary cache)...\n";
     } else {
         //std::string vert = ManagerEnvironmentConfiguration::getSMM() + "shaders/oneLightOverTexture.vert";
         //std::string frag = ManagerEnvironmentConfiguration::getSMM() + "shaders/oneLightOverTexture.frag";
@@ -82,12 +123,15 @@ void ManagerShader::shutdown()
         delete (*it);
     ManagerShader::defaultShadersLoadedByManagerAtInit.clear();
 
-    std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.begin();
+    ManagerShader::shutdownHotReload();
+
+    ShaderSet::iterator it = ManagerShader::shaders.begin();
     while (ManagerShader::shaders.size() > 0) {
         it = ManagerShader::shaders.begin();
         //std::cout << "Erasing GLSLShaderDataShared " << (*it)->toString() << "\n";
         delete (*it);
         ManagerShader::shaders.erase(it);
+        ++ManagerShader::shaderSetGeneration;
     }
 }
 
@@ -101,10 +145,11 @@ GLSLShader* ManagerShader::loadComputeShader(const std::string& computeShader)
     GLSLShaderDataShared* shader = new GLSLShaderDataShared("", "", "", GL_TRIANGLES, GL_TRIANGLE_STRIP, 3,
         computeShader);
 
-    std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.find(shader);
+    ShaderSet::iterator it = ManagerShader::shaders.find(shader);
     if (it == ManagerShader::shaders.end()) {
         if (ManagerShader::instantiateOpenGLShader(shader)) {
             ManagerShader::shaders.insert(shader); //store in set
+            ++ManagerShader::shaderSetGeneration;
             return new GLSLShader(shader);
         } else {
             delete shader;
@@ -114,7 +159,8 @@ GLSLShader* ManagerShader::loadComputeShader(const std::string& computeShader)
     } else {
         delete shader;
         shader = nullptr; //if the shader was already found, use the original and delete the new one
-        return new GLSLShader((*it)); //return pointer to already loaded texture
+        shader = ManagerShader::collectPendingShader(it);
+        return shader != nullptr ? new GLSLShader(shader) : nullptr; //return pointer to already loaded texture
     }
 }
 
@@ -151,10 +197,11 @@ GLSLShaderDataShared* ManagerShader::loadShaderDataShared(const std::string& ver
     GLSLShaderDataShared* shader = new GLSLShaderDataShared(vertexShader, fragmentShader, geometryShader,
         geometryInputPrimitiveType, geometryOutputPrimitiveType, geometryMaxOutputVerts, "");
 
-    std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.find(shader);
+    ShaderSet::iterator it = ManagerShader::shaders.find(shader);
     if (it == ManagerShader::shaders.end()) {
         if (ManagerShader::instantiateOpenGLShader(shader)) {
             ManagerShader::shaders.insert(shader); //store in set
+            ++ManagerShader::shaderSetGeneration;
             return shader;
         } else {
             delete shader;
@@ -163,7 +210,7 @@ GLSLShaderDataShared* ManagerShader::loadShaderDataShared(const std::string& ver
         }
     } else {
         delete shader; //if the shader was already found, use the original and delete the new one
-        return *it; //return pointer to already loaded texture
+        return ManagerShader::collectPendingShader(it); //return pointer to already loaded texture
     }
 }
 
@@ -197,10 +244,11 @@ GLSLShaderDataShared* ManagerShader::loadShaderDataShared(const GLSLShaderDescri
 
     GLSLShaderDataShared* shader = new GLSLShaderDataShared(desc);
 
-    std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.find(shader);
+    ShaderSet::iterator it = ManagerShader::shaders.find(shader);
     if (it == ManagerShader::shaders.end()) {
         if (ManagerShader::instantiateOpenGLShader(shader)) {
             ManagerShader::shaders.insert(shader); //store in set
+            ++ManagerShader::shaderSetGeneration;
             return shader;
         } else {
             delete shader;
@@ -209,10 +257,36 @@ GLSLShaderDataShared* ManagerShader::loadShaderDataShared(const GLSLShaderDescri
         }
     } else {
         delete shader; //if the shader was already found, use the original and delete the new one
-        return *it; //return pointer to already loaded texture
+        return ManagerShader::collectPendingShader(it); //return pointer to already loaded texture
     }
 }
 
+void ManagerShader::loadShaderDataSharedAsync(const std::vector<GLSLShaderDescriptor>& descs)
+{
+    if (glCreateShader == nullptr)
+        return;
+
+    unsigned int numSubmitted = 0;
+    for (const GLSLShaderDescriptor& desc : descs) {
+        GLSLShaderDataShared* shader = new GLSLShaderDataShared(desc);
+        if (ManagerShader::shaders.find(shader) != ManagerShader::shaders.end()) {
+            delete shader; //already loaded or already compiling
+            continue;
+        }
+
+        if (ManagerShader::beginInstantiateOpenGLShader(shader)) {
+            ManagerShader::shaders.insert(shader); //store in set, loadShaderDataShared collects it
+            ++ManagerShader::shaderSetGeneration;
+            if (shader->isInstantiationPending())
+                ++numSubmitted;
+        } else
+            delete shader;
+    }
+
+    std::cout << "Submitted " << numSubmitted << " shader programs for "
+              << (ManagerShader::parallelShaderCompile ? "parallel" : "deferred") << " compilation...\n";
+}
+
 GLSLShader* ManagerShader::loadShader(const std::string& vertexShader, const std::string& fragmentShader,
     std::string geometryShader, GLenum geometryInputPrimitiveType,
     GLenum geometryOutputPrimitiveType, GLuint geometryMaxOutputVerts)
@@ -227,16 +301,348 @@ GLSLShader* ManagerShader::loadShader(const GLSLShaderDescriptor& desc)
 
 bool ManagerShader::instantiateOpenGLShader(Aftr::GLSLShaderDataShared* shader)
 {
-    return shader->instantiate();
+    auto start = std::chrono::steady_clock::now();
+    bool success = shader->instantiate();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ManagerShader::shaderCreationTimeMs += ms;
+    if (shader->isLoadedFromProgramBinary())
+        ManagerShader::numProgramBinaryCacheHits++;
+
+    std::cout << (shader->isLoadedFromProgramBinary() ? "Loaded cached" : "Compiled") << " shader program " << shader->getShaderHandle()
+              << " in " << ms << " ms (" << ManagerShader::shaderCreationTimeMs << " ms spent on shader programs so far)...\n";
+    return success;
+}
+
+bool ManagerShader::beginInstantiateOpenGLShader(GLSLShaderDataShared* shader)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool success = shader->beginInstantiate();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ManagerShader::shaderCreationTimeMs += ms;
+    if (shader->isLoadedFromProgramBinary())
+        ManagerShader::numProgramBinaryCacheHits++;
+
+    std::cout << (shader->isLoadedFromProgramBinary() ? "Loaded cached" : "Submitted") << " shader program " << shader->getShaderHandle()
+              << " in " << ms << " ms (" << ManagerShader::shaderCreationTimeMs << " ms spent on shader programs so far)...\n";
+    return success;
+}
+
+GLSLShaderDataShared* ManagerShader::collectPendingShader(ShaderSet::iterator it)
+{
+    GLSLShaderDataShared* shader = *it;
+    if (!shader->isInstantiationPending())
+        return shader;
+
+    bool complete = shader->isInstantiationComplete();
+    auto start = std::chrono::steady_clock::now();
+    bool success = shader->finishInstantiate();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ManagerShader::shaderCreationTimeMs += ms;
+    std::cout << "Collected shader program " << shader->getShaderHandle() << " in " << ms << " ms"
+              << (complete ? "" : " (still compiling, had to wait)") << "...\n";
+
+    if (!success) {
+        ManagerShader::shaders.erase(it);
+        ++ManagerShader::shaderSetGeneration;
+        delete shader;
+        return nullptr;
+    }
+    return shader;
+}
+
+void ManagerShader::initProgramBinaryCache()
+{
+    ManagerShader::shaderCreationTimeMs = 0;
+    ManagerShader::numProgramBinaryCacheHits = 0;
+    ManagerShader::programBinaryCacheDirectory = "";
+
+    const GLubyte* vendor = glGetString(GL_VENDOR);
+    const GLubyte* renderer = glGetString(GL_RENDERER);
+    const GLubyte* version = glGetString(GL_VERSION);
+    std::stringstream ss;
+    ss << (vendor != nullptr ? (const char*)vendor : "") << "|" << (renderer != nullptr ? (const char*)renderer : "") << "|"
+       << (version != nullptr ? (const char*)version : "");
+    ManagerShader::driverString = ss.str();
+
+    std::string dir = ManagerEnvironmentConfiguration::getVariableValue("shaderprogramcache");
+    if (dir == "0" || dir == "false")
+        return;
+
+    GLint numFormats = 0;
+    if (glGetProgramBinary != nullptr && glProgramBinary != nullptr)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats <= 0) {
+        std::cout << "Driver supports no program binary formats, shader programs will always be compiled from source...\n";
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::path path = dir.empty() ? std::filesystem::temp_directory_path(ec) / "aftr_program_cache" : std::filesystem::path(dir);
+    std::filesystem::create_directories(path, ec);
+    if (ec) {
+        std::cout << "WARNING: Unable to create the shader program cache directory '" << path.string() << "': " << ec.message() << "...\n";
+        return;
+    }
+    ManagerShader::programBinaryCacheDirectory = path.string();
+}
+
+std::string ManagerShader::getProgramBinaryPath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return (std::filesystem::path(ManagerShader::programBinaryCacheDirectory) / name).string();
+}
+
+bool ManagerShader::loadProgramBinary(uint64_t key, GLuint program)
+{
+    if (ManagerShader::programBinaryCacheDirectory.empty())
+        return false;
+
+    std::ifstream fin(ManagerShader::getProgramBinaryPath(key), std::ios::binary);
+    if (!fin)
+        return false;
+
+    // header: magic, key, binary format, binary length
+    uint32_t magic = 0;
+    uint64_t storedKey = 0;
+    uint32_t format = 0;
+    uint32_t length = 0;
+    fin.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    fin.read(reinterpret_cast<char*>(&storedKey), sizeof(storedKey));
+    fin.read(reinterpret_cast<char*>(&format), sizeof(format));
+    fin.read(reinterpret_cast<char*>(&length), sizeof(length));
+    if (!fin || magic != PROGRAM_BINARY_MAGIC || storedKey != key || length == 0)
+        return false;
+
+    std::vector<char> binary(length);
+    fin.read(binary.data(), length);
+    if (!fin)
+        return false;
+
+    // the driver may still reject a binary it produced itself (after an update, for example)
+    glProgramBinary(program, format, binary.data(), length);
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    return status != 0;
+}
+
+void ManagerShader::storeProgramBinary(uint64_t key, GLuint program)
+{
+    if (ManagerShader::programBinaryCacheDirectory.empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    // write to a temporary file first so a crash never leaves a truncated binary behind
+    std::string path = ManagerShader::getProgramBinaryPath(key);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream fout(tempPath, std::ios::binary | std::ios::trunc);
+        uint32_t magic = PROGRAM_BINARY_MAGIC;
+        uint32_t storedFormat = format;
+        uint32_t storedLength = static_cast<uint32_t>(length);
+        fout.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        fout.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        fout.write(reinterpret_cast<const char*>(&storedFormat), sizeof(storedFormat));
+        fout.write(reinterpret_cast<const char*>(&storedLength), sizeof(storedLength));
+        fout.write(binary.data(), length);
+        if (!fout) {
+            std::cout << "WARNING: Unable to write the shader program cache file '" << tempPath << "'...\n";
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tempPath, path, ec);
+    if (ec)
+        std::filesystem::remove(tempPath, ec);
+}
+
+void ManagerShader::initHotReload()
+{
+    std::string value = ManagerEnvironmentConfiguration::getVariableValue("shaderhotreload");
+    ManagerShader::hotReloadEnabled = value == "1" || value == "true";
+    if (!ManagerShader::hotReloadEnabled)
+        return;
+
+#ifdef __linux__
+    ManagerShader::hotReloadInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ManagerShader::hotReloadInotifyFd < 0)
+        std::cout << "WARNING: inotify is unavailable, polling shader sources for changes instead...\n";
+#endif
+    ManagerShader::hotReloadLastPoll = std::chrono::steady_clock::now();
+    std::cout << "Shader hot reload is enabled, changed shader sources are recompiled while running...\n";
+}
+
+void ManagerShader::shutdownHotReload()
+{
+    for (auto& reload : ManagerShader::hotReloads)
+        delete reload.second;
+    ManagerShader::hotReloads.clear();
+    ManagerShader::hotReloadFiles.clear();
+    ManagerShader::hotReloadDirectories.clear();
+    ManagerShader::hotReloadWatchedGeneration = 0;
+
+#ifdef __linux__
+    if (ManagerShader::hotReloadInotifyFd >= 0)
+        close(ManagerShader::hotReloadInotifyFd);
+#endif
+    ManagerShader::hotReloadInotifyFd = -1;
+    ManagerShader::hotReloadEnabled = false;
+}
+
+std::string ManagerShader::getHotReloadPath(const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::path p = std::filesystem::weakly_canonical(std::filesystem::path(path), ec);
+    return ec ? path : p.string();
+}
+
+void ManagerShader::watchShaderSources()
+{
+    for (GLSLShaderDataShared* shader : ManagerShader::shaders) {
+        // every stage and everything the stages #include
+        for (const std::string& sourcePath : shader->getSourceFiles()) {
+            std::string path = ManagerShader::getHotReloadPath(sourcePath);
+            if (ManagerShader::hotReloadFiles.count(path) > 0)
+                continue;
+
+            std::error_code ec;
+            ManagerShader::hotReloadFiles[path] = std::filesystem::last_write_time(path, ec);
+
+#ifdef __linux__
+            // watch the directory rather than the file, editors often save by replacing the file
+            std::string dir = std::filesystem::path(path).parent_path().string();
+            if (ManagerShader::hotReloadInotifyFd >= 0) {
+                int wd = inotify_add_watch(ManagerShader::hotReloadInotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+                if (wd >= 0)
+                    ManagerShader::hotReloadDirectories[wd] = dir;
+            }
+#endif
+        }
+    }
+    ManagerShader::hotReloadWatchedGeneration = ManagerShader::shaderSetGeneration;
+}
+
+void ManagerShader::updateHotReload()
+{
+    if (!ManagerShader::hotReloadEnabled)
+        return;
+
+    // start watching the sources of programs loaded since the last update (the size alone misses an erase followed by an insert)
+    if (ManagerShader::shaderSetGeneration != ManagerShader::hotReloadWatchedGeneration)
+        ManagerShader::watchShaderSources();
+
+    std::set<std::string> changed;
+#ifdef __linux__
+    if (ManagerShader::hotReloadInotifyFd >= 0) {
+        alignas(inotify_event) char buf[4096];
+        ssize_t len;
+        while ((len = read(ManagerShader::hotReloadInotifyFd, buf, sizeof(buf))) > 0) {
+            for (char* ptr = buf; ptr < buf + len;) {
+                const inotify_event* e = reinterpret_cast<const inotify_event*>(ptr);
+                auto dir = ManagerShader::hotReloadDirectories.find(e->wd);
+                if (dir != ManagerShader::hotReloadDirectories.end() && e->len > 0) {
+                    std::string path = (std::filesystem::path(dir->second) / e->name).string();
+                    if (ManagerShader::hotReloadFiles.count(path) > 0)
+                        changed.insert(path);
+                }
+                ptr += sizeof(inotify_event) + e->len;
+            }
+        }
+    } else
+#endif
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double, std::milli>(now - ManagerShader::hotReloadLastPoll).count() >= HOT_RELOAD_POLL_INTERVAL_MS) {
+            ManagerShader::hotReloadLastPoll = now;
+            for (auto& file : ManagerShader::hotReloadFiles) {
+                std::error_code ec;
+                std::filesystem::file_time_type time = std::filesystem::last_write_time(file.first, ec);
+                if (!ec && time != file.second) {
+                    file.second = time;
+                    changed.insert(file.first);
+                }
+            }
+        }
+    }
+
+    // submit every program using a changed source for compilation into a replacement program
+    if (!changed.empty()) {
+        for (GLSLShaderDataShared* shader : ManagerShader::shaders) {
+            if (shader->isInstantiationPending())
+                continue;
+
+            bool reloading = false;
+            for (auto& reload : ManagerShader::hotReloads)
+                reloading |= reload.first == shader;
+            if (reloading)
+                continue;
+
+            bool uses = false;
+            for (const std::string& path : shader->getSourceFiles())
+                uses |= changed.count(ManagerShader::getHotReloadPath(path)) > 0;
+            if (!uses)
+                continue;
+
+            GLSLShaderDataShared* replacement = new GLSLShaderDataShared(shader->getDescriptor());
+            if (replacement->beginInstantiate(false)) { // a GLSL error only logs, the old program stays in use
+                std::cout << "Recompiling shader program " << shader->getShaderHandle() << "...\n";
+                ManagerShader::hotReloads.push_back(std::make_pair(shader, replacement));
+            } else {
+                std::cout << "WARNING: Failed to reload shader program " << shader->getShaderHandle() << ", keeping the old one...\n";
+                delete replacement;
+            }
+        }
+    }
+
+    // swap finished replacements in, every GLSLShader using the program picks it up on its next bind
+    bool reloaded = false;
+    for (size_t i = 0; i < ManagerShader::hotReloads.size();) {
+        GLSLShaderDataShared* shader = ManagerShader::hotReloads[i].first;
+        GLSLShaderDataShared* replacement = ManagerShader::hotReloads[i].second;
+        if (!replacement->isInstantiationComplete()) {
+            ++i;
+            continue;
+        }
+
+        if (replacement->finishInstantiate()) {
+            GLuint oldHandle = shader->getShaderHandle();
+            shader->swapProgram(*replacement);
+            if (ManagerShader::getCurrentlyBoundShader() == oldHandle)
+                ManagerShader::bindShader(0);
+            std::cout << "Reloaded shader program " << oldHandle << " as " << shader->getShaderHandle() << "...\n";
+            reloaded = true;
+        } else
+            std::cout << "WARNING: Failed to reload shader program " << shader->getShaderHandle() << ", keeping the old one...\n";
+
+        delete replacement; //holds the old program after a swap
+        ManagerShader::hotReloads.erase(ManagerShader::hotReloads.begin() + i);
+    }
+
+    // an edit may have added an #include
+    if (reloaded)
+        ManagerShader::watchShaderSources();
 }
 
 void ManagerShader::bindShader(GLuint shaderHandle)
 {
-    if (currentlyBoundShaderHandle == shaderHandle)
-        return; //the desired shader is already bound, no need to call glUseProgram again
+    GLStateCache::useProgram(shaderHandle); //skips glUseProgram if the desired shader is already bound
+}
 
-    glUseProgram(shaderHandle);
-    currentlyBoundShaderHandle = shaderHandle;
+GLuint ManagerShader::getCurrentlyBoundShader()
+{
+    return GLStateCache::getProgram();
 }
 
 std::string ManagerShader::queryShaderSupport()
@@ -376,15 +782,34 @@ void ManagerShader::loadShaderDefaultOrthoStencilGL32()
 
 bool ManagerShader::deletePreviouslyLoadedShaderFromCachedSet(GLSLShaderDataShared* shader)
 {
-    std::set<GLSLShaderDataShared*, ShaderSetCompare>::iterator it = ManagerShader::shaders.find(shader);
+    ShaderSet::iterator it = ManagerShader::shaders.find(shader);
     if (it == ManagerShader::shaders.end()) {
         std::cout << AFTR_FILE_LINE_STR << ": Shader Data Shared not loaded in ManagerShader... " << shader->toString() << "\n";
         return false;
     } else {
         GLSLShaderDataShared* ptr = *it;
         ManagerShader::shaders.erase(it);
+        ++ManagerShader::shaderSetGeneration;
         delete ptr;
         ptr = nullptr;
         return true;
     }
 }
+
+bool ManagerShader::registerShaderDataShared(GLSLShaderDataShared* shader)
+{
+    if (!ManagerShader::shaders.insert(shader).second)
+        return false;
+    ++ManagerShader::shaderSetGeneration;
+    return true;
+}
+
+bool ManagerShader::unregisterShaderDataShared(GLSLShaderDataShared* shader)
+{
+    ShaderSet::iterator it = ManagerShader::shaders.find(shader);
+    if (it == ManagerShader::shaders.end() || *it != shader)
+        return false;
+    ManagerShader::shaders.erase(it);
+    ++ManagerShader::shaderSetGeneration;
+    return true;
+}
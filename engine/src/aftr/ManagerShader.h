@@ -1,8 +1,15 @@
 #pragma once
 
 #include "GLSLShaderDataShared.h"
-#include <string>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
 #include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace Aftr
 {
@@ -16,12 +23,22 @@ namespace Aftr
    class GLSLShaderDefaultIndexedGeometryLinesGL32;
    class GLSLShaderDefaultOrthoStencilGL32;
 
-   struct ShaderSetCompare
+   /// Hashes a GLSLShaderDataShared* by its precomputed descriptor hash, so lookups never touch the paths.
+   struct ShaderSetHash
+   {
+      size_t operator() ( const GLSLShaderDataShared* shader ) const
+      { return static_cast< size_t >( shader->getDescriptorHash() ); }
+   };
+
+   /// Two GLSLShaderDataShared* are equal iff they describe the same program (compares the paths only on a hash match).
+   struct ShaderSetEqual
    {
       bool operator() ( const GLSLShaderDataShared* lhs, const GLSLShaderDataShared* rhs ) const
-      { return ( (*lhs) < (*rhs) ); }
+      { return ( (*lhs) == (*rhs) ); }
    };
 
+   using ShaderSet = std::unordered_set< GLSLShaderDataShared*, ShaderSetHash, ShaderSetEqual >;
+
 
 class ManagerShader
 {
@@ -84,6 +101,18 @@ public:
    */
    static GLSLShaderDataShared* loadShaderDataShared(const GLSLShaderDescriptor& desc);
 
+   /**
+      Submits every stage of every described program for compilation, and the programs for linking, without
+      waiting on any of them. With GL_KHR_parallel_shader_compile the driver does this work on its own threads,
+      otherwise it is typically deferred until a result is first queried. Programs already loaded (or
+      already submitted) are skipped.
+
+      The programs are collected by loadShaderDataShared (or GLSLShader::New) with the same descriptor, which
+      only blocks if the driver is not done yet. Call this as early as possible and keep loading other
+      resources before asking for the programs.
+   */
+   static void loadShaderDataSharedAsync( const std::vector< GLSLShaderDescriptor >& descs );
+
    static GLSLShader* loadComputeShader( const std::string& computeShader );
 
    static GLSLShader* loadShaderCrazyBump();
@@ -93,7 +122,7 @@ public:
 
    static void bindShader( GLuint shaderHandle );
 
-   static GLuint getCurrentlyBoundShader() { return currentlyBoundShaderHandle; }
+   static GLuint getCurrentlyBoundShader();
 
    static std::string queryShaderSupport();
 
@@ -117,6 +146,69 @@ public:
 
    static bool deletePreviouslyLoadedShaderFromCachedSet( GLSLShaderDataShared* shader );
 
+   /**
+      Adds shader to the set of loaded shaders, which then owns it. Returns false (and leaves shader alone) if a
+      shader describing the same program is already loaded.
+   */
+   static bool registerShaderDataShared( GLSLShaderDataShared* shader );
+
+   /**
+      Removes shader from the set of loaded shaders without deleting it; the caller owns it afterwards. Returns
+      false if shader itself (not just an equal shader) is not in the set.
+   */
+   static bool unregisterShaderDataShared( GLSLShaderDataShared* shader );
+
+   /**
+      Returns the directory linked program binaries are cached in, or "" if the cache is disabled.
+      The directory is set by the "shaderprogramcache" variable in aftr.conf ("0" disables the cache)
+      and defaults to "aftr_program_cache" in the system's temporary directory. The cache is also
+      disabled when the driver does not support any program binary formats.
+   */
+   static std::string getProgramBinaryCacheDirectory() { return programBinaryCacheDirectory; }
+
+   /**
+      Returns a string identifying the driver (vendor, renderer and version). Program binaries are
+      only valid for the driver that produced them, so this is part of every program binary key.
+   */
+   static std::string getDriverString() { return driverString; }
+
+   /**
+      Loads the program binary cached under key into program (a program object without any shaders
+      attached). Returns true iff a binary was found and the driver accepted it; otherwise, the
+      program should be compiled from source as usual.
+   */
+   static bool loadProgramBinary( uint64_t key, GLuint program );
+
+   /**
+      Caches the binary of the linked program under key. The program should have been linked with
+      GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+   */
+   static void storeProgramBinary( uint64_t key, GLuint program );
+
+   /// Returns the total time in milliseconds spent compiling, linking or loading shader programs since init.
+   static double getShaderCreationTimeMs() { return shaderCreationTimeMs; }
+
+   /// Returns the number of shader programs loaded from the program binary cache since init.
+   static unsigned int getNumProgramBinaryCacheHits() { return numProgramBinaryCacheHits; }
+
+   /// Returns true iff the driver supports GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile, so pending programs can be polled.
+   static bool isParallelShaderCompileSupported() { return parallelShaderCompile; }
+
+   /**
+      Returns true iff the source files of loaded programs are watched for changes. Set by the "shaderhotreload"
+      variable in aftr.conf (off by default).
+   */
+   static bool isHotReloadEnabled() { return hotReloadEnabled; }
+
+   /**
+      Call once per frame (from updateWorld). When hot reload is enabled, every program with a source file that
+      changed on disk (inotify on Linux, polling elsewhere) is recompiled into a replacement program in the
+      background. Once the replacement is linked, it is swapped into the existing GLSLShaderDataShared, so
+      every GLSLShader using it picks it up on its next bind. A replacement that fails to compile or link is
+      discarded and the old program stays in use.
+   */
+   static void updateHotReload();
+
 protected:
 
    static void loadGL32DefaultShaders(); ///< Loads shaders expecting GL 3.2 or greater to exist in the current context
@@ -133,6 +225,15 @@ protected:
    */
    static bool instantiateOpenGLShader( GLSLShaderDataShared* shader = NULL );
 
+   /// Same as instantiateOpenGLShader, but only submits the work (see GLSLShaderDataShared::beginInstantiate).
+   static bool beginInstantiateOpenGLShader( GLSLShaderDataShared* shader );
+
+   /**
+      Returns the shader at it, first finishing its instantiation if loadShaderDataSharedAsync left it pending.
+      A program that failed to compile or link is removed from the set and deleted, and nullptr is returned.
+   */
+   static GLSLShaderDataShared* collectPendingShader( ShaderSet::iterator it );
+
    /**
       Set containing all shaders that have been loaded via 
       Managershader::loadshader( const std::string& fileName ). These shaders
@@ -140,9 +241,33 @@ protected:
       any shaderDataShared*. All shaders are loaded exactly once and may be referenced by
       many different Models and/or ModelData objects.
    */
-   static std::set< GLSLShaderDataShared*, ShaderSetCompare > shaders;
+   static ShaderSet shaders;
+   static uint64_t shaderSetGeneration; ///< incremented on every insert into and erase from shaders
+
+   static std::string programBinaryCacheDirectory;
+   static std::string driverString;
+   static double shaderCreationTimeMs;
+   static unsigned int numProgramBinaryCacheHits;
+   static bool parallelShaderCompile;
+
+   /// Sets up the program binary cache directory from aftr.conf. Called by init once a context exists.
+   static void initProgramBinaryCache();
+
+   static bool hotReloadEnabled;
+   static int hotReloadInotifyFd; ///< inotify instance watching the source directories, -1 when polling
+   static uint64_t hotReloadWatchedGeneration; ///< shaderSetGeneration when the sources were last registered
+   static std::map< std::string, std::filesystem::file_time_type > hotReloadFiles; ///< watched sources and their last write times
+   static std::map< int, std::string > hotReloadDirectories; ///< inotify watch descriptor to directory
+   static std::vector< std::pair< GLSLShaderDataShared*, GLSLShaderDataShared* > > hotReloads; ///< programs being recompiled and their replacements
+   static std::chrono::steady_clock::time_point hotReloadLastPoll;
+
+   static void initHotReload(); ///< Reads "shaderhotreload" from aftr.conf and creates the inotify instance. Called by init.
+   static void shutdownHotReload(); ///< Deletes pending replacements and stops watching. Called by shutdown.
+   static void watchShaderSources(); ///< Starts watching the sources of every program in shaders not watched yet
+   static std::string getHotReloadPath( const std::string& path ); ///< Returns the canonical form watched sources are keyed by
 
-   static GLuint currentlyBoundShaderHandle;
+   /// Returns the path of the cache file holding the program binary of key.
+   static std::string getProgramBinaryPath( uint64_t key );
 
    /** 
       Default shader used by the engine. This default is ALWAYS returned in the
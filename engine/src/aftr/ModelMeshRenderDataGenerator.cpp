@@ -5,9 +5,140 @@
 #include <iostream>
 #include <set>
 #include <sstream>
+#include <thread>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include "AftrUtilities.h"
 using namespace Aftr;
 
+//fewest verticies populateInterleaved hands to a thread, smaller meshes are interleaved serially
+const static size_t MIN_VERTS_PER_INTERLEAVE_THREAD = 65536;
+
+namespace
+{
+   //Returns a new T[n] holding src narrowed to T, the caller checked every index fits
+   template< typename T > T* copyIndicies( const unsigned int* src, size_t n )
+   {
+      T* dst = new T[n];
+      for( size_t i = 0; i < n; ++i )
+         dst[i] = static_cast< T >( src[i] );
+      return dst;
+   }
+
+   //Returns a new T[n] holding 0, 1, ..., n - 1
+   template< typename T > T* sequentialIndicies( size_t n )
+   {
+      T* dst = new T[n];
+      for( size_t i = 0; i < n; ++i )
+         dst[i] = static_cast< T >( i );
+      return dst;
+   }
+
+   /**
+      The worker threads populateInterleaved splits a mesh across. Workers are started the first time a mesh
+      needs them and then wait for the next mesh for the life of the process, so a model with many meshes
+      does not create and join threads for every one of them.
+   */
+   class InterleaveThreadPool
+   {
+   public:
+      static InterleaveThreadPool& get()
+      {
+         static InterleaveThreadPool pool;
+         return pool;
+      }
+
+      ~InterleaveThreadPool()
+      {
+         {
+            std::lock_guard< std::mutex > lock( this->mutex );
+            this->stopping = true;
+         }
+         this->wake.notify_all();
+         for( std::thread& worker : this->workers )
+            worker.join();
+      }
+
+      //Runs job( 0 ) ... job( numJobs - 1 ) on the workers and the calling thread, returns once all of them finished
+      void run( unsigned int numJobs, const std::function< void( unsigned int ) >& job )
+      {
+         if( numJobs <= 1 )
+         {
+            if( numJobs == 1 )
+               job( 0 );
+            return;
+         }
+
+         std::lock_guard< std::mutex > serial( this->runMutex ); //meshes generated on several threads take turns
+         {
+            std::lock_guard< std::mutex > lock( this->mutex );
+            while( this->workers.size() + 1 < numJobs )
+               this->workers.emplace_back( &InterleaveThreadPool::work, this );
+            this->job = &job;
+            this->nextJob = 0;
+            this->numJobs = numJobs;
+            this->numUnfinished = numJobs;
+         }
+         this->wake.notify_all();
+
+         this->runJobs();
+         std::unique_lock< std::mutex > lock( this->mutex );
+         this->done.wait( lock, [this]() { return this->numUnfinished == 0; } );
+         this->job = nullptr;
+      }
+
+   private:
+      //Takes jobs of the current run until none are left
+      void runJobs()
+      {
+         for( ;; )
+         {
+            unsigned int t = 0;
+            {
+               std::lock_guard< std::mutex > lock( this->mutex );
+               if( this->job == nullptr || this->nextJob >= this->numJobs )
+                  return;
+               t = this->nextJob++;
+            }
+            ( *this->job )( t );
+
+            std::lock_guard< std::mutex > lock( this->mutex );
+            if( --this->numUnfinished == 0 )
+               this->done.notify_all();
+         }
+      }
+
+      void work()
+      {
+         std::unique_lock< std::mutex > lock( this->mutex );
+         for( ;; )
+         {
+            this->wake.wait( lock, [this]() { return this->stopping || ( this->job != nullptr && this->nextJob < this->numJobs ); } );
+            if( this->stopping )
+               return;
+            lock.unlock();
+            this->runJobs();
+            lock.lock();
+         }
+      }
+
+      std::vector< std::thread > workers;
+      std::mutex runMutex;
+      std::mutex mutex; ///< guards everything below
+      std::condition_variable wake;
+      std::condition_variable done;
+      const std::function< void( unsigned int ) >* job = nullptr;
+      unsigned int nextJob = 0;
+      unsigned int numJobs = 0;
+      unsigned int numUnfinished = 0;
+      bool stopping = false;
+   };
+}
+
+unsigned int ModelMeshRenderDataGenerator::maxInterleaveThreads = 0;
+
 ModelMeshRenderDataGenerator::ModelMeshRenderDataGenerator()
 {
    useTangents = false;
@@ -22,6 +153,73 @@ ModelMeshRenderDataGenerator::~ModelMeshRenderDataGenerator()
    //   delete this->verts.at(i); this->verts.at(i) = NULL;
    //}
    //this->verts.clear();
+
+   //arenas that were never handed to a ModelMeshRenderData
+   delete [] this->vertexArena;
+   this->deleteIndexArena();
+}
+
+void ModelMeshRenderDataGenerator::reserve( size_t numVerts, size_t numIndicies )
+{
+   this->verts.reserve( numVerts );
+   this->indicies.reserve( numIndicies );
+}
+
+GLubyte* ModelMeshRenderDataGenerator::allocateVertexArena( MESH_SHADING_TYPE shadingType, size_t numVerts )
+{
+   this->generateOffsets( shadingType );
+   delete [] this->vertexArena;
+   this->vertexArena = new GLubyte[ this->stride * numVerts ];
+   this->numArenaVerts = numVerts;
+   this->arenaStride = this->stride;
+   return this->vertexArena;
+}
+
+GLuint* ModelMeshRenderDataGenerator::allocateIndexArena( size_t numIndicies )
+{
+   this->deleteIndexArena();
+   GLuint* arena = new GLuint[ numIndicies ];
+   this->indexArena = arena;
+   this->indexArenaType = GL_UNSIGNED_INT;
+   this->numArenaIndicies = numIndicies;
+   return arena;
+}
+
+GLushort* ModelMeshRenderDataGenerator::allocateShortIndexArena( size_t numIndicies )
+{
+   this->deleteIndexArena();
+   GLushort* arena = new GLushort[ numIndicies ];
+   this->indexArena = arena;
+   this->indexArenaType = GL_UNSIGNED_SHORT;
+   this->numArenaIndicies = numIndicies;
+   return arena;
+}
+
+void ModelMeshRenderDataGenerator::deleteIndexArena()
+{
+   if( this->indexArenaType == GL_UNSIGNED_SHORT )
+      delete [] static_cast< GLushort* >( this->indexArena );
+   else
+      delete [] static_cast< GLuint* >( this->indexArena );
+   this->indexArena = nullptr;
+}
+
+bool ModelMeshRenderDataGenerator::isArenaAllocated( const char* generatePath ) const
+{
+   if( this->vertexArena == nullptr && this->indexArena == nullptr )
+      return false;
+
+   //the arena holds the only copy of the caller's data, these paths would silently generate from the empty vectors
+   std::cout << "ERROR: " << AFTR_FILE_LINE_STR << ": " << generatePath << " cannot use the vertex or index arena, only "
+             << "generateNoTransformRequired can. Fill getVerts() and getIndicies() instead. Generating an empty mesh..." << std::endl;
+   return true;
+}
+
+ModelMeshRenderData ModelMeshRenderDataGenerator::generateEmpty() const
+{
+   //no verticies and no indicies; the arenas stay with this generator, which deletes them
+   return ModelMeshRenderData( new GLushort[0], new GLubyte[0], 0, 0, GL_UNSIGNED_SHORT, 0, false, 0, 0, 0, 0, 0, 0,
+      std::vector< GLSLAttributeType >(), std::map< std::string, GLuint >(), NULL, NULL, 0, 0, GL_UNSIGNED_BYTE, GL_LINES );
 }
 
 ModelMeshRenderData ModelMeshRenderDataGenerator::generate( MESH_SHADING_TYPE shadingType, GLenum glPrimType )
@@ -61,6 +259,8 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateFlat( GLenum glPrimTyp
 
 ModelMeshRenderData ModelMeshRenderDataGenerator::generateFlatTriangles( )
 {
+   if( this->isArenaAllocated( "generateFlatTriangles" ) )
+      return this->generateEmpty();
    std::cout << "Generating Flat Triangles" << std::endl;
 
    std::pair<GLvoid*,GLvoid*> temp; 
@@ -180,10 +380,7 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateFlatTriangles( )
 
    GLenum idxMemType = GL_OUT_OF_MEMORY;
    GLenum normalIdxMemType = GL_OUT_OF_MEMORY;
-   populateVertices( temp.first );
-   populateColors( temp.first );
-   populateTextures( temp.first );
-   populateAttributes( temp.first );
+   populateInterleaved( temp.first );
    populateIndicesFlat( idxMemType, &temp.second );
 
    size_t vertsSize = verts.size();
@@ -237,6 +434,8 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateSmooth( GLenum glPrimT
 
 ModelMeshRenderData ModelMeshRenderDataGenerator::generateSmoothTriangles()
 {
+   if( this->isArenaAllocated( "generateSmoothTriangles" ) )
+      return this->generateEmpty();
    //std::cout << "Generating Smooth Triangles." << std::endl;
 
    std::pair< GLvoid*, GLvoid* > temp;// Vertex Data, Indices
@@ -411,10 +610,7 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateSmoothTriangles()
 
    GLenum idxMemType = GL_OUT_OF_MEMORY;
    GLenum NormalidxMemType = GL_OUT_OF_MEMORY;
-   populateVertices( temp.first );
-   populateColors( temp.first ); 
-   populateTextures( temp.first );
-   populateAttributes( temp.first );
+   populateInterleaved( temp.first );
    populateIndicesSmooth( idxMemType, &temp.second );
 
    bool isUsingColorsArray = false;
@@ -553,6 +749,9 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateNoNormalsLineLoopFromT
 
 ModelMeshRenderData ModelMeshRenderDataGenerator::generateNoNormalsPointsFromTriangles()
 {
+   if( this->isArenaAllocated( "generateNoNormalsPointsFromTriangles" ) )
+      return this->generateEmpty();
+
    std::pair<GLvoid*,GLvoid*> temp;
    std::vector< unsigned int > indexCopy = this->indicies;
    indicies.clear();
@@ -565,10 +764,7 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateNoNormalsPointsFromTri
    temp.first = new GLubyte[stride * this->verts.size()];
 
    GLenum idxMemType = GL_OUT_OF_MEMORY;
-   populateVertices( temp.first );
-   populateColors( temp.first ); 
-   populateTextures( temp.first );
-   populateAttributes( temp.first );
+   populateInterleaved( temp.first );
    populateIndicesSmooth( idxMemType, &temp.second );
 
    bool isUsingColorsArray = false;
@@ -632,16 +828,37 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateNoTransformRequired()
    //std::cout << "colors: " << this->colors.size() << std::endl;
 
    std::pair<GLvoid*,GLvoid*> temp;
+   size_t numVerts = this->verts.size();
+   size_t numIndicies = this->indicies.size();
+   GLenum idxMemType = GL_OUT_OF_MEMORY;
 
-   //allocate buffer
-   temp.first = new GLubyte[stride * this->verts.size()];
+   if( this->vertexArena != nullptr )
+   {
+      //the caller already wrote the final layout, hand the arena over as it is
+      if( this->arenaStride != this->stride )
+         std::cout << "WARNING: " << AFTR_FILE_LINE_STR << ": The vertex arena was laid out with a stride of " << this->arenaStride
+                   << " bytes, but the render data expects " << this->stride << "...\n";
+      temp.first = this->vertexArena;
+      numVerts = this->numArenaVerts;
+      this->vertexArena = nullptr;
+   }
+   else
+   {
+      //allocate buffer
+      temp.first = new GLubyte[stride * this->verts.size()];
 
-   GLenum idxMemType = GL_OUT_OF_MEMORY;
-   populateVertices( temp.first );
-   populateColors( temp.first ); 
-   populateTextures( temp.first );
-   populateAttributes( temp.first );
-   populateIndicesSmooth( idxMemType, &temp.second );
+      populateInterleaved( temp.first );
+   }
+
+   if( this->indexArena != nullptr )
+   {
+      temp.second = this->indexArena;
+      idxMemType = this->indexArenaType;
+      numIndicies = this->numArenaIndicies;
+      this->indexArena = nullptr;
+   }
+   else
+      populateIndicesSmooth( idxMemType, &temp.second );
 
    bool isUsingColorsArray = false;
    if( this->colors.size() > 0 )
@@ -655,7 +872,7 @@ ModelMeshRenderData ModelMeshRenderDataGenerator::generateNoTransformRequired()
    for( size_t i = 0; i < this->attributes.size(); ++i )
       attNameToIndex[ attributes[i].getName() ] = (unsigned int) i;
 
-   ModelMeshRenderData renderData( temp.second, temp.first, (GLsizei)this->indicies.size(), (GLsizei)this->verts.size(),
+   ModelMeshRenderData renderData( temp.second, temp.first, (GLsizei)numIndicies, (GLsizei)numVerts,
       idxMemType, this->stride, isUsingColorsArray, this->numColorChannels, this->vertsOffset,
       this->colorsOffset, this->normalsOffset, this->texCoordsOffset, 
       this->attributesOffset, attributesType, attNameToIndex, NULL, NULL, 0, 0, GL_UNSIGNED_BYTE, GL_LINES  );
@@ -793,6 +1010,106 @@ void ModelMeshRenderDataGenerator::populateVertices( GLvoid* x )
 
 }
 
+void ModelMeshRenderDataGenerator::populateInterleaved( GLvoid* x )
+{
+   //each source may hold a different number of elements, each is written for the verticies it has
+   size_t numVerts = this->verts.size();
+   size_t numColors = this->colors.size();
+   size_t numElements = std::max( numVerts, numColors );
+
+   struct TexSet { unsigned int offset; const aftrTexture4f* coords; size_t numCoords; int numComponents; };
+   std::vector< TexSet > texSets;
+   for( size_t i = 0; i < this->texCoords.size(); ++i )
+   {
+      GLenum type = this->texCoords[i].second;
+      int numComponents = 1;
+      if( type == GL_TEXTURE_2D || type == GL_TEXTURE_3D )
+         numComponents = 2;
+      if( type == GL_TEXTURE_3D )
+         numComponents = 3;
+      texSets.push_back( { this->texCoordsOffset[i], this->texCoords[i].first.data(), this->texCoords[i].first.size(), numComponents } );
+      numElements = std::max( numElements, this->texCoords[i].first.size() );
+   }
+
+   struct AttributeSet { unsigned int offset; GLSLAttributeArray* attribute; };
+   std::vector< AttributeSet > attributeSets;
+   for( size_t i = 0; i < this->attributesOffset.size(); ++i )
+   {
+      if( this->attributes[i].getElements()->empty() )
+         continue;
+      if( this->attributes[i].getType() != atVEC3 )
+      {
+         std::cout << "Warning: Everything except atVEC3 is unimplemented!" << std::endl;
+         std::cin.get();
+         continue;
+      }
+      attributeSets.push_back( { this->attributesOffset[i], &this->attributes[i] } );
+      numElements = std::max( numElements, this->attributes[i].getElements()->size() );
+   }
+
+   //one pass over the buffer, writing every member of a vertex while its cache line is at hand
+   const Vector* vertsData = this->verts.data();
+   const aftrColor4ub* colorsData = this->colors.data();
+   size_t stride = (size_t) this->stride;
+   unsigned int vertsOffset = this->vertsOffset;
+   unsigned int colorsOffset = this->colorsOffset;
+   bool rgba = this->numColorChannels == GL_RGBA;
+   auto interleave = [&]( size_t begin, size_t end )
+   {
+      for( size_t i = begin; i < end; ++i )
+      {
+         GLubyte* vertex = (GLubyte*) x + stride * i;
+         if( i < numVerts )
+         {
+            GLfloat* ptr = (GLfloat*) ( vertex + vertsOffset );
+            ptr[0] = vertsData[i].x;
+            ptr[1] = vertsData[i].y;
+            ptr[2] = vertsData[i].z;
+         }
+         if( i < numColors )
+         {
+            GLubyte* ptr = vertex + colorsOffset;
+            ptr[0] = colorsData[i].r;
+            ptr[1] = colorsData[i].g;
+            ptr[2] = colorsData[i].b;
+            if( rgba )
+               ptr[3] = colorsData[i].a;
+         }
+         for( const TexSet& set : texSets )
+         {
+            if( i >= set.numCoords )
+               continue;
+            GLfloat* ptr = (GLfloat*) ( vertex + set.offset );
+            const aftrTexture4f& coord = set.coords[i];
+            ptr[0] = coord.u;
+            if( set.numComponents > 1 )
+               ptr[1] = coord.v;
+            if( set.numComponents > 2 )
+               ptr[2] = coord.c;
+         }
+         for( const AttributeSet& set : attributeSets )
+         {
+            auto& elements = *set.attribute->getElements();
+            if( i >= elements.size() )
+               continue;
+            GLfloat* ptr = (GLfloat*) ( vertex + set.offset );
+            const GLfloat* element = (const GLfloat*) elements[i];
+            ptr[0] = element[0];
+            ptr[1] = element[1];
+            ptr[2] = element[2];
+         }
+      }
+   };
+
+   //split the verticies into contiguous ranges, the pool's workers and the calling thread take one each
+   unsigned int numThreads = maxInterleaveThreads > 0 ? maxInterleaveThreads : std::max( std::thread::hardware_concurrency(), 1u );
+   numThreads = (unsigned int) std::max< size_t >( std::min< size_t >( numThreads, numElements / MIN_VERTS_PER_INTERLEAVE_THREAD ), 1 );
+   size_t rangeSize = ( numElements + numThreads - 1 ) / numThreads;
+   InterleaveThreadPool::get().run( numThreads, [&]( unsigned int t ) {
+      interleave( t * rangeSize, std::min( ( t + 1 ) * rangeSize, numElements ) );
+   } );
+}
+
 void ModelMeshRenderDataGenerator::populateColors( GLvoid* x )
 {
    //populate colors
@@ -862,106 +1179,48 @@ void ModelMeshRenderDataGenerator::populateAttributes( GLvoid* x )
 void ModelMeshRenderDataGenerator::populateIndicesSmooth( GLenum& idxMemType, GLvoid** x )//<-- check if this is actually any different from populateIndicesFlat
 {
    //populate indices
-   if(this->indicies.size() < 0xFF)
-   {
-      idxMemType = GL_UNSIGNED_BYTE;
-      *x = new GLubyte[this->indicies.size()];
-   }
-   else if(this->indicies.size() < 0xFFFF)
-   {
-      idxMemType = GL_UNSIGNED_SHORT;
-      *x = new GLshort[this->indicies.size()];
-   }
-   else if(this->indicies.size() < 0xFFFFFFFF)
-   {
-      idxMemType = GL_UNSIGNED_INT;
-      *x = new GLuint[this->indicies.size()];
-   }
-   else
-   {
-      std::cout << "Too many indices in mesh to fit in GL_UNSIGNED_INT, this behavior is unsupported." << std::endl;
-      idxMemType = GL_OUT_OF_MEMORY;
-   }
+   unsigned int maxIndex = 0;
+   for( unsigned int idx : this->indicies )
+      maxIndex = std::max( maxIndex, idx );
 
-   for(size_t i = 0; i < this->indicies.size(); i++)
-   {
-      if( this->indicies.size() < 0xFF )
-         ( (GLubyte*)*x )[i] = static_cast<GLubyte>( indicies[i] );
-      else if(this->indicies.size() < 0xFFFF)
-         ( (GLushort*)*x )[i] = static_cast<GLushort>( indicies[i] );
-      else if(this->indicies.size() < 0xFFFFFFFF)
-         ( (GLuint*)*x )[i] = static_cast<GLuint>( indicies[i] );
-   }
+   idxMemType = getIndexType( maxIndex );
+   if( idxMemType == GL_UNSIGNED_SHORT )
+      *x = copyIndicies< GLushort >( this->indicies.data(), this->indicies.size() );
+   else
+      *x = copyIndicies< GLuint >( this->indicies.data(), this->indicies.size() );
 }
 
 void ModelMeshRenderDataGenerator::populateIndicesFlat( GLenum& idxMemType, GLvoid** x )//<-- check if this is actually any different from populateIndicesFlat
 {
-   //populate indices
-   if(this->indicies.size() < 0xFF)
-   {
-      idxMemType = GL_UNSIGNED_BYTE;
-      *x = new GLubyte[this->indicies.size()];
-   }
-   else if(this->indicies.size() < 0xFFFF)
-   {
-      idxMemType = GL_UNSIGNED_SHORT;
-      *x = new GLshort[this->indicies.size()];
-   }
-   else if(this->indicies.size() < 0xFFFFFFFF)
-   {
-      idxMemType = GL_UNSIGNED_INT;
-      *x = new GLuint[this->indicies.size()];
-   }
-   else
-   {
-      std::cout << "Too many indices in mesh to fit in GL_UNSIGNED_INT, this behavior is unsupported." << std::endl;
-      idxMemType = GL_OUT_OF_MEMORY;
-   }
-
-   for(size_t i = 0; i < this->indicies.size(); i++)
-   {
-      if(this->indicies.size() < 0xFF)
-         ((GLubyte*) *x)[i] = (GLubyte) indicies[i];
-      else if(this->indicies.size() < 0xFFFF)
-         ((GLushort*) *x)[i] = (GLushort) indicies[i];
-      else if(this->indicies.size() < 0xFFFFFFFF)
-         ((GLuint*) *x)[i] = (GLuint) indicies[i];
-   }
+   //the flat verticies were replicated before this is called, so the indicies are copied the same way
+   populateIndicesSmooth( idxMemType, x );
 }
 
 void ModelMeshRenderDataGenerator::populateIndicesNormal( GLenum& idxMemType, GLvoid** x, size_t vertsSize )
 {
-   //populate indices
-   if(this->indicies.size() < 0xFF)
-   {
-      idxMemType = GL_UNSIGNED_BYTE;
-      *x = new GLubyte[vertsSize * 2];
-   }
-   else if(this->indicies.size() < 0xFFFF)
-   {
-      idxMemType = GL_UNSIGNED_SHORT;
-      *x = new GLshort[vertsSize * 2];
-   }
-   else if(this->indicies.size() < 0xFFFFFFFF)
-   {
-      idxMemType = GL_UNSIGNED_INT;
-      *x = new GLuint[vertsSize * 2];
-   }
-   else
+   //populate indices, each normal is a line between its own two verticies
+   size_t numIndicies = vertsSize * 2;
+   if( numIndicies > 0xFFFFFFFF )
    {
       std::cout << "Too many indices in mesh to fit in GL_UNSIGNED_INT, this behavior is unsupported." << std::endl;
       idxMemType = GL_OUT_OF_MEMORY;
+      return;
    }
 
-   for(size_t i = 0; i < vertsSize * 2; i++)
-   {
-      if(this->indicies.size() < 0xFF)
-         ((GLubyte*) *x)[i] = (GLubyte) i;
-      else if(this->indicies.size() < 0xFFFF)
-         ((GLushort*) *x)[i] = (GLushort) i;
-      else if(this->indicies.size() < 0xFFFFFFFF)
-         ((GLuint*) *x)[i] = (GLuint) i;
-   }
+   idxMemType = getIndexType( numIndicies > 0 ? numIndicies - 1 : 0 );
+   if( idxMemType == GL_UNSIGNED_SHORT )
+      *x = sequentialIndicies< GLushort >( numIndicies );
+   else
+      *x = sequentialIndicies< GLuint >( numIndicies );
+}
+
+GLenum ModelMeshRenderDataGenerator::getIndexType( size_t maxIndex )
+{
+   //16 bits is the narrowest type, most hardware has no native 8 bit index fetch and converts GL_UNSIGNED_BYTE
+   //indices on the CPU. The all ones value of each type is left free, it is the primitive restart index
+   if( maxIndex < 0xFFFF )
+      return GL_UNSIGNED_SHORT;
+   return GL_UNSIGNED_INT;
 }
 
 void ModelMeshRenderDataGenerator::processNormalData( GLvoid* x, GLvoid** y, size_t vertsSize )
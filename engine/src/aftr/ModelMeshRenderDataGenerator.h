@@ -62,6 +62,38 @@ public:
 
    std::map< unsigned int, std::pair< unsigned int, unsigned int > >* getVertIdxToOrigVertIdxMap() { return &this->vertIdxToOrigVertIdx; }
 
+   /**
+      Pre-sizes the vertex and index lists of a mesh whose size is known up front, so filling them
+      with push_back never reallocates (and never holds the old and the new storage at once).
+   */
+   void reserve( size_t numVerts, size_t numIndicies );
+
+   /**
+      Arenas let the caller write the render data in its final layout, instead of filling getVerts() and
+      getIndicies() for generate to copy into a new interleaved buffer and a new index array. generate
+      hands an arena to the ModelMeshRenderData as it is, which then owns it.
+
+      allocateVertexArena lays the vertices out for shadingType with the texture coordinate, attribute and
+      color sets declared so far, and returns stride * numVerts bytes; write each vertex at the offsets
+      above. allocateIndexArena returns numIndicies GL_UNSIGNED_INT indices, and allocateShortIndexArena
+      numIndicies GL_UNSIGNED_SHORT indices for meshes whose largest index is below 0xFFFF.
+
+      While an arena is allocated generate ignores the corresponding vector, so the arena holds the only
+      copy of that data and the mesh can only be generated once. Only the mstNONE topologies that need no
+      conversion (generateNoTransformRequired, e.g. GL_PATCHES from GL_PATCHES) support arenas; the other
+      paths (flat and smooth normals, points from triangles) exit with an error if an arena is allocated.
+   */
+   GLubyte* allocateVertexArena( MESH_SHADING_TYPE shadingType, size_t numVerts );
+   GLuint* allocateIndexArena( size_t numIndicies );
+   GLushort* allocateShortIndexArena( size_t numIndicies );
+
+   /**
+      Returns the narrowest index type (GL_UNSIGNED_SHORT or GL_UNSIGNED_INT) that holds every index up to
+      maxIndex. GL_UNSIGNED_BYTE is never returned, most hardware has no native 8 bit index fetch. The
+      largest value of each type is never used, it is the primitive restart index.
+   */
+   static GLenum getIndexType( size_t maxIndex );
+
 
    /**
       Generates an optimized buffer for this mesh. The first GLvoid* is a pointer to the interleaved
@@ -96,11 +128,31 @@ public:
    //generates the render data when no conversion is necessary lines->lines, triangles->triangles, etc...
    virtual ModelMeshRenderData generateNoTransformRequired();
 
+   /**
+      Sets the most threads generate fills an interleaved buffer with; 0 (the default) uses every hardware
+      thread. Meshes are split into ranges of at least 65536 verticies, so small meshes stay on the calling thread.
+      The other threads belong to a pool that is started on first use and reused by every later mesh.
+   */
+   static void setMaxInterleaveThreads( unsigned int numThreads ) { maxInterleaveThreads = numThreads; }
+   static unsigned int getMaxInterleaveThreads() { return maxInterleaveThreads; }
+
 protected:
 
    std::vector< Vector > verts; ///< All verticies contained in this mesh
    std::vector< unsigned int > indicies; ///< Indicies into the verts
 
+   GLubyte* vertexArena = nullptr; ///< Interleaved verticies written by the caller, replaces verts until generate hands it over
+   size_t numArenaVerts = 0;
+   GLsizei arenaStride = 0; ///< stride the vertex arena was laid out with
+   GLvoid* indexArena = nullptr; ///< Indicies written by the caller, replaces indicies until generate hands it over
+   GLenum indexArenaType = GL_UNSIGNED_INT; ///< GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+   size_t numArenaIndicies = 0;
+   void deleteIndexArena();
+   /// Logs an error and returns true if an arena is allocated; called by the generate paths that rebuild verts or indicies and cannot use one.
+   bool isArenaAllocated( const char* generatePath ) const;
+   /// Returns render data without verticies or indicies, what those generate paths return when isArenaAllocated.
+   ModelMeshRenderData generateEmpty() const;
+
    /**
       This stores a mapping from a current vertex index to the original (meshID, vertex index)
       that was read from file/standard input within the ModelParser::parse method. The size of
@@ -125,11 +177,18 @@ protected:
    std::map< unsigned int, std::pair< unsigned int, unsigned int > > vertIdxToOrigVertIdx;
 
    virtual void generateOffsets( MESH_SHADING_TYPE shadingType ); ///< This generates the offsets for both smooth and flat shading (they are the same).
+   /**
+      Populates the buffer with the verts, colors, texCoords and attributes of each vertex in a single pass,
+      split across up to maxInterleaveThreads threads by vertex range. generate uses this instead of calling
+      the four populate methods below, which each walk the whole buffer.
+   */
+   virtual void populateInterleaved( GLvoid* x );
    virtual void populateVertices( GLvoid* x ); ///< This populates the buffer with the values stored in verts
    virtual void populateColors( GLvoid* x );
    virtual void populateTextures( GLvoid* x );
    virtual void populateAttributes( GLvoid* x );
 
+   /// Copies indicies into the narrowest type holding the largest index (see getIndexType)
    virtual void populateIndicesSmooth( GLenum& idxMemType, GLvoid** x );
    virtual void populateIndicesFlat( GLenum& idxMemType, GLvoid** x );//<-- may be the same as smooth, check this
 
@@ -162,6 +221,8 @@ protected:
 
    virtual Vector calcTangentVector( const Vector& p0, const Vector& p1, const Vector& p2, const Vector& t0, const Vector& t1, const Vector& t2, const Vector& normal );
 
+   static unsigned int maxInterleaveThreads; ///< 0 uses every hardware thread
+
    GLenum indexTopology; ///< Valid values include GL_POINTS, GL_LINE_STRIP, GL_LINE_LOOP, GL_LINES, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN, GL_TRIANGLES, GL_QUAD_STRIP, GL_QUADS, and GL_POLYGON 
 };
 
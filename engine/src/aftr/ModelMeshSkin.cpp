@@ -12,6 +12,7 @@
 #include "Mat4.h"
 #include "Camera.h"
 #include "GLSLShaderDefaultGL32.h"
+#include "GLStateCache.h" //AFTR_GL_CHECK
 
 using namespace Aftr;
 
@@ -347,7 +348,7 @@ void Aftr::ModelMeshSkin::bind( const std::tuple< const Mat4&, const Mat4&, cons
        glPatchParameteri(GL_PATCH_VERTICES, this->patchVertices);
    }
 
-   printOpenGLErrors( 4301, nullptr, AFTR_FILE_LINE_STR );
+   AFTR_GL_CHECK( 4301 );
 
    if( this->shader != nullptr )
    {
@@ -358,7 +359,7 @@ void Aftr::ModelMeshSkin::bind( const std::tuple< const Mat4&, const Mat4&, cons
 
    }
 
-   printOpenGLErrors( 4302, nullptr, AFTR_FILE_LINE_STR );
+   AFTR_GL_CHECK( 4302 );
 
    //Setup texture parameters
    for( size_t i = 0; i < this->multiTextures.size(); ++i )
@@ -373,19 +374,19 @@ void Aftr::ModelMeshSkin::bind( const std::tuple< const Mat4&, const Mat4&, cons
 
 void ModelMeshSkin::unbind() const
 {
-   printOpenGLErrors( 4311, nullptr, AFTR_FILE_LINE_STR );
+   AFTR_GL_CHECK( 4311 );
    for( size_t i = 0; i < this->multiTextures.size(); ++i )
    {
       glActiveTexture( GL_TEXTURE0 + (unsigned int) i );
       this->multiTextures.at(i)->unbind();
       glActiveTexture( GL_TEXTURE0 );
    }
-   printOpenGLErrors( 4312, nullptr, AFTR_FILE_LINE_STR );
+   AFTR_GL_CHECK( 4312 );
 
    if( this->shader != nullptr )
       this->shader->unbind();
 
-   printOpenGLErrors( 4313, nullptr, AFTR_FILE_LINE_STR );
+   AFTR_GL_CHECK( 4313 );
 
    // don't make this call if using newer version of OpenGL
    if (!ManagerOpenGLState::isGLContextProfileVersion32orGreater() && this->shadingType == MESH_SHADING_TYPE::mstNONE && ManagerLight::getNumLightsTotal() > 0)
@@ -1,26 +1,101 @@
-#version 330 core
+#version 430 core
+#ifdef EARTH_BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
+
+// Variants (see GLSLEarthShader::getDescriptor):
+//   EARTH_VIRTUAL_IMAGERY - read the imagery from the page cache of an ImageryVirtualTexture
+//                           through its indirection texture, and request the pages wanted in
+//                           ImageryFeedback for the texture to stream in.
+
+#ifdef EARTH_VIRTUAL_IMAGERY
+// writing the page requests would otherwise keep the driver from depth testing before shading,
+// and hidden fragments would request pages nobody sees
+layout (early_fragment_tests) in;
+#endif
+
 in vec3 fPos;
 in float fLat;
 
 out vec4 fragColor;
 
-uniform isampler2D elevationTexture;
-uniform sampler2D imageryTexture;
+#include "earth_uniforms.glsl"
 
 const float PI = 3.14159265358979323846;
 
-void main() {
-	// The lattitude is simply read as an interpolated value into this shader, but we
-	// do need to "flip" it because the imagery texture is inverted on the Y axis compared
-	// to the elevation texture.
-	float fLat = 1.0 - fLat;
+#ifdef EARTH_VIRTUAL_IMAGERY
+// one bit per page of the imagery, indexed like ImageryPageFile::getPageIndex
+layout (std430, binding = 7) buffer ImageryFeedback
+{
+	uint pageRequests[];
+};
+
+// Returns the size in texels of a level of the imagery, which halve rounding up like ImageryPageFile's.
+ivec2 imageryLevelSize(int level) {
+	return max((ivec2(imageryWidth, imageryHeight) + (1 << level) - 1) >> level, ivec2(1));
+}
+
+// Returns the number of pages across and down a level.
+ivec2 imageryLevelPages(int level) {
+	return (imageryLevelSize(level) + IMAGERY_PAGE_TEXELS - 1) / IMAGERY_PAGE_TEXELS;
+}
 
+vec3 sampleVirtualImagery(vec2 uv) {
+	// Pick the level whose texels are about a pixel apart. The longitude wraps around at the date
+	// line, so its derivatives are taken the short way around.
+	vec2 size = vec2(imageryWidth, imageryHeight);
+	vec2 dx = dFdx(uv);
+	vec2 dy = dFdy(uv);
+	dx.x -= round(dx.x);
+	dy.x -= round(dy.x);
+	dx *= size;
+	dy *= size;
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + imageryLodBias;
+	int level = clamp(int(floor(lod + 0.5)), 0, imageryNumLevels - 1);
+
+	ivec2 levelSize = imageryLevelSize(level);
+	ivec2 page = clamp(ivec2(uv * vec2(levelSize)), ivec2(0), levelSize - 1) / IMAGERY_PAGE_TEXELS;
+
+	// request the page from one pixel of every 4x4 block, which is plenty to find the visible pages
+	if (all(equal(ivec2(gl_FragCoord.xy) & 3, ivec2(0)))) {
+		int index = 0;
+		for (int l = 0; l < level; ++l) {
+			ivec2 pages = imageryLevelPages(l);
+			index += pages.x * pages.y;
+		}
+		index += page.y * imageryLevelPages(level).x + page.x;
+		atomicOr(pageRequests[index >> 5], 1u << uint(index & 31));
+	}
+
+	// the page drawn is the one requested or, until it is streamed in, its nearest resident ancestor
+	uvec4 entry = texelFetch(imageryIndirection, page, level);
+	vec2 texel = uv * vec2(imageryLevelSize(int(entry.y))) - vec2(entry.zw) * float(IMAGERY_PAGE_TEXELS);
+
+	// filter within the page and its border only, the neighbouring slot holds another page
+	texel = clamp(texel, vec2(0.5 - float(IMAGERY_PAGE_BORDER)), vec2(float(IMAGERY_PAGE_TEXELS + IMAGERY_PAGE_BORDER) - 0.5));
+	ivec2 cacheSize = textureSize(imageryTexture, 0);
+	int slotsPerSide = cacheSize.x / IMAGERY_PAGE_SIZE;
+	vec2 slot = vec2(ivec2(int(entry.x) % slotsPerSide, int(entry.x) / slotsPerSide));
+	vec2 cacheUV = (slot * float(IMAGERY_PAGE_SIZE) + float(IMAGERY_PAGE_BORDER) + texel) / vec2(cacheSize);
+	return textureLod(imageryTexture, cacheUV, 0.0).rgb;
+}
+#endif
+
+void main() {
 	// The longitude cannot be simply passed as an interpolated variable into this shader
-	// stage from the geometry shader due to it breaking down at the poles. However, it
+	// stage from the evaluation shader due to it breaking down at the poles. However, it
 	// can easily be recalculated from the localized ECEF position of this fragment.
 	// From: tan(lon) = y / x
 	float fLon = atan(fPos.y, fPos.x);
 	fLon = (fLon / PI + 1.0) / 2.0; // convert longitude to UV coordinate
 
-	fragColor = vec4(texture(imageryTexture, vec2(fLon, fLat)).rgb, 1.0);
+#ifdef EARTH_VIRTUAL_IMAGERY
+	// the pages are stored north up, like the elevation texture
+	fragColor = vec4(sampleVirtualImagery(vec2(fLon, fLat)), 1.0);
+#else
+	// The lattitude is simply read as an interpolated value into this shader, but we
+	// do need to "flip" it because the imagery texture is inverted on the Y axis compared
+	// to the elevation texture.
+	fragColor = vec4(texture(imageryTexture, vec2(fLon, 1.0 - fLat)).rgb, 1.0);
+#endif
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #version 430 core
 layout (location = 0) in vec3 VertexPosition;
+layout (location = 5) in vec4 CoarseEdge; // only supplied by the quadtree patch buffer
 
 out vec2 vPos;
+out float vEdgeType;
+out vec4 vCoarseEdge;
 
 void main() {
     vPos = VertexPosition.xy; // just forward the x and y
+    vEdgeType = VertexPosition.z; // type of the edge to the next vertex (always 0 for the fixed grid)
+    vCoarseEdge = CoarseEdge;
 }
\ No newline at end of file
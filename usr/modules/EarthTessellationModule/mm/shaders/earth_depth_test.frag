@@ -0,0 +1,9 @@
+#version 430 core
+
+// The z-fighting test scene of EarthDepthBenchmark only counts the samples passing the depth test.
+
+out vec4 fragColor;
+
+void main() {
+	fragColor = vec4(1.0);
+}
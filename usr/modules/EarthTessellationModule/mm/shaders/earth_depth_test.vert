@@ -0,0 +1,18 @@
+#version 430 core
+
+// A surface at a view depth, covering the viewport, for the z-fighting test scene of EarthDepthBenchmark.
+// It goes through the camera's projection like the rest of the scene, and is tilted a little so its
+// samples don't all round to the same depth buffer value.
+
+uniform mat4 Projection;
+uniform float viewDepth; // distance of the surface from the camera in world units at the center of the viewport
+
+const float TILT = 0.05; // the surface is this share of viewDepth farther at the top of the viewport, and nearer at the bottom
+
+void main() {
+	// one triangle whose corners (-1, -1), (3, -1) and (-1, 3) in normalized device coordinates cover the viewport
+	vec2 ndc = vec2(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID & 2) * 2 - 1));
+	float depth = viewDepth * (1.0 + TILT * ndc.y);
+	vec4 view = vec4(ndc.x * depth / Projection[0][0], ndc.y * depth / Projection[1][1], -depth, 1.0);
+	gl_Position = Projection * view;
+}
@@ -0,0 +1,152 @@
+// Culling and tessellation level selection shared by earth.tesc and earth_cull.comp, pulled in
+// with #include "earth_lod.glsl"
+
+#include "wgs84.glsl"
+
+// need the camera projection for the tess level heuristic
+layout ( binding = 0, std140 ) uniform CameraTransforms
+{
+   mat4 View;
+   mat4 Projection;
+   mat4 Shadow; //for shadow mapping
+   // A Value of 0 = Render w/ No shadows
+   // A Value of 1 = Generate depth map only
+   // A Value of 2 = Render w/ Shadow mapping
+   int ShadowMapShadingState;
+} Cam;
+
+// number of patches drawn and culled, read back by MGLEarthQuad, only counted while patchStatsEnabled is set
+layout (std430, binding = 1) buffer PatchStats
+{
+	uint drawnPatches;
+	uint culledPatches;
+};
+
+const int LOD_EDGE_LENGTH = 0;
+const int LOD_SCREEN_SPACE_ERROR = 1;
+
+// sample elevation texture at UV coordinate (the base level, there are no derivatives outside the fragment stage)
+float getElev(vec2 uv) {
+	return float(textureLod(elevationTexture, uv, 0.0).r) * 10.0; // exaggerate elevation by one magnitude of 10
+}
+
+// returns true if any of the 6 clip planes has every point outside of it
+bool outsideFrustum(vec4 c[13]) {
+	for (int axis = 0; axis < 3; ++axis) {
+		bool allBelow = true;
+		bool allAbove = true;
+		for (int i = 0; i < 13; ++i) {
+			allBelow = allBelow && c[i][axis] < -c[i].w;
+			allAbove = allAbove && c[i][axis] > c[i].w;
+		}
+
+		if (allBelow || allAbove)
+			return true;
+	}
+	return false;
+}
+
+// returns true if p lies behind the horizon of a sphere at the origin with radius r, seen from eye
+bool belowHorizon(vec3 p, vec3 eye, float r) {
+	vec3 vc = eye / r;
+	float vh = dot(vc, vc) - 1.0;
+	vec3 vt = p / r - vc;
+	float vtDotVc = -dot(vt, vc);
+	return vh > 0.0 && vtDotVc > vh && vtDotVc * vtDotVc / dot(vt, vt) > vh;
+}
+
+// returns true if the patch with corners pos and (min, max) elevation bounds is entirely outside
+// the view frustum or below the horizon
+bool isPatchCulled(vec2 pos[4], vec2 bounds) {
+	// corners at both bounds, plus edge midpoints and the center at the top bound where the
+	// curved surface bulges out the most
+	vec2 mid = (pos[0] + pos[1] + pos[2] + pos[3]) / 4.0;
+	vec3 p[13];
+	for (int i = 0; i < 4; ++i) {
+		p[i] = WGS84ToECEF(vec3(pos[i], bounds.x));
+		p[i + 4] = WGS84ToECEF(vec3(pos[i], bounds.y));
+		p[i + 8] = WGS84ToECEF(vec3((pos[i] + pos[(i + 1) % 4]) / 2.0, bounds.y));
+	}
+	p[12] = WGS84ToECEF(vec3(mid, bounds.y));
+
+	vec4 c[13];
+	for (int i = 0; i < 13; ++i)
+		c[i] = toClip(p[i]);
+	if (outsideFrustum(c))
+		return true;
+
+	// The occluder is a sphere inside the ellipsoid and the deepest point of the dataset, and the
+	// patch is hidden when all of its top points are behind it.
+	vec3 eyePos = eyePosition.xyz;
+	float r = (EARTH_POLAR_RADIUS + min(minElevation * 10.0, 0.0)) * scale;
+	for (int i = 4; i < 13; ++i) {
+		if (!belowHorizon(p[i], eyePos, r))
+			return false;
+	}
+	return true;
+}
+
+// calculate the tess level for an edge between a and b
+float tessLevel(vec3 a, vec3 b) {
+	float diameter = distance(a, b);
+	vec3 center = (a + b) / 2.0;
+	vec4 screenPos = toClip(center);
+
+	return abs(diameter * Cam.Projection[1][1] / screenPos.w) * tessellationFactor;
+}
+
+// Ensure f is <= maxTessellationFactor and then clamp in range [1, 64]
+float clampFactor(float f) {
+	return clamp(min(f, 64.0), 1.0, maxTessellationFactor);
+}
+
+// Get the geometric errors (in meters) of the grid tile containing pos, for 2^k segments per edge
+// at index k. The tile's columns repeat at the seam like the grid's longitudes do.
+void getTileErrors(vec2 pos, out float errors[7]) {
+	ivec2 size = textureSize(tileErrors, 0);
+	vec2 t = (pos - tileGrid.xy) / (tileGrid.zw - tileGrid.xy);
+	float u = (floor(t.y * float(size.x / 2)) * 2.0 + 0.5) / float(size.x);
+	vec4 a = textureLod(tileErrors, vec2(u, t.x), 0.0);
+	vec4 b = textureLod(tileErrors, vec2(u + 1.0 / float(size.x), t.x), 0.0);
+	errors = float[7](a.x, a.y, a.z, a.w, b.x, b.y, b.z);
+}
+
+// Calculate the tess level whose geometric error projects to targetPixelError pixels at center.
+// Interpolates between the powers of two in log space so the level changes smoothly with distance.
+float sseLevel(float errors[7], vec3 center) {
+	vec4 screenPos = toClip(center);
+	float pixelsPerMeter = Cam.Projection[1][1] * viewportHeight / 2.0 * 10.0 * scale / max(abs(screenPos.w), 1e-6); // errors are exaggerated like getElev
+	float target = targetPixelError / pixelsPerMeter;
+
+	if (errors[0] <= target)
+		return 1.0;
+	for (int k = 1; k < 7; ++k) {
+		if (errors[k] <= target) {
+			float t = log2(errors[k - 1] / target) / log2(errors[k - 1] / max(errors[k], errors[k - 1] / 64.0));
+			return exp2(float(k - 1) + min(t, 1.0));
+		}
+	}
+	return 64.0;
+}
+
+// Calculate the 4 outer and 2 inner tess levels of the grid tile with corners pos (ECEF v) from its
+// geometric errors. Each edge uses the larger error of the two tiles sharing it, so both tiles agree
+// on its level.
+void getSSELevels(vec2 pos[4], vec3 v[4], out float levels[6]) {
+	vec2 mid = (pos[0] + pos[1] + pos[2] + pos[3]) / 4.0;
+	float own[7];
+	getTileErrors(mid, own);
+
+	for (int i = 0; i < 4; ++i) {
+		float neighbour[7];
+		getTileErrors(pos[i] + pos[(i + 1) % 4] - mid, neighbour);
+
+		float errors[7];
+		for (int k = 0; k < 7; ++k)
+			errors[k] = max(own[k], neighbour[k]);
+		levels[i] = clampFactor(sseLevel(errors, (v[i] + v[(i + 1) % 4]) / 2.0));
+	}
+
+	levels[4] = clampFactor(sseLevel(own, (v[0] + v[1] + v[2] + v[3]) / 4.0));
+	levels[5] = levels[4];
+}
@@ -0,0 +1,63 @@
+// Parameters of the earth shaders, shared by every program drawing the same MGLEarthQuad and
+// written by EarthUniformBuffer, whose EarthUniforms struct mirrors this std140 layout exactly.
+// Pulled in with #include "earth_uniforms.glsl", which also declares the textures of the earth shaders.
+//
+// Variants (see GLSLEarthShader::getDescriptor):
+//   EARTH_BINDLESS_TEXTURES - the textures are read through the resident GL_ARB_bindless_texture
+//                             handles in the block instead of from texture units. Every stage
+//                             including this file enables the extension right after #version.
+//   EARTH_VIRTUAL_IMAGERY   - imageryTexture is the page cache of an ImageryVirtualTexture, whose
+//                             pages are found through imageryIndirection (see earth.frag).
+
+layout ( binding = 2, std140 ) uniform EarthUniforms
+{
+	mat4 MVPMat;
+	vec4 tileGrid; // (lat, lon) in radians of the fixed grid's upper-left and lower-right corners
+	float scale;
+	float tessellationFactor;
+	float maxTessellationFactor;
+	int cullingEnabled; // cull patches outside the view frustum or below the horizon
+	float minElevation; // lowest elevation of the whole dataset, used for the horizon occluder
+	int lodMode; // see EARTH_LOD_MODE in GLSLEarthShader.h
+	float targetPixelError; // largest projected geometric error in pixels
+	float viewportHeight;
+	int numTilesX; // fixed grid dimensions, for earth_cull.comp
+	int numTilesY;
+	uvec2 elevationTextureHandle; // bindless handles, only set with EARTH_BINDLESS_TEXTURES
+	uvec2 imageryTextureHandle;
+	uvec2 elevationBoundsHandle;
+	uvec2 tileErrorsHandle;
+	float padding; // unused, keeps patchStatsEnabled at offset 156
+	int patchStatsEnabled; // count the drawn and culled patches in PatchStats (see earth_lod.glsl)
+	vec4 eyeHigh; // the eye in model space as the sum of two floats, subtracted from every position
+	vec4 eyeLow;  // before MVPMat (zero when the translation is in MVPMat, see EarthUniformBuffer)
+	vec4 eyePosition; // the eye in model space
+	uvec2 imageryIndirectionHandle; // bindless handle of imageryIndirection
+	int imageryWidth; // base level size of the virtual imagery in texels
+	int imageryHeight;
+	int imageryNumLevels;
+	float imageryLodBias; // added to the level picked from the derivatives, positive is blurrier
+};
+
+// Transform a model space position into clip space. Subtracting the high part of the eye first is
+// exact near the camera, so the large coordinates cancel before any rounding reaches the projection.
+vec4 toClip(vec3 p) {
+	precise vec3 rel = (p - eyeHigh.xyz) - eyeLow.xyz;
+	return MVPMat * vec4(rel, 1.0);
+}
+
+#ifdef EARTH_BINDLESS_TEXTURES
+#define elevationTexture isampler2D(elevationTextureHandle)
+#define imageryTexture sampler2D(imageryTextureHandle)
+#define elevationBounds isampler2D(elevationBoundsHandle)
+#define tileErrors sampler2D(tileErrorsHandle)
+#define imageryIndirection usampler2D(imageryIndirectionHandle)
+#else
+layout (binding = 0) uniform isampler2D elevationTexture;
+layout (binding = 1) uniform sampler2D imageryTexture;
+layout (binding = 2) uniform isampler2D elevationBounds; // RG16I min/max pyramid of elevationTexture
+layout (binding = 3) uniform sampler2D tileErrors; // geometric errors of every grid tile, 2 texels per tile (see MGLEarthQuad)
+#ifdef EARTH_VIRTUAL_IMAGERY
+layout (binding = 4) uniform usampler2D imageryIndirection; // (slot, level, page x, page y) drawn for every page of every level
+#endif
+#endif
@@ -0,0 +1,38 @@
+// WGS84 helpers shared by the earth shaders, pulled in with #include "wgs84.glsl"
+
+#include "earth_uniforms.glsl"
+
+// constants used in conversion from WGS84
+const float EARTH_RADIUS = 6378137.0;
+const float EARTH_FLATTENING = 0.00669437999013;
+const float PI = 3.14159265358979323846;
+const float EARTH_POLAR_RADIUS = 6356752.314245;
+
+// convert from WGS84 to ECEF
+vec3 WGS84ToECEF(vec3 v) {
+	float latRad = v.x;
+	float lonRad = v.y;
+	float elev = v.z * scale;
+
+	float sinLatRad = sin(latRad);
+	float e2sinLatSq = EARTH_FLATTENING * (sinLatRad * sinLatRad);
+
+	float rn = EARTH_RADIUS * scale / sqrt(1 - e2sinLatSq);
+	float R = (rn + elev) * cos(latRad);
+
+	vec3 o;
+	o.x = R * cos(lonRad);
+	o.y = R * sin(lonRad);
+	o.z = (rn * (1 - EARTH_FLATTENING) + elev) * sin(latRad);
+
+	return o;
+}
+
+// convert WGS84 to UV space of elevation texture
+vec2 WGS84ToUV(vec2 v) {
+	vec2 uv;
+	uv.x = (v.y + PI) / (2 * PI);
+	uv.y = (PI / 2 - v.x) / PI;
+
+	return uv;
+}
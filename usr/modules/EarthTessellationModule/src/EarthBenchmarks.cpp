@@ -0,0 +1,554 @@
+#include "EarthBenchmarks.h"
+#include "EarthFlightBenchmark.h"
+#include "EarthGridChunks.h"
+#include "EarthQuadtree.h"
+#include "ElevationBoundsPyramid.h"
+#include "ElevationPyramidBuilder.h"
+#include "MGLEarthQuad.h"
+#include "ModelMeshRenderDataGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace Aftr;
+
+namespace {
+// size of the synthetic raster (the resolution of ETOPO1 cell registered data, rounded)
+const static unsigned int PYRAMID_BENCH_WIDTH = 21600;
+const static unsigned int PYRAMID_BENCH_HEIGHT = 10800;
+const static unsigned int PYRAMID_BENCH_RUNS = 3;
+
+// Fills a raster with smooth, terrain-like elevations in [-10000, 8000] plus a little noise.
+void fillSyntheticElevation(GLshort* data, unsigned int width, unsigned int height)
+{
+    unsigned int seed = 12345;
+    for (unsigned int y = 0; y < height; ++y) {
+        for (unsigned int x = 0; x < width; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            float fx = static_cast<float>(x) / width;
+            float fy = static_cast<float>(y) / height;
+            float h = 4000.0f * std::sin(fx * 37.0f) * std::cos(fy * 23.0f) + 3000.0f * std::sin((fx + fy) * 91.0f) - 1000.0f;
+            h += static_cast<float>(seed >> 24) - 128.0f;
+            data[static_cast<size_t>(y) * width + x] = static_cast<GLshort>(std::max(-10000.0f, std::min(8000.0f, h)));
+        }
+    }
+}
+
+// The mipmap loop MGLEarthQuad used before ElevationPyramidBuilder, kept as the baseline. Every
+// level is allocated with an extra row and column of padding since the loop reads past the last
+// row/column when a dimension is odd.
+void buildPyramidScalar(const GLshort* base, unsigned int width, unsigned int height, std::vector<std::vector<GLshort>>& levels)
+{
+    unsigned int dWidth = width;
+    unsigned int dHeight = height;
+    const GLshort* source = base;
+    levels.clear();
+    while (dWidth > 1 || dHeight > 1) {
+        unsigned int sWidth = dWidth; // keep source width
+
+        dWidth = std::max(dWidth / 2, 1u);
+        dHeight = std::max(dHeight / 2, 1u);
+
+        levels.emplace_back(static_cast<size_t>(dWidth + 1) * (dHeight + 1), 0);
+        GLshort* dest = levels.back().data();
+
+        for (unsigned int j = 0; j < dHeight; ++j) {
+            for (unsigned int i = 0; i < dWidth; ++i) {
+                int sum = source[j * 2 * sWidth + i * 2];
+                sum += source[(j * 2 + 1) * sWidth + i * 2];
+                sum += source[j * 2 * sWidth + i * 2 + 1];
+                sum += source[(j * 2 + 1) * sWidth + i * 2 + 1];
+
+                dest[j * dWidth + i] = static_cast<GLshort>(sum / 4);
+            }
+        }
+
+        source = dest;
+    }
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// size of the synthetic raster the quadtree benchmark bounds its nodes with
+const static unsigned int QUADTREE_BENCH_WIDTH = 4320;
+const static unsigned int QUADTREE_BENCH_HEIGHT = 2160;
+
+// the module's initial view (see GLViewEarthTessellationModule)
+const static float QUADTREE_BENCH_SCALE = 0.0001f;
+const static float QUADTREE_BENCH_TESS = 45.0f;
+const static float QUADTREE_BENCH_MAX_TESS = 16.0f;
+const static double QUADTREE_BENCH_LAT = 37.75;
+const static double QUADTREE_BENCH_LON = 15.0;
+
+// the flight path: frames, start and end altitude in meters, and degrees of longitude travelled
+const static unsigned int QUADTREE_BENCH_FRAMES = 300;
+const static double QUADTREE_BENCH_START_ALT = 2.0e7;
+const static double QUADTREE_BENCH_END_ALT = 2.0e3;
+const static double QUADTREE_BENCH_TRAVEL = 20.0;
+
+const static double QUADTREE_BENCH_VIEWPORT_WIDTH = 1920.0;
+const static double QUADTREE_BENCH_VIEWPORT_HEIGHT = 1080.0;
+const static double QUADTREE_BENCH_FOVY = 60.0;
+
+const static double BENCH_PI = 3.14159265358979323846;
+
+// Multiplies two column major 4x4 matrices.
+void multiply(const double* a, const double* b, double* out)
+{
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r)
+            out[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+}
+
+// Builds a column major view projection matrix looking from eye at target.
+void lookAtPerspective(const double* eye, const double* target, const double* up, double near, double far, double* out)
+{
+    double f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    double fl = std::sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (double& v : f)
+        v /= fl;
+    double s[3] = { f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0] };
+    double sl = std::sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+    for (double& v : s)
+        v /= sl;
+    double u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+
+    double view[16] = { s[0], u[0], -f[0], 0.0, s[1], u[1], -f[1], 0.0, s[2], u[2], -f[2], 0.0,
+        -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]), -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]),
+        f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2], 1.0 };
+
+    double t = 1.0 / std::tan(QUADTREE_BENCH_FOVY * BENCH_PI / 360.0);
+    double aspect = QUADTREE_BENCH_VIEWPORT_WIDTH / QUADTREE_BENCH_VIEWPORT_HEIGHT;
+    double proj[16] = { t / aspect, 0.0, 0.0, 0.0, 0.0, t, 0.0, 0.0, 0.0, 0.0, (far + near) / (near - far), -1.0,
+        0.0, 0.0, 2.0 * far * near / (near - far), 0.0 };
+
+    multiply(proj, view, out);
+}
+
+// Estimates the triangles the tessellator produces for the patches of an EarthQuadtree, using the
+// tessLevel and clampFactor heuristics of earth.tesc on the undisplaced corners. Fractional odd
+// spacing (the fixed grid) rounds the inner levels up to odd integers, equal spacing (the
+// quadtree) up to integers.
+double estimateTriangles(const EarthQuadtree& tree, const double* mvp, double projection11, float scale, bool oddSpacing)
+{
+    const std::vector<float>& data = tree.getPatchData();
+    const unsigned int stride = EarthQuadtree::FLOATS_PER_VERTEX;
+    double triangles = 0.0;
+    for (size_t patch = 0; patch < tree.getNumPatches(); ++patch) {
+        double p[4][3];
+        for (size_t i = 0; i < 4; ++i) {
+            const float* v = data.data() + (patch * 4 + i) * stride;
+            EarthQuadtree::toECEF(v[0], v[1], 0.0, scale, p[i]);
+        }
+
+        double e[4];
+        for (int i = 0; i < 4; ++i) {
+            const double* a = p[i];
+            const double* b = p[(i + 1) % 4];
+            double diameter = std::sqrt((a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]));
+            double center[3] = { (a[0] + b[0]) / 2.0, (a[1] + b[1]) / 2.0, (a[2] + b[2]) / 2.0 };
+            double w = mvp[3] * center[0] + mvp[7] * center[1] + mvp[11] * center[2] + mvp[15];
+            e[i] = std::abs(diameter * projection11 / w) * QUADTREE_BENCH_TESS;
+        }
+
+        auto clampLevel = [oddSpacing](double f) {
+            double level = std::ceil(std::max(std::min(std::min(f, 64.0), static_cast<double>(QUADTREE_BENCH_MAX_TESS)), 1.0));
+            if (oddSpacing && std::fmod(level, 2.0) == 0.0)
+                level += 1.0;
+            return level;
+        };
+        triangles += 2.0 * clampLevel((e[1] + e[3]) / 2.0) * clampLevel((e[0] + e[2]) / 2.0);
+    }
+    return triangles;
+}
+
+// the 1800x3600 grid (a tenth of a degree per tile) the generator benchmark builds
+const static unsigned int GENERATOR_BENCH_TILES_X = 1800;
+const static unsigned int GENERATOR_BENCH_TILES_Y = 3600;
+const static unsigned int GENERATOR_BENCH_RUNS = 3;
+
+// mesh sizes the interleave benchmark generates
+const static size_t INTERLEAVE_BENCH_SIZES[3] = { 10000, 1000000, 10000000 };
+const static unsigned int INTERLEAVE_BENCH_RUNS = 3;
+
+// Exposes the generator's interleaving and index passes and its arenas to the benchmarks.
+class InterleaveBenchGenerator : public ModelMeshRenderDataGenerator {
+public:
+    using ModelMeshRenderDataGenerator::generateOffsets;
+    using ModelMeshRenderDataGenerator::indexArena;
+    using ModelMeshRenderDataGenerator::populateAttributes;
+    using ModelMeshRenderDataGenerator::populateColors;
+    using ModelMeshRenderDataGenerator::populateInterleaved;
+    using ModelMeshRenderDataGenerator::populateTextures;
+    using ModelMeshRenderDataGenerator::populateVertices;
+    using ModelMeshRenderDataGenerator::vertexArena;
+};
+
+// A flight the flight path check parses and poses; its first keyframe isn't at frame 0.
+const static char* FLIGHT_CHECK_FLIGHT = "# descend, then fly east across the antimeridian\n"
+                                         "sweep coarse 8 16 edge 1.0\n"
+                                         "key 10   37 15 1000000   37   15 0\n"
+                                         "key 110  37 25 1000      37.1 25 0 # low over the ground\n"
+                                         "key 210  40 200 1000     40   200 0\n";
+
+// Flights parseFlight has to reject.
+const static char* FLIGHT_CHECK_MALFORMED[] = {
+    "key 10 37 15 1000\n", // too few numbers
+    "key 10 37 15 1000 37 15 0\nkey 10 37 15 1000 37 15 0\n", // frames not increasing
+    "sweep coarse 8 16 fast 1.0\nkey 0 37 15 1000 37 15 0\n", // unknown LOD mode
+    "# no keyframes\n"
+};
+
+// A frame the flight path check poses the camera at, and the eye (lat, lon, alt) and t expected there.
+struct FlightCheckPose {
+    unsigned int frame;
+    double eye[3];
+    double t;
+};
+}
+
+bool EarthBenchmarks::isBenchmarkRequested(const std::vector<std::string>& args, std::string& name)
+{
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "--benchmark") {
+            name = args[i + 1];
+            return true;
+        }
+    }
+    return false;
+}
+
+int EarthBenchmarks::run(const std::string& name)
+{
+    if (name == "pyramid")
+        return runPyramidBenchmark();
+    if (name == "quadtree")
+        return runQuadtreeBenchmark();
+    if (name == "generator")
+        return runGeneratorBenchmark();
+    if (name == "interleave")
+        return runInterleaveBenchmark();
+    if (name == "flightpath")
+        return runFlightPathCheck();
+
+    std::cout << "Error: unknown benchmark \"" << name << "\". Available: pyramid, quadtree, generator, interleave, flightpath, flight, depth" << std::endl;
+    return -1;
+}
+
+int EarthBenchmarks::runPyramidBenchmark()
+{
+    const unsigned int width = PYRAMID_BENCH_WIDTH;
+    const unsigned int height = PYRAMID_BENCH_HEIGHT;
+
+    // pad the base for the scalar loop, which reads one row past the end of odd height levels
+    std::vector<GLshort> base(static_cast<size_t>(width + 1) * (height + 1), 0);
+    fillSyntheticElevation(base.data(), width, height);
+
+    std::cout << "Pyramid benchmark: " << width << "x" << height << " R16I, " << PYRAMID_BENCH_RUNS << " runs, best time reported" << std::endl;
+
+    // baseline
+    std::vector<std::vector<GLshort>> scalarLevels;
+    double scalarMs = 1e30;
+    for (unsigned int run = 0; run < PYRAMID_BENCH_RUNS; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        buildPyramidScalar(base.data(), width, height, scalarLevels);
+        scalarMs = std::min(scalarMs, elapsedMs(start));
+    }
+    std::cout << "   scalar loop             : " << scalarMs << " ms" << std::endl;
+
+    // the builder single-threaded (kernel speedup only) and with every hardware thread
+    unsigned int threadCounts[2] = { 1, std::max(std::thread::hardware_concurrency(), 1u) };
+    bool matches = true;
+    for (unsigned int numThreads : threadCounts) {
+        ElevationPyramidBuilder builder(numThreads);
+        double builderMs = 1e30;
+        for (unsigned int run = 0; run < PYRAMID_BENCH_RUNS; ++run) {
+            // levels whose source had even dimensions must match the scalar loop exactly
+            bool evenSoFar = true;
+            unsigned int sWidth = width;
+            unsigned int sHeight = height;
+
+            auto start = std::chrono::steady_clock::now();
+            builder.build(base.data(), width, height, [&](unsigned int level, unsigned int w, unsigned int h, const GLshort* data) {
+                evenSoFar = evenSoFar && sWidth % 2 == 0 && sHeight % 2 == 0;
+                if (run == 0 && evenSoFar && std::memcmp(data, scalarLevels[level - 1].data(), sizeof(GLshort) * w * h) != 0)
+                    matches = false;
+                sWidth = w;
+                sHeight = h;
+            });
+            builderMs = std::min(builderMs, elapsedMs(start));
+        }
+        std::cout << "   builder (" << ElevationPyramidBuilder::getKernelName() << ", " << numThreads << " thread(s)) : "
+                  << builderMs << " ms (" << scalarMs / builderMs << "x)" << std::endl;
+    }
+
+    std::cout << "   even sized levels match the scalar loop: " << (matches ? "yes" : "NO") << std::endl;
+    return matches ? 0 : -1;
+}
+
+int EarthBenchmarks::runQuadtreeBenchmark()
+{
+    const unsigned int width = QUADTREE_BENCH_WIDTH;
+    const unsigned int height = QUADTREE_BENCH_HEIGHT;
+
+    std::vector<GLshort> elevation(static_cast<size_t>(width) * height);
+    fillSyntheticElevation(elevation.data(), width, height);
+    ElevationBoundsPyramid bounds(width, height);
+    bounds.addRows(0, height, elevation.data());
+    bounds.finish();
+
+    // the same degrees to texels mapping as MGLEarthQuad::getElevationBoundsWGS84, without the sampling margin
+    EarthQuadtree::BoundsCallback getBounds = [&bounds](const Vector& ul, const Vector& lr, float& minElev, float& maxElev) {
+        float x0 = (std::min(ul.y, lr.y) + 180.0f) / 360.0f * bounds.getWidth();
+        float x1 = (std::max(ul.y, lr.y) + 180.0f) / 360.0f * bounds.getWidth();
+        float y0 = (90.0f - std::max(ul.x, lr.x)) / 180.0f * bounds.getHeight();
+        float y1 = (90.0f - std::min(ul.x, lr.x)) / 180.0f * bounds.getHeight();
+        GLshort lo = 0;
+        GLshort hi = 0;
+        bounds.getBounds(static_cast<int>(std::floor(x0)), static_cast<int>(std::floor(y0)),
+            static_cast<int>(std::ceil(x1)) + 1, static_cast<int>(std::ceil(y1)) + 1, lo, hi);
+        minElev = lo;
+        maxElev = hi;
+    };
+
+    // the fixed grid is a quadtree that never splits its 1 degree roots
+    Vector ul(90.0f, -180.0f, 0.0f);
+    Vector lr(-90.0f, 180.0f, 0.0f);
+    EarthQuadtree grid(ul, lr, 180, 360, 0, getBounds);
+    EarthQuadtree quadtree(ul, lr, 2, 4, 12, getBounds);
+
+    double projection11 = 1.0 / std::tan(QUADTREE_BENCH_FOVY * BENCH_PI / 360.0);
+    double projScale = projection11 * QUADTREE_BENCH_VIEWPORT_HEIGHT / 2.0;
+
+    std::cout << "Quadtree benchmark: " << QUADTREE_BENCH_FRAMES << " frame descent from " << QUADTREE_BENCH_START_ALT / 1000.0
+              << " km to " << QUADTREE_BENCH_END_ALT / 1000.0 << " km, " << QUADTREE_BENCH_VIEWPORT_WIDTH << "x" << QUADTREE_BENCH_VIEWPORT_HEIGHT
+              << ", tess " << QUADTREE_BENCH_TESS << ", max tess " << QUADTREE_BENCH_MAX_TESS << ", quadtree max pixel error "
+              << quadtree.getMaxPixelError() << std::endl;
+    std::cout << "   altitude km | grid patches   grid tris | tree patches   tree tris  tree ms  depth" << std::endl;
+
+    // patches, triangles and ms of the grid and the quadtree. The grid's patches are the ones
+    // earth.tesc doesn't cull, and its selection time isn't reported since it costs no CPU time in
+    // the module.
+    double totals[2][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+    for (unsigned int frame = 0; frame < QUADTREE_BENCH_FRAMES; ++frame) {
+        // descend exponentially while flying east, tilting from straight down toward the horizon
+        double t = static_cast<double>(frame) / (QUADTREE_BENCH_FRAMES - 1);
+        double altitude = QUADTREE_BENCH_START_ALT * std::pow(QUADTREE_BENCH_END_ALT / QUADTREE_BENCH_START_ALT, t);
+        double lat = QUADTREE_BENCH_LAT * BENCH_PI / 180.0;
+        double lon = (QUADTREE_BENCH_LON + QUADTREE_BENCH_TRAVEL * t) * BENCH_PI / 180.0;
+        double ahead = (QUADTREE_BENCH_LON + QUADTREE_BENCH_TRAVEL * t + 0.001 + 2.0 * t * t) * BENCH_PI / 180.0;
+
+        double eye[3];
+        double target[3];
+        EarthQuadtree::toECEF(lat, lon, altitude / 10.0, QUADTREE_BENCH_SCALE, eye); // toECEF exaggerates elevation 10x
+        EarthQuadtree::toECEF(lat, ahead, 0.0, QUADTREE_BENCH_SCALE, target);
+        double up[3] = { eye[0], eye[1], eye[2] };
+
+        double near = std::max(altitude * QUADTREE_BENCH_SCALE * 0.1, 1e-3);
+        double far = 3.0 * (6378137.0 + altitude) * QUADTREE_BENCH_SCALE;
+        double mvp[16];
+        lookAtPerspective(eye, target, up, near, far, mvp);
+        float mvpF[16];
+        for (int i = 0; i < 16; ++i)
+            mvpF[i] = static_cast<float>(mvp[i]);
+
+        EarthQuadtree* trees[2] = { &grid, &quadtree };
+        double results[2][3];
+        for (int i = 0; i < 2; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            trees[i]->update(mvpF, static_cast<float>(projScale), QUADTREE_BENCH_SCALE, QUADTREE_BENCH_MAX_TESS);
+            results[i][2] = elapsedMs(start);
+            results[i][0] = trees[i]->getNumPatches();
+            results[i][1] = estimateTriangles(*trees[i], mvp, projection11, QUADTREE_BENCH_SCALE, i == 0);
+            for (int k = 0; k < 3; ++k)
+                totals[i][k] += results[i][k];
+        }
+
+        if (frame % 30 == 0 || frame + 1 == QUADTREE_BENCH_FRAMES) {
+            std::cout << std::fixed << std::setprecision(1) << "   " << std::setw(11) << altitude / 1000.0 << " | " << std::setprecision(0)
+                      << std::setw(12) << results[0][0] << " " << std::setw(11) << results[0][1] << " | " << std::setw(12) << results[1][0] << " " << std::setw(11) << results[1][1]
+                      << " " << std::setprecision(2) << std::setw(8) << results[1][2] << " " << std::setw(6) << quadtree.getDeepestLevel()
+                      << std::defaultfloat << std::endl;
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "   grid     average: " << totals[0][0] / QUADTREE_BENCH_FRAMES << " patches, " << totals[0][1] / QUADTREE_BENCH_FRAMES
+              << " triangles" << std::endl;
+    std::cout << "   quadtree average: " << totals[1][0] / QUADTREE_BENCH_FRAMES << " patches, " << totals[1][1] / QUADTREE_BENCH_FRAMES
+              << " triangles, " << std::setprecision(2) << totals[1][2] / QUADTREE_BENCH_FRAMES << " ms selecting" << std::defaultfloat << std::endl;
+    std::cout << "   (triangles are estimated from the tessellation control heuristic; GPU frame time needs a GL context and is"
+              << " compared in the module by switching earthPatchMode)" << std::endl;
+    return 0;
+}
+
+int EarthBenchmarks::runGeneratorBenchmark()
+{
+    // the whole grid as one chunk with 32 bit indices, as MGLEarthQuad builds it for the patch list
+    const unsigned int numTilesX = GENERATOR_BENCH_TILES_X;
+    const unsigned int numTilesY = GENERATOR_BENCH_TILES_Y;
+    const EarthGridChunk grid = { 0, 0, numTilesX, numTilesY };
+    const Vector upperLeft(90.0f, -180.0f, 0.0f);
+    const Vector lowerRight(-90.0f, 180.0f, 0.0f);
+
+    std::cout << "Generator benchmark: MGLEarthQuad::writeChunkMesh and ModelMeshRenderDataGenerator::generate on a " << numTilesX
+              << "x" << numTilesY << " patch grid, " << GENERATOR_BENCH_RUNS << " runs, best time reported" << std::endl;
+
+    const char* names[2] = { "vectors + copy", "arenas        " };
+    for (int path = 0; path < 2; ++path) {
+        bool useArenas = path == 1;
+        double best = 1e30;
+        size_t held = 0;
+        for (unsigned int run = 0; run < GENERATOR_BENCH_RUNS; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            InterleaveBenchGenerator data;
+            MGLEarthQuad::writeChunkMesh(data, grid, upperLeft, lowerRight, numTilesX, numTilesY, false, useArenas);
+
+            // generate copies the vectors into the render data's buffers while they are still alive
+            size_t vectorBytes = data.getVerts()->capacity() * sizeof(Vector) + data.getIndicies()->capacity() * sizeof(unsigned int);
+            {
+                ModelMeshRenderData renderData = data.generate(MESH_SHADING_TYPE::mstNONE, GL_PATCHES);
+                held = vectorBytes + grid.getNumVerts() * data.stride + grid.getNumIndices() * sizeof(GLuint);
+            }
+            best = std::min(best, elapsedMs(start));
+        }
+        std::cout << std::fixed << std::setprecision(1) << "   " << names[path] << " : " << best << " ms, " << held / (1024.0 * 1024.0)
+                  << " MB held at once while generating" << std::defaultfloat << std::endl;
+    }
+
+    // both paths have to hand the same vertices and indices to the render data
+    InterleaveBenchGenerator vectors;
+    InterleaveBenchGenerator arenas;
+    MGLEarthQuad::writeChunkMesh(vectors, grid, upperLeft, lowerRight, numTilesX, numTilesY, false, false);
+    MGLEarthQuad::writeChunkMesh(arenas, grid, upperLeft, lowerRight, numTilesX, numTilesY, false, true);
+    vectors.generateOffsets(MESH_SHADING_TYPE::mstNONE);
+    std::vector<GLubyte> interleaved(grid.getNumVerts() * vectors.stride);
+    vectors.populateInterleaved(interleaved.data());
+    const std::vector<unsigned int>& indices = *vectors.getIndicies();
+    bool matches = vectors.stride == arenas.stride && std::memcmp(interleaved.data(), arenas.vertexArena, interleaved.size()) == 0
+        && std::equal(indices.begin(), indices.end(), static_cast<const GLuint*>(arenas.indexArena));
+    std::cout << "   render data matches: " << (matches ? "yes" : "NO") << std::endl;
+    return matches ? 0 : -1;
+}
+
+int EarthBenchmarks::runInterleaveBenchmark()
+{
+    unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::cout << "Interleave benchmark: smooth shaded meshes with a position, an RGBA color and a 2D texture coordinate per vertex, "
+              << INTERLEAVE_BENCH_RUNS << " runs, best time reported" << std::endl;
+    std::cout << "       verts | four passes ms | fused 1 thread ms | fused " << hardwareThreads << " thread(s) ms | speedup" << std::endl;
+
+    bool matches = true;
+    for (size_t numVerts : INTERLEAVE_BENCH_SIZES) {
+        InterleaveBenchGenerator data;
+        data.numColorChannels = GL_RGBA;
+        data.getVerts()->resize(numVerts);
+        data.getColors()->resize(numVerts);
+        data.getTexCoords()->push_back(std::make_pair(std::vector<aftrTexture4f>(numVerts), static_cast<GLenum>(GL_TEXTURE_2D)));
+        for (size_t i = 0; i < numVerts; ++i) {
+            float f = static_cast<float>(i);
+            (*data.getVerts())[i] = Vector(f, f * 0.5f, -f);
+            aftrColor4ub& color = (*data.getColors())[i];
+            color.r = static_cast<GLubyte>(i);
+            color.g = static_cast<GLubyte>(i >> 8);
+            color.b = static_cast<GLubyte>(i >> 16);
+            color.a = 255;
+            aftrTexture4f& coord = (*data.getTexCoords())[0].first[i];
+            coord.u = f / numVerts;
+            coord.v = 1.0f - f / numVerts;
+        }
+
+        // lays the buffer out for smooth shading, the normals are left alone by every pass
+        GLubyte* fused = data.allocateVertexArena(MESH_SHADING_TYPE::mstSMOOTH, numVerts);
+        size_t size = static_cast<size_t>(data.stride) * numVerts;
+        std::vector<GLubyte> separate(size, 0);
+        std::memset(fused, 0, size);
+
+        double times[3] = { 1e30, 1e30, 1e30 };
+        for (unsigned int run = 0; run < INTERLEAVE_BENCH_RUNS; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            data.populateVertices(separate.data());
+            data.populateColors(separate.data());
+            data.populateTextures(separate.data());
+            data.populateAttributes(separate.data());
+            times[0] = std::min(times[0], elapsedMs(start));
+
+            unsigned int threadCounts[2] = { 1, hardwareThreads };
+            for (int i = 0; i < 2; ++i) {
+                ModelMeshRenderDataGenerator::setMaxInterleaveThreads(threadCounts[i]);
+                start = std::chrono::steady_clock::now();
+                data.populateInterleaved(fused);
+                times[i + 1] = std::min(times[i + 1], elapsedMs(start));
+            }
+        }
+        ModelMeshRenderDataGenerator::setMaxInterleaveThreads(0);
+
+        matches = matches && std::memcmp(fused, separate.data(), size) == 0;
+        std::cout << std::fixed << std::setprecision(2) << "   " << std::setw(9) << numVerts << " | " << std::setw(14) << times[0] << " | "
+                  << std::setw(17) << times[1] << " | " << std::setw(16 + std::to_string(hardwareThreads).size()) << times[2] << " | "
+                  << std::setw(6) << times[0] / times[2] << "x" << std::defaultfloat << std::endl;
+    }
+
+    std::cout << "   fused buffers match the four passes: " << (matches ? "yes" : "NO") << std::endl;
+    return matches ? 0 : -1;
+}
+
+int EarthBenchmarks::runFlightPathCheck()
+{
+    std::cout << "Flight path check: parsing flights and interpolating the camera of a flight starting at frame 10" << std::endl;
+
+    std::istringstream in(FLIGHT_CHECK_FLIGHT);
+    std::vector<EarthFlightKeyframe> keyframes;
+    std::vector<EarthFlightSettings> sweep;
+    std::string error;
+    bool parsed = EarthFlightBenchmark::parseFlight(in, keyframes, sweep, error) && keyframes.size() == 3 && sweep.size() == 1
+        && keyframes[1].frame == 110 && keyframes[1].target[0] == 37.1 && sweep[0].name == "coarse" && sweep[0].maxTessellationFactor == 16.0f
+        && sweep[0].lodMode == EARTH_LOD_MODE::elmEDGE_LENGTH;
+    std::cout << "   flight parsed: " << (parsed ? "yes" : "NO " + error) << std::endl;
+
+    bool rejected = true;
+    for (const char* flight : FLIGHT_CHECK_MALFORMED) {
+        std::istringstream malformed(flight);
+        std::vector<EarthFlightKeyframe> k;
+        std::vector<EarthFlightSettings> s;
+        rejected = rejected && !EarthFlightBenchmark::parseFlight(malformed, k, s, error);
+    }
+    std::cout << "   malformed flights rejected: " << (rejected ? "yes" : "NO") << std::endl;
+    if (!parsed)
+        return -1;
+
+    // before the first keyframe, on it, halfway down (geometric in altitude), on the second, halfway east, past the end
+    const FlightCheckPose poses[] = {
+        { 0, { 37.0, 15.0, 1.0e6 }, 0.0 },
+        { 10, { 37.0, 15.0, 1.0e6 }, 0.0 },
+        { 60, { 37.0, 20.0, std::sqrt(1.0e6 * 1.0e3) }, 0.5 },
+        { 110, { 37.0, 25.0, 1.0e3 }, 0.0 },
+        { 160, { 38.5, 112.5, 1.0e3 }, 0.5 },
+        { 500, { 40.0, 200.0, 1.0e3 }, 0.0 }
+    };
+    bool posed = true;
+    for (const FlightCheckPose& pose : poses) {
+        size_t a = 0;
+        size_t b = 0;
+        double t = 0.0;
+        double eye[3];
+        EarthFlightBenchmark::interpolateKeyframes(keyframes, pose.frame, a, b, t, eye);
+        bool matches = std::abs(t - pose.t) < 1.0e-9;
+        for (int i = 0; i < 3; ++i)
+            matches = matches && std::abs(eye[i] - pose.eye[i]) <= 1.0e-9 * std::max(1.0, std::abs(pose.eye[i]));
+        posed = posed && matches;
+        std::cout << std::setprecision(6) << "   frame " << std::setw(3) << pose.frame << ": eye " << eye[0] << ", " << eye[1] << ", "
+                  << eye[2] << " m, t " << t << ", expected pose: " << (matches ? "yes" : "NO") << std::endl;
+    }
+    return rejected && posed ? 0 : -1;
+}
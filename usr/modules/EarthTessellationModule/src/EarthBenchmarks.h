@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Aftr {
+/**
+   This class holds the module's offline micro-benchmarks. They run from the command line
+   (--benchmark <name>) before any GLView or OpenGL context is created and print their results
+   to the console.
+*/
+class EarthBenchmarks {
+public:
+    // Returns true if args request a benchmark, storing its name in name.
+    static bool isBenchmarkRequested(const std::vector<std::string>& args, std::string& name);
+
+    // Runs the named benchmark. Returns the process exit code.
+    static int run(const std::string& name);
+
+protected:
+    // Compares ElevationPyramidBuilder against the original single-threaded scalar mipmap loop.
+    static int runPyramidBenchmark();
+
+    /**
+        Flies a scripted descent from orbit to the surface and compares the fixed 180x360 patch grid
+        with the EarthQuadtree: patches drawn, estimated triangles after tessellation, and the CPU
+        time spent selecting patches each frame.
+    */
+    static int runQuadtreeBenchmark();
+
+    /**
+        Builds the render data of an 1800x3600 patch grid with MGLEarthQuad::writeChunkMesh and
+        ModelMeshRenderDataGenerator::generate, once through getVerts() and getIndicies() (which
+        generate copies) and once through the generator's arenas (which generate hands over), and
+        compares the time, the memory held at once and the render data of both.
+    */
+    static int runGeneratorBenchmark();
+
+    /**
+        Interleaves 10k, 1M and 10M vertex meshes with ModelMeshRenderDataGenerator's fused, threaded
+        pass and with its original four passes (verts, colors, texture coordinates, attributes), and
+        checks that both fill the buffer the same way.
+    */
+    static int runInterleaveBenchmark();
+
+    /**
+        Parses a flight with EarthFlightBenchmark::parseFlight, checks that malformed flights are
+        rejected, and checks the eye interpolated before, on, between and after the keyframes of a
+        flight whose first keyframe isn't at frame 0.
+    */
+    static int runFlightPathCheck();
+};
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "AftrUtilities.h"
+#include "ManagerEnvironmentConfiguration.h"
+
+#include <string>
+
+namespace Aftr {
+/**
+   Helpers for reading this module's optional aftr.conf settings. Each returns the supplied
+   default when the variable is not present in the configuration file.
+*/
+namespace EarthConfig {
+    // Returns the raw value of the variable, or def if it is not set.
+    inline std::string getString(const std::string& name, const std::string& def)
+    {
+        std::string value = ManagerEnvironmentConfiguration::getVariableValue(name);
+        return value.empty() ? def : value;
+    }
+
+    // Returns the variable as an int, or def if it is not set.
+    inline int getInt(const std::string& name, int def)
+    {
+        std::string value = ManagerEnvironmentConfiguration::getVariableValue(name);
+        return value.empty() ? def : Aftr::toInt(value);
+    }
+
+    // Returns the variable as a float, or def if it is not set.
+    inline float getFloat(const std::string& name, float def)
+    {
+        std::string value = ManagerEnvironmentConfiguration::getVariableValue(name);
+        return value.empty() ? def : Aftr::toFloat(value);
+    }
+
+    // Returns the variable as a bool (anything other than "0" or "false" is true), or def if it is not set.
+    inline bool getBool(const std::string& name, bool def)
+    {
+        std::string value = ManagerEnvironmentConfiguration::getVariableValue(name);
+        if (value.empty())
+            return def;
+        return value != "0" && value != "false";
+    }
+}
+}
@@ -0,0 +1,171 @@
+#include "EarthDepthBenchmark.h"
+
+#include "Camera.h"
+#include "GLSLShader.h"
+#include "GLSLShaderDescriptor.h"
+#include "ManagerEnvironmentConfiguration.h"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+using namespace Aftr;
+
+namespace {
+// size of the offscreen framebuffer the test scene is rendered into
+const static GLsizei DEPTH_BENCHMARK_SIZE = 256;
+
+// camera altitudes in meters the ground is looked at from
+const static double DEPTH_BENCHMARK_ALTITUDES[] = { 10.0, 100.0, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7 };
+
+// distances in meters between the two surfaces
+const static double DEPTH_BENCHMARK_SEPARATIONS[] = { 0.1, 1.0, 10.0, 100.0, 1.0e3, 1.0e4 };
+
+const static double DEPTH_BENCHMARK_EARTH_RADIUS = 6378137.0;
+}
+
+bool EarthDepthBenchmark::isRequested(const std::vector<std::string>& args)
+{
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "--benchmark" && args[i + 1] == "depth")
+            return true;
+    }
+    return false;
+}
+
+GLuint EarthDepthBenchmark::drawSurface(GLuint query, GLint viewDepthLocation, float viewDepth)
+{
+    glUniform1f(viewDepthLocation, viewDepth);
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    GLuint samples = 0;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+    return samples;
+}
+
+bool EarthDepthBenchmark::run(const Camera& cam, float scale)
+{
+    GLSLShaderDescriptor desc;
+    desc.vertexShader = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth_depth_test.vert";
+    desc.fragmentShader = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth_depth_test.frag";
+    GLSLShader* shader = GLSLShader::New(desc);
+    if (shader == nullptr) {
+        std::cout << "Depth benchmark: could not load the test scene's shaders" << std::endl;
+        return false;
+    }
+
+    // remember the state the scene changes
+    GLint oldFramebuffer = 0;
+    GLint oldViewport[4] = { 0, 0, 0, 0 };
+    GLint oldVertexArray = 0;
+    GLint oldDepthFunc = GL_LESS;
+    GLboolean oldDepthMask = GL_TRUE;
+    GLboolean oldDepthTest = glIsEnabled(GL_DEPTH_TEST);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &oldFramebuffer);
+
+    // the test scene gets a depth buffer as deep as the one drawn to, so it z-fights like the window would
+    GLint depthBits = 0;
+    GLenum depthAttachment = oldFramebuffer == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    GLenum depthFormat = depthBits == 16 ? GL_DEPTH_COMPONENT16 : depthBits == 32 ? GL_DEPTH_COMPONENT32 : GL_DEPTH_COMPONENT24;
+    if (depthBits != 16 && depthBits != 32)
+        depthBits = 24;
+    glGetIntegerv(GL_VIEWPORT, oldViewport);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &oldVertexArray);
+    glGetIntegerv(GL_DEPTH_FUNC, &oldDepthFunc);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &oldDepthMask);
+
+    GLuint renderbuffers[2] = { 0, 0 };
+    GLuint framebuffer = 0;
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, DEPTH_BENCHMARK_SIZE, DEPTH_BENCHMARK_SIZE);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, DEPTH_BENCHMARK_SIZE, DEPTH_BENCHMARK_SIZE);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // the surfaces are generated from gl_VertexID, but a core profile draw still needs a vertex array
+    GLuint vertexArray = 0;
+    GLuint query = 0;
+    glGenVertexArrays(1, &vertexArray);
+    glGenQueries(1, &query);
+
+    const Mat4 projection = cam.getCameraProjectionMatrix();
+    const float* p = projection.getPtr();
+    if (complete) {
+        glViewport(0, 0, DEPTH_BENCHMARK_SIZE, DEPTH_BENCHMARK_SIZE);
+        glBindVertexArray(vertexArray);
+        glEnable(GL_DEPTH_TEST);
+        shader->bind();
+        GLint projectionLocation = glGetUniformLocation(shader->getHandle(), "Projection");
+        GLint viewDepthLocation = glGetUniformLocation(shader->getHandle(), "viewDepth");
+        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, p);
+
+        // the planes of a glFrustum style projection, whose P[10] = (f + n) / (n - f) and P[14] = 2fn / (n - f),
+        // the far plane comes out infinite when P[10] rounds to -1
+        double nearPlane = p[14] / (p[10] - 1.0) / scale;
+        double farPlane = std::abs(p[14] / (p[10] + 1.0)) / scale;
+        std::cout << "Depth benchmark: share of the samples of a surface that z-fight with one the separation closer to the camera, "
+                  << depthBits << " bit depth buffer, near plane " << nearPlane << " m, far plane " << farPlane << " m" << std::endl;
+        std::cout << "   " << std::setw(9) << "altitude" << std::setw(9) << "view" << std::setw(11) << "depth";
+        for (double separation : DEPTH_BENCHMARK_SEPARATIONS)
+            std::cout << " | " << std::setw(7) << separation << " m";
+        std::cout << std::endl;
+
+        const double numSamples = static_cast<double>(DEPTH_BENCHMARK_SIZE) * DEPTH_BENCHMARK_SIZE;
+        for (double altitude : DEPTH_BENCHMARK_ALTITUDES) {
+            // straight down, and the horizon, the farthest ground the camera sees
+            const double depths[2] = { altitude, std::sqrt(altitude * (2.0 * DEPTH_BENCHMARK_EARTH_RADIUS + altitude)) };
+            const char* views[2] = { "nadir", "horizon" };
+            for (int v = 0; v < 2; ++v) {
+                std::cout << std::setprecision(3) << "   " << std::setw(9) << altitude << std::setw(9) << views[v] << std::setw(11) << depths[v];
+                for (double separation : DEPTH_BENCHMARK_SEPARATIONS) {
+                    float nearDepth = static_cast<float>(depths[v] * scale);
+                    float farDepth = static_cast<float>((depths[v] + separation) * scale);
+
+                    // the far surface alone, then the near one with the far one tested against it
+                    glDepthMask(GL_TRUE);
+                    glDepthFunc(GL_LESS);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    GLuint farAlone = drawSurface(query, viewDepthLocation, farDepth);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    GLuint nearAlone = drawSurface(query, viewDepthLocation, nearDepth);
+                    glDepthMask(GL_FALSE);
+                    glDepthFunc(GL_LEQUAL);
+                    GLuint fighting = drawSurface(query, viewDepthLocation, farDepth);
+
+                    std::cout << " | " << std::setw(9);
+                    if (nearAlone < numSamples || farAlone < numSamples)
+                        std::cout << "clipped";
+                    else
+                        std::cout << std::fixed << std::setprecision(1) << 100.0 * fighting / numSamples << "%" << std::defaultfloat;
+                }
+                std::cout << std::endl;
+            }
+        }
+        std::cout << std::setprecision(6);
+        shader->unbind();
+    } else
+        std::cout << "Depth benchmark: the offscreen framebuffer is incomplete" << std::endl;
+
+    glDeleteQueries(1, &query);
+    glDeleteVertexArrays(1, &vertexArray);
+    glBindFramebuffer(GL_FRAMEBUFFER, oldFramebuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(2, renderbuffers);
+    glBindVertexArray(oldVertexArray);
+    glViewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
+    glDepthFunc(oldDepthFunc);
+    glDepthMask(oldDepthMask);
+    if (!oldDepthTest)
+        glDisable(GL_DEPTH_TEST);
+    delete shader;
+    return complete;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <string>
+#include <vector>
+
+namespace Aftr {
+class Camera;
+
+/**
+   This class renders a z-fighting test scene with the camera's projection (the module's earthNearPlane,
+   earthFarPlane and earthScale) and prints how much two surfaces a given distance apart z-fight at the
+   depths the ground is seen at. It runs inside GLViewEarthTessellationModule when the module is started with
+
+       --benchmark depth [--headless]
+
+   For every camera altitude the ground is looked at straight down (at the altitude) and at the horizon
+   (the farthest ground in view). At each of these depths a surface covering the view, tilted a little so
+   its samples span a few depth buffer values, is drawn into an offscreen framebuffer with a depth buffer
+   as deep as the window's, then a second one a separation farther away is drawn behind it with GL_LEQUAL
+   and counted with a GL_SAMPLES_PASSED query. Every sample of the far surface passing is one whose depth
+   the buffer can't tell from the near surface's, so which of the two is seen depends on the draw order
+   and the rasterizer's rounding: it z-fights. Depths outside the near and far planes are reported as
+   clipped.
+*/
+class EarthDepthBenchmark {
+public:
+    // Returns true if args request the depth benchmark.
+    static bool isRequested(const std::vector<std::string>& args);
+
+    /**
+        Renders the test scene with cam's projection, scale world units per meter, and prints the share of
+        z-fighting samples of every altitude, view and separation. Restores the framebuffer, viewport, vertex
+        array and depth state it changes. Returns false, after printing why, if the scene couldn't be rendered.
+    */
+    static bool run(const Camera& cam, float scale);
+
+protected:
+    // Draws the test surface at viewDepth world units from the camera, returns the number of samples that passed the depth test.
+    static GLuint drawSurface(GLuint query, GLint viewDepthLocation, float viewDepth);
+};
+}
@@ -0,0 +1,528 @@
+#include "EarthFlightBenchmark.h"
+
+#include "Camera.h"
+#include "MGLEarthQuad.h"
+#include "ManagerEnvironmentConfiguration.h"
+#include "Vector.h"
+#include "WO.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifdef AFTR_CONFIG_USE_GDAL
+// Note: GDAL internally has warnings in their library headers, so I'm doing this to suppress them
+#pragma warning(push, 0)
+#include "gdal_priv.h"
+#pragma warning(pop)
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace Aftr;
+
+namespace {
+const static double FLIGHT_PI = 3.14159265358979323846;
+
+// size of the synthetic elevation raster (5 arc minutes) and imagery
+const static int SYNTHETIC_ELEVATION_WIDTH = 4320;
+const static int SYNTHETIC_ELEVATION_HEIGHT = 2160;
+const static int SYNTHETIC_IMAGERY_WIDTH = 2048;
+const static int SYNTHETIC_IMAGERY_HEIGHT = 1024;
+
+// the synthetic volcano stands where the module's camera starts, so the default flight sees it
+const static double SYNTHETIC_PEAK_LAT = 37.75;
+const static double SYNTHETIC_PEAK_LON = 15.0;
+const static double SYNTHETIC_PEAK_HEIGHT = 3300.0;
+const static double SYNTHETIC_PEAK_RADIUS = 0.25; // degrees
+
+// Returns the elevation in meters of the synthetic earth: ocean basins, continents, ridges and a volcano.
+double syntheticElevation(double lat, double lon)
+{
+    double latRad = lat * FLIGHT_PI / 180.0;
+    double lonRad = lon * FLIGHT_PI / 180.0;
+    double h = 2500.0 * std::sin(lonRad * 3.0) * std::cos(latRad * 2.0) + 1500.0 * std::sin((latRad + lonRad) * 7.0) - 1200.0;
+    h += 600.0 * std::sin(lonRad * 53.0) * std::sin(latRad * 47.0);
+
+    double dLat = lat - SYNTHETIC_PEAK_LAT;
+    double dLon = (lon - SYNTHETIC_PEAK_LON) * std::cos(latRad);
+    double peak = SYNTHETIC_PEAK_HEIGHT * std::exp(-(dLat * dLat + dLon * dLon) / (2.0 * SYNTHETIC_PEAK_RADIUS * SYNTHETIC_PEAK_RADIUS));
+    return std::max(-10000.0, std::min(8000.0, std::max(h, peak)));
+}
+
+// Writes the color of elevation h to rgb: deep to shallow blue below sea level, then green, brown and snow.
+void syntheticColor(double h, unsigned char* rgb)
+{
+    double r, g, b;
+    if (h < 0.0) {
+        double t = std::min(-h / 6000.0, 1.0);
+        r = 30.0 - 20.0 * t;
+        g = 90.0 - 60.0 * t;
+        b = 170.0 - 70.0 * t;
+    } else if (h < 1500.0) {
+        double t = h / 1500.0;
+        r = 70.0 + 70.0 * t;
+        g = 120.0 - 10.0 * t;
+        b = 50.0 + 10.0 * t;
+    } else {
+        double t = std::min((h - 1500.0) / 2000.0, 1.0);
+        r = 140.0 + 110.0 * t;
+        g = 110.0 + 140.0 * t;
+        b = 60.0 + 190.0 * t;
+    }
+    rgb[0] = static_cast<unsigned char>(r);
+    rgb[1] = static_cast<unsigned char>(g);
+    rgb[2] = static_cast<unsigned char>(b);
+}
+
+// Returns the peak resident memory of the process in bytes.
+size_t getPeakMemoryBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss); // bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+#endif
+}
+
+// Returns the earth centered position of (lat, lon, alt) scaled and placed like the earth model.
+Vector toWorld(const double* latLonAlt, const Vector& origin, float scale)
+{
+    VectorD p = VectorD(latLonAlt[0], latLonAlt[1], latLonAlt[2]).toECEFfromWGS84();
+    return origin + Vector(static_cast<float>(p.x * scale), static_cast<float>(p.y * scale), static_cast<float>(p.z * scale));
+}
+
+// Returns s as a quoted JSON string.
+std::string jsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            out += c;
+    }
+    return out + "\"";
+}
+
+const char* lodModeName(EARTH_LOD_MODE mode)
+{
+    return mode == EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR ? "sse" : "edge";
+}
+}
+
+bool EarthFlightBenchmark::isRequested(const std::vector<std::string>& args)
+{
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        if (args[i] == "--benchmark" && args[i + 1] == "flight")
+            return true;
+    }
+    return false;
+}
+
+bool EarthFlightBenchmark::isHeadless(const std::vector<std::string>& args)
+{
+    return std::find(args.begin(), args.end(), "--headless") != args.end();
+}
+
+bool EarthFlightBenchmark::writeSyntheticDataset(const std::string& dir, std::string& elevation, std::string& imagery)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    elevation = (std::filesystem::path(dir) / "earth_synthetic_elevation.tif").string();
+    imagery = (std::filesystem::path(dir) / "earth_synthetic_imagery.png").string();
+
+    // the dataset never changes, and rewriting it would invalidate the elevation pyramid cache next to it
+    if (std::filesystem::exists(elevation, ec) && std::filesystem::exists(imagery, ec))
+        return true;
+
+#ifdef AFTR_CONFIG_USE_GDAL
+    GDALAllRegister();
+    GDALDriver* tiff = GetGDALDriverManager()->GetDriverByName("GTiff");
+    GDALDriver* mem = GetGDALDriverManager()->GetDriverByName("MEM");
+    GDALDriver* png = GetGDALDriverManager()->GetDriverByName("PNG");
+    if (tiff == nullptr || mem == nullptr || png == nullptr) {
+        std::cout << "Error: GDAL lacks the GTiff, MEM or PNG driver needed for the synthetic dataset" << std::endl;
+        return false;
+    }
+
+    // grid registered like ETOPO1, row 0 at the north pole
+    std::vector<GLshort> heights(static_cast<size_t>(SYNTHETIC_ELEVATION_WIDTH) * SYNTHETIC_ELEVATION_HEIGHT);
+    for (int y = 0; y < SYNTHETIC_ELEVATION_HEIGHT; ++y) {
+        double lat = 90.0 - 180.0 * y / (SYNTHETIC_ELEVATION_HEIGHT - 1);
+        for (int x = 0; x < SYNTHETIC_ELEVATION_WIDTH; ++x) {
+            double lon = -180.0 + 360.0 * x / (SYNTHETIC_ELEVATION_WIDTH - 1);
+            heights[static_cast<size_t>(y) * SYNTHETIC_ELEVATION_WIDTH + x] = static_cast<GLshort>(syntheticElevation(lat, lon));
+        }
+    }
+
+    GDALDataset* elevDataset = tiff->Create(elevation.c_str(), SYNTHETIC_ELEVATION_WIDTH, SYNTHETIC_ELEVATION_HEIGHT, 1, GDT_Int16, nullptr);
+    if (elevDataset == nullptr) {
+        std::cout << "Error: unable to create " << elevation << std::endl;
+        return false;
+    }
+    double geoTransform[6] = { -180.0, 360.0 / (SYNTHETIC_ELEVATION_WIDTH - 1), 0.0, 90.0, 0.0, -180.0 / (SYNTHETIC_ELEVATION_HEIGHT - 1) };
+    elevDataset->SetGeoTransform(geoTransform);
+    CPLErr err = elevDataset->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, SYNTHETIC_ELEVATION_WIDTH, SYNTHETIC_ELEVATION_HEIGHT,
+        heights.data(), SYNTHETIC_ELEVATION_WIDTH, SYNTHETIC_ELEVATION_HEIGHT, GDT_Int16, 0, 0);
+    GDALClose(elevDataset);
+    if (err != CE_None) {
+        std::cout << "Error: unable to write " << elevation << std::endl;
+        return false;
+    }
+
+    // the PNG driver can only copy a finished dataset, so paint the imagery in memory first
+    std::vector<unsigned char> rgb(static_cast<size_t>(SYNTHETIC_IMAGERY_WIDTH) * SYNTHETIC_IMAGERY_HEIGHT * 3);
+    for (int y = 0; y < SYNTHETIC_IMAGERY_HEIGHT; ++y) {
+        double lat = 90.0 - 180.0 * (y + 0.5) / SYNTHETIC_IMAGERY_HEIGHT;
+        for (int x = 0; x < SYNTHETIC_IMAGERY_WIDTH; ++x) {
+            double lon = -180.0 + 360.0 * (x + 0.5) / SYNTHETIC_IMAGERY_WIDTH;
+            syntheticColor(syntheticElevation(lat, lon), &rgb[(static_cast<size_t>(y) * SYNTHETIC_IMAGERY_WIDTH + x) * 3]);
+        }
+    }
+
+    GDALDataset* memDataset = mem->Create("", SYNTHETIC_IMAGERY_WIDTH, SYNTHETIC_IMAGERY_HEIGHT, 3, GDT_Byte, nullptr);
+    err = memDataset->RasterIO(GF_Write, 0, 0, SYNTHETIC_IMAGERY_WIDTH, SYNTHETIC_IMAGERY_HEIGHT, rgb.data(),
+        SYNTHETIC_IMAGERY_WIDTH, SYNTHETIC_IMAGERY_HEIGHT, GDT_Byte, 3, nullptr, 3, SYNTHETIC_IMAGERY_WIDTH * 3, 1);
+    GDALDataset* pngDataset = err == CE_None ? png->CreateCopy(imagery.c_str(), memDataset, FALSE, nullptr, nullptr, nullptr) : nullptr;
+    GDALClose(memDataset);
+    if (pngDataset == nullptr) {
+        std::cout << "Error: unable to write " << imagery << std::endl;
+        return false;
+    }
+    GDALClose(pngDataset);
+
+    std::cout << "Wrote the synthetic earth dataset to " << dir << std::endl;
+    return true;
+#else
+    std::cout << "Error: the synthetic dataset needs GDAL" << std::endl;
+    return false;
+#endif
+}
+
+EarthFlightBenchmark::EarthFlightBenchmark(const std::vector<std::string>& args)
+{
+    this->flightPath.clear();
+    this->outputPath = "earth_flight.json";
+    this->synthetic = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--flight" && i + 1 < args.size())
+            this->flightPath = args[++i];
+        else if (args[i] == "--out" && i + 1 < args.size())
+            this->outputPath = args[++i];
+        else if (args[i] == "--synthetic")
+            this->synthetic = true;
+    }
+    this->pipelineStatistics = false;
+    this->step = 0;
+    this->pendingPass = 0;
+    this->pendingFrame = 0;
+}
+
+bool EarthFlightBenchmark::load()
+{
+    // the managers aren't initialized when the constructor runs, so the default path is resolved here
+    if (this->flightPath.empty())
+        this->flightPath = ManagerEnvironmentConfiguration::getLMM() + "benchmark/earth_flight.txt";
+
+    std::ifstream in(this->flightPath);
+    if (!in) {
+        std::cout << "Error: unable to open flight " << this->flightPath << std::endl;
+        return false;
+    }
+
+    std::string error;
+    if (!parseFlight(in, this->keyframes, this->sweep, error)) {
+        std::cout << "Error: " << this->flightPath << ": " << error << std::endl;
+        return false;
+    }
+
+    unsigned int numFrames = this->keyframes.back().frame + 1;
+    size_t numPasses = std::max<size_t>(this->sweep.size(), 1);
+    this->passes.assign(numPasses, std::vector<EarthFlightFrame>(numFrames));
+    std::cout << "Flying " << this->flightPath << ": " << numFrames << " frames, " << numPasses << " settings" << std::endl;
+    return true;
+}
+
+bool EarthFlightBenchmark::parseFlight(std::istream& in, std::vector<EarthFlightKeyframe>& keyframes,
+    std::vector<EarthFlightSettings>& sweep, std::string& error)
+{
+    keyframes.clear();
+    sweep.clear();
+
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command))
+            continue;
+
+        bool ok = false;
+        if (command == "key") {
+            EarthFlightKeyframe key;
+            ok = static_cast<bool>(words >> key.frame >> key.eye[0] >> key.eye[1] >> key.eye[2] >> key.target[0] >> key.target[1] >> key.target[2]);
+            ok = ok && (keyframes.empty() || key.frame > keyframes.back().frame);
+            if (ok)
+                keyframes.push_back(key);
+        } else if (command == "sweep") {
+            EarthFlightSettings settings;
+            std::string lod;
+            ok = static_cast<bool>(words >> settings.name >> settings.tessellationFactor >> settings.maxTessellationFactor >> lod >> settings.targetPixelError);
+            ok = ok && (lod == "edge" || lod == "sse");
+            settings.lodMode = lod == "sse" ? EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR : EARTH_LOD_MODE::elmEDGE_LENGTH;
+            if (ok)
+                sweep.push_back(settings);
+        }
+
+        if (!ok) {
+            error = "line " + std::to_string(lineNumber) + " is not a valid key (with increasing frames) or sweep command";
+            return false;
+        }
+    }
+
+    if (keyframes.empty()) {
+        error = "the flight has no keyframes";
+        return false;
+    }
+    return true;
+}
+
+bool EarthFlightBenchmark::update(WO* earth, Camera* cam)
+{
+    MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+    const EarthRenderProfiler& profiler = mod->getProfiler();
+    auto now = std::chrono::steady_clock::now();
+
+    if (this->step == 0) {
+        const GLubyte* name = glGetString(GL_RENDERER);
+        this->renderer = name != nullptr ? reinterpret_cast<const char*>(name) : "";
+        this->pipelineStatistics = profiler.isCountingStatistics();
+
+        // without a sweep the flight is flown once with whatever the module was started with
+        if (this->sweep.empty())
+            this->sweep.push_back({ "default", mod->getTessellationFactor(), mod->getMaxTessellationFactor(), mod->getLODMode(), mod->getTargetPixelError() });
+    }
+
+    // each pass renders the flight's frames and then holds the last pose until the GPU results are in
+    unsigned int numFrames = static_cast<unsigned int>(this->passes[0].size());
+    unsigned int passLength = numFrames + EarthRenderProfiler::NUM_FRAMES;
+
+    // record the frame rendered since the last call
+    if (this->step > WARMUP_FRAMES) {
+        unsigned int done = this->step - 1 - WARMUP_FRAMES;
+        if (done % passLength < numFrames) {
+            EarthFlightFrame& frame = this->passes[done / passLength][done % passLength];
+            frame.cpuMs = std::chrono::duration<double, std::milli>(now - this->lastUpdate).count();
+            frame.profilerFrame = profiler.getFrame();
+            frame.peakMemoryBytes = getPeakMemoryBytes();
+        }
+    }
+    this->collectGPUResults(profiler);
+    this->lastUpdate = now;
+
+    // pose the camera for the next frame
+    unsigned int next = this->step++;
+    unsigned int pass = 0;
+    unsigned int frame = 0;
+    if (next >= WARMUP_FRAMES) {
+        pass = (next - WARMUP_FRAMES) / passLength;
+        frame = std::min((next - WARMUP_FRAMES) % passLength, numFrames - 1);
+        if (pass >= this->passes.size()) {
+            if (this->writeJSON())
+                std::cout << "Wrote the flight benchmark results to " << this->outputPath << std::endl;
+            this->printSummary();
+            return false;
+        }
+    }
+    if (next == 0 || (next >= WARMUP_FRAMES && (next - WARMUP_FRAMES) % passLength == 0))
+        applySettings(this->sweep[pass], mod);
+    this->poseCamera(frame, earth, cam);
+    return true;
+}
+
+void EarthFlightBenchmark::interpolateKeyframes(const std::vector<EarthFlightKeyframe>& keyframes, unsigned int frame, size_t& a, size_t& b,
+    double& t, double* eye)
+{
+    // the segment of the flight frame lies on, frames before the first keyframe hold its pose
+    a = 0;
+    while (a + 1 < keyframes.size() && keyframes[a + 1].frame <= frame)
+        ++a;
+    b = std::min(a + 1, keyframes.size() - 1);
+    const EarthFlightKeyframe& ka = keyframes[a];
+    const EarthFlightKeyframe& kb = keyframes[b];
+    t = kb.frame > ka.frame ? (static_cast<double>(frame) - ka.frame) / (static_cast<double>(kb.frame) - ka.frame) : 0.0;
+    t = std::max(0.0, std::min(t, 1.0));
+
+    // descents from orbit spend as many frames per halving of the altitude, so alt is interpolated geometrically
+    eye[0] = ka.eye[0] + (kb.eye[0] - ka.eye[0]) * t;
+    eye[1] = ka.eye[1] + (kb.eye[1] - ka.eye[1]) * t;
+    if (ka.eye[2] > 0.0 && kb.eye[2] > 0.0)
+        eye[2] = ka.eye[2] * std::pow(kb.eye[2] / ka.eye[2], t);
+    else
+        eye[2] = ka.eye[2] + (kb.eye[2] - ka.eye[2]) * t;
+}
+
+void EarthFlightBenchmark::poseCamera(unsigned int frame, WO* earth, Camera* cam) const
+{
+    size_t a = 0;
+    size_t b = 0;
+    double t = 0.0;
+    double eye[3];
+    interpolateKeyframes(this->keyframes, frame, a, b, t, eye);
+
+    MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+    float scale = mod->getScaleFactor();
+    Vector origin = earth->getPosition();
+    Vector targetA = toWorld(this->keyframes[a].target, origin, scale);
+    Vector targetB = toWorld(this->keyframes[b].target, origin, scale);
+
+    cam->setPosition(toWorld(eye, origin, scale));
+    cam->setCameraLookAtPoint(targetA + (targetB - targetA) * static_cast<float>(t));
+}
+
+void EarthFlightBenchmark::applySettings(const EarthFlightSettings& settings, MGLEarthQuad* earth)
+{
+    earth->setTessellationFactor(settings.tessellationFactor);
+    earth->setMaxTessellationFactor(settings.maxTessellationFactor);
+    earth->setLODMode(settings.lodMode);
+    earth->setTargetPixelError(settings.targetPixelError);
+}
+
+void EarthFlightBenchmark::collectGPUResults(const EarthRenderProfiler& profiler)
+{
+    const EarthRenderStats& stats = profiler.getStats();
+    while (this->pendingPass < this->passes.size()) {
+        EarthFlightFrame& frame = this->passes[this->pendingPass][this->pendingFrame];
+
+        // stop at the first frame that hasn't been rendered or whose results haven't arrived
+        if (frame.profilerFrame == 0 || frame.profilerFrame > stats.frame)
+            break;
+
+        // results arrive in order, so an older frame than the newest results was dropped
+        if (frame.profilerFrame == stats.frame) {
+            frame.gpu = stats;
+            frame.hasGPU = true;
+        }
+
+        if (++this->pendingFrame == this->passes[this->pendingPass].size()) {
+            this->pendingFrame = 0;
+            this->pendingPass++;
+        }
+    }
+}
+
+bool EarthFlightBenchmark::writeJSON() const
+{
+    std::ofstream out(this->outputPath);
+    if (!out) {
+        std::cout << "Error: unable to write " << this->outputPath << std::endl;
+        return false;
+    }
+
+    out << std::setprecision(6);
+    out << "{\n"
+        << "  \"flight\": " << jsonString(this->flightPath) << ",\n"
+        << "  \"synthetic\": " << (this->synthetic ? "true" : "false") << ",\n"
+        << "  \"renderer\": " << jsonString(this->renderer) << ",\n"
+        << "  \"pipelineStatistics\": " << (this->pipelineStatistics ? "true" : "false") << ",\n"
+        << "  \"warmupFrames\": " << WARMUP_FRAMES << ",\n"
+        << "  \"passes\": [\n";
+
+    for (size_t p = 0; p < this->passes.size(); ++p) {
+        const EarthFlightSettings& settings = this->sweep[p];
+        out << "    {\n"
+            << "      \"name\": " << jsonString(settings.name) << ",\n"
+            << "      \"tessellationFactor\": " << settings.tessellationFactor << ",\n"
+            << "      \"maxTessellationFactor\": " << settings.maxTessellationFactor << ",\n"
+            << "      \"lodMode\": \"" << lodModeName(settings.lodMode) << "\",\n"
+            << "      \"targetPixelError\": " << settings.targetPixelError << ",\n"
+            << "      \"frames\": [\n";
+
+        const std::vector<EarthFlightFrame>& frames = this->passes[p];
+        for (size_t f = 0; f < frames.size(); ++f) {
+            const EarthFlightFrame& frame = frames[f];
+            out << "        { \"frame\": " << f << ", \"cpuMs\": " << frame.cpuMs;
+
+            // frames the profiler dropped have no GPU results rather than zeros
+            out << ", \"gpuMs\": ";
+            if (frame.hasGPU)
+                out << frame.gpu.getTotalMs();
+            else
+                out << "null";
+            for (int s = 0; s < static_cast<int>(EARTH_RENDER_STAGE::ersNUM_STAGES); ++s) {
+                out << ", \"" << EarthRenderProfiler::getStageName(static_cast<EARTH_RENDER_STAGE>(s)) << "Ms\": ";
+                if (frame.hasGPU)
+                    out << frame.gpu.stageMs[s];
+                else
+                    out << "null";
+            }
+            for (int i = 0; i < static_cast<int>(EARTH_RENDER_STATISTIC::ersNUM_STATISTICS); ++i) {
+                out << ", \"" << EarthRenderProfiler::getStatisticName(static_cast<EARTH_RENDER_STATISTIC>(i)) << "\": ";
+                if (frame.hasGPU && this->pipelineStatistics)
+                    out << frame.gpu.statistics[i];
+                else
+                    out << "null";
+            }
+            out << ", \"peakMemoryBytes\": " << frame.peakMemoryBytes << " }" << (f + 1 < frames.size() ? "," : "") << "\n";
+        }
+
+        out << "      ]\n"
+            << "    }" << (p + 1 < this->passes.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n"
+        << "}\n";
+    return static_cast<bool>(out);
+}
+
+void EarthFlightBenchmark::printSummary() const
+{
+    std::cout << "Flight benchmark on " << this->renderer << ":" << std::endl;
+    for (size_t p = 0; p < this->passes.size(); ++p) {
+        double cpuMs = 0.0;
+        double maxCpuMs = 0.0;
+        double gpuMs = 0.0;
+        double tessEval = 0.0;
+        unsigned int numGPU = 0;
+        for (const EarthFlightFrame& frame : this->passes[p]) {
+            cpuMs += frame.cpuMs;
+            maxCpuMs = std::max(maxCpuMs, frame.cpuMs);
+            if (frame.hasGPU) {
+                gpuMs += frame.gpu.getTotalMs();
+                tessEval += static_cast<double>(frame.gpu.get(EARTH_RENDER_STATISTIC::ersTESS_EVALUATION_INVOCATIONS));
+                numGPU++;
+            }
+        }
+
+        size_t numFrames = this->passes[p].size();
+        std::cout << "  " << std::left << std::setw(16) << this->sweep[p].name << std::right
+                  << " frame " << std::fixed << std::setprecision(2) << cpuMs / numFrames << " ms (max " << maxCpuMs << ")"
+                  << ", GPU " << gpuMs / std::max(numGPU, 1u) << " ms";
+        if (this->pipelineStatistics)
+            std::cout << ", TES invocations " << std::setprecision(0) << tessEval / std::max(numGPU, 1u);
+        std::cout << ", " << (numFrames - numGPU) << " frames without GPU results, peak "
+                  << (this->passes[p].back().peakMemoryBytes >> 20) << " MB" << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+}
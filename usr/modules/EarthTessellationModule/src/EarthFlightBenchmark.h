@@ -0,0 +1,141 @@
+#pragma once
+
+#include "EarthRenderProfiler.h"
+#include "GLSLEarthShader.h"
+
+#include <chrono>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace Aftr {
+class Camera;
+class MGLEarthQuad;
+class WO;
+
+// A camera pose of a flight: the eye and the point looked at as (lat, lon) in degrees and meters above the ellipsoid.
+struct EarthFlightKeyframe {
+    unsigned int frame;
+    double eye[3];
+    double target[3];
+};
+
+// One set of tessellation parameters a flight is replayed with.
+struct EarthFlightSettings {
+    std::string name;
+    float tessellationFactor;
+    float maxTessellationFactor;
+    EARTH_LOD_MODE lodMode;
+    float targetPixelError;
+};
+
+// The measurements of one rendered frame of a flight.
+struct EarthFlightFrame {
+    double cpuMs = 0.0; // wall time from this frame's update to the next one's
+    bool hasGPU = false; // false until (or if the profiler dropped) the frame's GPU results
+    EarthRenderStats gpu;
+    size_t peakMemoryBytes = 0; // peak resident memory of the process so far
+    unsigned int profilerFrame = 0; // EarthRenderProfiler frame the frame was rendered as
+};
+
+/**
+   This class replays a scripted camera flight over the earth once for every set of tessellation
+   settings of a sweep, and writes the CPU and GPU time, the pipeline statistics and the peak memory
+   of every frame to a JSON file. It runs inside GLViewEarthTessellationModule when the module is
+   started with
+
+       --benchmark flight [--flight <file>] [--out <file.json>] [--synthetic] [--headless]
+
+   --flight defaults to benchmark/earth_flight.txt in the local multimedia path and --out to
+   earth_flight.json. --synthetic draws a small dataset generated in process instead of ETOPO1, so
+   no data has to be downloaded, and --headless renders through SDL's offscreen video driver, which
+   needs no display and works with Mesa's llvmpipe.
+
+   A flight file holds one command per line, # starts a comment:
+
+       key <frame> <eyeLat> <eyeLon> <eyeAlt> <targetLat> <targetLon> <targetAlt>
+       sweep <name> <tessellationFactor> <maxTessellationFactor> <edge|sse> <targetPixelError>
+
+   Between keyframes the eye moves linearly in latitude and longitude (so longitudes beyond +-180
+   orbit the earth) and geometrically in altitude, while the target moves in a straight line. A
+   flight without sweep lines is flown once with the module's current settings.
+
+   Frames are counted rather than timed, so every run renders exactly the same views. The GPU
+   results arrive a couple of frames late, so each pass holds its last pose until they are in.
+*/
+class EarthFlightBenchmark {
+public:
+    // frames rendered from the first pose before the first pass, so shader compilation and uploads aren't measured
+    const static unsigned int WARMUP_FRAMES = 30;
+
+    // Returns true if args request the flight benchmark.
+    static bool isRequested(const std::vector<std::string>& args);
+
+    // Returns true if args request rendering without a display.
+    static bool isHeadless(const std::vector<std::string>& args);
+
+    /**
+        Writes the synthetic elevation (a 16 bit GeoTIFF) and imagery (a PNG) to dir unless they
+        are already there, and returns their paths. Returns false if they couldn't be written.
+    */
+    static bool writeSyntheticDataset(const std::string& dir, std::string& elevation, std::string& imagery);
+
+    // Reads the flight and the output path from args (see above).
+    EarthFlightBenchmark(const std::vector<std::string>& args);
+
+    // Returns whether the earth should be drawn from the synthetic dataset.
+    bool isSynthetic() const { return this->synthetic; }
+
+    // Reads the flight file. Returns false, after printing why, if it can't be flown.
+    bool load();
+
+    /**
+        Records the frame rendered since the last call and poses cam for the next one over earth,
+        whose model is an MGLEarthQuad. Call once per frame before rendering. Returns false once
+        the flight is over and the results were written.
+    */
+    bool update(WO* earth, Camera* cam);
+
+    // Parses a flight file. Returns false and sets error to the offending line if it is malformed.
+    static bool parseFlight(std::istream& in, std::vector<EarthFlightKeyframe>& keyframes,
+        std::vector<EarthFlightSettings>& sweep, std::string& error);
+
+    /**
+        Finds the keyframes a and b of the segment frame lies on and how far along it frame is (t in
+        [0, 1]), and sets eye to the interpolated (lat, lon, alt) of the eye. Frames before the first
+        keyframe hold its pose and frames after the last one hold the last.
+    */
+    static void interpolateKeyframes(const std::vector<EarthFlightKeyframe>& keyframes, unsigned int frame, size_t& a, size_t& b,
+        double& t, double* eye);
+
+protected:
+    // Poses cam at frame of the flight over earth, whose model is an MGLEarthQuad.
+    void poseCamera(unsigned int frame, WO* earth, Camera* cam) const;
+
+    // Applies settings to earth.
+    static void applySettings(const EarthFlightSettings& settings, MGLEarthQuad* earth);
+
+    // Hands the GPU results that arrived to the frames they belong to.
+    void collectGPUResults(const EarthRenderProfiler& profiler);
+
+    // Writes the results to outputPath. Returns false if it can't be written.
+    bool writeJSON() const;
+
+    // Prints the per pass averages.
+    void printSummary() const;
+
+    std::string flightPath;
+    std::string outputPath;
+    bool synthetic;
+    std::vector<EarthFlightKeyframe> keyframes;
+    std::vector<EarthFlightSettings> sweep;
+    std::string renderer; // GL_RENDERER of the context the flight ran on
+    bool pipelineStatistics; // whether the driver counted the pipeline statistics
+
+    std::vector<std::vector<EarthFlightFrame>> passes; // the measured frames of each sweep entry
+    unsigned int step; // update calls so far
+    size_t pendingPass; // oldest frame still waiting for its GPU results
+    size_t pendingFrame;
+    std::chrono::steady_clock::time_point lastUpdate;
+};
+}
@@ -0,0 +1,27 @@
+#include "EarthGridChunks.h"
+
+#include <algorithm>
+
+using namespace Aftr;
+
+std::vector<EarthGridChunk> EarthGridChunk::split(unsigned int numTilesX, unsigned int numTilesY, size_t maxVerts)
+{
+    // as many tiles in longitude as fit with at least two rows of vertices, then as many rows as fit
+    size_t maxTilesY = std::max<size_t>(maxVerts / 2, 2) - 1;
+    unsigned int chunkTilesY = static_cast<unsigned int>(std::min<size_t>(numTilesY, maxTilesY));
+    size_t maxTilesX = std::max<size_t>(maxVerts / (chunkTilesY + 1), 2) - 1;
+    unsigned int chunkTilesX = static_cast<unsigned int>(std::min<size_t>(numTilesX, maxTilesX));
+
+    std::vector<EarthGridChunk> chunks;
+    for (unsigned int x = 0; x < numTilesX; x += chunkTilesX) {
+        for (unsigned int y = 0; y < numTilesY; y += chunkTilesY) {
+            EarthGridChunk chunk;
+            chunk.x = x;
+            chunk.y = y;
+            chunk.numTilesX = std::min(chunkTilesX, numTilesX - x);
+            chunk.numTilesY = std::min(chunkTilesY, numTilesY - y);
+            chunks.push_back(chunk);
+        }
+    }
+    return chunks;
+}
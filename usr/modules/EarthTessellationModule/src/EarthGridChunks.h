@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace Aftr {
+/**
+   A rectangle of tiles of the fixed grid that is drawn as its own mesh, so its vertices can be
+   indexed with narrower indices than the whole grid's. Chunks share the vertices on their common
+   edges (each chunk has its own copy), so neighbouring patches still see identical corners and
+   tessellate without cracks.
+*/
+struct EarthGridChunk {
+    unsigned int x; // first tile in latitude
+    unsigned int y; // first tile in longitude
+    unsigned int numTilesX;
+    unsigned int numTilesY;
+
+    // Returns the number of vertices of the chunk, (numTilesX + 1) * (numTilesY + 1).
+    size_t getNumVerts() const { return static_cast<size_t>(this->numTilesX + 1) * (this->numTilesY + 1); }
+
+    // Returns the number of patch indices of the chunk, 4 per tile.
+    size_t getNumIndices() const { return static_cast<size_t>(this->numTilesX) * this->numTilesY * 4; }
+
+    /**
+        Splits a numTilesX x numTilesY grid into chunks of at most maxVerts vertices each, keeping
+        whole rows of tiles together where a row fits. maxVerts must be at least 4.
+    */
+    static std::vector<EarthGridChunk> split(unsigned int numTilesX, unsigned int numTilesY, size_t maxVerts);
+
+    /**
+        Writes the corners (ul, ll, lr, ur) of every tile of the chunk to indices, tile (x, y) at
+        (y + x * numTilesY) * 4. Vertex (x, y) of the chunk is its y + x * (numTilesY + 1)th vertex,
+        the same layout MGLEarthQuad::generateData uses for the whole grid.
+    */
+    template <typename T>
+    void writePatchIndices(T* indices) const
+    {
+        unsigned int width = this->numTilesY + 1;
+        for (unsigned int x = 0; x < this->numTilesX; ++x) {
+            for (unsigned int y = 0; y < this->numTilesY; ++y) {
+                T* patch = indices + (y + static_cast<size_t>(x) * this->numTilesY) * 4;
+                patch[0] = static_cast<T>(y + x * width);
+                patch[1] = static_cast<T>(y + (x + 1) * width);
+                patch[2] = static_cast<T>((y + 1) + (x + 1) * width);
+                patch[3] = static_cast<T>((y + 1) + x * width);
+            }
+        }
+    }
+};
+}
@@ -0,0 +1,406 @@
+#include "EarthQuadtree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace Aftr;
+
+namespace {
+// constants used in conversion from WGS84 (the same ones the shaders use)
+const static double EARTH_RADIUS = 6378137.0;
+const static double EARTH_FLATTENING = 0.00669437999013;
+const static double EARTH_POLAR_RADIUS = 6356752.314245;
+const static double DEG_TO_RAD = 3.14159265358979323846 / 180.0;
+
+// the shaders exaggerate elevation by one magnitude of 10
+const static double ELEVATION_EXAGGERATION = 10.0;
+
+// Nodes spanning more degrees than this are never culled. The 13 points the culling tests are
+// only a good stand-in for the curved surface of a node when it is small.
+const static double MAX_CULLED_SPAN_DEG = 10.0;
+
+// Inverts a column major 4x4 matrix. Returns false if it is singular.
+bool invert(const double* m, double* out)
+{
+    double inv[16];
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    double det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    if (det == 0.0)
+        return false;
+
+    for (int i = 0; i < 16; ++i)
+        out[i] = inv[i] / det;
+    return true;
+}
+
+double distance(const double* a, const double* b)
+{
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    double dz = a[2] - b[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Returns true if p lies behind the horizon of a sphere at the origin with radius r, seen from eye
+// (the same test as belowHorizon in earth.tesc).
+bool belowHorizon(const double* p, const double* eye, double r)
+{
+    double vc[3] = { eye[0] / r, eye[1] / r, eye[2] / r };
+    double vh = vc[0] * vc[0] + vc[1] * vc[1] + vc[2] * vc[2] - 1.0;
+    double vt[3] = { p[0] / r - vc[0], p[1] / r - vc[1], p[2] / r - vc[2] };
+    double vtDotVc = -(vt[0] * vc[0] + vt[1] * vc[1] + vt[2] * vc[2]);
+    double vtLengthSq = vt[0] * vt[0] + vt[1] * vt[1] + vt[2] * vt[2];
+    return vh > 0.0 && vtDotVc > vh && vtDotVc * vtDotVc / vtLengthSq > vh;
+}
+}
+
+EarthQuadtree::EarthQuadtree(const Vector& ul, const Vector& lr, unsigned int nRootsX, unsigned int nRootsY, unsigned int maxDepth,
+    const BoundsCallback& getBounds)
+{
+    this->upperLeft = ul;
+    this->lowerRight = lr;
+    this->numRootsX = nRootsX;
+    this->numRootsY = nRootsY;
+    this->maxDepth = maxDepth;
+    this->wrapLon = std::abs(lr.y - ul.y) >= 360.0f;
+    this->maxPixelError = 8.0f;
+    this->boundsCallback = getBounds;
+    this->view = View();
+    this->numSplitNodes = 0;
+    this->numCulledNodes = 0;
+    this->deepestLevel = 0;
+
+    // node keys hold 32 bit coordinates
+    assert(nRootsX > 0 && nRootsY > 0);
+    assert(maxDepth < 32);
+    this->splitNodes.resize(maxDepth + 1);
+    this->testedNodes.resize(maxDepth + 1);
+}
+
+void EarthQuadtree::update(const float* mvp, float projScale, float scale, float maxTess)
+{
+    for (int i = 0; i < 16; ++i)
+        this->view.mvp[i] = mvp[i];
+
+    // the eye projects to the point at infinity on the clip space z axis (see isPatchCulled in earth.tesc)
+    double inv[16];
+    if (!invert(this->view.mvp, inv) || inv[11] == 0.0)
+        return;
+    for (int i = 0; i < 3; ++i)
+        this->view.eye[i] = inv[8 + i] / inv[11];
+
+    // the horizon occluder has to sit below the deepest point of the region
+    float minElev = 0.0f;
+    float maxElev = 0.0f;
+    this->boundsCallback(this->upperLeft, this->lowerRight, minElev, maxElev);
+    this->view.occluderRadius = (EARTH_POLAR_RADIUS + std::min(minElev * ELEVATION_EXAGGERATION, 0.0)) * scale;
+
+    this->view.projScale = projScale;
+    this->view.scale = scale;
+    this->view.maxTess = std::max(maxTess, 1.0f);
+
+    for (std::unordered_set<uint64_t>& nodes : this->splitNodes)
+        nodes.clear();
+    for (std::unordered_map<uint64_t, bool>& nodes : this->testedNodes)
+        nodes.clear();
+
+    for (unsigned int x = 0; x < this->numRootsX; ++x)
+        for (unsigned int y = 0; y < this->numRootsY; ++y)
+            refine(0, x, y);
+
+    balance();
+
+    this->numSplitNodes = 0;
+    for (const std::unordered_set<uint64_t>& nodes : this->splitNodes)
+        this->numSplitNodes += static_cast<unsigned int>(nodes.size());
+
+    this->patchData.clear();
+    this->numCulledNodes = 0;
+    this->deepestLevel = 0;
+    for (unsigned int x = 0; x < this->numRootsX; ++x)
+        for (unsigned int y = 0; y < this->numRootsY; ++y)
+            emit(0, x, y);
+}
+
+void EarthQuadtree::toECEF(double latRad, double lonRad, double elev, double scale, double* out)
+{
+    elev *= ELEVATION_EXAGGERATION * scale;
+
+    double sinLatRad = std::sin(latRad);
+    double e2sinLatSq = EARTH_FLATTENING * (sinLatRad * sinLatRad);
+
+    double rn = EARTH_RADIUS * scale / std::sqrt(1 - e2sinLatSq);
+    double R = (rn + elev) * std::cos(latRad);
+
+    out[0] = R * std::cos(lonRad);
+    out[1] = R * std::sin(lonRad);
+    out[2] = (rn * (1 - EARTH_FLATTENING) + elev) * sinLatRad;
+}
+
+double EarthQuadtree::getLat(unsigned int level, unsigned int x) const
+{
+    // Dividing by the level size keeps a corner shared by nodes of different levels bit identical,
+    // since 2x / 2n rounds to the same double as x / n.
+    return this->upperLeft.x + (static_cast<double>(this->lowerRight.x) - this->upperLeft.x) * (static_cast<double>(x) / getLevelSizeX(level));
+}
+
+double EarthQuadtree::getLon(unsigned int level, unsigned int y) const
+{
+    return this->upperLeft.y + (static_cast<double>(this->lowerRight.y) - this->upperLeft.y) * (static_cast<double>(y) / getLevelSizeY(level));
+}
+
+bool EarthQuadtree::isSplit(unsigned int level, unsigned int x, unsigned int y) const
+{
+    return level < this->splitNodes.size() && this->splitNodes[level].count(getKey(x, y)) > 0;
+}
+
+void EarthQuadtree::markSplit(unsigned int level, unsigned int x, unsigned int y)
+{
+    // stop at the first ancestor that is already split, since its ancestors are too
+    while (this->splitNodes[level].insert(getKey(x, y)).second && level > 0) {
+        --level;
+        x /= 2;
+        y /= 2;
+    }
+}
+
+void EarthQuadtree::refine(unsigned int level, unsigned int x, unsigned int y)
+{
+    double pixelError;
+    bool culled = isCulled(level, x, y, pixelError);
+    this->testedNodes[level][getKey(x, y)] = culled;
+    if (culled)
+        return;
+
+    if (level >= this->maxDepth || pixelError <= this->maxPixelError)
+        return;
+
+    this->splitNodes[level].insert(getKey(x, y));
+    for (unsigned int i = 0; i < 2; ++i)
+        for (unsigned int j = 0; j < 2; ++j)
+            refine(level + 1, x * 2 + i, y * 2 + j);
+}
+
+void EarthQuadtree::balance()
+{
+    // Every split node needs all 4 of its neighbours to exist as nodes, which means their parents
+    // have to be split. Splitting those parents can only add nodes to shallower levels, so a single
+    // pass from the deepest level up is enough.
+    for (unsigned int level = this->maxDepth; level > 0; --level) {
+        for (uint64_t key : this->splitNodes[level]) {
+            unsigned int x = static_cast<unsigned int>(key >> 32);
+            unsigned int y = static_cast<unsigned int>(key & 0xFFFFFFFF);
+
+            for (unsigned int edge = 0; edge < 4; ++edge) {
+                unsigned int nx;
+                unsigned int ny;
+                if (getNeighbour(level, x, y, edge, nx, ny))
+                    markSplit(level - 1, nx / 2, ny / 2);
+            }
+        }
+    }
+}
+
+void EarthQuadtree::emit(unsigned int level, unsigned int x, unsigned int y)
+{
+    if (isSplit(level, x, y)) {
+        for (unsigned int i = 0; i < 2; ++i)
+            for (unsigned int j = 0; j < 2; ++j)
+                emit(level + 1, x * 2 + i, y * 2 + j);
+        return;
+    }
+
+    // only leaves added by balance haven't been tested yet
+    bool culled;
+    auto tested = this->testedNodes[level].find(getKey(x, y));
+    if (tested != this->testedNodes[level].end()) {
+        culled = tested->second;
+    } else {
+        double pixelError;
+        culled = isCulled(level, x, y, pixelError);
+    }
+
+    if (culled)
+        this->numCulledNodes++;
+    else
+        emitPatch(level, x, y);
+}
+
+void EarthQuadtree::emitPatch(unsigned int level, unsigned int x, unsigned int y)
+{
+    // corners in the order ul, ll, lr, ur, as offsets from (x, y)
+    const static unsigned int CORNERS[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+    for (unsigned int i = 0; i < 4; ++i) {
+        float latRad = static_cast<float>(getLat(level, x + CORNERS[i][0]) * DEG_TO_RAD);
+        float lonRad = static_cast<float>(getLon(level, y + CORNERS[i][1]) * DEG_TO_RAD);
+
+        // classify the edge from this corner to the next one
+        EARTH_EDGE_TYPE type = EARTH_EDGE_TYPE::eetSAME;
+        float coarseEdge[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        unsigned int nx;
+        unsigned int ny;
+        if (getNeighbour(level, x, y, i, nx, ny)) {
+            if (isSplit(level, nx, ny)) {
+                type = EARTH_EDGE_TYPE::eetFINER;
+            } else if (level > 0 && !isSplit(level - 1, nx / 2, ny / 2)) {
+                // the neighbour is our parent's neighbour, so the coarse edge is our parent's edge
+                type = EARTH_EDGE_TYPE::eetCOARSER;
+                for (unsigned int k = 0; k < 2; ++k) {
+                    const unsigned int* corner = CORNERS[(i + k) % 4];
+                    coarseEdge[k * 2] = static_cast<float>(getLat(level - 1, x / 2 + corner[0]) * DEG_TO_RAD);
+                    coarseEdge[k * 2 + 1] = static_cast<float>(getLon(level - 1, y / 2 + corner[1]) * DEG_TO_RAD);
+                }
+            }
+        }
+
+        this->patchData.push_back(latRad);
+        this->patchData.push_back(lonRad);
+        this->patchData.push_back(static_cast<float>(type));
+        this->patchData.insert(this->patchData.end(), coarseEdge, coarseEdge + 4);
+    }
+
+    this->deepestLevel = std::max(this->deepestLevel, level);
+}
+
+bool EarthQuadtree::getNeighbour(unsigned int level, unsigned int x, unsigned int y, unsigned int edge, unsigned int& nx, unsigned int& ny) const
+{
+    unsigned int sizeX = getLevelSizeX(level);
+    unsigned int sizeY = getLevelSizeY(level);
+    nx = x;
+    ny = y;
+
+    switch (edge) {
+    case 0:
+        if (y == 0 && !this->wrapLon)
+            return false;
+        ny = (y == 0 ? sizeY : y) - 1;
+        return true;
+    case 1:
+        nx = x + 1;
+        return nx < sizeX;
+    case 2:
+        if (y + 1 == sizeY && !this->wrapLon)
+            return false;
+        ny = (y + 1) % sizeY;
+        return true;
+    default:
+        if (x == 0)
+            return false;
+        nx = x - 1;
+        return true;
+    }
+}
+
+bool EarthQuadtree::isCulled(unsigned int level, unsigned int x, unsigned int y, double& pixelError) const
+{
+    double lat0 = getLat(level, x);
+    double lat1 = getLat(level, x + 1);
+    double lon0 = getLon(level, y);
+    double lon1 = getLon(level, y + 1);
+
+    float minElev = 0.0f;
+    float maxElev = 0.0f;
+    this->boundsCallback(Vector(static_cast<float>(lat0), static_cast<float>(lon0), 0.0f),
+        Vector(static_cast<float>(lat1), static_cast<float>(lon1), 0.0f), minElev, maxElev);
+
+    // The same points earth.tesc culls patches with: the corners at both bounds, plus the edge
+    // midpoints and the center at the top bound where the curved surface bulges out the most.
+    // They lie on a 3x3 grid of lattitudes and longitudes, so the trigonometry is shared.
+    double lats[3] = { lat0 * DEG_TO_RAD, (lat0 + lat1) / 2.0 * DEG_TO_RAD, lat1 * DEG_TO_RAD };
+    double lons[3] = { lon0 * DEG_TO_RAD, (lon0 + lon1) / 2.0 * DEG_TO_RAD, lon1 * DEG_TO_RAD };
+    double sinLat[3];
+    double cosLat[3];
+    double rn[3];
+    double cosLon[3];
+    double sinLon[3];
+    for (int i = 0; i < 3; ++i) {
+        sinLat[i] = std::sin(lats[i]);
+        cosLat[i] = std::cos(lats[i]);
+        rn[i] = EARTH_RADIUS * this->view.scale / std::sqrt(1 - EARTH_FLATTENING * sinLat[i] * sinLat[i]);
+        cosLon[i] = std::cos(lons[i]);
+        sinLon[i] = std::sin(lons[i]);
+    }
+
+    // grid coordinates of the corners (in the order ul, ll, lr, ur) and of the edge midpoints after each corner
+    const static int CORNERS[4][2] = { { 0, 0 }, { 2, 0 }, { 2, 2 }, { 0, 2 } };
+    const static int MIDPOINTS[4][2] = { { 1, 0 }, { 2, 1 }, { 1, 2 }, { 0, 1 } };
+    auto toPoint = [&](int la, int lo, float elev, double* out) {
+        double h = elev * ELEVATION_EXAGGERATION * this->view.scale;
+        double R = (rn[la] + h) * cosLat[la];
+        out[0] = R * cosLon[lo];
+        out[1] = R * sinLon[lo];
+        out[2] = (rn[la] * (1 - EARTH_FLATTENING) + h) * sinLat[la];
+    };
+
+    double p[13][3];
+    for (int i = 0; i < 4; ++i) {
+        toPoint(CORNERS[i][0], CORNERS[i][1], minElev, p[i]);
+        toPoint(CORNERS[i][0], CORNERS[i][1], maxElev, p[i + 4]);
+        toPoint(MIDPOINTS[i][0], MIDPOINTS[i][1], maxElev, p[i + 8]);
+    }
+    toPoint(1, 1, maxElev, p[12]);
+
+    double span = std::max(std::abs(lat1 - lat0), std::abs(lon1 - lon0));
+    if (span <= MAX_CULLED_SPAN_DEG) {
+        // outside the frustum if every point is outside the same clip plane
+        const double* m = this->view.mvp;
+        double c[13][4];
+        for (int i = 0; i < 13; ++i)
+            for (int r = 0; r < 4; ++r)
+                c[i][r] = m[r] * p[i][0] + m[4 + r] * p[i][1] + m[8 + r] * p[i][2] + m[12 + r];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            bool allBelow = true;
+            bool allAbove = true;
+            for (int i = 0; i < 13; ++i) {
+                allBelow = allBelow && c[i][axis] < -c[i][3];
+                allAbove = allAbove && c[i][axis] > c[i][3];
+            }
+            if (allBelow || allAbove)
+                return true;
+        }
+
+        // hidden if every top point is behind the horizon
+        bool hidden = true;
+        for (int i = 4; i < 13 && hidden; ++i)
+            hidden = belowHorizon(p[i], this->view.eye, this->view.occluderRadius);
+        if (hidden)
+            return true;
+    }
+
+    // the longest edge, measured through its midpoint so large nodes account for the curvature
+    double edgeLength = 0.0;
+    for (int i = 0; i < 4; ++i)
+        edgeLength = std::max(edgeLength, distance(p[i + 4], p[i + 8]) + distance(p[i + 8], p[(i + 1) % 4 + 4]));
+
+    // distance from the eye to a sphere around the node
+    double center[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < 13; ++i)
+        for (int k = 0; k < 3; ++k)
+            center[k] += p[i][k] / 13.0;
+    double radius = 0.0;
+    for (int i = 0; i < 13; ++i)
+        radius = std::max(radius, distance(center, p[i]));
+    double dist = std::max(distance(this->view.eye, center) - radius, 1e-6 * this->view.scale);
+
+    pixelError = edgeLength * this->view.projScale / dist / this->view.maxTess;
+    return false;
+}
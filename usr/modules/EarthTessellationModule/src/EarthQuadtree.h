@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Vector.h"
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Aftr {
+// How MGLEarthQuad lays out the patches it feeds to the tessellation shaders.
+enum class EARTH_PATCH_MODE {
+    epmFIXED_GRID, // a static grid of equally sized patches
+    epmQUADTREE // visible leaves of an EarthQuadtree, refined every frame
+};
+
+// Relation of a quadtree patch edge to the patch on the other side of it, stored in the z
+// coordinate of the edge's first vertex and read by earth.tesc.
+enum class EARTH_EDGE_TYPE {
+    eetSAME = 0, // the neighbour is the same size (always the case for the fixed grid)
+    eetCOARSER = 1, // the neighbour is twice as large, this edge is half of its edge
+    eetFINER = 2 // the neighbour is split, two of its edges make up this edge
+};
+
+/**
+   This class selects the patches of a restricted (CDLOD style) quadtree over a WGS84 region every
+   frame. The region is covered by a grid of root nodes, and a node is split while its longest
+   edge would still span more than maxPixelError pixels per segment after being tessellated
+   maxTessellationFactor times. Nodes entirely outside the view frustum or below the horizon are
+   neither split nor emitted.
+
+   After refining, the tree is balanced so neighbouring leaves differ by at most one level, and
+   every edge of a visible leaf is tagged with an EARTH_EDGE_TYPE so earth.tesc can pick edge
+   tessellation levels that line up with the neighbour and leave no cracks.
+
+   Each visible leaf is emitted as 4 vertices of FLOATS_PER_VERTEX floats, in the same corner order
+   generateData uses for the fixed grid (ul, ll, lr, ur):
+   - lattitude and longitude in radians, then the EARTH_EDGE_TYPE of the edge to the next vertex
+   - the lattitude and longitude of both ends of the coarse neighbour's edge (only set for
+     eetCOARSER edges)
+*/
+class EarthQuadtree {
+public:
+    // floats per vertex of getPatchData
+    const static unsigned int FLOATS_PER_VERTEX = 7;
+
+    /**
+        Gets the elevation bounds (in meters, before exaggeration) of the region between two WGS84
+        coordinates in degrees. The bounds must include everything the shaders may sample for a
+        patch covering the region.
+    */
+    using BoundsCallback = std::function<void(const Vector& ul, const Vector& lr, float& minElev, float& maxElev)>;
+
+    /**
+        Constructor for creating a quadtree.
+        ul - The upper-left WGS84 coordinate of the region.
+        lr - The lower-right WGS84 coordinate of the region.
+        nRootsX - The number of root nodes on the x axis (lattitude).
+        nRootsY - The number of root nodes on the y axis (longitude).
+        maxDepth - The deepest level nodes are split to (0 keeps the roots as a fixed grid).
+        getBounds - Looks up the elevation bounds of a node.
+    */
+    EarthQuadtree(const Vector& ul, const Vector& lr, unsigned int nRootsX, unsigned int nRootsY, unsigned int maxDepth,
+        const BoundsCallback& getBounds);
+
+    /**
+        Refines the tree for a view and rebuilds the patch data.
+        mvp - The column major model view projection matrix.
+        projScale - Pixels covered by a unit length at unit distance (the projection's [1][1]
+                    times half the viewport height).
+        scale - The Earth scale factor.
+        maxTess - The maximum tessellation factor of a patch edge.
+    */
+    void update(const float* mvp, float projScale, float scale, float maxTess);
+
+    // Returns the largest size in pixels of a tessellated segment before a node is split.
+    float getMaxPixelError() const { return this->maxPixelError; }
+
+    // Sets the largest size in pixels of a tessellated segment before a node is split.
+    void setMaxPixelError(float pixels) { this->maxPixelError = pixels; }
+
+    // Returns the deepest level nodes are split to.
+    unsigned int getMaxDepth() const { return this->maxDepth; }
+
+    // Returns the vertices of the visible leaves of the last update.
+    const std::vector<float>& getPatchData() const { return this->patchData; }
+
+    // Returns the number of visible leaves of the last update.
+    unsigned int getNumPatches() const { return static_cast<unsigned int>(this->patchData.size() / (4 * FLOATS_PER_VERTEX)); }
+
+    // Returns the number of split nodes after balancing in the last update.
+    unsigned int getNumSplitNodes() const { return this->numSplitNodes; }
+
+    // Returns the number of nodes culled in the last update.
+    unsigned int getNumCulledNodes() const { return this->numCulledNodes; }
+
+    // Returns the deepest level of a visible leaf in the last update.
+    unsigned int getDeepestLevel() const { return this->deepestLevel; }
+
+    /**
+        Converts a WGS84 coordinate to scaled ECEF the same way WGS84ToECEF does in the shaders.
+        latRad, lonRad - The coordinate in radians.
+        elev - The elevation in meters, exaggerated like the shaders do before scaling.
+    */
+    static void toECEF(double latRad, double lonRad, double elev, double scale, double* out);
+
+protected:
+    // Culling and error metric inputs of the current update.
+    struct View {
+        double mvp[16];
+        double eye[3]; // eye position in model space
+        double projScale;
+        double scale;
+        double maxTess;
+        double occluderRadius; // radius of the horizon culling sphere
+    };
+
+    Vector upperLeft;
+    Vector lowerRight;
+    unsigned int numRootsX;
+    unsigned int numRootsY;
+    unsigned int maxDepth;
+    bool wrapLon; // whether the region spans all longitudes, so the first and last columns are neighbours
+    float maxPixelError;
+    BoundsCallback boundsCallback;
+
+    View view;
+    std::vector<std::unordered_set<uint64_t>> splitNodes; // split nodes of each level, keyed by getKey
+    std::vector<std::unordered_map<uint64_t, bool>> testedNodes; // whether each node refine tested was culled
+    std::vector<float> patchData;
+    unsigned int numSplitNodes;
+    unsigned int numCulledNodes;
+    unsigned int deepestLevel;
+
+    // Returns the key of node (x, y) within its level.
+    static uint64_t getKey(unsigned int x, unsigned int y) { return (static_cast<uint64_t>(x) << 32) | y; }
+
+    // Returns the number of nodes of a level on the x axis (lattitude).
+    unsigned int getLevelSizeX(unsigned int level) const { return this->numRootsX << level; }
+
+    // Returns the number of nodes of a level on the y axis (longitude).
+    unsigned int getLevelSizeY(unsigned int level) const { return this->numRootsY << level; }
+
+    // Returns the lattitude in degrees of row x of a level.
+    double getLat(unsigned int level, unsigned int x) const;
+
+    // Returns the longitude in degrees of column y of a level.
+    double getLon(unsigned int level, unsigned int y) const;
+
+    // Returns whether node (x, y) of a level is split.
+    bool isSplit(unsigned int level, unsigned int x, unsigned int y) const;
+
+    // Marks a node and every one of its ancestors as split.
+    void markSplit(unsigned int level, unsigned int x, unsigned int y);
+
+    // Splits the node while it is visible and too coarse, then does the same for its children.
+    void refine(unsigned int level, unsigned int x, unsigned int y);
+
+    // Splits nodes until neighbouring leaves differ by at most one level.
+    void balance();
+
+    // Emits the visible leaves below a node.
+    void emit(unsigned int level, unsigned int x, unsigned int y);
+
+    // Writes a visible leaf to patchData.
+    void emitPatch(unsigned int level, unsigned int x, unsigned int y);
+
+    // Gets the node's neighbour across edge (0 west, 1 south, 2 east, 3 north). Returns false if there is none.
+    bool getNeighbour(unsigned int level, unsigned int x, unsigned int y, unsigned int edge, unsigned int& nx, unsigned int& ny) const;
+
+    /**
+        Tests a node against the view. Returns true if it is entirely outside the view frustum or
+        below the horizon, otherwise stores its projected size in pixels per tessellated segment.
+    */
+    bool isCulled(unsigned int level, unsigned int x, unsigned int y, double& pixelError) const;
+};
+}
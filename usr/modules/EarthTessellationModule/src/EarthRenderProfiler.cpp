@@ -0,0 +1,201 @@
+#include "EarthRenderProfiler.h"
+
+#include <cstdio>
+
+using namespace Aftr;
+
+namespace {
+// the query target of each EARTH_RENDER_STATISTIC
+const GLenum STATISTIC_TARGETS[] = {
+    GL_COMPUTE_SHADER_INVOCATIONS_ARB,
+    GL_PRIMITIVES_SUBMITTED_ARB, // the primitives of a GL_PATCHES draw are its patches
+    GL_TESS_CONTROL_SHADER_PATCHES_ARB,
+    GL_TESS_EVALUATION_SHADER_INVOCATIONS_ARB,
+    GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED_ARB,
+    GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+    GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+};
+
+// the stage whose work each EARTH_RENDER_STATISTIC counts
+const EARTH_RENDER_STAGE STATISTIC_STAGES[] = {
+    EARTH_RENDER_STAGE::ersCULL,
+    EARTH_RENDER_STAGE::ersDRAW,
+    EARTH_RENDER_STAGE::ersDRAW,
+    EARTH_RENDER_STAGE::ersDRAW,
+    EARTH_RENDER_STAGE::ersDRAW,
+    EARTH_RENDER_STAGE::ersDRAW,
+    EARTH_RENDER_STAGE::ersDRAW
+};
+
+const char* STAGE_NAMES[] = { "cull", "draw" };
+const char* STATISTIC_NAMES[] = { "computeInvocations", "patchesSubmitted", "tessControlPatches", "tessEvalInvocations",
+    "geometryPrimitives", "clippingPrimitives", "fragmentInvocations" };
+}
+
+double EarthRenderStats::getTotalMs() const
+{
+    double total = 0.0;
+    for (double ms : this->stageMs)
+        total += ms;
+    return total;
+}
+
+EarthRenderProfiler::EarthRenderProfiler()
+{
+    static_assert(sizeof(STATISTIC_TARGETS) / sizeof(STATISTIC_TARGETS[0]) == NUM_STATISTICS, "a target per EARTH_RENDER_STATISTIC");
+    static_assert(sizeof(STATISTIC_STAGES) / sizeof(STATISTIC_STAGES[0]) == NUM_STATISTICS, "a stage per EARTH_RENDER_STATISTIC");
+    static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == NUM_STAGES, "a name per EARTH_RENDER_STAGE");
+    static_assert(sizeof(STATISTIC_NAMES) / sizeof(STATISTIC_NAMES[0]) == NUM_STATISTICS, "a name per EARTH_RENDER_STATISTIC");
+
+    this->countStatistics = GLEW_ARB_pipeline_statistics_query != GL_FALSE;
+    this->frame = 0;
+    this->numDroppedFrames = 0;
+    this->stats.hasStatistics = this->countStatistics;
+
+    glGenQueries(NUM_FRAMES * NUM_STAGES, &this->timerQueries[0][0]);
+    if (this->countStatistics)
+        glGenQueries(NUM_FRAMES * NUM_STATISTICS, &this->statisticQueries[0][0]);
+    for (auto& issued : this->stageIssued) {
+        for (bool& stage : issued)
+            stage = false;
+    }
+}
+
+EarthRenderProfiler::~EarthRenderProfiler()
+{
+    glDeleteQueries(NUM_FRAMES * NUM_STAGES, &this->timerQueries[0][0]);
+    if (this->countStatistics)
+        glDeleteQueries(NUM_FRAMES * NUM_STATISTICS, &this->statisticQueries[0][0]);
+}
+
+void EarthRenderProfiler::beginFrame()
+{
+    this->frame++;
+
+    // the slot this frame reuses last ran NUM_FRAMES frames ago (frame 0 is never begun)
+    unsigned int slot = this->frame % NUM_FRAMES;
+    if (this->frame > NUM_FRAMES) {
+        if (readResults(slot))
+            this->stats.frame = this->frame - NUM_FRAMES;
+        else
+            this->numDroppedFrames++;
+    }
+
+    for (bool& issued : this->stageIssued[slot])
+        issued = false;
+}
+
+void EarthRenderProfiler::beginStage(EARTH_RENDER_STAGE stage)
+{
+    unsigned int slot = this->frame % NUM_FRAMES;
+    int s = static_cast<int>(stage);
+    this->stageIssued[slot][s] = true;
+
+    glBeginQuery(GL_TIME_ELAPSED, this->timerQueries[slot][s]);
+    if (this->countStatistics) {
+        for (int i = 0; i < NUM_STATISTICS; ++i) {
+            if (STATISTIC_STAGES[i] == stage)
+                glBeginQuery(STATISTIC_TARGETS[i], this->statisticQueries[slot][i]);
+        }
+    }
+}
+
+void EarthRenderProfiler::endStage(EARTH_RENDER_STAGE stage)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    if (this->countStatistics) {
+        for (int i = 0; i < NUM_STATISTICS; ++i) {
+            if (STATISTIC_STAGES[i] == stage)
+                glEndQuery(STATISTIC_TARGETS[i]);
+        }
+    }
+}
+
+bool EarthRenderProfiler::readResults(unsigned int slot)
+{
+    // results become available in order, so checking the last query of each stage would do, but
+    // the check is cheap and this doesn't rely on it
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        if (!this->stageIssued[slot][s])
+            continue;
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(this->timerQueries[slot][s], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+            return false;
+        if (this->countStatistics) {
+            for (int i = 0; i < NUM_STATISTICS; ++i) {
+                if (static_cast<int>(STATISTIC_STAGES[i]) != s)
+                    continue;
+                glGetQueryObjectuiv(this->statisticQueries[slot][i], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available == GL_FALSE)
+                    return false;
+            }
+        }
+    }
+
+    // every result is there, so none of these waits
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        GLuint64 ns = 0;
+        if (this->stageIssued[slot][s])
+            glGetQueryObjectui64v(this->timerQueries[slot][s], GL_QUERY_RESULT, &ns);
+        this->stats.stageMs[s] = static_cast<double>(ns) / 1.0e6;
+    }
+    for (int i = 0; i < NUM_STATISTICS; ++i) {
+        GLuint64 count = 0;
+        if (this->countStatistics && this->stageIssued[slot][static_cast<int>(STATISTIC_STAGES[i])])
+            glGetQueryObjectui64v(this->statisticQueries[slot][i], GL_QUERY_RESULT, &count);
+        this->stats.statistics[i] = count;
+    }
+    return true;
+}
+
+std::string EarthRenderProfiler::toString() const
+{
+    const EarthRenderStats& s = this->stats;
+    char buf[256];
+    int n = std::snprintf(buf, sizeof(buf), "GPU %.2f ms (cull %.2f, draw %.2f)", s.getTotalMs(),
+        s.getMs(EARTH_RENDER_STAGE::ersCULL), s.getMs(EARTH_RENDER_STAGE::ersDRAW));
+    if (s.hasStatistics && n > 0 && n < static_cast<int>(sizeof(buf))) {
+        std::snprintf(buf + n, sizeof(buf) - n, " | patches %llu, TCS %llu, TES %llu, GS %llu, clip %llu, FS %llu",
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersPATCHES_SUBMITTED)),
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersTESS_CONTROL_PATCHES)),
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersTESS_EVALUATION_INVOCATIONS)),
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersGEOMETRY_PRIMITIVES)),
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersCLIPPING_PRIMITIVES)),
+            static_cast<unsigned long long>(s.get(EARTH_RENDER_STATISTIC::ersFRAGMENT_INVOCATIONS)));
+    }
+    return buf;
+}
+
+const char* EarthRenderProfiler::getStageName(EARTH_RENDER_STAGE stage)
+{
+    return STAGE_NAMES[static_cast<int>(stage)];
+}
+
+const char* EarthRenderProfiler::getStatisticName(EARTH_RENDER_STATISTIC counter)
+{
+    return STATISTIC_NAMES[static_cast<int>(counter)];
+}
+
+void EarthRenderProfiler::writeCSVHeader(std::ostream& out)
+{
+    out << "statsFrame,totalMs";
+    for (const char* name : STAGE_NAMES)
+        out << ',' << name << "Ms";
+    for (const char* name : STATISTIC_NAMES)
+        out << ',' << name;
+}
+
+void EarthRenderProfiler::writeCSVRow(std::ostream& out) const
+{
+    const EarthRenderStats& s = this->stats;
+    out << s.frame << ',' << s.getTotalMs();
+    for (double ms : s.stageMs)
+        out << ',' << ms;
+    // leave the counters empty rather than report zeros the driver never counted
+    for (GLuint64 count : s.statistics) {
+        out << ',';
+        if (s.hasStatistics)
+            out << count;
+    }
+}
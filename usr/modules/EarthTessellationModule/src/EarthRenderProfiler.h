@@ -0,0 +1,119 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <ostream>
+#include <string>
+
+namespace Aftr {
+// The GPU work MGLEarthQuad::render times separately.
+enum class EARTH_RENDER_STAGE {
+    ersCULL, // earth_cull.comp building the GPU patch list (only with earthGPUPatchList)
+    ersDRAW, // the tessellated draw of the patches
+    ersNUM_STAGES
+};
+
+// The GL_ARB_pipeline_statistics_query counters EarthRenderProfiler collects.
+enum class EARTH_RENDER_STATISTIC {
+    ersCOMPUTE_INVOCATIONS, // earth_cull.comp invocations (ersCULL)
+    ersPATCHES_SUBMITTED, // patches fed to earth.tesc (ersDRAW)
+    ersTESS_CONTROL_PATCHES, // patches earth.tesc processed
+    ersTESS_EVALUATION_INVOCATIONS, // vertices earth.tese evaluated
+    ersGEOMETRY_PRIMITIVES, // primitives emitted by a geometry shader (0, the earth shaders have none)
+    ersCLIPPING_PRIMITIVES, // tessellated primitives reaching the clipper
+    ersFRAGMENT_INVOCATIONS, // earth.frag invocations
+    ersNUM_STATISTICS
+};
+
+// The GPU times and counters of one frame.
+struct EarthRenderStats {
+    unsigned int frame = 0; // the frame (counted by EarthRenderProfiler::beginFrame) these results belong to
+    double stageMs[static_cast<int>(EARTH_RENDER_STAGE::ersNUM_STAGES)] = {}; // GL_TIME_ELAPSED of each stage, 0 if it didn't run
+    GLuint64 statistics[static_cast<int>(EARTH_RENDER_STATISTIC::ersNUM_STATISTICS)] = {};
+    bool hasStatistics = false; // false when the driver lacks GL_ARB_pipeline_statistics_query
+
+    // Returns the summed GPU time of every stage.
+    double getTotalMs() const;
+
+    // Returns the time of stage.
+    double getMs(EARTH_RENDER_STAGE stage) const { return this->stageMs[static_cast<int>(stage)]; }
+
+    // Returns the value of counter.
+    GLuint64 get(EARTH_RENDER_STATISTIC counter) const { return this->statistics[static_cast<int>(counter)]; }
+};
+
+/**
+   This class measures the GPU time of each EARTH_RENDER_STAGE with GL_TIME_ELAPSED queries and,
+   when the driver supports GL_ARB_pipeline_statistics_query, counts what the stage's shaders did.
+
+   Every query lives in a ring of NUM_FRAMES frames. beginFrame reads the results of the frame about
+   to be reused, which the GPU finished long ago, so reading never stalls the pipeline; a frame
+   whose results are somehow still pending is dropped rather than waited for. The results returned
+   by getStats are therefore NUM_FRAMES - 1 frames old.
+
+   GL_TIME_ELAPSED queries can't nest, so stages must not overlap, and nothing else may have a
+   GL_TIME_ELAPSED query active while a stage runs.
+*/
+class EarthRenderProfiler {
+public:
+    // frames of queries in flight
+    const static unsigned int NUM_FRAMES = 3;
+
+    EarthRenderProfiler();
+    ~EarthRenderProfiler();
+
+    EarthRenderProfiler(const EarthRenderProfiler&) = delete;
+    EarthRenderProfiler& operator=(const EarthRenderProfiler&) = delete;
+
+    // Collects the results of the frame NUM_FRAMES - 1 frames ago and starts a new frame.
+    void beginFrame();
+
+    // Starts timing (and counting) stage, which must not already be running.
+    void beginStage(EARTH_RENDER_STAGE stage);
+
+    // Stops timing stage.
+    void endStage(EARTH_RENDER_STAGE stage);
+
+    // Returns the newest complete results.
+    const EarthRenderStats& getStats() const { return this->stats; }
+
+    // Returns the number of frames begun so far, i.e. the frame the stages run now belong to.
+    unsigned int getFrame() const { return this->frame; }
+
+    // Returns how many frames' results were dropped because they weren't ready in time.
+    unsigned int getNumDroppedFrames() const { return this->numDroppedFrames; }
+
+    // Returns whether the pipeline statistics are collected.
+    bool isCountingStatistics() const { return this->countStatistics; }
+
+    // Returns a one line summary of getStats(), e.g. for the window title.
+    std::string toString() const;
+
+    // Returns the name stage is reported under, e.g. "draw".
+    static const char* getStageName(EARTH_RENDER_STAGE stage);
+
+    // Returns the name counter is reported under, e.g. "patchesSubmitted".
+    static const char* getStatisticName(EARTH_RENDER_STATISTIC counter);
+
+    // Writes the column names of writeCSVRow, without a line break.
+    static void writeCSVHeader(std::ostream& out);
+
+    // Writes getStats() as comma separated values, without a line break.
+    void writeCSVRow(std::ostream& out) const;
+
+protected:
+    const static int NUM_STAGES = static_cast<int>(EARTH_RENDER_STAGE::ersNUM_STAGES);
+    const static int NUM_STATISTICS = static_cast<int>(EARTH_RENDER_STATISTIC::ersNUM_STATISTICS);
+
+    // Reads the results of slot if they are all available. Returns false if any is still pending.
+    bool readResults(unsigned int slot);
+
+    bool countStatistics;
+    unsigned int frame; // frames begun so far
+    unsigned int numDroppedFrames;
+    GLuint timerQueries[NUM_FRAMES][NUM_STAGES];
+    GLuint statisticQueries[NUM_FRAMES][NUM_STATISTICS];
+    bool stageIssued[NUM_FRAMES][NUM_STAGES]; // whether the stage ran in the slot's frame
+    EarthRenderStats stats;
+};
+}
@@ -0,0 +1,208 @@
+#include "EarthUniformBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Aftr;
+
+// how long bind waits on a slot's fence per glClientWaitSync call, in nanoseconds
+const static GLuint64 FENCE_WAIT_TIMEOUT = 1000000;
+
+namespace {
+// Writes the product a * b of the column major 4x4 matrices to out.
+void multiply(const double* a, const double* b, double* out)
+{
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            double sum = 0.0;
+            for (int k = 0; k < 4; ++k)
+                sum += a[k * 4 + r] * b[c * 4 + k];
+            out[c * 4 + r] = sum;
+        }
+    }
+}
+
+// Returns the triple product a . (b x c), the determinant of the 3x3 matrix with columns a, b and c.
+double triple(const double* a, const double* b, const double* c)
+{
+    return a[0] * (b[1] * c[2] - b[2] * c[1]) + a[1] * (b[2] * c[0] - b[0] * c[2]) + a[2] * (b[0] * c[1] - b[1] * c[0]);
+}
+
+// Copies n floats from src to dst. Returns true if any of them changed.
+bool copyIfChanged(float* dst, const float* src, size_t n)
+{
+    if (std::memcmp(dst, src, n * sizeof(float)) == 0)
+        return false;
+    std::memcpy(dst, src, n * sizeof(float));
+    return true;
+}
+}
+
+EarthUniformBuffer::EarthUniformBuffer()
+{
+    std::memset(&this->uniforms, 0, sizeof(this->uniforms));
+    this->uniforms.maxTessellationFactor = 64.0f;
+    this->dirty = true;
+    this->relativeToEye = true;
+    this->buffer = 0;
+    this->slot = 0;
+    this->mapped = nullptr;
+    for (GLsync& fence : this->fences)
+        fence = nullptr;
+    this->numWrites = 0;
+    this->numBinds = 0;
+    this->numWritesLastFrame = 0;
+    this->numBindsLastFrame = 0;
+
+    // every slot has to start at a multiple of the offset alignment to be bound with glBindBufferRange
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 1);
+    this->slotSize = (static_cast<GLsizeiptr>(sizeof(EarthUniforms)) + alignment - 1) / alignment * alignment;
+    GLsizeiptr size = this->slotSize * NUM_SLOTS;
+
+    // a loaded glBufferStorage doesn't mean the context supports it, GLEW resolves whatever the driver exports
+    // (fences and glMapBufferRange are core in the GL 4 tessellation needs)
+    bool bufferStorage = GLEW_VERSION_4_4 != GL_FALSE || GLEW_ARB_buffer_storage != GL_FALSE;
+
+    glGenBuffers(1, &this->buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+    if (bufferStorage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+        this->mapped = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags));
+    }
+    if (this->mapped == nullptr) {
+        // buffer storage is immutable, so start over with a buffer glBufferSubData can write
+        if (bufferStorage) {
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glDeleteBuffers(1, &this->buffer);
+            glGenBuffers(1, &this->buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+        }
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+EarthUniformBuffer::~EarthUniformBuffer()
+{
+    for (GLsync fence : this->fences) {
+        if (fence != nullptr)
+            glDeleteSync(fence);
+    }
+
+    if (this->mapped != nullptr) {
+        glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &this->buffer);
+}
+
+void EarthUniformBuffer::setMVPMatrix(const float* m)
+{
+    if (copyIfChanged(this->uniforms.MVPMat, m, 16))
+        this->dirty = true;
+}
+
+void EarthUniformBuffer::setCameraTransform(const float* projection, const float* view, const float* model, const float* cameraPosition)
+{
+    double p[16];
+    double v[16];
+    double m[16];
+    for (int i = 0; i < 16; ++i) {
+        p[i] = projection[i];
+        v[i] = view[i];
+        m[i] = model[i];
+    }
+
+    // the eye in model space solves M * eye = cameraPosition, by Cramer's rule on the upper 3x3 of M
+    double b[3] = { cameraPosition[0] - m[12], cameraPosition[1] - m[13], cameraPosition[2] - m[14] };
+    double eye[3] = { b[0], b[1], b[2] };
+    double det = triple(m, m + 4, m + 8);
+    if (det != 0.0) {
+        eye[0] = triple(b, m + 4, m + 8) / det;
+        eye[1] = triple(m, b, m + 8) / det;
+        eye[2] = triple(m, m + 4, b) / det;
+    }
+
+    // The view matrix takes the camera to the origin, so V * M * x = (V * M without its translation) * (x - eye).
+    // Dropping the translation keeps the large, nearly cancelling terms out of the float matrix.
+    double vm[16];
+    double mvp[16];
+    multiply(v, m, vm);
+    if (this->relativeToEye)
+        vm[12] = vm[13] = vm[14] = 0.0;
+    multiply(p, vm, mvp);
+
+    float mvpF[16];
+    for (int i = 0; i < 16; ++i)
+        mvpF[i] = static_cast<float>(mvp[i]);
+    this->setMVPMatrix(mvpF);
+
+    // eyeHigh + eyeLow carries about 48 bits of the eye, and x - eyeHigh is exact for any x near it
+    float high[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float low[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float position[4] = { static_cast<float>(eye[0]), static_cast<float>(eye[1]), static_cast<float>(eye[2]), 1.0f };
+    if (this->relativeToEye) {
+        for (int i = 0; i < 3; ++i) {
+            high[i] = static_cast<float>(eye[i]);
+            low[i] = static_cast<float>(eye[i] - high[i]);
+        }
+    }
+    if (copyIfChanged(this->uniforms.eyeHigh, high, 4))
+        this->dirty = true;
+    if (copyIfChanged(this->uniforms.eyeLow, low, 4))
+        this->dirty = true;
+    if (copyIfChanged(this->uniforms.eyePosition, position, 4))
+        this->dirty = true;
+}
+
+void EarthUniformBuffer::setTileGrid(const float* grid)
+{
+    if (copyIfChanged(this->uniforms.tileGrid, grid, 4))
+        this->dirty = true;
+}
+
+void EarthUniformBuffer::bind()
+{
+    if (this->dirty) {
+        // every draw issued so far that reads the current slot is before this fence
+        unsigned int next = (this->slot + 1) % NUM_SLOTS;
+        if (this->mapped != nullptr) {
+            if (this->fences[this->slot] != nullptr)
+                glDeleteSync(this->fences[this->slot]);
+            this->fences[this->slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+            // the ring wrapped around, wait until the GPU is done with the slot (normally long ago)
+            if (this->fences[next] != nullptr) {
+                while (glClientWaitSync(this->fences[next], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_WAIT_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+                    ;
+                glDeleteSync(this->fences[next]);
+                this->fences[next] = nullptr;
+            }
+            std::memcpy(this->mapped + next * this->slotSize, &this->uniforms, sizeof(this->uniforms));
+        } else {
+            glBindBuffer(GL_UNIFORM_BUFFER, this->buffer);
+            glBufferSubData(GL_UNIFORM_BUFFER, next * this->slotSize, sizeof(this->uniforms), &this->uniforms);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+
+        this->slot = next;
+        this->dirty = false;
+        this->numWrites++;
+    }
+
+    // rebind even when clean, another EarthUniformBuffer may have used the binding point since
+    glBindBufferRange(GL_UNIFORM_BUFFER, getUniformBlockBinding(), this->buffer, this->slot * this->slotSize, sizeof(EarthUniforms));
+    this->numBinds++;
+}
+
+void EarthUniformBuffer::beginFrame()
+{
+    this->numWritesLastFrame = this->numWrites;
+    this->numBindsLastFrame = this->numBinds;
+    this->numWrites = 0;
+    this->numBinds = 0;
+}
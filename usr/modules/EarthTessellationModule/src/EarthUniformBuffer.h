@@ -0,0 +1,132 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <cstddef>
+
+namespace Aftr {
+
+/**
+   The std140 layout of the EarthUniforms block declared in earth_uniforms.glsl. The members, their
+   order and their offsets must match the block exactly.
+*/
+struct EarthUniforms {
+    float MVPMat[16]; // offset 0
+    float tileGrid[4]; // offset 64, (lat, lon) in radians of the fixed grid's upper-left and lower-right corners
+    float scale; // offset 80
+    float tessellationFactor;
+    float maxTessellationFactor;
+    GLint cullingEnabled;
+    float minElevation; // offset 96
+    GLint lodMode;
+    float targetPixelError;
+    float viewportHeight;
+    GLint numTilesX; // offset 112
+    GLint numTilesY;
+    GLuint64 elevationTextureHandle; // offset 120, GL_ARB_bindless_texture handles (uvec2 in the block)
+    GLuint64 imageryTextureHandle;
+    GLuint64 elevationBoundsHandle;
+    GLuint64 tileErrorsHandle;
+    float padding; // offset 152, unused
+    GLint patchStatsEnabled; // offset 156, whether earth.tesc and earth_cull.comp count the drawn and culled patches
+    float eyeHigh[4]; // offset 160, the eye in model space split into two floats whose sum is the eye in double,
+    float eyeLow[4]; // subtracted from every position before MVPMat (zero without relative-to-eye rendering)
+    float eyePosition[4]; // offset 192, the eye in model space
+    GLuint64 imageryIndirectionHandle; // offset 208, bindless handle of the ImageryVirtualTexture's indirection texture
+    GLint imageryWidth; // offset 216, base level size of the virtual imagery
+    GLint imageryHeight;
+    GLint imageryNumLevels;
+    float imageryLodBias; // added to the level earth.frag picks from the imagery's derivatives
+    float padding2[2]; // std140 rounds the block up to 16 bytes
+};
+static_assert(sizeof(EarthUniforms) == 240, "EarthUniforms must match the std140 layout of earth_uniforms.glsl");
+
+/**
+   This class holds the parameters of the earth shaders in a uniform buffer object, which is shared
+   by every program drawing the same MGLEarthQuad (the skin and earth_cull.comp).
+
+   The setters only update a copy in client memory and mark it dirty when a value actually changes.
+   bind then writes the whole block once into the next slot of a ring of NUM_SLOTS slots and binds
+   that range to the EarthUniforms binding point, so a frame whose parameters did not change writes
+   nothing at all. The ring is persistently mapped when the context supports GL_ARB_buffer_storage
+   (or is GL 4.4), and each slot is fenced before it is written again so the GPU is never raced.
+   Without buffer storage the slots are written with glBufferSubData.
+
+   With relative-to-eye rendering (the default) setCameraTransform moves the camera's translation
+   out of MVPMat: the eye is computed in double and subtracted from every position in the shaders
+   as eyeHigh and eyeLow before the projection, so positions near the camera keep their precision
+   even at the scale of the earth's radius.
+*/
+class EarthUniformBuffer {
+public:
+    // slots in the ring, the number of block writes the GPU may lag behind before bind waits
+    const static unsigned int NUM_SLOTS = 64;
+
+    // Returns the uniform buffer binding point of the EarthUniforms block (layout (binding = 2) in earth_uniforms.glsl).
+    static GLuint getUniformBlockBinding() { return 2; }
+
+    EarthUniformBuffer();
+    ~EarthUniformBuffer();
+
+    EarthUniformBuffer(const EarthUniformBuffer&) = delete;
+    EarthUniformBuffer& operator=(const EarthUniformBuffer&) = delete;
+
+    // Returns the values the next bind makes visible to the shaders.
+    const EarthUniforms& getUniforms() const { return this->uniforms; }
+
+    // Sets a scalar member, e.g. set(&EarthUniforms::scale, 2.0f). Marks the block dirty iff the value changed.
+    template <typename T>
+    void set(T EarthUniforms::*member, T value)
+    {
+        if (!(this->uniforms.*member == value)) {
+            this->uniforms.*member = value;
+            this->dirty = true;
+        }
+    }
+
+    // Sets the column major Model View Projection matrix.
+    void setMVPMatrix(const float* m);
+
+    /**
+        Sets MVPMat and the eye from the camera and model transforms, combining them in double.
+        projection, view, model - Column major 4x4 matrices.
+        cameraPosition - The camera's position in world space.
+    */
+    void setCameraTransform(const float* projection, const float* view, const float* model, const float* cameraPosition);
+
+    // Sets whether setCameraTransform subtracts the eye before MVPMat rather than folding it into MVPMat.
+    void setRelativeToEye(bool b) { this->relativeToEye = b; }
+
+    // Returns whether setCameraTransform subtracts the eye before MVPMat.
+    bool isRelativeToEye() const { return this->relativeToEye; }
+
+    // Sets the (lat, lon) in radians of the fixed grid's upper-left and lower-right corners.
+    void setTileGrid(const float* grid);
+
+    // Writes the block if it is dirty and binds its current slot to getUniformBlockBinding().
+    void bind();
+
+    // Starts a new frame of the counters below.
+    void beginFrame();
+
+    // Returns how many times the block was written (one buffer write per dirty bind) in the last complete frame.
+    unsigned int getNumWritesLastFrame() const { return this->numWritesLastFrame; }
+
+    // Returns how many times a slot was bound to the binding point in the last complete frame.
+    unsigned int getNumBindsLastFrame() const { return this->numBindsLastFrame; }
+
+protected:
+    EarthUniforms uniforms;
+    bool dirty;
+    bool relativeToEye;
+    GLuint buffer;
+    GLsizeiptr slotSize; // sizeof(EarthUniforms) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    unsigned int slot; // slot the block was last written to
+    char* mapped; // the persistently mapped ring, nullptr when the slots are written with glBufferSubData
+    GLsync fences[NUM_SLOTS]; // set when the GPU may still read a slot
+    unsigned int numWrites;
+    unsigned int numBinds;
+    unsigned int numWritesLastFrame;
+    unsigned int numBindsLastFrame;
+};
+}
@@ -0,0 +1,208 @@
+#include "ElevationBoundsPyramid.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+using namespace Aftr;
+
+namespace {
+// Splits [begin, end) into at most two ranges within [0, size), wrapping around like a repeat
+// wrapped texture. Returns the number of ranges written to ranges.
+unsigned int wrapRange(int begin, int end, int size, int ranges[2][2])
+{
+    if (end - begin >= size) {
+        ranges[0][0] = 0;
+        ranges[0][1] = size;
+        return 1;
+    }
+
+    int first = ((begin % size) + size) % size;
+    int last = first + (end - begin);
+    ranges[0][0] = first;
+    ranges[0][1] = std::min(last, size);
+    if (last <= size)
+        return 1;
+
+    ranges[1][0] = 0;
+    ranges[1][1] = last - size;
+    return 2;
+}
+}
+
+ElevationBoundsPyramid::ElevationBoundsPyramid()
+{
+    this->width = 0;
+    this->height = 0;
+    this->cellShift = 0;
+}
+
+ElevationBoundsPyramid::ElevationBoundsPyramid(unsigned int width, unsigned int height)
+{
+    this->width = width;
+    this->height = height;
+    size_t size = computeLayout(width, height, this->cellShift, this->levelWidths, this->levelHeights, this->levelOffsets);
+
+    // start every cell out as an empty range so addRows only ever has to widen it
+    this->data.resize(size);
+    for (size_t i = 0; i < size; i += 2) {
+        this->data[i] = SHRT_MAX;
+        this->data[i + 1] = SHRT_MIN;
+    }
+}
+
+void ElevationBoundsPyramid::addRows(unsigned int y, unsigned int numRows, const GLshort* rows)
+{
+    unsigned int cellSize = this->getCellSize();
+    unsigned int baseWidth = this->levelWidths.at(0);
+
+    for (unsigned int j = 0; j < numRows; ++j) {
+        const GLshort* row = rows + static_cast<size_t>(j) * this->width;
+        GLshort* cells = this->data.data() + static_cast<size_t>((y + j) >> this->cellShift) * baseWidth * 2;
+
+        for (unsigned int cx = 0; cx < baseWidth; ++cx) {
+            unsigned int x0 = cx * cellSize;
+            unsigned int x1 = std::min(x0 + cellSize, this->width);
+
+            GLshort lo = cells[cx * 2];
+            GLshort hi = cells[cx * 2 + 1];
+            for (unsigned int x = x0; x < x1; ++x) {
+                lo = std::min(lo, row[x]);
+                hi = std::max(hi, row[x]);
+            }
+            cells[cx * 2] = lo;
+            cells[cx * 2 + 1] = hi;
+        }
+    }
+}
+
+void ElevationBoundsPyramid::finish()
+{
+    for (unsigned int level = 1; level < this->getNumLevels(); ++level) {
+        unsigned int sWidth = this->levelWidths[level - 1];
+        unsigned int sHeight = this->levelHeights[level - 1];
+        const GLshort* src = this->data.data() + this->levelOffsets[level - 1];
+        GLshort* dest = this->data.data() + this->levelOffsets[level];
+
+        unsigned int dWidth = this->levelWidths[level];
+        unsigned int dHeight = this->levelHeights[level];
+
+        // The levels round down like GL's mipmaps, so the last row and column of each level also
+        // take the odd row and column left over below them.
+        for (unsigned int cy = 0; cy < dHeight; ++cy) {
+            unsigned int sy0 = cy * 2;
+            unsigned int sy1 = cy + 1 == dHeight ? sHeight : std::min(sy0 + 2, sHeight);
+
+            for (unsigned int cx = 0; cx < dWidth; ++cx) {
+                unsigned int sx0 = cx * 2;
+                unsigned int sx1 = cx + 1 == dWidth ? sWidth : std::min(sx0 + 2, sWidth);
+
+                GLshort lo = SHRT_MAX;
+                GLshort hi = SHRT_MIN;
+                for (unsigned int sy = sy0; sy < sy1; ++sy) {
+                    const GLshort* cells = src + static_cast<size_t>(sy) * sWidth * 2;
+                    for (unsigned int sx = sx0; sx < sx1; ++sx) {
+                        lo = std::min(lo, cells[sx * 2]);
+                        hi = std::max(hi, cells[sx * 2 + 1]);
+                    }
+                }
+
+                GLshort* out = dest + (static_cast<size_t>(cy) * dWidth + cx) * 2;
+                out[0] = lo;
+                out[1] = hi;
+            }
+        }
+    }
+}
+
+void ElevationBoundsPyramid::setData(const GLshort* data)
+{
+    std::memcpy(this->data.data(), data, sizeof(GLshort) * this->data.size());
+}
+
+bool ElevationBoundsPyramid::getBounds(int x0, int y0, int x1, int y1, GLshort& minElev, GLshort& maxElev) const
+{
+    if (this->isEmpty() || x1 <= x0 || y1 <= y0)
+        return false;
+
+    int xRanges[2][2];
+    int yRanges[2][2];
+    unsigned int numX = wrapRange(x0, x1, static_cast<int>(this->width), xRanges);
+    unsigned int numY = wrapRange(y0, y1, static_cast<int>(this->height), yRanges);
+
+    int lo = INT_MAX;
+    int hi = INT_MIN;
+    for (unsigned int i = 0; i < numX; ++i)
+        for (unsigned int j = 0; j < numY; ++j)
+            this->getBoundsClamped(xRanges[i][0], yRanges[j][0], xRanges[i][1], yRanges[j][1], lo, hi);
+
+    minElev = static_cast<GLshort>(lo);
+    maxElev = static_cast<GLshort>(hi);
+    return true;
+}
+
+size_t ElevationBoundsPyramid::getDataSize(unsigned int width, unsigned int height)
+{
+    unsigned int cellShift;
+    std::vector<unsigned int> widths;
+    std::vector<unsigned int> heights;
+    std::vector<size_t> offsets;
+    return computeLayout(width, height, cellShift, widths, heights, offsets);
+}
+
+size_t ElevationBoundsPyramid::computeLayout(unsigned int width, unsigned int height, unsigned int& cellShift,
+    std::vector<unsigned int>& widths, std::vector<unsigned int>& heights, std::vector<size_t>& offsets)
+{
+    // pick the smallest power of two cell that keeps the base level within MAX_BASE_WIDTH
+    cellShift = 0;
+    while (((width + (1u << cellShift) - 1) >> cellShift) > MAX_BASE_WIDTH)
+        ++cellShift;
+
+    unsigned int w = (width + (1u << cellShift) - 1) >> cellShift;
+    unsigned int h = (height + (1u << cellShift) - 1) >> cellShift;
+    size_t size = 0;
+    while (true) {
+        widths.push_back(w);
+        heights.push_back(h);
+        offsets.push_back(size);
+        size += static_cast<size_t>(w) * h * 2;
+
+        if (w == 1 && h == 1)
+            break;
+
+        // round down like GL's mipmap sizes, so the levels upload as the texture's mipmaps
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+    return size;
+}
+
+void ElevationBoundsPyramid::getBoundsClamped(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, int& minElev, int& maxElev) const
+{
+    unsigned int cx0 = x0 >> this->cellShift;
+    unsigned int cx1 = (x1 - 1) >> this->cellShift;
+    unsigned int cy0 = y0 >> this->cellShift;
+    unsigned int cy1 = (y1 - 1) >> this->cellShift;
+
+    // climb until the rectangle touches at most 3x3 cells, the last cell of a level holds the odd ones below it
+    unsigned int level = 0;
+    while ((cx1 - cx0 > 2 || cy1 - cy0 > 2) && level + 1 < this->getNumLevels()) {
+        ++level;
+        unsigned int lastX = this->levelWidths[level] - 1;
+        unsigned int lastY = this->levelHeights[level] - 1;
+        cx0 = std::min(cx0 >> 1, lastX);
+        cx1 = std::min(cx1 >> 1, lastX);
+        cy0 = std::min(cy0 >> 1, lastY);
+        cy1 = std::min(cy1 >> 1, lastY);
+    }
+
+    const GLshort* cells = this->getLevel(level);
+    unsigned int levelWidth = this->levelWidths[level];
+    for (unsigned int cy = cy0; cy <= cy1; ++cy) {
+        for (unsigned int cx = cx0; cx <= cx1; ++cx) {
+            const GLshort* cell = cells + (static_cast<size_t>(cy) * levelWidth + cx) * 2;
+            minElev = std::min(minElev, static_cast<int>(cell[0]));
+            maxElev = std::max(maxElev, static_cast<int>(cell[1]));
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <vector>
+
+namespace Aftr {
+/**
+   This class holds a min/max pyramid over 16 bit elevation data. Each cell of the base level
+   stores the lowest and highest elevation of a square block of source texels (the block is sized
+   so the base level is at most MAX_BASE_WIDTH cells wide), and each coarser level stores the
+   min/max of 2x2 cells of the level below, down to a single cell. The levels are sized like GL's
+   mipmaps (halved and rounded down), so the last row and column of a level also cover the odd row
+   and column of the level below.
+
+   The data of every level is stored as interleaved (min, max) pairs, so it can be uploaded
+   directly as an RG16I texture. Queries are conservative: the returned range always contains every
+   source texel in the queried rectangle, but may also include some of its neighbours.
+*/
+class ElevationBoundsPyramid {
+public:
+    // the base level is never wider than this many cells
+    const static unsigned int MAX_BASE_WIDTH = 4096;
+
+    // Constructor for an empty pyramid. getBounds always fails on an empty pyramid.
+    ElevationBoundsPyramid();
+
+    /**
+        Constructor for creating a pyramid over a source of the given dimensions.
+        Rows are then added with addRows and finish is called once all of them have been added,
+        or the whole pyramid is loaded at once with setData.
+    */
+    ElevationBoundsPyramid(unsigned int width, unsigned int height);
+
+    // Accumulates numRows full rows of source texels starting at row y into the base level.
+    void addRows(unsigned int y, unsigned int numRows, const GLshort* rows);
+
+    // Builds every level above the base level. Call once after the last addRows.
+    void finish();
+
+    // Replaces the whole pyramid with getDataSize() values in the layout returned by getData.
+    void setData(const GLshort* data);
+
+    /**
+        Gets the conservative min/max elevation of the source texels in [x0, x1) x [y0, y1).
+        The rectangle may extend past the edges of the source, in which case it wraps around like
+        the repeat wrapped elevation texture does. Returns false if the pyramid is empty or the
+        rectangle is empty.
+    */
+    bool getBounds(int x0, int y0, int x1, int y1, GLshort& minElev, GLshort& maxElev) const;
+
+    // Returns whether the pyramid covers any data.
+    bool isEmpty() const { return this->data.empty(); }
+
+    // Returns the width of the source data.
+    unsigned int getWidth() const { return this->width; }
+
+    // Returns the height of the source data.
+    unsigned int getHeight() const { return this->height; }
+
+    // Returns the width and height in source texels covered by a single base level cell.
+    unsigned int getCellSize() const { return 1u << this->cellShift; }
+
+    // Returns the number of levels, including the base level.
+    unsigned int getNumLevels() const { return static_cast<unsigned int>(this->levelWidths.size()); }
+
+    // Returns the width of a level in cells.
+    unsigned int getLevelWidth(unsigned int level) const { return this->levelWidths.at(level); }
+
+    // Returns the height of a level in cells.
+    unsigned int getLevelHeight(unsigned int level) const { return this->levelHeights.at(level); }
+
+    // Returns the (min, max) pairs of a level.
+    const GLshort* getLevel(unsigned int level) const { return this->data.data() + this->levelOffsets.at(level); }
+
+    // Returns every level, one after the other.
+    const std::vector<GLshort>& getData() const { return this->data; }
+
+    // Returns the number of GLshort values a pyramid over a source of the given dimensions holds.
+    static size_t getDataSize(unsigned int width, unsigned int height);
+
+protected:
+    unsigned int width;
+    unsigned int height;
+    unsigned int cellShift; // log2 of the base cell size
+    std::vector<unsigned int> levelWidths;
+    std::vector<unsigned int> levelHeights;
+    std::vector<size_t> levelOffsets; // offsets into data of each level, in GLshorts
+    std::vector<GLshort> data;
+
+    // Computes the level layout of a source of the given dimensions. Returns the total number of values.
+    static size_t computeLayout(unsigned int width, unsigned int height, unsigned int& cellShift,
+        std::vector<unsigned int>& widths, std::vector<unsigned int>& heights, std::vector<size_t>& offsets);
+
+    // Gets the bounds of a rectangle that lies completely within the source.
+    void getBoundsClamped(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1, int& minElev, int& maxElev) const;
+};
+}
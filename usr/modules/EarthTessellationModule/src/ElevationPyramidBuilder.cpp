@@ -0,0 +1,253 @@
+#include "ElevationPyramidBuilder.h"
+
+#include <algorithm>
+#include <thread>
+
+// SSE2 is part of every x86-64 target; AVX2 is compiled in when the compiler can target it and
+// only used after checking the CPU at runtime.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EARTH_PYRAMID_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(EARTH_PYRAMID_SSE2) && (defined(__GNUC__) || defined(_MSC_VER))
+#define EARTH_PYRAMID_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define EARTH_PYRAMID_AVX2_TARGET
+#else
+#define EARTH_PYRAMID_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace Aftr;
+
+namespace {
+// below this many destination texels a level is reduced on the calling thread
+const static size_t MIN_TEXELS_PER_THREAD = 1 << 16;
+
+// Reduces count destination texels from two source rows, each destination texel averaging a 2x2 block.
+using Kernel2x2 = void (*)(const GLshort* src0, const GLshort* src1, GLshort* dest, unsigned int count);
+
+void reduce2x2Scalar(const GLshort* src0, const GLshort* src1, GLshort* dest, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i) {
+        // (Do summation as integer to avoid short overflow).
+        int sum = src0[i * 2];
+        sum += src0[i * 2 + 1];
+        sum += src1[i * 2];
+        sum += src1[i * 2 + 1];
+
+        dest[i] = static_cast<GLshort>(sum / 4);
+    }
+}
+
+#ifdef EARTH_PYRAMID_SSE2
+void reduce2x2SSE2(const GLshort* src0, const GLshort* src1, GLshort* dest, unsigned int count)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i three = _mm_set1_epi32(3);
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + i * 2));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + i * 2 + 8));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + i * 2));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + i * 2 + 8));
+
+        // madd against 1 sums horizontal pairs into 32 bit lanes
+        __m128i s0 = _mm_add_epi32(_mm_madd_epi16(a0, ones), _mm_madd_epi16(b0, ones));
+        __m128i s1 = _mm_add_epi32(_mm_madd_epi16(a1, ones), _mm_madd_epi16(b1, ones));
+
+        // divide by 4 rounding toward zero to match integer division
+        s0 = _mm_srai_epi32(_mm_add_epi32(s0, _mm_and_si128(_mm_srai_epi32(s0, 31), three)), 2);
+        s1 = _mm_srai_epi32(_mm_add_epi32(s1, _mm_and_si128(_mm_srai_epi32(s1, 31), three)), 2);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packs_epi32(s0, s1));
+    }
+
+    reduce2x2Scalar(src0 + i * 2, src1 + i * 2, dest + i, count - i);
+}
+#endif
+
+#ifdef EARTH_PYRAMID_AVX2
+EARTH_PYRAMID_AVX2_TARGET void reduce2x2AVX2(const GLshort* src0, const GLshort* src1, GLshort* dest, unsigned int count)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i three = _mm256_set1_epi32(3);
+
+    unsigned int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + i * 2));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + i * 2 + 16));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + i * 2));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + i * 2 + 16));
+
+        __m256i s0 = _mm256_add_epi32(_mm256_madd_epi16(a0, ones), _mm256_madd_epi16(b0, ones));
+        __m256i s1 = _mm256_add_epi32(_mm256_madd_epi16(a1, ones), _mm256_madd_epi16(b1, ones));
+
+        s0 = _mm256_srai_epi32(_mm256_add_epi32(s0, _mm256_and_si256(_mm256_srai_epi32(s0, 31), three)), 2);
+        s1 = _mm256_srai_epi32(_mm256_add_epi32(s1, _mm256_and_si256(_mm256_srai_epi32(s1, 31), three)), 2);
+
+        // packs works within 128 bit lanes, so put the quadwords back in order afterwards
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), packed);
+    }
+
+    reduce2x2SSE2(src0 + i * 2, src1 + i * 2, dest + i, count - i);
+}
+
+bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+Kernel2x2 selectKernel(const char** name)
+{
+#ifdef EARTH_PYRAMID_AVX2
+    if (cpuHasAVX2()) {
+        *name = "AVX2";
+        return reduce2x2AVX2;
+    }
+#endif
+#ifdef EARTH_PYRAMID_SSE2
+    *name = "SSE2";
+    return reduce2x2SSE2;
+#else
+    *name = "scalar";
+    return reduce2x2Scalar;
+#endif
+}
+
+const char* kernelName = nullptr;
+const Kernel2x2 kernel2x2 = selectKernel(&kernelName);
+}
+
+ElevationPyramidBuilder::ElevationPyramidBuilder(unsigned int numThreads)
+{
+    this->numThreads = numThreads > 0 ? numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ElevationPyramidBuilder::build(const GLshort* base, unsigned int width, unsigned int height, const LevelCallback& onLevel)
+{
+    if (width == 0 || height == 0)
+        return;
+
+    // level 1 and level 2 are the two largest levels, every later level reuses one of their halves
+    unsigned int w1 = std::max(width / 2, 1u);
+    unsigned int h1 = std::max(height / 2, 1u);
+    size_t size1 = static_cast<size_t>(w1) * h1;
+    size_t size2 = static_cast<size_t>(std::max(w1 / 2, 1u)) * std::max(h1 / 2, 1u);
+    this->arena.resize(size1 + size2);
+
+    const GLshort* source = base;
+    unsigned int sWidth = width;
+    unsigned int sHeight = height;
+    unsigned int level = 0;
+    while (sWidth > 1 || sHeight > 1) {
+        unsigned int dWidth = std::max(sWidth / 2, 1u);
+        unsigned int dHeight = std::max(sHeight / 2, 1u);
+
+        level++;
+        GLshort* dest = this->arena.data() + (level % 2 == 1 ? 0 : size1);
+
+        this->reduceRows(source, 0, sWidth, sHeight, dest, 0, dHeight, dWidth);
+        onLevel(level, dWidth, dHeight, dest);
+
+        source = dest;
+        sWidth = dWidth;
+        sHeight = dHeight;
+    }
+}
+
+void ElevationPyramidBuilder::reduceRows(const GLshort* src, unsigned int srcFirstRow, unsigned int sWidth, unsigned int sHeight,
+    GLshort* dest, unsigned int destBegin, unsigned int destEnd, unsigned int dWidth) const
+{
+    unsigned int dHeight = std::max(sHeight / 2, 1u);
+
+    auto reduceBand = [=](unsigned int begin, unsigned int end) {
+        for (unsigned int j = begin; j < end; ++j) {
+            const GLshort* first = src + static_cast<size_t>(2 * j - srcFirstRow) * sWidth;
+            const GLshort* rows[3] = { first, first + sWidth, first + 2 * static_cast<size_t>(sWidth) };
+            reduceRow(rows, getSourceRowsFor(j, sHeight, dHeight), sWidth, dest + static_cast<size_t>(j - destBegin) * dWidth, dWidth);
+        }
+    };
+
+    unsigned int numRows = destEnd - destBegin;
+    size_t numTexels = static_cast<size_t>(numRows) * dWidth;
+    unsigned int numBands = static_cast<unsigned int>(std::min<size_t>({ this->numThreads, numRows, numTexels / MIN_TEXELS_PER_THREAD }));
+    if (numBands <= 1) {
+        reduceBand(destBegin, destEnd);
+        return;
+    }
+
+    // hand out contiguous bands of rows, the calling thread takes the last one
+    std::vector<std::thread> workers;
+    workers.reserve(numBands - 1);
+    unsigned int begin = destBegin;
+    for (unsigned int band = 0; band < numBands; ++band) {
+        unsigned int end = destBegin + static_cast<unsigned int>(static_cast<size_t>(numRows) * (band + 1) / numBands);
+        if (band + 1 < numBands)
+            workers.emplace_back(reduceBand, begin, end);
+        else
+            reduceBand(begin, end);
+        begin = end;
+    }
+
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+unsigned int ElevationPyramidBuilder::getSourceRowsFor(unsigned int destRow, unsigned int sHeight, unsigned int dHeight)
+{
+    if (sHeight == 1)
+        return 1;
+    if (destRow + 1 == dHeight && sHeight % 2 == 1)
+        return 3; // the last row of an odd height source folds into the last destination row
+    return 2;
+}
+
+const char* ElevationPyramidBuilder::getKernelName()
+{
+    return kernelName;
+}
+
+void ElevationPyramidBuilder::reduceRow(const GLshort* const* rows, unsigned int numRows, unsigned int sWidth, GLshort* dest, unsigned int dWidth)
+{
+    // the common case of two rows and whole 2x2 blocks goes through the vector kernel
+    unsigned int i = 0;
+    if (numRows == 2 && sWidth > 1) {
+        i = sWidth % 2 == 1 ? dWidth - 1 : dWidth;
+        kernel2x2(rows[0], rows[1], dest, i);
+    }
+
+    // the remaining texels average 1 to 3 columns of 1 to 3 rows
+    for (; i < dWidth; ++i) {
+        unsigned int x0 = i * 2;
+        unsigned int numCols = 2;
+        if (sWidth == 1)
+            numCols = 1;
+        else if (i + 1 == dWidth && sWidth % 2 == 1)
+            numCols = 3;
+
+        int sum = 0;
+        for (unsigned int r = 0; r < numRows; ++r)
+            for (unsigned int c = 0; c < numCols; ++c)
+                sum += rows[r][x0 + c];
+
+        dest[i] = static_cast<GLshort>(sum / static_cast<int>(numRows * numCols));
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <functional>
+#include <vector>
+
+namespace Aftr {
+/**
+   This class builds the averaged mipmap pyramid of 16 bit elevation data (the R16I elevation
+   texture) on the CPU. Each level is split across worker threads by bands of rows, and the 2x2
+   reduction uses SSE2 or AVX2 kernels when the CPU supports them.
+
+   Levels are sized floor(n / 2) like OpenGL mipmaps. When a source dimension is odd, the last
+   destination column (or row) averages the 3 remaining source columns (or rows) so no source
+   texel is dropped and nothing is read past the end of a row or image.
+*/
+class ElevationPyramidBuilder {
+public:
+    /**
+        Called once for each level produced by build.
+        level - The mipmap level (1 is the first level below the base).
+        width, height - The dimensions of the level.
+        data - Tightly packed level data. Only valid for the duration of the call.
+    */
+    using LevelCallback = std::function<void(unsigned int level, unsigned int width, unsigned int height, const GLshort* data)>;
+
+    /**
+        Constructor for creating a pyramid builder.
+        numThreads - The number of threads used to reduce a level. 0 uses the hardware concurrency.
+    */
+    ElevationPyramidBuilder(unsigned int numThreads = 0);
+
+    /**
+        Builds every level below the base level down to 1x1. All levels are produced in a single
+        ping-pong arena that is reused for the whole chain, so the memory used is about a third
+        of the base level.
+    */
+    void build(const GLshort* base, unsigned int width, unsigned int height, const LevelCallback& onLevel);
+
+    /**
+        Reduces destination rows [destBegin, destEnd) of one level from its source level.
+        src - Points at source row srcFirstRow. It must hold every source row the requested
+              destination rows need (rows 2 * destBegin through 2 * destEnd - 1, plus the last
+              source row when the source height is odd).
+        dest - Points at destination row destBegin.
+    */
+    void reduceRows(const GLshort* src, unsigned int srcFirstRow, unsigned int sWidth, unsigned int sHeight,
+        GLshort* dest, unsigned int destBegin, unsigned int destEnd, unsigned int dWidth) const;
+
+    // Returns the number of source rows needed to produce destination row destRow, starting at row 2 * destRow.
+    static unsigned int getSourceRowsFor(unsigned int destRow, unsigned int sHeight, unsigned int dHeight);
+
+    // Returns the number of threads used per level.
+    unsigned int getNumThreads() const { return this->numThreads; }
+
+    // Returns the name of the 2x2 kernel selected for this CPU ("AVX2", "SSE2" or "scalar").
+    static const char* getKernelName();
+
+protected:
+    unsigned int numThreads;
+    std::vector<GLshort> arena; // ping-pong storage for the levels produced by build
+
+    // Reduces a single destination row from 1, 2 or 3 source rows.
+    static void reduceRow(const GLshort* const* rows, unsigned int numRows, unsigned int sWidth, GLshort* dest, unsigned int dWidth);
+};
+}
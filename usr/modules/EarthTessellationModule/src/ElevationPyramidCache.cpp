@@ -0,0 +1,325 @@
+#include "ElevationPyramidCache.h"
+#include "ElevationBoundsPyramid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Aftr;
+
+namespace {
+const static char PYRAMID_CACHE_MAGIC[8] = { 'A', 'F', 'T', 'R', 'P', 'Y', 'R', '\0' };
+const static uint32_t PYRAMID_CACHE_VERSION = 3; // 3 rounds the bounds levels down
+const static uint32_t PYRAMID_CACHE_BYTE_ORDER = 0x01020304;
+const static unsigned int PYRAMID_CACHE_MAX_LEVELS = 32;
+const static uint64_t PYRAMID_CACHE_DATA_ALIGNMENT = 4096; // the base level starts on a page boundary
+const static uint64_t PYRAMID_CACHE_LEVEL_ALIGNMENT = 64;
+
+// Fixed size header at the start of every cache file, followed by the source path and the levels.
+struct PyramidCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numLevels;
+    uint32_t sourcePathLength;
+    uint64_t fileSize;
+    uint64_t boundsOffset; // the ElevationBoundsPyramid data follows the last level
+    uint64_t levelOffsets[PYRAMID_CACHE_MAX_LEVELS];
+};
+
+// Identifies the exact version of a source dataset the cache was built from.
+struct SourceKey {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool getSourceKey(const std::string& dataset, SourceKey& key)
+{
+    std::error_code ec;
+    std::filesystem::path path = std::filesystem::canonical(dataset, ec);
+    if (ec)
+        return false;
+
+    key.path = path.string();
+    key.size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+
+    key.mtime = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    return !ec;
+}
+
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Computes the dimensions and file offsets of every level and of the bounds pyramid. Returns the total file size.
+uint64_t computeLayout(unsigned int width, unsigned int height, size_t pathLength,
+    std::vector<unsigned int>& widths, std::vector<unsigned int>& heights, std::vector<uint64_t>& offsets, uint64_t& boundsOffset)
+{
+    widths.clear();
+    heights.clear();
+    offsets.clear();
+
+    uint64_t offset = alignUp(sizeof(PyramidCacheHeader) + pathLength, PYRAMID_CACHE_DATA_ALIGNMENT);
+    unsigned int w = width;
+    unsigned int h = height;
+    while (true) {
+        widths.push_back(w);
+        heights.push_back(h);
+        offsets.push_back(offset);
+        offset = alignUp(offset + sizeof(GLshort) * static_cast<uint64_t>(w) * h, PYRAMID_CACHE_LEVEL_ALIGNMENT);
+
+        if (w == 1 && h == 1)
+            break;
+
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+
+    boundsOffset = offset;
+    return boundsOffset + sizeof(GLshort) * static_cast<uint64_t>(ElevationBoundsPyramid::getDataSize(width, height));
+}
+}
+
+std::string ElevationPyramidCache::getCachePath(const std::string& dataset)
+{
+    return dataset + ".aftrpyr";
+}
+
+std::unique_ptr<ElevationPyramidCache> ElevationPyramidCache::open(const std::string& dataset)
+{
+    SourceKey key;
+    if (!getSourceKey(dataset, key))
+        return nullptr;
+
+    std::unique_ptr<ElevationPyramidCache> cache(new ElevationPyramidCache());
+    if (!cache->map(getCachePath(dataset)))
+        return nullptr;
+
+    // validate the header against the dataset as it is right now
+    if (cache->mappedSize < sizeof(PyramidCacheHeader))
+        return nullptr;
+
+    PyramidCacheHeader header;
+    std::memcpy(&header, cache->mapped, sizeof(header));
+    if (std::memcmp(header.magic, PYRAMID_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != PYRAMID_CACHE_VERSION
+        || header.byteOrder != PYRAMID_CACHE_BYTE_ORDER
+        || header.fileSize != cache->mappedSize
+        || header.sourceSize != key.size
+        || header.sourceMtime != key.mtime
+        || header.numLevels > PYRAMID_CACHE_MAX_LEVELS
+        || header.sourcePathLength != key.path.size()
+        || sizeof(header) + header.sourcePathLength > cache->mappedSize
+        || std::memcmp(cache->mapped + sizeof(header), key.path.data(), key.path.size()) != 0) {
+        return nullptr;
+    }
+
+    // header.levelOffsets only holds PYRAMID_CACHE_MAX_LEVELS entries, which the check above guarantees are enough
+    uint64_t fileSize = computeLayout(header.width, header.height, key.path.size(), cache->levelWidths, cache->levelHeights,
+        cache->levelOffsets, cache->boundsOffset);
+    if (fileSize != header.fileSize || cache->boundsOffset != header.boundsOffset || cache->levelOffsets.size() != header.numLevels
+        || !std::equal(cache->levelOffsets.begin(), cache->levelOffsets.end(), header.levelOffsets)) {
+        return nullptr;
+    }
+
+    return cache;
+}
+
+ElevationPyramidCache::ElevationPyramidCache()
+{
+    this->mapped = nullptr;
+    this->mappedSize = 0;
+    this->boundsOffset = 0;
+#ifdef _WIN32
+    this->fileHandle = INVALID_HANDLE_VALUE;
+    this->mappingHandle = nullptr;
+#else
+    this->fd = -1;
+#endif
+}
+
+ElevationPyramidCache::~ElevationPyramidCache()
+{
+#ifdef _WIN32
+    if (this->mapped != nullptr)
+        UnmapViewOfFile(this->mapped);
+    if (this->mappingHandle != nullptr)
+        CloseHandle(this->mappingHandle);
+    if (this->fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(this->fileHandle);
+#else
+    if (this->mapped != nullptr)
+        munmap(const_cast<unsigned char*>(this->mapped), this->mappedSize);
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+}
+
+const GLshort* ElevationPyramidCache::getLevel(unsigned int level) const
+{
+    return reinterpret_cast<const GLshort*>(this->mapped + this->levelOffsets.at(level));
+}
+
+const GLshort* ElevationPyramidCache::getBoundsData() const
+{
+    return reinterpret_cast<const GLshort*>(this->mapped + this->boundsOffset);
+}
+
+bool ElevationPyramidCache::map(const std::string& path)
+{
+#ifdef _WIN32
+    this->fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (this->fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(this->fileHandle, &size) || size.QuadPart == 0)
+        return false;
+    this->mappedSize = static_cast<size_t>(size.QuadPart);
+
+    this->mappingHandle = CreateFileMappingA(this->fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (this->mappingHandle == nullptr)
+        return false;
+
+    this->mapped = static_cast<const unsigned char*>(MapViewOfFile(this->mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    return this->mapped != nullptr;
+#else
+    this->fd = ::open(path.c_str(), O_RDONLY);
+    if (this->fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(this->fd, &st) != 0 || st.st_size == 0)
+        return false;
+    this->mappedSize = static_cast<size_t>(st.st_size);
+
+    void* addr = mmap(nullptr, this->mappedSize, PROT_READ, MAP_PRIVATE, this->fd, 0);
+    if (addr == MAP_FAILED)
+        return false;
+    this->mapped = static_cast<const unsigned char*>(addr);
+
+    // the levels are uploaded front to back right after this, so start reading ahead now
+    madvise(addr, this->mappedSize, MADV_SEQUENTIAL);
+    madvise(addr, this->mappedSize, MADV_WILLNEED);
+    return true;
+#endif
+}
+
+ElevationPyramidCacheWriter::ElevationPyramidCacheWriter(const std::string& dataset, unsigned int width, unsigned int height)
+{
+    this->dataset = dataset;
+    this->tempPath = ElevationPyramidCache::getCachePath(dataset) + ".tmp";
+    this->committed = false;
+    this->wroteBounds = false;
+
+    SourceKey key;
+    this->good = getSourceKey(dataset, key);
+    this->sourcePath = key.path;
+    this->sourceSize = key.size;
+    this->sourceMtime = key.mtime;
+    this->fileSize = computeLayout(width, height, key.path.size(), this->levelWidths, this->levelHeights, this->levelOffsets, this->boundsOffset);
+    if (this->levelOffsets.size() > PYRAMID_CACHE_MAX_LEVELS)
+        this->good = false;
+
+    if (this->good) {
+        this->out.open(this->tempPath, std::ios::binary | std::ios::trunc);
+        this->good = this->out.is_open();
+    }
+}
+
+ElevationPyramidCacheWriter::~ElevationPyramidCacheWriter()
+{
+    // discard a partially written cache
+    if (!this->committed) {
+        if (this->out.is_open())
+            this->out.close();
+        std::error_code ec;
+        std::filesystem::remove(this->tempPath, ec);
+    }
+}
+
+void ElevationPyramidCacheWriter::writeRows(unsigned int level, unsigned int y, unsigned int width, unsigned int numRows, const GLshort* rows)
+{
+    if (!this->good || level >= this->levelOffsets.size() || width != this->levelWidths[level])
+        return;
+
+    uint64_t offset = this->levelOffsets[level] + sizeof(GLshort) * static_cast<uint64_t>(y) * width;
+    this->out.seekp(static_cast<std::streamoff>(offset));
+    this->out.write(reinterpret_cast<const char*>(rows), static_cast<std::streamsize>(sizeof(GLshort) * static_cast<size_t>(width) * numRows));
+    this->good = this->out.good();
+}
+
+void ElevationPyramidCacheWriter::writeBounds(const ElevationBoundsPyramid& bounds)
+{
+    const std::vector<GLshort>& data = bounds.getData();
+    if (!this->good || data.size() != ElevationBoundsPyramid::getDataSize(this->levelWidths.at(0), this->levelHeights.at(0))) {
+        this->good = false;
+        return;
+    }
+
+    this->out.seekp(static_cast<std::streamoff>(this->boundsOffset));
+    this->out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(sizeof(GLshort) * data.size()));
+    this->good = this->out.good();
+    this->wroteBounds = this->good;
+}
+
+bool ElevationPyramidCacheWriter::commit()
+{
+    // don't cache data from a dataset that changed while it was being read
+    SourceKey key;
+    if (!this->good || !this->wroteBounds || !getSourceKey(this->dataset, key) || key.path != this->sourcePath
+        || key.size != this->sourceSize || key.mtime != this->sourceMtime) {
+        return false;
+    }
+
+    PyramidCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, PYRAMID_CACHE_MAGIC, sizeof(header.magic));
+    header.version = PYRAMID_CACHE_VERSION;
+    header.byteOrder = PYRAMID_CACHE_BYTE_ORDER;
+    header.sourceSize = key.size;
+    header.sourceMtime = key.mtime;
+    header.width = this->levelWidths.at(0);
+    header.height = this->levelHeights.at(0);
+    header.numLevels = static_cast<uint32_t>(this->levelOffsets.size());
+    header.sourcePathLength = static_cast<uint32_t>(key.path.size());
+    header.fileSize = this->fileSize;
+    header.boundsOffset = this->boundsOffset;
+    std::copy(this->levelOffsets.begin(), this->levelOffsets.end(), header.levelOffsets);
+
+    // the bounds are written last, so the file is already at its full size
+    this->out.seekp(0);
+    this->out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    this->out.write(key.path.data(), static_cast<std::streamsize>(key.path.size()));
+    this->out.close();
+    if (this->out.fail())
+        return false;
+
+    std::error_code ec;
+    std::filesystem::rename(this->tempPath, ElevationPyramidCache::getCachePath(this->dataset), ec);
+    if (ec)
+        return false;
+
+    this->committed = true;
+    return true;
+}
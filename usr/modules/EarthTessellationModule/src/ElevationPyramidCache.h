@@ -0,0 +1,123 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Aftr {
+class ElevationBoundsPyramid;
+
+/**
+   This class is a read-only view of a preprocessed elevation mipmap pyramid and its min/max
+   ElevationBoundsPyramid, stored next to their source dataset (see ElevationPyramidCacheWriter).
+   The cache file is memory mapped, so each level can be handed straight to glTexSubImage2D without
+   being copied or parsed first.
+
+   A cache is only opened when its header matches the dataset's current path, size and
+   modification time. Otherwise open returns nullptr and the caller falls back to GDAL.
+*/
+class ElevationPyramidCache {
+public:
+    // Returns the path of the cache file for dataset.
+    static std::string getCachePath(const std::string& dataset);
+
+    // Maps the cache of dataset. Returns nullptr if the cache is missing, stale or corrupt.
+    static std::unique_ptr<ElevationPyramidCache> open(const std::string& dataset);
+
+    ElevationPyramidCache(const ElevationPyramidCache&) = delete;
+    ElevationPyramidCache& operator=(const ElevationPyramidCache&) = delete;
+    virtual ~ElevationPyramidCache();
+
+    // Returns the width of the base level.
+    unsigned int getWidth() const { return this->levelWidths.at(0); }
+
+    // Returns the height of the base level.
+    unsigned int getHeight() const { return this->levelHeights.at(0); }
+
+    // Returns the number of mipmap levels (including the base level).
+    unsigned int getNumLevels() const { return static_cast<unsigned int>(this->levelWidths.size()); }
+
+    // Returns the width of a level.
+    unsigned int getLevelWidth(unsigned int level) const { return this->levelWidths.at(level); }
+
+    // Returns the height of a level.
+    unsigned int getLevelHeight(unsigned int level) const { return this->levelHeights.at(level); }
+
+    // Returns the tightly packed texels of a level, pointing directly into the mapping.
+    const GLshort* getLevel(unsigned int level) const;
+
+    // Returns the ElevationBoundsPyramid data of the dataset, in the layout of ElevationBoundsPyramid::getData.
+    const GLshort* getBoundsData() const;
+
+    // Returns the size of the mapped file in bytes.
+    size_t getMappedSize() const { return this->mappedSize; }
+
+protected:
+    ElevationPyramidCache();
+
+    const unsigned char* mapped;
+    size_t mappedSize;
+    std::vector<unsigned int> levelWidths;
+    std::vector<unsigned int> levelHeights;
+    std::vector<uint64_t> levelOffsets;
+    uint64_t boundsOffset;
+
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+
+    // Maps path into memory. Returns false on failure.
+    bool map(const std::string& path);
+};
+
+/**
+   This class writes the elevation mipmap pyramid to the cache file of a dataset while it is being
+   built. Rows may arrive in any order. They are written to a temporary file, which only replaces
+   the cache when commit is called, so an interrupted load never leaves a truncated cache behind.
+*/
+class ElevationPyramidCacheWriter {
+public:
+    /**
+        Constructor for creating a cache writer.
+        dataset - The path to the source elevation dataset.
+        width, height - The dimensions of the base level.
+    */
+    ElevationPyramidCacheWriter(const std::string& dataset, unsigned int width, unsigned int height);
+    virtual ~ElevationPyramidCacheWriter();
+
+    // Returns whether the writer is still able to produce a cache.
+    bool isGood() const { return this->good; }
+
+    // Writes numRows rows of a level starting at row y. Uses the same arguments as ElevationStreamReader::RowsCallback.
+    void writeRows(unsigned int level, unsigned int y, unsigned int width, unsigned int numRows, const GLshort* rows);
+
+    // Writes the min/max pyramid of the dataset. Must be called before commit.
+    void writeBounds(const ElevationBoundsPyramid& bounds);
+
+    // Finalizes the cache and moves it into place. Returns false if anything failed.
+    bool commit();
+
+protected:
+    std::string dataset;
+    std::string tempPath;
+    std::string sourcePath; // canonical path of the dataset
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    std::ofstream out;
+    bool good;
+    bool committed;
+    bool wroteBounds;
+    std::vector<unsigned int> levelWidths;
+    std::vector<unsigned int> levelHeights;
+    std::vector<uint64_t> levelOffsets;
+    uint64_t boundsOffset;
+    uint64_t fileSize;
+};
+}
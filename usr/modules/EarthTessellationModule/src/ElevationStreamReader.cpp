@@ -0,0 +1,160 @@
+#include "ElevationStreamReader.h"
+
+#ifdef AFTR_CONFIG_USE_GDAL // this class won't work without GDAL
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+// Note: GDAL internally has warnings in their library headers, so I'm doing this to suppress them
+#pragma warning(push, 0)
+#include "gdal_priv.h"
+#pragma warning(pop)
+
+using namespace Aftr;
+
+ElevationStreamReader::ElevationStreamReader(GDALRasterBand* band, size_t stripBudgetBytes)
+{
+    this->band = band;
+    this->width = static_cast<unsigned int>(band->GetXSize());
+    this->height = static_cast<unsigned int>(band->GetYSize());
+
+    // round the strip down to whole block rows so GDAL never decodes a block twice
+    int blockX = 0;
+    int blockY = 0;
+    band->GetBlockSize(&blockX, &blockY);
+    unsigned int blockRows = static_cast<unsigned int>(std::max(blockY, 1));
+    size_t budgetRows = stripBudgetBytes / (sizeof(GLshort) * this->width);
+    this->stripRows = static_cast<unsigned int>(budgetRows / blockRows) * blockRows;
+    this->stripRows = std::min(std::max(this->stripRows, blockRows), this->height);
+
+    // describe every mipmap level down to 1x1
+    unsigned int w = this->width;
+    unsigned int h = this->height;
+    while (true) {
+        Level level;
+        level.width = w;
+        level.height = h;
+        this->levels.push_back(level);
+
+        if (w == 1 && h == 1)
+            break;
+
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+}
+
+bool ElevationStreamReader::read(const RowsCallback& onRows)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    this->stats = ElevationStreamStats();
+    this->stats.stripRows = this->stripRows;
+    for (Level& level : this->levels) {
+        level.rowsReceived = 0;
+        level.pendingRows = 0;
+    }
+
+    bool success = true;
+    for (unsigned int y = 0; y < this->height; y += this->stripRows) {
+        unsigned int rows = std::min(this->stripRows, this->height - y);
+
+        // read the strip directly behind any rows the next level still needs
+        Level& base = this->levels[0];
+        GLshort* dest = this->reservePending(0, base.pendingRows + rows) + static_cast<size_t>(base.pendingRows) * this->width;
+        if (this->band->RasterIO(GF_Read, 0, y, this->width, rows, dest, this->width, rows, GDT_Int16, 0, 0) != CE_None) {
+            std::cout << "Error: unable to read elevation rows " << y << " to " << (y + rows) << std::endl;
+            success = false;
+            break;
+        }
+
+        // drop the blocks GDAL cached for this strip, we will never read them again
+        this->band->FlushCache();
+
+        this->stats.bytesRead += sizeof(GLshort) * this->width * rows;
+        this->stats.numStrips++;
+
+        this->pushRows(0, rows, onRows);
+    }
+
+    // release the working buffers
+    for (Level& level : this->levels) {
+        level.pending.clear();
+        level.pending.shrink_to_fit();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    this->stats.wallTimeMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+    return success;
+}
+
+void ElevationStreamReader::pushRows(unsigned int level, unsigned int numRows, const RowsCallback& onRows)
+{
+    Level& src = this->levels[level];
+
+    // hand the new rows to the caller
+    const GLshort* newRows = src.pending.data() + static_cast<size_t>(src.pendingRows) * src.width;
+    onRows(level, src.rowsReceived, src.width, numRows, newRows);
+    src.rowsReceived += numRows;
+    src.pendingRows += numRows;
+
+    // the last level has nothing to feed
+    if (level + 1 == this->levels.size()) {
+        src.pendingRows = 0;
+        return;
+    }
+
+    Level& dest = this->levels[level + 1];
+    unsigned int firstPendingRow = src.rowsReceived - src.pendingRows;
+
+    // count how many destination rows have all of their source rows available
+    unsigned int destRow = dest.rowsReceived;
+    unsigned int numDestRows = 0;
+    while (destRow + numDestRows < dest.height) {
+        unsigned int j = destRow + numDestRows;
+        unsigned int lastSourceRow = 2 * j + ElevationPyramidBuilder::getSourceRowsFor(j, src.height, dest.height) - 1;
+        if (lastSourceRow >= src.rowsReceived)
+            break;
+        ++numDestRows;
+    }
+
+    if (numDestRows > 0) {
+        GLshort* out = this->reservePending(level + 1, dest.pendingRows + numDestRows) + static_cast<size_t>(dest.pendingRows) * dest.width;
+        this->pyramidBuilder.reduceRows(src.pending.data(), firstPendingRow, src.width, src.height, out, destRow, destRow + numDestRows, dest.width);
+    }
+
+    // keep only the source rows the next destination row will need
+    unsigned int nextNeededRow = std::min(2 * (destRow + numDestRows), src.rowsReceived);
+    if (destRow + numDestRows == dest.height)
+        nextNeededRow = src.rowsReceived;
+
+    unsigned int leftover = src.rowsReceived - nextNeededRow;
+    if (leftover > 0 && nextNeededRow > firstPendingRow) {
+        std::memmove(src.pending.data(), src.pending.data() + static_cast<size_t>(nextNeededRow - firstPendingRow) * src.width,
+            sizeof(GLshort) * leftover * src.width);
+    }
+    src.pendingRows = leftover;
+
+    if (numDestRows > 0)
+        this->pushRows(level + 1, numDestRows, onRows);
+}
+
+GLshort* ElevationStreamReader::reservePending(unsigned int level, unsigned int numRows)
+{
+    Level& l = this->levels[level];
+    size_t needed = static_cast<size_t>(numRows) * l.width;
+    if (l.pending.size() < needed) {
+        l.pending.resize(needed);
+
+        size_t workingSet = 0;
+        for (const Level& other : this->levels)
+            workingSet += other.pending.capacity() * sizeof(GLshort);
+        this->stats.peakWorkingSet = std::max(this->stats.peakWorkingSet, workingSet);
+    }
+    return l.pending.data();
+}
+
+#endif // AFTR_CONFIG_USE_GDAL
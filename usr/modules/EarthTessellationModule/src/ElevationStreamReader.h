@@ -0,0 +1,90 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+#include "ElevationPyramidBuilder.h"
+
+#include <functional>
+#include <vector>
+
+class GDALRasterBand;
+
+namespace Aftr {
+/**
+   Statistics gathered by an ElevationStreamReader while streaming a raster band.
+*/
+struct ElevationStreamStats {
+    size_t bytesRead = 0; // bytes of elevation data requested from GDAL
+    size_t peakWorkingSet = 0; // high water mark of the strip and mipmap buffers held by the reader
+    unsigned int numStrips = 0; // number of strips read from the band
+    unsigned int stripRows = 0; // rows per strip (a multiple of the band's block height)
+    double wallTimeMs = 0.0; // wall time spent reading, downsampling and delivering rows
+};
+
+/**
+   This class streams a GDAL raster band in block-aligned horizontal strips instead of reading the
+   whole band at once. As each strip arrives it is handed to the caller, and the averaged mipmap
+   chain is built incrementally from the strips, so the memory held at any time is bounded by the
+   strip budget (plus roughly a third for the partially built mipmap levels) rather than by the
+   size of the dataset.
+*/
+class ElevationStreamReader {
+public:
+    /**
+        Called for every contiguous run of rows of a mipmap level as soon as they are available.
+        level - The mipmap level the rows belong to (0 is the full resolution band).
+        y - The index of the first row within the level.
+        width - The width of the level in texels.
+        numRows - The number of rows pointed to by rows.
+        rows - Tightly packed row data. Only valid for the duration of the call.
+    */
+    using RowsCallback = std::function<void(unsigned int level, unsigned int y, unsigned int width, unsigned int numRows, const GLshort* rows)>;
+
+    /**
+        Constructor for creating a stream reader.
+        band - The raster band to read.
+        stripBudgetBytes - The number of bytes of full resolution data to read per strip. The
+                           strip is rounded down to a multiple of the band's block height, but is
+                           always at least one block high.
+    */
+    ElevationStreamReader(GDALRasterBand* band, size_t stripBudgetBytes);
+
+    // Reads the whole band, calling onRows for every level as rows become available. Returns false on a read error.
+    bool read(const RowsCallback& onRows);
+
+    // Returns the width of the band.
+    unsigned int getWidth() const { return this->width; }
+
+    // Returns the height of the band.
+    unsigned int getHeight() const { return this->height; }
+
+    // Returns the number of mipmap levels (including the base level) that will be produced.
+    unsigned int getNumLevels() const { return static_cast<unsigned int>(this->levels.size()); }
+
+    // Returns the statistics of the last call to read.
+    const ElevationStreamStats& getStats() const { return this->stats; }
+
+protected:
+    // State of a single mipmap level while it is being built.
+    struct Level {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int rowsReceived = 0; // rows of this level delivered so far
+        unsigned int pendingRows = 0; // rows held in pending that the next level still needs
+        std::vector<GLshort> pending; // rows of this level not yet consumed by the next level
+    };
+
+    GDALRasterBand* band;
+    unsigned int width;
+    unsigned int height;
+    unsigned int stripRows;
+    std::vector<Level> levels;
+    ElevationStreamStats stats;
+    ElevationPyramidBuilder pyramidBuilder; // downsamples each batch of completed rows
+
+    // Delivers numRows new rows appended to levels[level].pending and cascades them to the next level.
+    void pushRows(unsigned int level, unsigned int numRows, const RowsCallback& onRows);
+
+    // Ensures the pending buffer of a level can hold numRows rows and updates the working set statistics.
+    GLshort* reservePending(unsigned int level, unsigned int numRows);
+};
+}
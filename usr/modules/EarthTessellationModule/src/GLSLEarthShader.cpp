@@ -3,20 +3,40 @@
 #include "Camera.h"
 #include "GLSLAttribute.h"
 #include "GLSLShaderDescriptor.h"
-#include "GLSLUniform.h"
 #include "GLView.h"
+#include "ImageryPageFile.h"
 #include "ManagerEnvironmentConfiguration.h"
 #include "ManagerShader.h"
 #include "Model.h"
+#include "Vector.h"
 
 using namespace Aftr;
 
-GLSLEarthShader* GLSLEarthShader::New(bool useLines, float scale, float tess, float maxTess)
+GLSLEarthShader* GLSLEarthShader::New(float scale, float tess, float maxTess, bool quadtreePatches, bool patchLevelsPrecomputed,
+    bool bindlessTextures, bool virtualImagery, std::shared_ptr<EarthUniformBuffer> uniformBuffer)
+{
+    // create the shader data (already compiling if the program was submitted with ManagerShader::loadShaderDataSharedAsync)
+    GLSLShaderDescriptor desc = getDescriptor(quadtreePatches, patchLevelsPrecomputed, bindlessTextures, virtualImagery);
+    GLSLShaderDataShared* shdrData = ManagerShader::loadShaderDataShared(desc);
+    if (shdrData == nullptr)
+        return nullptr;
+
+    // create the GLSLEarthShader object
+    GLSLEarthShader* shdr = new GLSLEarthShader(shdrData);
+    shdr->uniformBuffer = uniformBuffer != nullptr ? uniformBuffer : std::make_shared<EarthUniformBuffer>();
+    shdr->setScaleFactor(scale);
+    shdr->setTessellationFactor(tess);
+    shdr->setMaxTessellationFactor(maxTess);
+
+    return shdr;
+}
+
+GLSLShaderDescriptor GLSLEarthShader::getDescriptor(bool quadtreePatches, bool patchLevelsPrecomputed, bool bindlessTextures,
+    bool virtualImagery)
 {
     // produce strings for the shader programs
     std::string vert = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth.vert";
     std::string frag = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth.frag";
-    std::string geom = ManagerEnvironmentConfiguration::getLMM() + (useLines ? "shaders/earth.geom" : "shaders/earth_tri.geom");
     std::string tessCon = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth.tesc";
     std::string tessEval = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth.tese";
 
@@ -24,49 +44,50 @@ GLSLEarthShader* GLSLEarthShader::New(bool useLines, float scale, float tess, fl
     GLSLShaderDescriptor desc;
     desc.vertexShader = vert;
     desc.fragmentShader = frag;
-    desc.geometryShader = geom;
     desc.tessellationControlShader = tessCon;
     desc.tessellationEvalShader = tessEval;
-    desc.geometryInputPrimitiveType = GL_TRIANGLES;
-    desc.geometryOutputPrimitiveType = GL_TRIANGLE_STRIP;
-    desc.geometryMaxOutputVerts = 3;
     desc.tessellationMaxVerticesPerPatch = 4;
 
-    // create the shader data
-    GLSLShaderDataShared* shdrData = ManagerShader::loadShaderDataShared(desc);
-    if (shdrData == nullptr)
-        return nullptr;
+    // pick the variant, every combination compiles (and is cached) as its own program
+    if (quadtreePatches)
+        desc.defines["EARTH_QUADTREE"] = "1";
+    if (patchLevelsPrecomputed)
+        desc.defines["EARTH_PATCH_LEVELS_PRECOMPUTED"] = "1";
+    if (bindlessTextures)
+        desc.defines["EARTH_BINDLESS_TEXTURES"] = "1";
+    if (virtualImagery) {
+        // earth.frag addresses the cache with the page layout of ImageryPageFile
+        desc.defines["EARTH_VIRTUAL_IMAGERY"] = "1";
+        desc.defines["IMAGERY_PAGE_TEXELS"] = std::to_string(ImageryPageFile::PAGE_TEXELS);
+        desc.defines["IMAGERY_PAGE_BORDER"] = std::to_string(ImageryPageFile::PAGE_BORDER);
+        desc.defines["IMAGERY_PAGE_SIZE"] = std::to_string(ImageryPageFile::PAGE_SIZE);
+    }
 
-    // create the GLSLEarthShader object
-    GLSLEarthShader* shdr = new GLSLEarthShader(shdrData);
-    shdr->scaleFactor = scale;
-    shdr->tessellationFactor = tess;
-    shdr->maxTessellationFactor = maxTess;
+    return desc;
+}
 
-    return shdr;
+GLSLShaderDescriptor GLSLEarthShader::getCullDescriptor(bool bindlessTextures)
+{
+    GLSLShaderDescriptor desc;
+    desc.computeShader = ManagerEnvironmentConfiguration::getLMM() + "shaders/earth_cull.comp";
+    if (bindlessTextures)
+        desc.defines["EARTH_BINDLESS_TEXTURES"] = "1";
+
+    return desc;
 }
 
 GLSLEarthShader* GLSLEarthShader::New(GLSLShaderDataShared* shdrData)
 {
     GLSLEarthShader* shdr = new GLSLEarthShader(shdrData);
+    shdr->uniformBuffer = std::make_shared<EarthUniformBuffer>();
     return shdr;
 }
 
 GLSLEarthShader::GLSLEarthShader(GLSLShaderDataShared* dataShared)
     : GLSLShader(dataShared)
 {
-    this->addUniform(new GLSLUniform("MVPMat", utMAT4, this->getHandle()));
-    this->addUniform(new GLSLUniform("scale", utFLOAT, this->getHandle()));
-    this->addUniform(new GLSLUniform("tessellationFactor", utFLOAT, this->getHandle()));
-    this->addUniform(new GLSLUniform("maxTessellationFactor", utFLOAT, this->getHandle()));
-    this->addUniform(new GLSLUniform("elevationTexture", utSAMPLER2D, this->getHandle()));
-    this->addUniform(new GLSLUniform("imageryTexture", utSAMPLER2D, this->getHandle()));
-
+    // the parameters are in the EarthUniforms block and the samplers use fixed texture units, so there are no uniforms to add
     this->addAttribute(new GLSLAttribute("VertexPosition", atVEC3, this));
-
-    this->scaleFactor = 0.0f;
-    this->tessellationFactor = 0.0f;
-    this->maxTessellationFactor = 64.0f;
 }
 
 GLSLEarthShader::GLSLEarthShader(const GLSLEarthShader& toCopy)
@@ -86,10 +107,8 @@ GLSLEarthShader& Aftr::GLSLEarthShader::operator=(const GLSLEarthShader& shader)
         // copy all of parent info in base shader, then copy local members in this subclass instance
         GLSLShader::operator=(shader);
 
-        // Now copy local members from this subclassed instance
-        this->scaleFactor = shader.scaleFactor;
-        this->tessellationFactor = shader.tessellationFactor;
-        this->maxTessellationFactor = shader.maxTessellationFactor;
+        // Now copy local members from this subclassed instance, the copy shares the parameters
+        this->uniformBuffer = shader.uniformBuffer;
     }
     return *this;
 }
@@ -102,43 +121,64 @@ GLSLShader* GLSLEarthShader::getCopyOfThisInstance()
 
 void GLSLEarthShader::bind(const Mat4& modelMatrix, const Mat4& normalMatrix, const Camera& cam, const ModelMeshSkin& skin)
 {
-    GLSLShader::bind(); // Must Bind this shader program handle to GL before updating any uniforms
-
-    const std::vector<GLSLUniform*>* uniforms = this->getUniforms();
-
-    // calculate and bind MVP matrix
-    Mat4 MVPMat = cam.getCameraProjectionMatrix() * cam.getCameraViewMatrix() * modelMatrix;
-    uniforms->at(0)->setValues(MVPMat.getPtr());
-
-    // bind factors
-    this->getUniforms()->at(1)->set(scaleFactor);
-    this->getUniforms()->at(2)->set(tessellationFactor);
-    this->getUniforms()->at(3)->set(maxTessellationFactor);
-
-    // bind texture unit locations
-    this->getUniforms()->at(4)->set(0);
-    this->getUniforms()->at(5)->set(1);
+    GLSLShader::bind();
+
+    // calculate the MVP matrix and the eye, the block is only written if they or any other parameter changed
+    Mat4 projection = cam.getCameraProjectionMatrix();
+    Mat4 view = cam.getCameraViewMatrix();
+    Vector camPos = cam.getPosition();
+    float eye[3] = { camPos.x, camPos.y, camPos.z };
+    this->uniformBuffer->setCameraTransform(projection.getPtr(), view.getPtr(), modelMatrix.getPtr(), eye);
+    this->uniformBuffer->bind();
 }
 
 void GLSLEarthShader::setMVPMatrix(const Mat4& mvpMatrix)
 {
-    this->getUniforms()->at(0)->setValues(mvpMatrix.getPtr());
+    this->uniformBuffer->setMVPMatrix(mvpMatrix.getPtr());
 }
 
 void GLSLEarthShader::setScaleFactor(float s)
 {
-    scaleFactor = s;
-    this->getUniforms()->at(1)->set(scaleFactor);
+    this->uniformBuffer->set(&EarthUniforms::scale, s);
 }
 
 void GLSLEarthShader::setTessellationFactor(float t)
 {
-    tessellationFactor = t;
-    this->getUniforms()->at(2)->set(tessellationFactor);
+    this->uniformBuffer->set(&EarthUniforms::tessellationFactor, t);
 }
 
 void GLSLEarthShader::setMaxTessellationFactor(float m)
 {
-    maxTessellationFactor = m;
-    this->getUniforms()->at(3)->set(maxTessellationFactor);
-}
\ No newline at end of file
+    this->uniformBuffer->set(&EarthUniforms::maxTessellationFactor, m);
+}
+
+void GLSLEarthShader::setCullingEnabled(bool b)
+{
+    this->uniformBuffer->set(&EarthUniforms::cullingEnabled, b ? 1 : 0);
+}
+
+void GLSLEarthShader::setPatchStatsEnabled(bool b)
+{
+    this->uniformBuffer->set(&EarthUniforms::patchStatsEnabled, b ? 1 : 0);
+}
+
+void GLSLEarthShader::setMinElevation(float e)
+{
+    this->uniformBuffer->set(&EarthUniforms::minElevation, e);
+}
+
+void GLSLEarthShader::setLODMode(EARTH_LOD_MODE mode)
+{
+    this->uniformBuffer->set(&EarthUniforms::lodMode, static_cast<GLint>(mode));
+}
+
+void GLSLEarthShader::setTargetPixelError(float pixels)
+{
+    this->uniformBuffer->set(&EarthUniforms::targetPixelError, pixels);
+}
+
+void GLSLEarthShader::setTileGrid(const Vector& ul, const Vector& lr)
+{
+    float tileGrid[4] = { ul.x * Aftr::DEGtoRAD, ul.y * Aftr::DEGtoRAD, lr.x * Aftr::DEGtoRAD, lr.y * Aftr::DEGtoRAD };
+    this->uniformBuffer->setTileGrid(tileGrid);
+}
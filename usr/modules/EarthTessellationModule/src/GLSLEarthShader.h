@@ -1,25 +1,61 @@
 #pragma once
 
+#include "EarthUniformBuffer.h"
 #include "GLSLShader.h"
+#include "GLSLShaderDescriptor.h"
 #include "Mat4Fwd.h"
 #include "VectorFwd.h"
 
+#include <memory>
+
 namespace Aftr {
 class Model;
 
+// How earth.tesc picks the tessellation levels of a patch.
+enum class EARTH_LOD_MODE {
+    elmEDGE_LENGTH = 0, // projected edge length times the tessellation factor
+    elmSCREEN_SPACE_ERROR = 1 // fewest segments whose geometric error projects to at most the target pixel error
+};
+
 /**
    This class provides a shader for rendering tessellated Earth quads.
+
+   The parameters live in an EarthUniformBuffer instead of individual uniforms, and the samplers
+   have fixed texture units (layout (binding = ...) in the shaders) or are read through bindless
+   handles kept in the same buffer, so bind only writes the block when a parameter or the MVP
+   matrix actually changed. Every shader drawing the same MGLEarthQuad
+   shares one buffer, so a setter called on each of them writes it only once.
 */
 class GLSLEarthShader : public GLSLShader {
 public:
-    /** Constructor for creating an Earth shader.
-        useLines - Whether or not to render using lines. If false, will render with triangles.
+    /** Constructor for creating an Earth shader. The program has no geometry stage, so it draws
+        both triangles and lines (MGLEarthQuad rasterizes the same triangles with glPolygonMode).
         scale - The scale factor for the Earth
         tess - The tessellation factor applied to the LOD scheme. Higher value = more tessellation.
         maxTess - The tessellation factor cap (maximum value) when applying LOD.
+        quadtreePatches - Whether the patches come from an EarthQuadtree, which needs equal spacing
+                          so neighbouring patches of different sizes line up (see earth.tese).
+        patchLevelsPrecomputed - Whether the patches were culled and their tess levels computed by earth_cull.comp.
+        bindlessTextures - Whether the textures are read through the GL_ARB_bindless_texture handles in the
+                           uniform buffer instead of the skin's texture units. Needs the extension.
+        virtualImagery - Whether the imagery is an ImageryVirtualTexture's page cache, looked up through its
+                         indirection texture, instead of a single texture.
+        uniformBuffer - The buffer holding the parameters. If null, the shader creates its own.
     */
-    static GLSLEarthShader* New(bool useLines, float scale, float tess, float maxTess);
+    static GLSLEarthShader* New(float scale, float tess, float maxTess, bool quadtreePatches = false,
+        bool patchLevelsPrecomputed = false, bool bindlessTextures = false, bool virtualImagery = false,
+        std::shared_ptr<EarthUniformBuffer> uniformBuffer = nullptr);
     static GLSLEarthShader* New(GLSLShaderDataShared* shdrData);
+
+    // Returns the descriptor of the program New(..., quadtreePatches, patchLevelsPrecomputed, bindlessTextures, virtualImagery)
+    // loads, so it can be compiled ahead of time. Each combination is a variant of the same sources picked by preprocessor definitions
+    // (EARTH_QUADTREE, EARTH_PATCH_LEVELS_PRECOMPUTED, EARTH_BINDLESS_TEXTURES and EARTH_VIRTUAL_IMAGERY).
+    static GLSLShaderDescriptor getDescriptor(bool quadtreePatches = false, bool patchLevelsPrecomputed = false, bool bindlessTextures = false,
+        bool virtualImagery = false);
+
+    // Returns the descriptor of earth_cull.comp, which reads the same textures as the programs above.
+    static GLSLShaderDescriptor getCullDescriptor(bool bindlessTextures = false);
+
     virtual ~GLSLEarthShader();
     virtual void bind(const Mat4& modelMatrix, const Mat4& normalMatrix, const Camera& cam, const ModelMeshSkin& skin);
 
@@ -37,6 +73,31 @@ public:
     // Sets the max tessellation factor.
     void setMaxTessellationFactor(float m);
 
+    // Sets whether patches outside the view frustum or below the horizon are discarded.
+    void setCullingEnabled(bool b);
+
+    // Sets whether earth.tesc and earth_cull.comp count the drawn and culled patches into PatchStats.
+    void setPatchStatsEnabled(bool b);
+
+    // Sets the lowest elevation of the dataset (in meters), which bounds the horizon culling occluder.
+    void setMinElevation(float e);
+
+    // Returns the buffer holding the parameters of this shader.
+    const std::shared_ptr<EarthUniformBuffer>& getUniformBuffer() const { return this->uniformBuffer; }
+
+    // Sets how the tessellation levels are picked.
+    void setLODMode(EARTH_LOD_MODE mode);
+
+    // Sets the largest projected geometric error in pixels for EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR.
+    void setTargetPixelError(float pixels);
+
+    /**
+        Sets the fixed grid whose tile errors are looked up for EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR.
+        ul - The upper-left WGS84 coordinate of the grid in degrees.
+        lr - The lower-right WGS84 coordinate of the grid in degrees.
+    */
+    void setTileGrid(const Vector& ul, const Vector& lr);
+
     /**
       Returns a copy of this instance. This is identical to invoking the copy constructor with
       the addition that this preserves the polymorphic type. That is, if this was a subclass
@@ -52,9 +113,7 @@ public:
     virtual GLSLShader* getCopyOfThisInstance();
 
 protected:
-    float scaleFactor;
-    float tessellationFactor;
-    float maxTessellationFactor;
+    std::shared_ptr<EarthUniformBuffer> uniformBuffer;
 
     GLSLEarthShader(GLSLShaderDataShared* dataShared);
     GLSLEarthShader(const GLSLEarthShader&);
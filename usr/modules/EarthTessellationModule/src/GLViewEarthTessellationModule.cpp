@@ -12,7 +12,12 @@
 #include "CameraChaseActorRelNormal.h"
 #include "CameraChaseActorSmooth.h"
 #include "CameraStandard.h"
+#include "EarthConfig.h"
+#include "EarthDepthBenchmark.h"
+#include "GLStateCache.h"
+#include "ImageryVirtualTexture.h"
 #include "MGLEarthQuad.h"
+#include "ManagerShader.h"
 #include "Model.h"
 #include "ModelDataShared.h"
 #include "ModelMesh.h"
@@ -25,11 +30,13 @@
 #include "GLSLShader.h"
 #include "GLSLShaderDataShared.h"
 
+#include <filesystem>
+
 using namespace Aftr;
 
-// number of tiles to render the earth with
-const static unsigned int NUM_TILES_X = 180;
-const static unsigned int NUM_TILES_Y = 360;
+// default number of tiles to render the earth with (earthTilesX, earthTilesY in aftr.conf)
+const static int NUM_TILES_X = 180;
+const static int NUM_TILES_Y = 360;
 
 // factors affecting tessellation of the tiles
 // currently tuned to reduce swimming artifacts
@@ -37,10 +44,22 @@ const static float INIT_SCALE_FACTOR = 0.0001f;
 const static float INIT_TESS_FACTOR = 45.0f;
 const static float INIT_MAX_TESS_FACTOR = 16.0f;
 
+// default near and far planes in meters (earthNearPlane, earthFarPlane in aftr.conf)
+const static float INIT_NEAR_PLANE = 10000.0f;
+const static float INIT_FAR_PLANE = 1.0e8f;
+
 // initial position of the camera on earth's surface (in degrees lat lon)
 const static float INIT_LAT = 37.75f;
 const static float INIT_LON = 15.0f;
 
+// frames the wireframe benchmark renders in each mode, and how many of them it ignores after
+// switching since the GPU times lag a couple of frames behind
+const static unsigned int WIREFRAME_BENCHMARK_FRAMES = 300;
+const static unsigned int WIREFRAME_BENCHMARK_WARMUP_FRAMES = 10;
+
+// how often the profile in the window title is refreshed, so it stays readable
+const static std::chrono::milliseconds PROFILER_OVERLAY_INTERVAL(250);
+
 GLViewEarthTessellationModule* GLViewEarthTessellationModule::New(const std::vector<std::string>& args)
 {
     GLViewEarthTessellationModule* glv = new GLViewEarthTessellationModule(args);
@@ -67,6 +86,15 @@ GLViewEarthTessellationModule::GLViewEarthTessellationModule(const std::vector<s
     // GLViewEarthTessellationModule::onCreate() is invoked after this module's LoadMap() is completed.
 
     earth = nullptr;
+    wireframeBenchmarkFramesLeft = 0;
+    wireframeBenchmarkUsedLines = false;
+    profilerOverlay = false;
+    profilerCSVLastFrame = 0;
+    depthBenchmark = EarthDepthBenchmark::isRequested(args);
+
+    // fly the scripted benchmark instead of handing the camera to the user
+    if (EarthFlightBenchmark::isRequested(args))
+        flightBenchmark = std::make_unique<EarthFlightBenchmark>(args);
 }
 
 void GLViewEarthTessellationModule::onCreate()
@@ -81,6 +109,24 @@ void GLViewEarthTessellationModule::onCreate()
         this->pe->setGravityScalar(Aftr::GRAVITY);
     }
     this->setActorChaseType(STANDARDEZNAV); // Default is STANDARDEZNAV mode
+
+    // log the earth's GPU profile of every frame (see earthProfileCSV in aftr.conf)
+    std::string csvPath = EarthConfig::getString("earthprofilecsv", "");
+    if (!csvPath.empty()) {
+        this->profilerCSV.open(csvPath);
+        if (this->profilerCSV) {
+            this->profilerCSV << "tessellationFactor,maxTessellationFactor,lodMode,targetPixelError,lines,";
+            EarthRenderProfiler::writeCSVHeader(this->profilerCSV);
+            this->profilerCSV << '\n';
+        } else {
+            std::cout << "Could not open " << csvPath << " for the earth's GPU profile" << std::endl;
+        }
+    }
+
+    if (this->flightBenchmark != nullptr && !this->flightBenchmark->load()) {
+        this->flightBenchmark.reset();
+        this->requestExit();
+    }
 }
 
 GLViewEarthTessellationModule::~GLViewEarthTessellationModule()
@@ -91,11 +137,116 @@ GLViewEarthTessellationModule::~GLViewEarthTessellationModule()
 void GLViewEarthTessellationModule::updateWorld()
 {
     GLView::updateWorld(); // Just call the parent's update world
+
+    // count the GL state changes of the frame about to be rendered
+    GLStateCache::beginFrame();
+
+    // stream in the imagery pages the earth asked for in the last frames, once per frame however often it is drawn
+    ImageryVirtualTexture::updateAll();
+
+    // pick up edits to the earth shaders without reloading the datasets (see shaderHotReload in aftr.conf)
+    ManagerShader::updateHotReload();
+
+    if (this->wireframeBenchmarkFramesLeft > 0)
+        this->updateWireframeBenchmark();
+
+    if (this->profilerOverlay || this->profilerCSV.is_open())
+        this->updateProfilerOutput();
+
+    if (this->flightBenchmark != nullptr && !this->flightBenchmark->update(earth, this->cam)) {
+        this->flightBenchmark.reset();
+        this->requestExit();
+    }
+
+    if (this->depthBenchmark) {
+        this->depthBenchmark = false;
+        EarthDepthBenchmark::run(*this->cam, earth->getModelT<MGLEarthQuad>()->getScaleFactor());
+        this->requestExit();
+    }
+}
+
+void GLViewEarthTessellationModule::requestExit()
+{
+    SDL_Event quit;
+    quit.type = SDL_QUIT;
+    SDL_PushEvent(&quit);
+}
+
+void GLViewEarthTessellationModule::updateProfilerOutput()
+{
+    MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+    const EarthRenderProfiler& profiler = mod->getProfiler();
+    const EarthRenderStats& stats = profiler.getStats();
+
+    // one row per frame whose results arrived, labelled with the parameters it was (give or take the
+    // couple of frames the results lag behind) rendered with
+    if (this->profilerCSV.is_open() && stats.frame != this->profilerCSVLastFrame) {
+        this->profilerCSVLastFrame = stats.frame;
+        bool sse = mod->getLODMode() == EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR;
+        this->profilerCSV << mod->getTessellationFactor() << ','
+                          << mod->getMaxTessellationFactor() << ',' << (sse ? "sse" : "edge") << ','
+                          << mod->getTargetPixelError() << ',' << (mod->isUsingLines() ? 1 : 0) << ',';
+        profiler.writeCSVRow(this->profilerCSV);
+        this->profilerCSV << '\n';
+    }
+
+    // this tree has no text overlay, so the profile goes to the window title
+    auto now = std::chrono::steady_clock::now();
+    if (this->profilerOverlay && now - this->profilerOverlayLastUpdate >= PROFILER_OVERLAY_INTERVAL) {
+        this->profilerOverlayLastUpdate = now;
+        if (SDL_Window* window = SDL_GL_GetCurrentWindow())
+            SDL_SetWindowTitle(window, profiler.toString().c_str());
+    }
+}
+
+void GLViewEarthTessellationModule::updateWireframeBenchmark()
+{
+    MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+    // the time since the last call is the time of the frame rendered in between
+    auto now = std::chrono::steady_clock::now();
+    double frameMs = std::chrono::duration<double, std::milli>(now - this->wireframeBenchmarkLastFrame).count();
+    this->wireframeBenchmarkLastFrame = now;
+
+    // render WIREFRAME_BENCHMARK_FRAMES frames of triangles, then as many of lines
+    unsigned int frame = 2 * WIREFRAME_BENCHMARK_FRAMES - this->wireframeBenchmarkFramesLeft;
+    unsigned int mode = frame / WIREFRAME_BENCHMARK_FRAMES;
+    unsigned int modeFrame = frame % WIREFRAME_BENCHMARK_FRAMES;
+    if (modeFrame == 0) {
+        mod->useLines(mode == 1);
+    } else if (modeFrame >= WIREFRAME_BENCHMARK_WARMUP_FRAMES) {
+        this->wireframeBenchmarkGPUMs[mode] += mod->getGPUTimeMs();
+        this->wireframeBenchmarkFrameMs[mode] += frameMs;
+        this->wireframeBenchmarkSamples[mode]++;
+    }
+
+    if (--this->wireframeBenchmarkFramesLeft > 0)
+        return;
+
+    mod->useLines(this->wireframeBenchmarkUsedLines);
+
+    double gpuMs[2];
+    double avgFrameMs[2];
+    for (int i = 0; i < 2; ++i) {
+        unsigned int samples = std::max(this->wireframeBenchmarkSamples[i], 1u);
+        gpuMs[i] = this->wireframeBenchmarkGPUMs[i] / samples;
+        avgFrameMs[i] = this->wireframeBenchmarkFrameMs[i] / samples;
+    }
+
+    // the frame times include everything else in the scene and are capped by vsync, the GPU times are the earth's alone
+    std::cout << "Wireframe benchmark (" << this->wireframeBenchmarkSamples[0] << " frames per mode):" << std::endl
+              << "  triangles: " << gpuMs[0] << " ms GPU, " << avgFrameMs[0] << " ms per frame" << std::endl
+              << "  lines:     " << gpuMs[1] << " ms GPU, " << avgFrameMs[1] << " ms per frame" << std::endl
+              << "  delta:     " << (gpuMs[1] - gpuMs[0]) << " ms GPU, " << (avgFrameMs[1] - avgFrameMs[0]) << " ms per frame" << std::endl;
 }
 
 void GLViewEarthTessellationModule::onResizeWindow(GLsizei width, GLsizei height)
 {
     GLView::onResizeWindow(width, height); // call parent's resize method
+
+    // the earth's LOD metrics project to the viewport's height, handed over here instead of queried every draw
+    if (earth != nullptr)
+        earth->getModelT<MGLEarthQuad>()->setViewportHeight(static_cast<float>(height));
 }
 
 void GLViewEarthTessellationModule::onMouseDown(const SDL_MouseButtonEvent& e)
@@ -127,6 +278,97 @@ void GLViewEarthTessellationModule::onKeyDown(const SDL_KeyboardEvent& key)
         mod->useLines(useLines);
 
         std::cout << "Using " << (useLines ? "lines" : "triangles") << std::endl;
+    } else if (key.keysym.sym == SDLK_2) {
+        MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+        // toggle frustum and horizon culling of patches
+        bool culling = !mod->isCullingEnabled();
+        mod->setCullingEnabled(culling);
+
+        std::cout << "Patch culling " << (culling ? "enabled" : "disabled") << std::endl;
+    } else if (key.keysym.sym == SDLK_3) {
+        MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+        // print how many patches were tessellated and culled, the shaders only count them while the stats are enabled
+        if (!mod->isPatchStatsEnabled()) {
+            mod->setPatchStatsEnabled(true);
+            std::cout << "Patch stats enabled, the counts are available in a few frames" << std::endl;
+        }
+        unsigned int drawn = mod->getNumDrawnPatches();
+        unsigned int culled = mod->getNumCulledPatches();
+        unsigned int total = std::max(drawn + culled, 1u);
+        std::cout << "Patches drawn: " << drawn << ", culled: " << culled << " (" << (100 * culled / total) << "% culled)" << std::endl;
+
+        // and how often the shader parameters reached the GPU (a write only happens when one changed)
+        std::cout << "Uniform buffer writes last frame: " << mod->getNumUniformWritesLastFrame()
+                  << ", binds: " << mod->getNumUniformBindsLastFrame() << std::endl;
+
+        // and how many state changes the GL state cache made and skipped (error checks are compiled out of release builds)
+        std::cout << "GL state calls last frame: " << GLStateCache::getNumCallsLastFrame()
+                  << ", skipped: " << GLStateCache::getNumSkippedCallsLastFrame()
+                  << ", error checks: " << GLStateCache::getNumErrorChecksLastFrame() << std::endl;
+
+        // and what the quadtree selected on the CPU
+        if (const EarthQuadtree* quadtree = mod->getQuadtree()) {
+            std::cout << "Quadtree leaves: " << quadtree->getNumPatches() << ", split nodes: " << quadtree->getNumSplitNodes()
+                      << ", culled nodes: " << quadtree->getNumCulledNodes() << ", deepest level: " << quadtree->getDeepestLevel() << std::endl;
+        }
+
+        // and how the imagery pages are streaming
+        if (const ImageryVirtualTexture* imagery = mod->getVirtualImagery()) {
+            std::cout << "Imagery pages resident: " << imagery->getNumResidentPages() << "/" << imagery->getNumSlots()
+                      << ", wanted: " << imagery->getNumWantedPages() << ", uploaded last frame: " << imagery->getNumUploadsLastFrame() << std::endl;
+        }
+    } else if (key.keysym.sym == SDLK_4) {
+        MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+        // toggle the LOD metric between edge length and screen space error for A/B comparisons
+        bool sse = mod->getLODMode() != EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR;
+        mod->setLODMode(sse ? EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR : EARTH_LOD_MODE::elmEDGE_LENGTH);
+
+        if (sse && mod->getLODMode() != EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR)
+            std::cout << "Screen space error LOD needs the fixed grid patch mode" << std::endl;
+        else
+            std::cout << "LOD metric: " << (sse ? "screen space error" : "edge length") << std::endl;
+    } else if (key.keysym.sym == SDLK_5 && this->wireframeBenchmarkFramesLeft == 0) {
+        MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+        // time the same view rendered with triangles and with lines, keep the camera still meanwhile
+        this->wireframeBenchmarkFramesLeft = 2 * WIREFRAME_BENCHMARK_FRAMES;
+        this->wireframeBenchmarkUsedLines = mod->isUsingLines();
+        for (int i = 0; i < 2; ++i) {
+            this->wireframeBenchmarkGPUMs[i] = 0.0;
+            this->wireframeBenchmarkFrameMs[i] = 0.0;
+            this->wireframeBenchmarkSamples[i] = 0;
+        }
+        this->wireframeBenchmarkLastFrame = std::chrono::steady_clock::now();
+
+        std::cout << "Running the wireframe benchmark..." << std::endl;
+    } else if (key.keysym.sym == SDLK_6) {
+        // toggle the GPU time and pipeline statistics of the earth in the window title
+        this->profilerOverlay = !this->profilerOverlay;
+        SDL_Window* window = SDL_GL_GetCurrentWindow();
+        if (this->profilerOverlay) {
+            if (window != nullptr)
+                this->profilerSavedTitle = SDL_GetWindowTitle(window);
+            this->profilerOverlayLastUpdate = std::chrono::steady_clock::time_point();
+        } else if (window != nullptr) {
+            SDL_SetWindowTitle(window, this->profilerSavedTitle.c_str());
+        }
+
+        const EarthRenderProfiler& profiler = earth->getModelT<MGLEarthQuad>()->getProfiler();
+        std::cout << "GPU profile overlay " << (this->profilerOverlay ? "enabled" : "disabled") << std::endl;
+        if (this->profilerOverlay && !profiler.isCountingStatistics())
+            std::cout << "GL_ARB_pipeline_statistics_query is not supported, only the GPU times are shown" << std::endl;
+    } else if (key.keysym.sym == SDLK_RIGHTBRACKET || key.keysym.sym == SDLK_LEFTBRACKET) {
+        MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
+
+        // increase/decrease the target pixel error of the screen space error LOD
+        float newPE = mod->getTargetPixelError() * (key.keysym.sym == SDLK_RIGHTBRACKET ? 1.25f : 0.8f);
+        newPE = std::max(newPE, 0.25f);
+        mod->setTargetPixelError(newPE);
+
+        std::cout << "Target pixel error: " << newPE << std::endl;
     } else if (key.keysym.sym == SDLK_UP || key.keysym.sym == SDLK_DOWN) {
         MGLEarthQuad* mod = earth->getModelT<MGLEarthQuad>();
 
@@ -176,8 +418,13 @@ void Aftr::GLViewEarthTessellationModule::loadMap()
     this->actorLst = new WorldList();
     this->netLst = new WorldList();
 
-    ManagerOpenGLState::GL_CLIPPING_PLANE = 10000.0;
-    ManagerOpenGLState::GL_NEAR_PLANE = 1.0f;
+    // world units per meter, 1 renders at true scale (which relies on the relative-to-eye rendering of the earth)
+    float scale = EarthConfig::getFloat("earthscale", INIT_SCALE_FACTOR);
+    if (!(scale > 0.0f))
+        scale = INIT_SCALE_FACTOR;
+
+    ManagerOpenGLState::GL_CLIPPING_PLANE = EarthConfig::getFloat("earthfarplane", INIT_FAR_PLANE) * scale;
+    ManagerOpenGLState::GL_NEAR_PLANE = EarthConfig::getFloat("earthnearplane", INIT_NEAR_PLANE) * scale;
     ManagerOpenGLState::enableFrustumCulling = false;
     Axes::isVisible = true;
     this->glRenderer->isUsingShadowMapping(false); // set to TRUE to enable shadow mapping, must be using GL 3.2+
@@ -185,7 +432,7 @@ void Aftr::GLViewEarthTessellationModule::loadMap()
     // calculate camera init position as a vector double
     VectorD pos(INIT_LAT, INIT_LON, 0);
     pos = pos.toECEFfromWGS84();
-    pos *= INIT_SCALE_FACTOR * 1.5; // the extra 1.5 is to place the camera above the surface
+    pos *= scale * 1.5; // the extra 1.5 is to place the camera above the surface
 
     // convert to single precision
     Vector posF = Vector(
@@ -222,12 +469,34 @@ void Aftr::GLViewEarthTessellationModule::loadMap()
     std::string dataset = ManagerEnvironmentConfiguration::getLMM() + "/images/ETOPO1_Ice_g_geotiff.tif";
     std::string imagery = ManagerEnvironmentConfiguration::getLMM() + "/images/2_no_clouds_16k.jpg";
 
+    // the flight benchmark can run without the downloaded datasets
+    if (this->flightBenchmark != nullptr && this->flightBenchmark->isSynthetic()) {
+        std::error_code ec;
+        std::string dir = (std::filesystem::temp_directory_path(ec) / "aftr_earth_synthetic").string();
+        std::string syntheticElevation;
+        std::string syntheticImagery;
+        if (EarthFlightBenchmark::writeSyntheticDataset(dir, syntheticElevation, syntheticImagery)) {
+            dataset = syntheticElevation;
+            imagery = syntheticImagery;
+        } else {
+            std::cout << "Falling back to the downloaded datasets" << std::endl;
+        }
+    }
+
     // create earth WO
     earth = WO::New();
 
+    // lay the patches out as the fixed grid or as a camera driven quadtree
+    EARTH_PATCH_MODE patchMode = EARTH_PATCH_MODE::epmFIXED_GRID;
+    if (EarthConfig::getString("earthpatchmode", "grid") == "quadtree")
+        patchMode = EARTH_PATCH_MODE::epmQUADTREE;
+
+    unsigned int numTilesX = static_cast<unsigned int>(std::max(EarthConfig::getInt("earthtilesx", NUM_TILES_X), 1));
+    unsigned int numTilesY = static_cast<unsigned int>(std::max(EarthConfig::getInt("earthtilesy", NUM_TILES_Y), 1));
+
     // create and use earth model
     earth->setModel(new MGLEarthQuad(earth, Vector(90.0f, -180.0f, 0.0f), Vector(-90.0f, 180.0f, 0.0f),
-        NUM_TILES_X, NUM_TILES_Y, INIT_SCALE_FACTOR, INIT_TESS_FACTOR, INIT_MAX_TESS_FACTOR, dataset, imagery));
+        numTilesX, numTilesY, scale, INIT_TESS_FACTOR, INIT_MAX_TESS_FACTOR, dataset, imagery, patchMode));
     earth->setPosition(Vector(0.0, 0.0, 0.0)); // center earth at origin of world
 
     // add to world
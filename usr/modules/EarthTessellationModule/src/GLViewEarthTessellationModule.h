@@ -1,7 +1,12 @@
 #pragma once
 
+#include "EarthFlightBenchmark.h"
 #include "GLView.h"
 
+#include <chrono>
+#include <fstream>
+#include <memory>
+
 namespace Aftr {
 /**
    This class demonstrates how tessellation on the GPU can be used for rendering a large globe of
@@ -24,6 +29,31 @@ protected:
     GLViewEarthTessellationModule(const std::vector<std::string>& args);
     virtual void onCreate();
 
+    // Advances the triangles vs. lines benchmark started with the 5 key by one frame.
+    void updateWireframeBenchmark();
+
+    // Ends the simulation loop as if the window had been closed.
+    void requestExit();
+
+    // Shows the earth's GPU profile in the window title (toggled with the 6 key) and appends it to earthProfileCSV.
+    void updateProfilerOutput();
+
     WO* earth;
+
+    unsigned int wireframeBenchmarkFramesLeft; // 0 when the benchmark isn't running
+    bool wireframeBenchmarkUsedLines; // render mode to restore afterwards
+    double wireframeBenchmarkGPUMs[2]; // summed GPU and frame times of triangles [0] and lines [1]
+    double wireframeBenchmarkFrameMs[2];
+    unsigned int wireframeBenchmarkSamples[2];
+    std::chrono::steady_clock::time_point wireframeBenchmarkLastFrame;
+
+    bool profilerOverlay; // whether the window title shows the GPU profile
+    std::string profilerSavedTitle; // window title to restore when the overlay is turned off
+    std::chrono::steady_clock::time_point profilerOverlayLastUpdate;
+    std::ofstream profilerCSV; // not open unless earthProfileCSV is set
+    unsigned int profilerCSVLastFrame; // stats frame of the last row written
+
+    std::unique_ptr<EarthFlightBenchmark> flightBenchmark; // set when started with --benchmark flight
+    bool depthBenchmark; // whether the first frame renders the z-fighting test scene (--benchmark depth) and exits
 };
 } //namespace Aftr
@@ -0,0 +1,403 @@
+#include "ImageryPageFile.h"
+
+#include "AftrConfig.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+#ifdef AFTR_CONFIG_USE_GDAL
+// Note: GDAL internally has warnings in their library headers, so I'm doing this to suppress them
+#pragma warning(push, 0)
+#include "gdal_priv.h"
+#pragma warning(pop)
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Aftr;
+
+namespace {
+const static char PAGE_FILE_MAGIC[8] = { 'A', 'F', 'T', 'R', 'V', 'T', 'X', '\0' };
+const static uint32_t PAGE_FILE_VERSION = 1;
+const static uint32_t PAGE_FILE_BYTE_ORDER = 0x01020304;
+const static uint64_t PAGE_FILE_DATA_ALIGNMENT = 4096; // the first page starts on a page boundary
+
+// Fixed size header at the start of every page file, followed by the source path and the pages.
+struct PageFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pageTexels;
+    uint32_t pageBorder;
+    uint32_t numLevels;
+    uint32_t sourcePathLength;
+    uint64_t fileSize;
+};
+
+// Identifies the exact version of a source image the page file was built from.
+struct SourceKey {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool getSourceKey(const std::string& imagery, SourceKey& key)
+{
+    std::error_code ec;
+    std::filesystem::path path = std::filesystem::canonical(imagery, ec);
+    if (ec)
+        return false;
+
+    key.path = path.string();
+    key.size = std::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+
+    key.mtime = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    return !ec;
+}
+
+// Computes the dimensions and the pages of every level, and the offset of the first page. Returns the total file size.
+uint64_t computeLayout(unsigned int width, unsigned int height, size_t pathLength, std::vector<unsigned int>& widths,
+    std::vector<unsigned int>& heights, std::vector<unsigned int>& pagesX, std::vector<unsigned int>& pagesY,
+    std::vector<uint32_t>& firstPages, uint64_t& dataOffset)
+{
+    widths.clear();
+    heights.clear();
+    pagesX.clear();
+    pagesY.clear();
+    firstPages.clear();
+
+    const unsigned int texels = ImageryPageFile::PAGE_TEXELS;
+    uint32_t numPages = 0;
+    unsigned int w = std::max(width, 1u);
+    unsigned int h = std::max(height, 1u);
+    while (true) {
+        widths.push_back(w);
+        heights.push_back(h);
+        pagesX.push_back((w + texels - 1) / texels);
+        pagesY.push_back((h + texels - 1) / texels);
+        firstPages.push_back(numPages);
+        numPages += pagesX.back() * pagesY.back();
+
+        if (w <= texels && h <= texels)
+            break;
+
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    firstPages.push_back(numPages);
+
+    dataOffset = (sizeof(PageFileHeader) + pathLength + PAGE_FILE_DATA_ALIGNMENT - 1) / PAGE_FILE_DATA_ALIGNMENT * PAGE_FILE_DATA_ALIGNMENT;
+    return dataOffset + static_cast<uint64_t>(numPages) * ImageryPageFile::PAGE_BYTES;
+}
+
+// Returns the RGB texels of row y of a level, with y clamped to the level.
+using RowFunction = std::function<const unsigned char*(int y)>;
+
+// Cuts page row py of a level (width texels wide) into pagesX bordered pages, tightly packed in pages.
+void cutPageRow(const RowFunction& row, unsigned int width, unsigned int py, unsigned int pagesX, unsigned char* pages)
+{
+    const int size = static_cast<int>(ImageryPageFile::PAGE_SIZE);
+    const int texels = static_cast<int>(ImageryPageFile::PAGE_TEXELS);
+    const int border = static_cast<int>(ImageryPageFile::PAGE_BORDER);
+    const int w = static_cast<int>(width);
+    for (unsigned int px = 0; px < pagesX; ++px) {
+        unsigned char* page = pages + px * ImageryPageFile::PAGE_BYTES;
+        for (int j = 0; j < size; ++j) {
+            const unsigned char* src = row(static_cast<int>(py) * texels - border + j);
+            unsigned char* dst = page + static_cast<size_t>(j) * size * 3;
+            for (int i = 0; i < size; ++i) {
+                // longitude wraps around
+                int x = ((static_cast<int>(px) * texels - border + i) % w + w) % w;
+                std::memcpy(dst + i * 3, src + x * 3, 3);
+            }
+        }
+    }
+}
+
+// Averages rows [y0, y1) of the next level (nextWidth texels wide) from 2x2 texels of a level width texels wide.
+void downsampleRows(const RowFunction& row, unsigned int width, unsigned int nextWidth, unsigned int y0, unsigned int y1, unsigned char* next)
+{
+    for (unsigned int y = y0; y < y1; ++y) {
+        const unsigned char* r0 = row(static_cast<int>(y * 2));
+        const unsigned char* r1 = row(static_cast<int>(y * 2 + 1));
+        unsigned char* dst = next + static_cast<size_t>(y) * nextWidth * 3;
+        for (unsigned int x = 0; x < nextWidth; ++x) {
+            unsigned int x0 = x * 2 * 3;
+            unsigned int x1 = std::min(x * 2 + 1, width - 1) * 3;
+            for (unsigned int c = 0; c < 3; ++c)
+                dst[x * 3 + c] = static_cast<unsigned char>((r0[x0 + c] + r0[x1 + c] + r1[x0 + c] + r1[x1 + c] + 2) / 4);
+        }
+    }
+}
+}
+
+std::string ImageryPageFile::getPagePath(const std::string& imagery)
+{
+    return imagery + ".aftrvt";
+}
+
+std::unique_ptr<ImageryPageFile> ImageryPageFile::open(const std::string& imagery)
+{
+    SourceKey key;
+    if (!getSourceKey(imagery, key))
+        return nullptr;
+
+    std::unique_ptr<ImageryPageFile> file(new ImageryPageFile());
+    if (!file->map(getPagePath(imagery)))
+        return nullptr;
+
+    // validate the header against the image as it is right now
+    if (file->mappedSize < sizeof(PageFileHeader))
+        return nullptr;
+
+    PageFileHeader header;
+    std::memcpy(&header, file->mapped, sizeof(header));
+    if (std::memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != PAGE_FILE_VERSION
+        || header.byteOrder != PAGE_FILE_BYTE_ORDER
+        || header.pageTexels != PAGE_TEXELS
+        || header.pageBorder != PAGE_BORDER
+        || header.fileSize != file->mappedSize
+        || header.sourceSize != key.size
+        || header.sourceMtime != key.mtime
+        || header.sourcePathLength != key.path.size()
+        || sizeof(header) + header.sourcePathLength > file->mappedSize
+        || std::memcmp(file->mapped + sizeof(header), key.path.data(), key.path.size()) != 0) {
+        return nullptr;
+    }
+
+    uint64_t fileSize = computeLayout(header.width, header.height, key.path.size(), file->levelWidths, file->levelHeights,
+        file->pagesX, file->pagesY, file->firstPages, file->dataOffset);
+    if (fileSize != header.fileSize || file->levelWidths.size() != header.numLevels)
+        return nullptr;
+
+    return file;
+}
+
+bool ImageryPageFile::build(const std::string& imagery)
+{
+#ifdef AFTR_CONFIG_USE_GDAL
+    auto start = std::chrono::steady_clock::now();
+
+    SourceKey key;
+    if (!getSourceKey(imagery, key))
+        return false;
+
+    GDALAllRegister();
+    GDALDataset* dataset = static_cast<GDALDataset*>(GDALOpen(imagery.c_str(), GA_ReadOnly));
+    if (dataset == nullptr)
+        return false;
+    if (dataset->GetRasterCount() == 0) {
+        GDALClose(dataset);
+        return false;
+    }
+
+    // a gray image repeats its one band, and an alpha band is ignored
+    int bandMap[3] = { 1, 2, 3 };
+    if (dataset->GetRasterCount() < 3)
+        bandMap[1] = bandMap[2] = 1;
+
+    unsigned int width = static_cast<unsigned int>(dataset->GetRasterBand(1)->GetXSize());
+    unsigned int height = static_cast<unsigned int>(dataset->GetRasterBand(1)->GetYSize());
+
+    std::vector<unsigned int> widths;
+    std::vector<unsigned int> heights;
+    std::vector<unsigned int> pagesX;
+    std::vector<unsigned int> pagesY;
+    std::vector<uint32_t> firstPages;
+    uint64_t dataOffset = 0;
+    uint64_t fileSize = computeLayout(width, height, key.path.size(), widths, heights, pagesX, pagesY, firstPages, dataOffset);
+
+    std::string tempPath = getPagePath(imagery) + ".tmp";
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    bool good = out.is_open();
+
+    const int texels = static_cast<int>(PAGE_TEXELS);
+    const int border = static_cast<int>(PAGE_BORDER);
+    std::vector<unsigned char> strip; // the rows of the base level the current page row needs
+    std::vector<unsigned char> current; // the whole current level, from level 1 on
+    std::vector<unsigned char> next; // the next level, filled as the current one is paged
+    std::vector<unsigned char> pages;
+    for (unsigned int level = 0; level < widths.size() && good; ++level) {
+        unsigned int w = widths[level];
+        unsigned int h = heights[level];
+        bool hasNext = level + 1 < widths.size();
+        if (hasNext)
+            next.assign(static_cast<size_t>(widths[level + 1]) * heights[level + 1] * 3, 0);
+        pages.resize(pagesX[level] * PAGE_BYTES);
+
+        int stripFirst = 0;
+        RowFunction row = [&](int y) {
+            y = std::min(std::max(y, 0), static_cast<int>(h) - 1);
+            if (level == 0)
+                return &strip[static_cast<size_t>(y - stripFirst) * w * 3];
+            return &current[static_cast<size_t>(y) * w * 3];
+        };
+
+        for (unsigned int py = 0; py < pagesY[level] && good; ++py) {
+            // stream the base level one row of pages (and its borders) at a time
+            if (level == 0) {
+                stripFirst = std::max(static_cast<int>(py) * texels - border, 0);
+                int stripLast = std::min(static_cast<int>(py + 1) * texels + border, static_cast<int>(h));
+                int numRows = stripLast - stripFirst;
+                strip.resize(static_cast<size_t>(numRows) * w * 3);
+                good = dataset->RasterIO(GF_Read, 0, stripFirst, w, numRows, strip.data(), w, numRows, GDT_Byte, 3, bandMap,
+                           3, static_cast<long long>(w) * 3, 1) == CE_None;
+                if (!good)
+                    break;
+            }
+
+            cutPageRow(row, w, py, pagesX[level], pages.data());
+            out.seekp(static_cast<std::streamoff>(dataOffset + static_cast<uint64_t>(firstPages[level] + py * pagesX[level]) * PAGE_BYTES));
+            out.write(reinterpret_cast<const char*>(pages.data()), static_cast<std::streamsize>(pages.size()));
+            good = out.good();
+
+            if (hasNext) {
+                unsigned int y0 = py * PAGE_TEXELS / 2;
+                unsigned int y1 = std::min((py + 1) * PAGE_TEXELS / 2, heights[level + 1]);
+                downsampleRows(row, w, widths[level + 1], y0, y1, next.data());
+            }
+        }
+
+        current.swap(next);
+        strip = std::vector<unsigned char>();
+    }
+    GDALClose(dataset);
+
+    // don't keep pages of an image that changed while it was being read
+    SourceKey after;
+    good = good && getSourceKey(imagery, after) && after.path == key.path && after.size == key.size && after.mtime == key.mtime;
+    if (good) {
+        PageFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic));
+        header.version = PAGE_FILE_VERSION;
+        header.byteOrder = PAGE_FILE_BYTE_ORDER;
+        header.sourceSize = key.size;
+        header.sourceMtime = key.mtime;
+        header.width = width;
+        header.height = height;
+        header.pageTexels = PAGE_TEXELS;
+        header.pageBorder = PAGE_BORDER;
+        header.numLevels = static_cast<uint32_t>(widths.size());
+        header.sourcePathLength = static_cast<uint32_t>(key.path.size());
+        header.fileSize = fileSize;
+
+        // the last page was written last, so the file is already at its full size
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(key.path.data(), static_cast<std::streamsize>(key.path.size()));
+    }
+    out.close();
+    good = good && !out.fail();
+
+    std::error_code ec;
+    if (good)
+        std::filesystem::rename(tempPath, getPagePath(imagery), ec);
+    if (!good || ec) {
+        std::filesystem::remove(tempPath, ec);
+        return false;
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Built imagery pages " << width << "x" << height << " (" << widths.size() << " levels, " << firstPages.back()
+              << " pages, " << (fileSize >> 20) << " MB) in " << ms << " ms" << std::endl;
+    return true;
+#else
+    return false;
+#endif
+}
+
+ImageryPageFile::ImageryPageFile()
+{
+    this->mapped = nullptr;
+    this->mappedSize = 0;
+    this->dataOffset = 0;
+#ifdef _WIN32
+    this->fileHandle = INVALID_HANDLE_VALUE;
+    this->mappingHandle = nullptr;
+#else
+    this->fd = -1;
+#endif
+}
+
+ImageryPageFile::~ImageryPageFile()
+{
+#ifdef _WIN32
+    if (this->mapped != nullptr)
+        UnmapViewOfFile(this->mapped);
+    if (this->mappingHandle != nullptr)
+        CloseHandle(this->mappingHandle);
+    if (this->fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(this->fileHandle);
+#else
+    if (this->mapped != nullptr)
+        munmap(const_cast<unsigned char*>(this->mapped), this->mappedSize);
+    if (this->fd >= 0)
+        close(this->fd);
+#endif
+}
+
+const unsigned char* ImageryPageFile::getPage(uint32_t index) const
+{
+    return this->mapped + this->dataOffset + static_cast<uint64_t>(index) * PAGE_BYTES;
+}
+
+bool ImageryPageFile::map(const std::string& path)
+{
+#ifdef _WIN32
+    this->fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (this->fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(this->fileHandle, &size) || size.QuadPart == 0)
+        return false;
+    this->mappedSize = static_cast<size_t>(size.QuadPart);
+
+    this->mappingHandle = CreateFileMappingA(this->fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (this->mappingHandle == nullptr)
+        return false;
+
+    this->mapped = static_cast<const unsigned char*>(MapViewOfFile(this->mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    return this->mapped != nullptr;
+#else
+    this->fd = ::open(path.c_str(), O_RDONLY);
+    if (this->fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(this->fd, &st) != 0 || st.st_size == 0)
+        return false;
+    this->mappedSize = static_cast<size_t>(st.st_size);
+
+    void* addr = mmap(nullptr, this->mappedSize, PROT_READ, MAP_PRIVATE, this->fd, 0);
+    if (addr == MAP_FAILED)
+        return false;
+    this->mapped = static_cast<const unsigned char*>(addr);
+
+    // pages are read where the camera looks, reading ahead would only load pages nobody asked for
+    madvise(addr, this->mappedSize, MADV_RANDOM);
+    return true;
+#endif
+}
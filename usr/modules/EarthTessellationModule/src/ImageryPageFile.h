@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Aftr {
+/**
+   This class is a read-only view of the page pyramid of an imagery texture, stored next to the
+   source image (see getPagePath) and written by build. Every mipmap level of the image is cut into
+   pages of PAGE_TEXELS by PAGE_TEXELS RGB texels, and each page is stored with a border of
+   PAGE_BORDER texels copied from its neighbours (wrapping around in longitude and clamped at the
+   poles), so a page filtered on its own looks exactly like the level around it. The levels halve,
+   rounding up, until a single page holds the whole level.
+
+   The file is memory mapped and read one page at a time, in whatever order the pages are needed.
+   Like ElevationPyramidCache, a page file is only opened when its header matches the image's
+   current path, size and modification time.
+*/
+class ImageryPageFile {
+public:
+    // texels of the image on each side of a page
+    const static unsigned int PAGE_TEXELS = 128;
+
+    // texels copied from the neighbouring pages on each side of a page
+    const static unsigned int PAGE_BORDER = 4;
+
+    // texels on each side of a stored page
+    const static unsigned int PAGE_SIZE = PAGE_TEXELS + 2 * PAGE_BORDER;
+
+    // bytes of a stored page, tightly packed RGB rows
+    const static size_t PAGE_BYTES = static_cast<size_t>(PAGE_SIZE) * PAGE_SIZE * 3;
+
+    // Returns the path of the page file for imagery.
+    static std::string getPagePath(const std::string& imagery);
+
+    // Maps the page file of imagery. Returns nullptr if it is missing, stale or corrupt.
+    static std::unique_ptr<ImageryPageFile> open(const std::string& imagery);
+
+    /**
+        Builds the page file of imagery with GDAL. The full resolution level is read in strips of
+        one row of pages, and only the next level is held in memory whole (a quarter of the decoded
+        image), from which the coarser levels are paged and downsampled in turn. The file is written
+        to a temporary path and only moved into place once complete. Returns false on failure.
+    */
+    static bool build(const std::string& imagery);
+
+    ImageryPageFile(const ImageryPageFile&) = delete;
+    ImageryPageFile& operator=(const ImageryPageFile&) = delete;
+    virtual ~ImageryPageFile();
+
+    // Returns the width of the base level.
+    unsigned int getWidth() const { return this->levelWidths.at(0); }
+
+    // Returns the height of the base level.
+    unsigned int getHeight() const { return this->levelHeights.at(0); }
+
+    // Returns the number of levels (including the base level).
+    unsigned int getNumLevels() const { return static_cast<unsigned int>(this->levelWidths.size()); }
+
+    // Returns the width of a level in texels.
+    unsigned int getLevelWidth(unsigned int level) const { return this->levelWidths.at(level); }
+
+    // Returns the height of a level in texels.
+    unsigned int getLevelHeight(unsigned int level) const { return this->levelHeights.at(level); }
+
+    // Returns the number of pages across a level.
+    unsigned int getPagesX(unsigned int level) const { return this->pagesX.at(level); }
+
+    // Returns the number of pages down a level.
+    unsigned int getPagesY(unsigned int level) const { return this->pagesY.at(level); }
+
+    // Returns the number of pages of every level.
+    uint32_t getNumPages() const { return this->firstPages.back(); }
+
+    // Returns the index of page (x, y) of a level. The pages of each level follow those of the finer levels, row by row.
+    uint32_t getPageIndex(unsigned int level, unsigned int x, unsigned int y) const { return this->firstPages.at(level) + y * this->pagesX.at(level) + x; }
+
+    // Returns the index of the first page of a level (getNumPages() for getNumLevels()).
+    uint32_t getFirstPage(unsigned int level) const { return this->firstPages.at(level); }
+
+    // Returns the PAGE_BYTES texels of the page with index, pointing directly into the mapping.
+    const unsigned char* getPage(uint32_t index) const;
+
+    // Returns the size of the mapped file in bytes.
+    size_t getMappedSize() const { return this->mappedSize; }
+
+protected:
+    ImageryPageFile();
+
+    const unsigned char* mapped;
+    size_t mappedSize;
+    uint64_t dataOffset; // offset of the first page
+    std::vector<unsigned int> levelWidths;
+    std::vector<unsigned int> levelHeights;
+    std::vector<unsigned int> pagesX;
+    std::vector<unsigned int> pagesY;
+    std::vector<uint32_t> firstPages; // getNumLevels() + 1 entries
+
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+
+    // Maps path into memory. Returns false on failure.
+    bool map(const std::string& path);
+};
+}
@@ -0,0 +1,415 @@
+#include "ImageryVirtualTexture.h"
+
+#include "GLStateCache.h"
+#include "Texture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+
+using namespace Aftr;
+
+// slot indices and page coordinates are stored in 16 bit channels of the indirection texture
+const static unsigned int MAX_SLOTS_PER_SIDE = 255;
+
+// the virtual texture of each imagery path, shared by every MGLEarthQuad drawing it (see acquire)
+static std::map<std::string, std::weak_ptr<ImageryVirtualTexture>> sharedTextures;
+
+// Wraps the immutable texture texID in an owned Texture.
+static Texture* wrapTexture(GLuint texID, GLenum internalFormat, GLenum texelFormat, GLenum texelType, unsigned int width, unsigned int height, bool mipmapped)
+{
+    TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
+    tex->isMipmapped(mipmapped);
+    tex->setTextureDimensionality(GL_TEXTURE_2D);
+    tex->setGLInternalFormat(internalFormat);
+    tex->setGLRawTexelFormat(texelFormat);
+    tex->setGLRawTexelType(texelType);
+    tex->setTextureDimensions(width, height);
+    tex->setGLTex(texID);
+    return new TextureOwnsTexDataOwnsGLHandle(tex);
+}
+
+ImageryVirtualTexture::ImageryVirtualTexture(std::unique_ptr<ImageryPageFile> pageFile, unsigned int slotsPerSide, unsigned int pagesPerFrame)
+{
+    this->pageFile = std::move(pageFile);
+    this->pagesPerFrame = std::max(pagesPerFrame, 1u);
+    this->frame = 0;
+    this->currentFeedback = 0;
+    this->numResident = 0;
+    this->numWanted = 0;
+    this->numUploads = 0;
+    this->stopping = false;
+
+    // the cache needs a slot for the pinned coarsest page and at least one more
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    unsigned int maxSlotsPerSide = std::min(static_cast<unsigned int>(maxSize) / ImageryPageFile::PAGE_SIZE, MAX_SLOTS_PER_SIDE);
+    this->slotsPerSide = std::min(std::max(slotsPerSide, 2u), std::max(maxSlotsPerSide, 2u));
+    this->slots.assign(this->slotsPerSide * this->slotsPerSide, Slot{ NO_PAGE, 0, false });
+
+    const ImageryPageFile& file = *this->pageFile;
+    this->pageSlots.assign(file.getNumPages(), -1);
+    this->wantedFrame.assign(file.getNumPages(), std::numeric_limits<unsigned int>::max());
+
+    // create the cache, pages are only ever sampled from their own slot and border
+    unsigned int cacheSize = this->slotsPerSide * ImageryPageFile::PAGE_SIZE;
+    GLuint cacheID;
+    glGenTextures(1, &cacheID);
+    glBindTexture(GL_TEXTURE_2D, cacheID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, cacheSize, cacheSize);
+    this->cacheTex = wrapTexture(cacheID, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, cacheSize, cacheSize, false);
+
+    // Level L of the indirection texture holds the pages of level L. Its base level is sized so
+    // that every mipmap level, halving and rounding down, still covers its page level.
+    unsigned int numLevels = file.getNumLevels();
+    unsigned int baseWidth = 1;
+    unsigned int baseHeight = 1;
+    for (unsigned int level = 0; level < numLevels; ++level) {
+        baseWidth = std::max(baseWidth, file.getPagesX(level) << level);
+        baseHeight = std::max(baseHeight, file.getPagesY(level) << level);
+    }
+
+    GLuint indirectionID;
+    glGenTextures(1, &indirectionID);
+    glBindTexture(GL_TEXTURE_2D, indirectionID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_RGBA16UI, baseWidth, baseHeight);
+    this->indirectionTex = wrapTexture(indirectionID, GL_RGBA16UI, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, baseWidth, baseHeight, true);
+
+    this->indirection.resize(numLevels);
+    this->dirty.resize(numLevels);
+    for (unsigned int level = 0; level < numLevels; ++level) {
+        unsigned int pagesX = file.getPagesX(level);
+        unsigned int pagesY = file.getPagesY(level);
+        this->indirection[level].assign(static_cast<size_t>(pagesX) * pagesY * 4, 0);
+        for (size_t i = 0; i < static_cast<size_t>(pagesX) * pagesY; ++i)
+            this->indirection[level][i * 4 + 1] = NO_LEVEL;
+        this->dirty[level] = DirtyRect{ 0, 0, pagesX, pagesY };
+    }
+
+    // the coarsest level is a single page that every lookup falls back to, keep it forever
+    uint32_t coarsest = file.getFirstPage(numLevels - 1);
+    makeResident(coarsest, file.getPage(coarsest), true);
+    uploadIndirection();
+
+    // create the ring of page requests written by earth.frag
+    size_t numWords = (static_cast<size_t>(file.getNumPages()) + 31) / 32;
+    this->feedback.assign(numWords, 0);
+    glGenBuffers(NUM_FEEDBACK_BUFFERS, this->feedbackBuffers);
+    for (GLuint buffer : this->feedbackBuffers) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, numWords * sizeof(GLuint), this->feedback.data(), GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // the textures above were created with glBindTexture calls the GL state cache didn't see
+    GLStateCache::invalidateTextures();
+
+    this->loader = std::thread(&ImageryVirtualTexture::loadPages, this);
+
+    std::cout << "Streaming imagery " << file.getWidth() << "x" << file.getHeight() << " (" << file.getNumPages() << " pages) through "
+              << this->slots.size() << " cached pages (" << (static_cast<size_t>(cacheSize) * cacheSize * 3 >> 20) << " MB)" << std::endl;
+}
+
+ImageryVirtualTexture::~ImageryVirtualTexture()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_one();
+    this->loader.join();
+
+    glDeleteBuffers(NUM_FEEDBACK_BUFFERS, this->feedbackBuffers);
+
+    delete this->cacheTex;
+    this->cacheTex = nullptr;
+    delete this->indirectionTex;
+    this->indirectionTex = nullptr;
+
+    // GL unbound whichever of the textures were still bound
+    GLStateCache::invalidateTextures();
+}
+
+std::shared_ptr<ImageryVirtualTexture> ImageryVirtualTexture::acquire(const std::string& imagery, unsigned int slotsPerSide, unsigned int pagesPerFrame)
+{
+    std::shared_ptr<ImageryVirtualTexture> texture = sharedTextures[imagery].lock();
+    if (texture != nullptr)
+        return texture;
+
+    // cut the image into pages on the first launch, or whenever it changed since
+    std::unique_ptr<ImageryPageFile> pages = ImageryPageFile::open(imagery);
+    if (pages == nullptr && ImageryPageFile::build(imagery))
+        pages = ImageryPageFile::open(imagery);
+    if (pages == nullptr) {
+        sharedTextures.erase(imagery);
+        return nullptr;
+    }
+
+    texture = std::make_shared<ImageryVirtualTexture>(std::move(pages), slotsPerSide, pagesPerFrame);
+    sharedTextures[imagery] = texture;
+    return texture;
+}
+
+void ImageryVirtualTexture::updateAll()
+{
+    for (auto it = sharedTextures.begin(); it != sharedTextures.end();) {
+        if (std::shared_ptr<ImageryVirtualTexture> texture = it->second.lock()) {
+            texture->update();
+            ++it;
+        } else {
+            it = sharedTextures.erase(it);
+        }
+    }
+}
+
+void ImageryVirtualTexture::bindFeedback() const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, getFeedbackBinding(), this->feedbackBuffers[this->currentFeedback]);
+}
+
+void ImageryVirtualTexture::update()
+{
+    // Read the requests of the oldest frame in the ring, which the GPU finished long ago, so the
+    // readback never stalls the pipeline. The requests are NUM_FEEDBACK_BUFFERS - 1 frames old.
+    unsigned int current = this->frame % NUM_FEEDBACK_BUFFERS;
+    unsigned int oldest = (this->frame + 1) % NUM_FEEDBACK_BUFFERS;
+    size_t numWords = this->feedback.size();
+    if (this->frame + 1 >= NUM_FEEDBACK_BUFFERS) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->feedbackBuffers[oldest]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, numWords * sizeof(GLuint), this->feedback.data());
+    }
+
+    // a page can only be drawn once its ancestors are resident, so they are wanted too
+    std::vector<uint32_t> missing;
+    this->numWanted = 0;
+    unsigned int numLevels = this->pageFile->getNumLevels();
+    for (size_t word = 0; word < numWords; ++word) {
+        for (GLuint bits = this->feedback[word]; bits != 0; bits &= bits - 1) {
+            unsigned int bit = 0;
+            while (((bits >> bit) & 1) == 0)
+                ++bit;
+
+            unsigned int level, x, y;
+            getPageCoords(static_cast<uint32_t>(word * 32 + bit), level, x, y);
+            for (; level < numLevels; ++level, x /= 2, y /= 2) {
+                uint32_t page = this->pageFile->getPageIndex(level, x, y);
+                if (this->wantedFrame[page] == this->frame)
+                    break;
+                this->wantedFrame[page] = this->frame;
+                ++this->numWanted;
+                if (this->pageSlots[page] >= 0)
+                    this->slots[this->pageSlots[page]].lastWanted = this->frame;
+                else
+                    missing.push_back(page);
+            }
+        }
+    }
+
+    // pages nobody wants anymore aren't worth a slot
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::move(this->loaded.begin(), this->loaded.end(), std::back_inserter(this->ready));
+        this->loaded.clear();
+    }
+    this->ready.erase(std::remove_if(this->ready.begin(), this->ready.end(), [this](const LoadedPage& p) {
+        return this->wantedFrame[p.page] != this->frame || this->pageSlots[p.page] >= 0;
+    }), this->ready.end());
+
+    // The pages of the finer levels come first, so sorting by index puts the coarsest pages last,
+    // where the loader takes the next page from. Only queue as many as a few frames can upload, so
+    // the queue never holds on to pages the camera has long moved away from.
+    auto byPage = [](const LoadedPage& a, uint32_t page) { return a.page < page; };
+    std::sort(this->ready.begin(), this->ready.end(), [](const LoadedPage& a, const LoadedPage& b) { return a.page < b.page; });
+    std::sort(missing.begin(), missing.end());
+    std::vector<uint32_t> queue;
+    for (uint32_t page : missing) {
+        auto it = std::lower_bound(this->ready.begin(), this->ready.end(), page, byPage);
+        if (it == this->ready.end() || it->page != page)
+            queue.push_back(page);
+    }
+    size_t maxQueued = static_cast<size_t>(QUEUE_FRAMES) * this->pagesPerFrame;
+    if (queue.size() > maxQueued)
+        queue.erase(queue.begin(), queue.end() - maxQueued);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.swap(queue);
+    }
+    this->wake.notify_one();
+
+    // upload the coarsest loaded pages
+    this->numUploads = 0;
+    while (!this->ready.empty() && this->numUploads < this->pagesPerFrame) {
+        if (!makeResident(this->ready.back().page, this->ready.back().texels.data(), false))
+            break;
+        this->ready.pop_back();
+        ++this->numUploads;
+    }
+    uploadIndirection();
+
+    // clear this frame's requests, bindFeedback hands them to earth.frag
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->feedbackBuffers[current]);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    this->currentFeedback = current;
+
+    GLStateCache::invalidateTextures();
+    this->frame++;
+}
+
+void ImageryVirtualTexture::loadPages()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wake.wait(lock, [this]() { return this->stopping || !this->queue.empty(); });
+        if (this->stopping)
+            return;
+
+        LoadedPage page;
+        page.page = this->queue.back();
+        this->queue.pop_back();
+        lock.unlock();
+
+        // the page faults of the mapping are taken here instead of on the render thread
+        const unsigned char* texels = this->pageFile->getPage(page.page);
+        page.texels.assign(texels, texels + ImageryPageFile::PAGE_BYTES);
+
+        lock.lock();
+        this->loaded.push_back(std::move(page));
+    }
+}
+
+void ImageryVirtualTexture::getPageCoords(uint32_t page, unsigned int& level, unsigned int& x, unsigned int& y) const
+{
+    const ImageryPageFile& file = *this->pageFile;
+    level = 0;
+    while (page >= file.getFirstPage(level + 1))
+        ++level;
+
+    uint32_t offset = page - file.getFirstPage(level);
+    x = offset % file.getPagesX(level);
+    y = offset / file.getPagesX(level);
+}
+
+bool ImageryVirtualTexture::makeResident(uint32_t page, const unsigned char* texels, bool pinned)
+{
+    if (this->pageSlots[page] >= 0)
+        return true;
+
+    // take a free slot, or else the slot least recently wanted before this frame
+    int best = -1;
+    for (size_t i = 0; i < this->slots.size(); ++i) {
+        const Slot& slot = this->slots[i];
+        if (slot.page == NO_PAGE) {
+            best = static_cast<int>(i);
+            break;
+        }
+        if (!slot.pinned && slot.lastWanted != this->frame && (best < 0 || slot.lastWanted < this->slots[best].lastWanted))
+            best = static_cast<int>(i);
+    }
+    if (best < 0)
+        return false;
+
+    unsigned int level, x, y;
+    Slot& slot = this->slots[best];
+    if (slot.page != NO_PAGE) {
+        // point whatever drew the evicted page at its parent
+        this->pageSlots[slot.page] = -1;
+        --this->numResident;
+        getPageCoords(slot.page, level, x, y);
+        refreshIndirection(level, x, y);
+    }
+
+    unsigned int slotX = static_cast<unsigned int>(best) % this->slotsPerSide;
+    unsigned int slotY = static_cast<unsigned int>(best) / this->slotsPerSide;
+    glBindTexture(GL_TEXTURE_2D, this->cacheTex->getGLTex());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slotX * ImageryPageFile::PAGE_SIZE, slotY * ImageryPageFile::PAGE_SIZE,
+        ImageryPageFile::PAGE_SIZE, ImageryPageFile::PAGE_SIZE, GL_RGB, GL_UNSIGNED_BYTE, texels);
+
+    slot.page = page;
+    slot.lastWanted = this->frame;
+    slot.pinned = pinned;
+    this->pageSlots[page] = best;
+    ++this->numResident;
+    getPageCoords(page, level, x, y);
+    refreshIndirection(level, x, y);
+    return true;
+}
+
+void ImageryVirtualTexture::refreshIndirection(unsigned int level, unsigned int x, unsigned int y)
+{
+    const ImageryPageFile& file = *this->pageFile;
+    unsigned int pagesX = file.getPagesX(level);
+    GLushort* entry = &this->indirection[level][(static_cast<size_t>(y) * pagesX + x) * 4];
+    int slot = this->pageSlots[file.getPageIndex(level, x, y)];
+    if (slot >= 0) {
+        entry[0] = static_cast<GLushort>(slot);
+        entry[1] = static_cast<GLushort>(level);
+        entry[2] = static_cast<GLushort>(x);
+        entry[3] = static_cast<GLushort>(y);
+    } else if (level + 1 < file.getNumLevels()) {
+        const GLushort* parent = &this->indirection[level + 1][(static_cast<size_t>(y / 2) * file.getPagesX(level + 1) + x / 2) * 4];
+        std::memcpy(entry, parent, 4 * sizeof(GLushort));
+    } else {
+        entry[1] = NO_LEVEL;
+    }
+
+    DirtyRect& rect = this->dirty[level];
+    if (rect.x0 >= rect.x1) {
+        rect = DirtyRect{ x, y, x + 1, y + 1 };
+    } else {
+        rect.x0 = std::min(rect.x0, x);
+        rect.y0 = std::min(rect.y0, y);
+        rect.x1 = std::max(rect.x1, x + 1);
+        rect.y1 = std::max(rect.y1, y + 1);
+    }
+
+    // the subtrees of resident children draw their own pages
+    if (level == 0)
+        return;
+    unsigned int childX1 = std::min(x * 2 + 2, file.getPagesX(level - 1));
+    unsigned int childY1 = std::min(y * 2 + 2, file.getPagesY(level - 1));
+    for (unsigned int cy = y * 2; cy < childY1; ++cy) {
+        for (unsigned int cx = x * 2; cx < childX1; ++cx) {
+            if (this->pageSlots[file.getPageIndex(level - 1, cx, cy)] < 0)
+                refreshIndirection(level - 1, cx, cy);
+        }
+    }
+}
+
+void ImageryVirtualTexture::uploadIndirection()
+{
+    bool bound = false;
+    for (unsigned int level = 0; level < this->dirty.size(); ++level) {
+        DirtyRect& rect = this->dirty[level];
+        if (rect.x0 >= rect.x1)
+            continue;
+
+        if (!bound) {
+            glBindTexture(GL_TEXTURE_2D, this->indirectionTex->getGLTex());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            bound = true;
+        }
+
+        unsigned int pagesX = this->pageFile->getPagesX(level);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pagesX);
+        glTexSubImage2D(GL_TEXTURE_2D, level, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT,
+            &this->indirection[level][(static_cast<size_t>(rect.y0) * pagesX + rect.x0) * 4]);
+        rect = DirtyRect{ 0, 0, 0, 0 };
+    }
+
+    if (bound)
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
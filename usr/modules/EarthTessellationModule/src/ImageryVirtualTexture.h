@@ -0,0 +1,166 @@
+#pragma once
+
+#include "AftrOpenGLIncludes.h"
+#include "ImageryPageFile.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Aftr {
+class Texture;
+
+/**
+   This class draws the earth imagery as a virtual texture, so the GPU memory it takes is fixed no
+   matter how large the source image is. The pages of an ImageryPageFile are streamed into a cache
+   texture of slotsPerSide x slotsPerSide page slots, and an indirection texture with a mip level per
+   page level maps every page to its slot, or to the slot of its nearest resident ancestor while it
+   isn't loaded yet. The coarsest level is loaded up front and never evicted, so every lookup finds
+   a page.
+
+   earth.frag (with EARTH_VIRTUAL_IMAGERY) picks the level whose texels are about a pixel apart and
+   sets the bit of the page it wanted in a feedback buffer, one bit per page. The feedback buffers
+   form a ring of NUM_FEEDBACK_BUFFERS frames like MGLEarthQuad's patch counters, so update reads
+   back requests the GPU finished with long ago and never stalls. The missing pages (and their
+   ancestors) are handed to a loader thread coarsest first, and update uploads at most pagesPerFrame
+   of the loaded pages per frame into the least recently wanted slots.
+
+   Every MGLEarthQuad drawing the same imagery shares one virtual texture (see acquire), so they share
+   its page cache and loader thread, and their pixels request pages in the same feedback buffer.
+   updateAll updates each of them once per frame, however many quads and render passes draw with it.
+*/
+class ImageryVirtualTexture {
+public:
+    // frames of feedback buffers in flight, so reading them back never waits on the GPU
+    const static unsigned int NUM_FEEDBACK_BUFFERS = 3;
+
+    // Returns the shader storage binding of the ImageryFeedback block in earth.frag.
+    static GLuint getFeedbackBinding() { return 7; }
+
+    /**
+        Constructor for creating a virtual texture.
+        pageFile - The pages to stream.
+        slotsPerSide - The cache texture holds slotsPerSide^2 pages. Clamped to GL_MAX_TEXTURE_SIZE.
+        pagesPerFrame - The most pages update uploads per frame.
+    */
+    ImageryVirtualTexture(std::unique_ptr<ImageryPageFile> pageFile, unsigned int slotsPerSide, unsigned int pagesPerFrame);
+    ~ImageryVirtualTexture();
+
+    ImageryVirtualTexture(const ImageryVirtualTexture&) = delete;
+    ImageryVirtualTexture& operator=(const ImageryVirtualTexture&) = delete;
+
+    /**
+        Returns the virtual texture of imagery, shared with everyone else holding it. The first call opens the
+        pages, cutting the image into pages first if they are missing or stale, and creates the texture with
+        slotsPerSide and pagesPerFrame; later calls return it as it is. Returns nullptr if the pages can't be built.
+    */
+    static std::shared_ptr<ImageryVirtualTexture> acquire(const std::string& imagery, unsigned int slotsPerSide, unsigned int pagesPerFrame);
+
+    // Calls update on every virtual texture acquired and still held. Call once per frame before rendering.
+    static void updateAll();
+
+    // Collects the oldest frame's page requests, uploads loaded pages and clears this frame's feedback buffer.
+    void update();
+
+    // Binds this frame's feedback buffer to getFeedbackBinding(). Call before each draw with earth.frag, in every render pass.
+    void bindFeedback() const;
+
+    // Returns the RGB8 cache texture holding the resident pages.
+    Texture* getCacheTexture() const { return this->cacheTex; }
+
+    // Returns the RGBA16UI indirection texture (slot, level, page x, page y of the page drawn for every page of every level).
+    Texture* getIndirectionTexture() const { return this->indirectionTex; }
+
+    // Returns the pages being streamed.
+    const ImageryPageFile& getPageFile() const { return *this->pageFile; }
+
+    // Returns the number of page slots of the cache texture.
+    unsigned int getNumSlots() const { return static_cast<unsigned int>(this->slots.size()); }
+
+    // Returns the number of pages in the cache.
+    unsigned int getNumResidentPages() const { return this->numResident; }
+
+    // Returns the number of pages (including ancestors) wanted by the frame the last update read back.
+    unsigned int getNumWantedPages() const { return this->numWanted; }
+
+    // Returns the number of pages uploaded by the last update.
+    unsigned int getNumUploadsLastFrame() const { return this->numUploads; }
+
+protected:
+    // most pages queued for the loader at a time, in multiples of pagesPerFrame
+    const static unsigned int QUEUE_FRAMES = 4;
+
+    // the level entry of an indirection texel whose page has no resident ancestor
+    const static GLushort NO_LEVEL = 0xFFFF;
+
+    // A page slot of the cache texture.
+    struct Slot {
+        uint32_t page; // the page held, NO_PAGE if free
+        unsigned int lastWanted; // frame the page was last wanted
+        bool pinned; // never evicted
+    };
+
+    // A page read by the loader thread.
+    struct LoadedPage {
+        uint32_t page;
+        std::vector<unsigned char> texels;
+    };
+
+    // A region of an indirection level that changed since its last upload.
+    struct DirtyRect {
+        unsigned int x0;
+        unsigned int y0;
+        unsigned int x1;
+        unsigned int y1;
+    };
+
+    const static uint32_t NO_PAGE = 0xFFFFFFFF;
+
+    // Runs on the loader thread, reading the queued pages until stopping is set.
+    void loadPages();
+
+    // Gets the level and the page coordinates of page.
+    void getPageCoords(uint32_t page, unsigned int& level, unsigned int& x, unsigned int& y) const;
+
+    // Uploads texels into a free (or the least recently wanted) slot. Returns false if every slot was wanted this frame or is pinned.
+    bool makeResident(uint32_t page, const unsigned char* texels, bool pinned);
+
+    // Points the indirection texels of page (level, x, y) and of every page below it at the nearest resident page.
+    void refreshIndirection(unsigned int level, unsigned int x, unsigned int y);
+
+    // Uploads the dirty regions of the indirection levels.
+    void uploadIndirection();
+
+    std::unique_ptr<ImageryPageFile> pageFile;
+    unsigned int slotsPerSide;
+    unsigned int pagesPerFrame;
+    std::vector<Slot> slots;
+    std::vector<int> pageSlots; // slot of every page, -1 if not resident
+    std::vector<unsigned int> wantedFrame; // frame every page was last wanted, to dedupe the requests
+    std::vector<std::vector<GLushort>> indirection; // RGBA texels of every level, pagesX x pagesY
+    std::vector<DirtyRect> dirty; // per level, empty when x0 >= x1
+    unsigned int frame;
+    unsigned int numResident;
+    unsigned int numWanted;
+    unsigned int numUploads;
+
+    Texture* cacheTex;
+    Texture* indirectionTex;
+    GLuint feedbackBuffers[NUM_FEEDBACK_BUFFERS]; // ring of page request bits written by earth.frag
+    unsigned int currentFeedback; // the buffer of feedbackBuffers this frame's pixels request pages in
+    std::vector<GLuint> feedback; // the bits of the last read back frame
+
+    std::thread loader;
+    std::mutex mutex; // guards queue, loaded and stopping
+    std::condition_variable wake;
+    std::vector<uint32_t> queue; // pages to load, the next one last
+    std::vector<LoadedPage> loaded; // pages read since the last update
+    bool stopping;
+
+    std::vector<LoadedPage> ready; // loaded pages still waiting for an upload, only touched by update
+};
+}
@@ -1,9 +1,17 @@
 #include "MGLEarthQuad.h"
 
 #include "GLSLEarthShader.h"
-#include "GLSLUniform.h"
 
+#include "EarthConfig.h"
+#include "EarthGridChunks.h"
+#include "ElevationPyramidCache.h"
+#include "ElevationStreamReader.h"
+#include "GLStateCache.h"
+#include "ImageryPageFile.h"
+#include "ImageryVirtualTexture.h"
 #include "ManagerEnvironmentConfiguration.h"
+#include "ManagerOpenGLState.h"
+#include "ManagerShader.h"
 #include "ManagerTexture.h"
 #include "Texture.h"
 
@@ -15,10 +23,85 @@
 #include "gdal_priv.h"
 #pragma warning(pop)
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <map>
+
 using namespace Aftr;
 
+// default number of megabytes of full resolution elevation data read per strip
+const static int DEFAULT_STRIP_BUDGET_MB = 16;
+
+// shader storage binding of the PatchStats block in earth.tesc
+const static GLuint PATCH_STATS_BINDING = 1;
+
+// root tiles of the quadtree (90 degrees each over the whole Earth)
+const static unsigned int QUADTREE_ROOTS_X = 2;
+const static unsigned int QUADTREE_ROOTS_Y = 4;
+
+// default deepest quadtree level (about 1 km patches) and largest tessellated segment in pixels
+const static int DEFAULT_QUADTREE_MAX_DEPTH = 12;
+const static float DEFAULT_QUADTREE_MAX_PIXEL_ERROR = 8.0f;
+
+// attribute location of CoarseEdge in earth.vert (after the engine's default attribute locations)
+const static GLuint COARSE_EDGE_LOCATION = 5;
+
+// shader storage bindings of the GPU patch list blocks in earth_cull.comp (PatchLevels is read by earth.tesc too)
+const static GLuint GRID_VERTICES_BINDING = 2;
+const static GLuint TILE_BOUNDS_BINDING = 3;
+const static GLuint PATCH_INDICES_BINDING = 4;
+const static GLuint PATCH_LEVELS_BINDING = 5;
+const static GLuint DRAW_COMMAND_BINDING = 6;
+
+// local_size_x of earth_cull.comp
+const static unsigned int CULL_GROUP_SIZE = 64;
+
+// floats of earth_cull.comp's PatchLevels per patch
+const static unsigned int FLOATS_PER_PATCH_LEVELS = 8;
+
+// tile errors are computed for 2^k segments per edge, k in [0, NUM_TILE_ERRORS) (up to 64 segments)
+const static unsigned int NUM_TILE_ERRORS = 7;
+
+// most vertices a chunk of the grid may have to be indexed with GLushort (0xFFFF is the restart index)
+const static size_t MAX_SHORT_INDEXED_VERTS = 0xFFFF;
+
+// default largest projected geometric error in pixels of the screen space error LOD
+const static float DEFAULT_TARGET_PIXEL_ERROR = 4.0f;
+
+// default page slots on each side of the imagery page cache (16^2 pages of 136^2 RGB texels, about 14 MB)
+const static int DEFAULT_IMAGERY_CACHE_SLOTS = 16;
+
+// default most imagery pages uploaded per frame
+const static int DEFAULT_IMAGERY_PAGES_PER_FRAME = 16;
+
+// how many MGLEarthQuads made each bindless texture handle resident (the imagery texture is shared
+// through ManagerTexture, and every user of a texture gets the same handle)
+static std::map<GLuint64, unsigned int> residentTextureHandles;
+
+// Returns the bindless handle of tex, which is resident until releaseTextureHandle is called as often.
+static GLuint64 acquireTextureHandle(const Texture* tex)
+{
+    GLuint64 handle = glGetTextureHandleARB(tex->getGLTex());
+    if (residentTextureHandles[handle]++ == 0)
+        glMakeTextureHandleResidentARB(handle);
+    return handle;
+}
+
+// Makes handle non-resident once the last MGLEarthQuad using it lets go of it.
+static void releaseTextureHandle(GLuint64 handle)
+{
+    auto it = residentTextureHandles.find(handle);
+    if (it != residentTextureHandles.end() && --it->second == 0) {
+        glMakeTextureHandleNonResidentARB(handle);
+        residentTextureHandles.erase(it);
+    }
+}
+
 MGLEarthQuad::MGLEarthQuad(WO* parentWO, const Vector& ul, const Vector& lr, unsigned int nTilesX, unsigned int nTilesY,
-    float s, float tess, float maxTess, const std::string& elev, const std::string& imagery)
+    float s, float tess, float maxTess, const std::string& elev, const std::string& imagery, EARTH_PATCH_MODE mode)
     : MGL(parentWO)
 {
     this->scale = s;
@@ -26,38 +109,312 @@ MGLEarthQuad::MGLEarthQuad(WO* parentWO, const Vector& ul, const Vector& lr, uns
     this->maxTessellationFactor = maxTess;
     this->usingLines = false;
     this->elevTex = nullptr;
+    this->elevBoundsTex = nullptr;
     this->imageryTex = nullptr;
+    this->tileErrorsTex = nullptr;
+    this->numTilesX = 0;
+    this->numTilesY = 0;
+    this->cullingEnabled = EarthConfig::getBool("earthculling", true);
+    this->patchStatsEnabled = EarthConfig::getBool("earthpatchstats", false);
+    this->numDrawnPatches = 0;
+    this->numCulledPatches = 0;
+    this->patchStatsFrame = 0;
+    this->patchMode = mode;
+    bool sse = mode == EARTH_PATCH_MODE::epmFIXED_GRID && EarthConfig::getString("earthlodmode", "edge") == "sse";
+    this->lodMode = sse ? EARTH_LOD_MODE::elmSCREEN_SPACE_ERROR : EARTH_LOD_MODE::elmEDGE_LENGTH;
+    this->targetPixelError = EarthConfig::getFloat("earthtargetpixelerror", DEFAULT_TARGET_PIXEL_ERROR);
+    this->patchVAO = 0;
+    this->patchVBO = 0;
+    this->gpuPatchList = mode == EARTH_PATCH_MODE::epmFIXED_GRID && EarthConfig::getBool("earthgpupatchlist", false);
+    this->shortIndices = EarthConfig::getBool("earth16bitindices", true);
+    this->bindlessTextures = false;
+    if (EarthConfig::getBool("earthbindlesstextures", true)) {
+        this->bindlessTextures = GLEW_ARB_bindless_texture != GL_FALSE;
+        if (!this->bindlessTextures)
+            std::cout << "GL_ARB_bindless_texture is not supported, binding the earth textures to texture units instead" << std::endl;
+    }
+    this->uniformBuffer = std::make_shared<EarthUniformBuffer>();
+    this->uniformBuffer->setRelativeToEye(EarthConfig::getBool("earthrelativetoeye", true));
+
+    // start from the viewport at creation, the GLView passes on every resize after that (see setViewportHeight)
+    GLint viewport[4] = { 0, 0, 0, 0 };
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    this->setViewportHeight(static_cast<float>(viewport[3]));
+    this->cullShader = nullptr;
+    this->gridVAO = 0;
+    this->gridVBO = 0;
+    this->tileBoundsBuffer = 0;
+    this->patchIndexBuffer = 0;
+    this->patchLevelsBuffer = 0;
+    this->drawCommandBuffer = 0;
 
     // ensure number of tiles is nonzero
     assert(nTilesX > 0);
     assert(nTilesY > 0);
 
+    // Whether the imagery is virtual picks the program variant. Its pages are built from the image when
+    // they are missing, so finding the image is enough to pick it without loading anything yet.
+    std::error_code ec;
+    bool virtualTexture = EarthConfig::getBool("imageryvirtualtexture", true) && std::filesystem::is_regular_file(imagery, ec);
+
+    // start compiling the programs this quad draws with so the driver works on them while the textures load
+    bool quadtreePatches = mode == EARTH_PATCH_MODE::epmQUADTREE;
+    std::vector<GLSLShaderDescriptor> programs = { GLSLEarthShader::getDescriptor(quadtreePatches, this->gpuPatchList, this->bindlessTextures, virtualTexture) };
+    if (this->gpuPatchList)
+        programs.push_back(GLSLEarthShader::getCullDescriptor(this->bindlessTextures));
+    ManagerShader::loadShaderDataSharedAsync(programs);
+
+    // if the pages can't be built after all, the single texture variant compiles when the skin asks for it
+    loadImageryTexture(imagery, virtualTexture);
+
+    // create the patch counters written by earth.tesc
+    glGenBuffers(NUM_PATCH_STATS_BUFFERS, this->patchStatsBuffers);
+    for (GLuint buffer : this->patchStatsBuffers) {
+        GLuint zero[2] = { 0, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), zero, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // and the queries timing each frame's stages
+    this->profiler = std::make_unique<EarthRenderProfiler>();
+
     // generate data
     loadElevationTexture(elev);
-    loadImageryTexture(imagery);
-    generateData(ul, lr, nTilesX, nTilesY);
+    createElevationBoundsTexture();
+    if (this->patchMode == EARTH_PATCH_MODE::epmQUADTREE) {
+        // the mesh only holds the skin and the root tiles, the patches come from the quadtree
+        generateData(ul, lr, QUADTREE_ROOTS_X, QUADTREE_ROOTS_Y);
+        createQuadtree(ul, lr);
+    } else {
+        generateData(ul, lr, nTilesX, nTilesY);
+    }
+
+    // hand the shaders the textures' bindless handles, they stay resident for the lifetime of this quad
+    if (this->bindlessTextures) {
+        this->uniformBuffer->set(&EarthUniforms::elevationTextureHandle, acquireTextureHandle(this->elevTex));
+        this->uniformBuffer->set(&EarthUniforms::imageryTextureHandle, acquireTextureHandle(this->imageryTex));
+        this->uniformBuffer->set(&EarthUniforms::elevationBoundsHandle, acquireTextureHandle(this->elevBoundsTex));
+        this->uniformBuffer->set(&EarthUniforms::tileErrorsHandle, acquireTextureHandle(this->tileErrorsTex));
+        if (this->virtualImagery != nullptr)
+            this->uniformBuffer->set(&EarthUniforms::imageryIndirectionHandle, acquireTextureHandle(this->virtualImagery->getIndirectionTexture()));
+    }
+
+    // the textures above were created with glBindTexture calls the GL state cache didn't see
+    GLStateCache::invalidateTextures();
 }
 
 MGLEarthQuad::~MGLEarthQuad()
 {
-    delete this->modelData->getModelMeshes().at(0)->getMeshDataShared();
+    for (ModelMesh* mesh : this->modelData->getModelMeshes())
+        delete mesh->getMeshDataShared();
 
     this->modelData->destroyCompositeLists();
     delete this->modelData;
     this->modelData = nullptr;
 
+    // a texture can't be deleted while its handle is resident
+    if (this->bindlessTextures) {
+        const EarthUniforms& uniforms = this->uniformBuffer->getUniforms();
+        releaseTextureHandle(uniforms.elevationTextureHandle);
+        releaseTextureHandle(uniforms.imageryTextureHandle);
+        releaseTextureHandle(uniforms.elevationBoundsHandle);
+        releaseTextureHandle(uniforms.tileErrorsHandle);
+        if (this->virtualImagery != nullptr)
+            releaseTextureHandle(uniforms.imageryIndirectionHandle);
+    }
+
     // destroy elevation texture
     if (elevTex != nullptr) {
         delete elevTex;
         elevTex = nullptr;
     }
 
-    // note: we don't delete imageryTex because ManagerTexture handles that
+    if (elevBoundsTex != nullptr) {
+        delete elevBoundsTex;
+        elevBoundsTex = nullptr;
+    }
+
+    if (tileErrorsTex != nullptr) {
+        delete tileErrorsTex;
+        tileErrorsTex = nullptr;
+    }
+
+    // the last quad drawing the imagery stops the page loader and deletes the page cache imageryTex points to
+    this->virtualImagery.reset();
+
+    // GL unbound whichever of the textures were still bound
+    GLStateCache::invalidateTextures();
+
+    glDeleteBuffers(NUM_PATCH_STATS_BUFFERS, this->patchStatsBuffers);
+
+    if (this->patchVAO != 0) {
+        glDeleteVertexArrays(1, &this->patchVAO);
+        glDeleteBuffers(1, &this->patchVBO);
+    }
+
+    if (this->gridVAO != 0) {
+        glDeleteVertexArrays(1, &this->gridVAO);
+        GLuint buffers[5] = { this->gridVBO, this->tileBoundsBuffer, this->patchIndexBuffer, this->patchLevelsBuffer, this->drawCommandBuffer };
+        glDeleteBuffers(5, buffers);
+    }
+
+    if (this->cullShader != nullptr) {
+        delete this->cullShader;
+        this->cullShader = nullptr;
+    }
+
+    // note: we don't delete imageryTex because ManagerTexture (or virtualImagery) handles that
 }
 
 void MGLEarthQuad::render(const Camera& cam)
 {
-    Model::render(cam);
+    this->uniformBuffer->beginFrame();
+
+    // The shaders only count patches while the stats are enabled, otherwise there's nothing to read back or reset.
+    // The block stays bound either way since earth.tesc and earth_cull.comp declare it.
+    unsigned int current = this->patchStatsFrame % NUM_PATCH_STATS_BUFFERS;
+    if (this->patchStatsEnabled) {
+        // Read the counters of the oldest frame in the ring, which the GPU finished long ago, so the
+        // readback never stalls the pipeline. The counts are NUM_PATCH_STATS_BUFFERS - 1 frames old.
+        unsigned int oldest = (this->patchStatsFrame + 1) % NUM_PATCH_STATS_BUFFERS;
+        GLuint counts[2] = { 0, 0 };
+        if (this->patchStatsFrame + 1 >= NUM_PATCH_STATS_BUFFERS) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->patchStatsBuffers[oldest]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+            this->numDrawnPatches = counts[0];
+            this->numCulledPatches = counts[1];
+        }
+
+        // reset this frame's counters
+        counts[0] = 0;
+        counts[1] = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->patchStatsBuffers[current]);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCH_STATS_BINDING, this->patchStatsBuffers[current]);
+
+    // collect this frame's page requests, the pages stream in once per frame in ImageryVirtualTexture::updateAll
+    if (this->virtualImagery != nullptr)
+        this->virtualImagery->bindFeedback();
+
+    this->profiler->beginFrame();
+
+    // The wireframe rasterizes the very triangles the program tessellates as lines, so neither mode
+    // needs a geometry shader and toggling between them never switches programs.
+    if (this->usingLines)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+    if (this->patchMode == EARTH_PATCH_MODE::epmQUADTREE)
+        renderQuadtree(cam);
+    else if (this->gpuPatchList)
+        renderPatchList(cam);
+    else {
+        this->profiler->beginStage(EARTH_RENDER_STAGE::ersDRAW);
+        Model::render(cam);
+        this->profiler->endStage(EARTH_RENDER_STAGE::ersDRAW);
+    }
+
+    if (this->usingLines)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    this->patchStatsFrame++;
+}
+
+void MGLEarthQuad::renderQuadtree(const Camera& cam)
+{
+    Mat4 modelMatrix = this->getModelMatrix();
+    Mat4 normalMatrix = this->getDisplayMatrix();
+    Mat4 MVPMat = cam.getCameraProjectionMatrix() * cam.getCameraViewMatrix() * modelMatrix;
+
+    // pixels covered by a unit length at unit distance (the projection term tessLevel uses in earth.tesc)
+    float projScale = cam.getCameraProjectionMatrix().getPtr()[5] * this->getViewportHeight() / 2.0f;
+
+    this->quadtree->update(MVPMat.getPtr(), projScale, this->scale, this->maxTessellationFactor);
+
+    // respecify the whole buffer so the driver orphans last frame's storage instead of waiting on it
+    const std::vector<float>& patches = this->quadtree->getPatchData();
+    glBindBuffer(GL_ARRAY_BUFFER, this->patchVBO);
+    glBufferData(GL_ARRAY_BUFFER, patches.size() * sizeof(float), patches.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (patches.empty())
+        return;
+
+    // draw with the skin, exactly as Model::render would
+    const ModelMeshSkin& skin = this->getModelDataShared()->getModelMeshes().at(0)->getSkins().at(0);
+    std::tuple<const Mat4&, const Mat4&, const Camera&> shaderParams(modelMatrix, normalMatrix, cam);
+    skin.bind(&shaderParams);
+
+    glBindVertexArray(this->patchVAO);
+    this->profiler->beginStage(EARTH_RENDER_STAGE::ersDRAW);
+    glDrawArrays(GL_PATCHES, 0, this->quadtree->getNumPatches() * 4);
+    this->profiler->endStage(EARTH_RENDER_STAGE::ersDRAW);
+    glBindVertexArray(0);
+
+    skin.unbind();
+}
+
+void MGLEarthQuad::renderPatchList(const Camera& cam)
+{
+    Mat4 modelMatrix = this->getModelMatrix();
+    Mat4 normalMatrix = this->getDisplayMatrix();
+    Mat4 projection = cam.getCameraProjectionMatrix();
+    Mat4 view = cam.getCameraViewMatrix();
+    Vector camPos = cam.getPosition();
+    float eye[3] = { camPos.x, camPos.y, camPos.z };
+
+    // start from an empty draw (count, instanceCount, firstIndex, baseVertex, baseInstance)
+    GLuint command[5] = { 0, 1, 0, 0, 0 };
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->drawCommandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), command);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // the dispatch shares the parameters of the skin, and the skin's bind below finds them unchanged
+    this->cullShader->bind();
+    this->uniformBuffer->setCameraTransform(projection.getPtr(), view.getPtr(), modelMatrix.getPtr(), eye);
+    this->uniformBuffer->bind();
+
+    // the texture units of the samplers in earth_uniforms.glsl, which are the units the skin binds them to as well
+    if (!this->bindlessTextures) {
+        GLStateCache::bindTexture(0, GL_TEXTURE_2D, this->elevTex->getGLTex());
+        GLStateCache::bindTexture(3, GL_TEXTURE_2D, this->tileErrorsTex->getGLTex());
+        GLStateCache::activeTexture(0);
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GRID_VERTICES_BINDING, this->gridVBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_BOUNDS_BINDING, this->tileBoundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCH_INDICES_BINDING, this->patchIndexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PATCH_LEVELS_BINDING, this->patchLevelsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMAND_BINDING, this->drawCommandBuffer);
+
+    unsigned int numTiles = this->numTilesX * this->numTilesY;
+    this->profiler->beginStage(EARTH_RENDER_STAGE::ersCULL);
+    glDispatchCompute((numTiles + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    this->profiler->endStage(EARTH_RENDER_STAGE::ersCULL);
+
+    // the draw reads the command, the indices and (in earth.tesc) the levels the dispatch wrote
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    this->cullShader->unbind();
+
+    // draw with the skin, exactly as Model::render would
+    const ModelMeshSkin& skin = this->getModelDataShared()->getModelMeshes().at(0)->getSkins().at(0);
+    std::tuple<const Mat4&, const Mat4&, const Camera&> shaderParams(modelMatrix, normalMatrix, cam);
+    skin.bind(&shaderParams);
+
+    glBindVertexArray(this->gridVAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->drawCommandBuffer);
+    this->profiler->beginStage(EARTH_RENDER_STAGE::ersDRAW);
+    glDrawElementsIndirect(GL_PATCHES, GL_UNSIGNED_INT, nullptr);
+    this->profiler->endStage(EARTH_RENDER_STAGE::ersDRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+
+    skin.unbind();
+
+    // the skin binds and unbinds its textures directly, behind the GL state cache's back
+    GLStateCache::invalidateTextures();
 }
 
 void MGLEarthQuad::renderSelection(const Camera& cam, GLubyte red, GLubyte green, GLubyte blue)
@@ -67,132 +424,499 @@ void MGLEarthQuad::renderSelection(const Camera& cam, GLubyte red, GLubyte green
 
 void MGLEarthQuad::useLines(bool b)
 {
+    // render picks the polygon mode, the program is the same for triangles and lines
     this->usingLines = b;
+}
 
-    // use skin 0 for triangles and skin 1 for lines
-    this->getModelDataShared()->getModelMeshes().at(0)->useSkinAtIndex(this->usingLines ? 1 : 0);
+GLSLEarthShader* MGLEarthQuad::getEarthShader()
+{
+    return this->getModelDataShared()->getModelMeshes().at(0)->getSkins().at(0).getShaderT<GLSLEarthShader>();
 }
 
 void MGLEarthQuad::setScaleFactor(float s)
 {
     this->scale = s;
 
-    // get triangle and line skins
-    ModelMesh* mesh = this->getModelDataShared()->getModelMeshes().at(0);
-    ModelMeshSkin& skin1 = mesh->getSkins().at(0);
-    ModelMeshSkin& skin2 = mesh->getSkins().at(1);
-
-    // set both skins' scale factors
-    skin1.getShaderT<GLSLEarthShader>()->setScaleFactor(this->scale);
-    skin2.getShaderT<GLSLEarthShader>()->setScaleFactor(this->scale);
+    // set the skin's scale factor
+    this->getEarthShader()->setScaleFactor(this->scale);
 }
 
 void MGLEarthQuad::setTessellationFactor(float t)
 {
     this->tessellationFactor = t;
 
-    // get triangle and line skins
-    ModelMesh* mesh = this->getModelDataShared()->getModelMeshes().at(0);
-    ModelMeshSkin& skin1 = mesh->getSkins().at(0);
-    ModelMeshSkin& skin2 = mesh->getSkins().at(1);
-
-    // set both skins' tessellation factors
-    skin1.getShaderT<GLSLEarthShader>()->setTessellationFactor(this->tessellationFactor);
-    skin2.getShaderT<GLSLEarthShader>()->setTessellationFactor(this->tessellationFactor);
+    // set the skin's tessellation factor
+    this->getEarthShader()->setTessellationFactor(this->tessellationFactor);
 }
 
 void MGLEarthQuad::setMaxTessellationFactor(float t)
 {
     this->maxTessellationFactor = t;
 
-    // get triangle and line skins
-    ModelMesh* mesh = this->getModelDataShared()->getModelMeshes().at(0);
-    ModelMeshSkin& skin1 = mesh->getSkins().at(0);
-    ModelMeshSkin& skin2 = mesh->getSkins().at(1);
+    // set the skin's max tessellation factor
+    this->getEarthShader()->setMaxTessellationFactor(this->maxTessellationFactor);
+
+    // the evaluation shader samples a coarser mipmap level now, which changes the tile footprints
+    computeTileElevationBounds();
+}
+
+void MGLEarthQuad::setLODMode(EARTH_LOD_MODE mode)
+{
+    // quadtree patches don't line up with the tiles the errors are computed for
+    if (this->patchMode == EARTH_PATCH_MODE::epmQUADTREE)
+        mode = EARTH_LOD_MODE::elmEDGE_LENGTH;
+    this->lodMode = mode;
+
+    // set the skin's LOD mode
+    this->getEarthShader()->setLODMode(this->lodMode);
+}
+
+void MGLEarthQuad::setTargetPixelError(float pixels)
+{
+    this->targetPixelError = pixels;
 
-    // set both skins' max tessellation factors
-    skin1.getShaderT<GLSLEarthShader>()->setMaxTessellationFactor(this->maxTessellationFactor);
-    skin2.getShaderT<GLSLEarthShader>()->setMaxTessellationFactor(this->maxTessellationFactor);
+    // set the skin's target pixel error
+    this->getEarthShader()->setTargetPixelError(this->targetPixelError);
+}
+
+void MGLEarthQuad::setViewportHeight(float pixels)
+{
+    // shared by the skin, earth_cull.comp and the quadtree, so no draw has to query the viewport from GL
+    this->uniformBuffer->set(&EarthUniforms::viewportHeight, pixels);
+}
+
+void MGLEarthQuad::setCullingEnabled(bool b)
+{
+    this->cullingEnabled = b;
+
+    // set the skin's culling
+    this->getEarthShader()->setCullingEnabled(this->cullingEnabled);
+}
+
+void MGLEarthQuad::setPatchStatsEnabled(bool b)
+{
+    // restart the ring so no counts from before the counting stopped are read back
+    if (b && !this->patchStatsEnabled)
+        this->patchStatsFrame = 0;
+    this->patchStatsEnabled = b;
+    this->numDrawnPatches = 0;
+    this->numCulledPatches = 0;
+
+    this->getEarthShader()->setPatchStatsEnabled(this->patchStatsEnabled);
+}
+
+bool MGLEarthQuad::getElevationBounds(const Vector& ul, const Vector& lr, float& minElev, float& maxElev) const
+{
+    GLshort lo;
+    GLshort hi;
+    if (!getElevationBoundsWGS84(ul, lr, false, lo, hi))
+        return false;
+
+    minElev = lo;
+    maxElev = hi;
+    return true;
+}
+
+void MGLEarthQuad::getTileElevationBounds(unsigned int x, unsigned int y, float& minElev, float& maxElev) const
+{
+    size_t tile = y + static_cast<size_t>(x) * this->numTilesY;
+    minElev = this->tileBounds.at(tile * 2);
+    maxElev = this->tileBounds.at(tile * 2 + 1);
 }
 
 void MGLEarthQuad::generateData(const Vector& upperLeft, const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY)
 {
-    // create mesh data generator
-    std::unique_ptr<ModelMeshRenderDataGenerator> data = std::make_unique<ModelMeshRenderDataGenerator>();
-    data->setIndexTopology(GL_PATCHES);
+    auto start = std::chrono::steady_clock::now();
+
+    // Split the grid into chunks whose vertices 16 bit indices can address, which halves the index
+    // buffers. The patch list culls and indexes the grid as a whole, so it keeps a single chunk.
+    bool shortIndices = this->shortIndices && !this->gpuPatchList;
+    size_t maxVerts = shortIndices ? MAX_SHORT_INDEXED_VERTS : std::numeric_limits<size_t>::max();
+    std::vector<EarthGridChunk> chunks = EarthGridChunk::split(numTilesX, numTilesY, maxVerts);
+
+    std::vector<std::unique_ptr<ModelMeshRenderDataGenerator>> generators;
+    size_t totalVerts = 0;
+    size_t totalBytes = 0;
+    GLfloat* positions = nullptr;
+    for (const EarthGridChunk& chunk : chunks) {
+        // create mesh data generator
+        std::unique_ptr<ModelMeshRenderDataGenerator> data = std::make_unique<ModelMeshRenderDataGenerator>();
+        positions = writeChunkMesh(*data, chunk, upperLeft, lowerRight, numTilesX, numTilesY, shortIndices, true);
+
+        totalVerts += chunk.getNumVerts();
+        totalBytes += chunk.getNumVerts() * data->stride + chunk.getNumIndices() * (shortIndices ? sizeof(GLushort) : sizeof(GLuint));
+        generators.push_back(std::move(data));
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Generated " << totalVerts << " patch vertices and " << static_cast<size_t>(numTilesX) * numTilesY * 4 << " "
+              << (shortIndices ? 16 : 32) << " bit indices in " << chunks.size() << " chunk(s) (" << totalBytes / (1024.0 * 1024.0)
+              << " MB) in " << ms << " ms" << std::endl;
+
+    if (this->gpuPatchList)
+        createPatchList(positions, totalVerts, generators.at(0)->stride, numTilesX * numTilesY);
+
+    createTileErrorsTexture(upperLeft, lowerRight, numTilesX, numTilesY);
+
+    // the horizon culling occluder has to sit below the deepest point of the dataset
+    const ElevationBoundsPyramid& bounds = this->elevBounds;
+    float minElevation = static_cast<float>(bounds.getLevel(bounds.getNumLevels() - 1)[0]);
+
+    // create the skin, its program draws both triangles and lines (see render)
+    ModelMeshSkin skin;
+    skin.setGLPrimType(GL_PATCHES);
+    skin.setMeshShadingType(MESH_SHADING_TYPE::mstNONE);
+    bool quadtreePatches = patchMode == EARTH_PATCH_MODE::epmQUADTREE;
+    skin.setShader(GLSLEarthShader::New(scale, tessellationFactor, maxTessellationFactor, quadtreePatches, gpuPatchList, bindlessTextures,
+        virtualImagery != nullptr, uniformBuffer));
+    skin.setPatchVertices(4);
+    if (!bindlessTextures) {
+        // bound to the texture units of the samplers in earth_uniforms.glsl
+        skin.getMultiTextureSet().at(0) = new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(elevTex->getTextureData()));
+        if (virtualImagery != nullptr)
+            skin.getMultiTextureSet().push_back(new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(imageryTex->getTextureData())));
+        else
+            skin.getMultiTextureSet().push_back(imageryTex);
+        skin.getMultiTextureSet().push_back(new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(elevBoundsTex->getTextureData())));
+        skin.getMultiTextureSet().push_back(new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(tileErrorsTex->getTextureData())));
+        if (virtualImagery != nullptr) {
+            Texture* indirection = virtualImagery->getIndirectionTexture();
+            skin.getMultiTextureSet().push_back(new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(indirection->getTextureData())));
+        }
+    }
+    skin.getShaderT<GLSLEarthShader>()->setCullingEnabled(cullingEnabled);
+    skin.getShaderT<GLSLEarthShader>()->setPatchStatsEnabled(patchStatsEnabled);
+    skin.getShaderT<GLSLEarthShader>()->setMinElevation(minElevation);
+    skin.getShaderT<GLSLEarthShader>()->setLODMode(lodMode);
+    skin.getShaderT<GLSLEarthShader>()->setTargetPixelError(targetPixelError);
+    skin.getShaderT<GLSLEarthShader>()->setTileGrid(upperLeft, lowerRight);
+
+    // create mesh data with the skin and our data generator, one mesh per chunk
+    std::vector<std::unique_ptr<ModelMesh>> meshes;
+    std::vector<ModelMesh*> meshPtrs;
+    for (std::unique_ptr<ModelMeshRenderDataGenerator>& data : generators) {
+        ModelMeshDataShared* dataShared = new ModelMeshDataShared(std::move(data));
+        meshes.push_back(std::make_unique<ModelMesh>(skin, dataShared));
+        meshes.back()->setParentModel(this);
+        meshPtrs.push_back(meshes.back().get());
+    }
+    this->modelData = new ModelDataShared(meshPtrs);
+
+    // Note that the meshes are deallocated when this function returns, but that's okay because
+    // the constructor of ModelDataShared actually makes a copy of them. Each copy of the skin has a
+    // copy of the shader, and every copy shares uniformBuffer.
+
+    // keep the grid so the elevation bounds of each tile can be looked up
+    this->upperLeft = upperLeft;
+    this->lowerRight = lowerRight;
+    this->numTilesX = numTilesX;
+    this->numTilesY = numTilesY;
+    this->uniformBuffer->set(&EarthUniforms::numTilesX, static_cast<GLint>(numTilesX));
+    this->uniformBuffer->set(&EarthUniforms::numTilesY, static_cast<GLint>(numTilesY));
+    computeTileElevationBounds();
+}
+
+GLfloat* MGLEarthQuad::writeChunkMesh(ModelMeshRenderDataGenerator& data, const EarthGridChunk& chunk, const Vector& upperLeft,
+    const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY, bool shortIndices, bool useArenas)
+{
+    data.setIndexTopology(GL_PATCHES);
+
+    // with arenas the vertices and indices are written straight into the buffers the render data takes
+    // over, rather than into getVerts() and getIndicies() for generate to interleave into copies
+    size_t numVerts = chunk.getNumVerts();
+    size_t numIndices = chunk.getNumIndices();
+    GLfloat* positions = nullptr;
+    size_t floatsPerVertex = 0;
+    if (useArenas) {
+        GLubyte* vertexArena = data.allocateVertexArena(MESH_SHADING_TYPE::mstNONE, numVerts);
+        positions = reinterpret_cast<GLfloat*>(vertexArena + data.vertsOffset);
+        floatsPerVertex = data.stride / sizeof(GLfloat);
+    }
 
     // generate patch vertices
-    for (unsigned int x = 0; x <= numTilesX; ++x) {
-        // calculate the lattitude at this subdivison level
-        float lat = upperLeft.x + (lowerRight.x - upperLeft.x) * static_cast<float>(x) / numTilesX;
+    for (unsigned int x = 0; x <= chunk.numTilesX; ++x) {
+        // calculate the latitude at this subdivison level
+        float lat = upperLeft.x + (lowerRight.x - upperLeft.x) * static_cast<float>(chunk.x + x) / numTilesX;
         float latRad = lat * Aftr::DEGtoRAD;
 
-        for (unsigned int y = 0; y <= numTilesY; ++y) {
+        for (unsigned int y = 0; y <= chunk.numTilesY; ++y) {
             // calculate the longitude at this subdivision level
-            float lon = upperLeft.y + (lowerRight.y - upperLeft.y) * static_cast<float>(y) / numTilesY;
+            float lon = upperLeft.y + (lowerRight.y - upperLeft.y) * static_cast<float>(chunk.y + y) / numTilesY;
             float lonRad = lon * Aftr::DEGtoRAD;
 
             // combine lat and lon into WGS84 coordinate
-            data->getVerts()->push_back(Vector(latRad, lonRad, 0.0f));
+            if (useArenas) {
+                GLfloat* v = positions + (y + static_cast<size_t>(x) * (chunk.numTilesY + 1)) * floatsPerVertex;
+                v[0] = latRad;
+                v[1] = lonRad;
+                v[2] = 0.0f;
+            } else
+                data.getVerts()->push_back(Vector(latRad, lonRad, 0.0f));
         }
     }
 
-    unsigned int width = numTilesY + 1;
-
     // generate indices
-    for (unsigned int x = 0; x < numTilesX; ++x) {
-        for (unsigned int y = 0; y < numTilesY; ++y) {
-            // convert 2d array indices to 1d array indices
-            unsigned int ul = y + x * width;
-            unsigned int ll = y + (x + 1) * width;
-            unsigned int lr = (y + 1) + (x + 1) * width;
-            unsigned int ur = (y + 1) + x * width;
-
-            data->getIndicies()->push_back(ul);
-            data->getIndicies()->push_back(ll);
-            data->getIndicies()->push_back(lr);
-            data->getIndicies()->push_back(ur);
+    if (!useArenas) {
+        std::vector<unsigned int>& indices = *data.getIndicies();
+        indices.resize(numIndices);
+        chunk.writePatchIndices(indices.data());
+    } else if (shortIndices)
+        chunk.writePatchIndices(data.allocateShortIndexArena(numIndices));
+    else
+        chunk.writePatchIndices(data.allocateIndexArena(numIndices));
+    return positions;
+}
+
+void MGLEarthQuad::createQuadtree(const Vector& upperLeft, const Vector& lowerRight)
+{
+    unsigned int maxDepth = static_cast<unsigned int>(std::max(EarthConfig::getInt("quadtreemaxdepth", DEFAULT_QUADTREE_MAX_DEPTH), 0));
+
+    // nodes are bounded by the same sampling footprint as the fixed grid's tiles
+    this->quadtree = std::make_unique<EarthQuadtree>(upperLeft, lowerRight, QUADTREE_ROOTS_X, QUADTREE_ROOTS_Y, maxDepth,
+        [this](const Vector& ul, const Vector& lr, float& minElev, float& maxElev) {
+            GLshort lo = 0;
+            GLshort hi = 0;
+            getElevationBoundsWGS84(ul, lr, true, lo, hi);
+            minElev = lo;
+            maxElev = hi;
+        });
+    this->quadtree->setMaxPixelError(EarthConfig::getFloat("quadtreemaxpixelerror", DEFAULT_QUADTREE_MAX_PIXEL_ERROR));
+
+    // (lat, lon, edge type) at location 0 like the grid's vertices, the coarse edge at COARSE_EDGE_LOCATION
+    GLsizei stride = EarthQuadtree::FLOATS_PER_VERTEX * sizeof(float);
+    glGenVertexArrays(1, &this->patchVAO);
+    glGenBuffers(1, &this->patchVBO);
+    glBindVertexArray(this->patchVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, this->patchVBO);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+    glEnableVertexAttribArray(COARSE_EDGE_LOCATION);
+    glVertexAttribPointer(COARSE_EDGE_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const void*>(3 * sizeof(float)));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MGLEarthQuad::createPatchList(const GLfloat* positions, size_t numVerts, GLsizei stride, unsigned int numTiles)
+{
+    this->cullShader = GLSLShader::New(GLSLEarthShader::getCullDescriptor(this->bindlessTextures));
+    if (this->cullShader == nullptr) {
+        std::cout << "Warning: unable to load earth_cull.comp, drawing the whole grid instead of a GPU patch list" << std::endl;
+        this->gpuPatchList = false;
+        return;
+    }
+
+    // earth_cull.comp reads its parameters from uniformBuffer, there are no uniforms to add
+
+    GLuint buffers[5];
+    glGenBuffers(5, buffers);
+    this->gridVBO = buffers[0];
+    this->tileBoundsBuffer = buffers[1];
+    this->patchIndexBuffer = buffers[2];
+    this->patchLevelsBuffer = buffers[3];
+    this->drawCommandBuffer = buffers[4];
+
+    glGenVertexArrays(1, &this->gridVAO);
+    glBindVertexArray(this->gridVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, this->gridVBO);
+    // the grid vertices, read as a vertex buffer by the draw and as a storage buffer by the dispatch
+    glBufferData(GL_ARRAY_BUFFER, numVerts * stride, positions, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+
+    // room for every tile, only the first count indices are drawn
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->patchIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<size_t>(numTiles) * 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->patchLevelsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<size_t>(numTiles) * FLOATS_PER_PATCH_LEVELS * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLuint command[5] = { 0, 1, 0, 0, 0 };
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->drawCommandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), command, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // tileBoundsBuffer is filled by computeTileElevationBounds
+}
+
+void MGLEarthQuad::uploadTileElevationBounds()
+{
+    if (this->tileBoundsBuffer == 0)
+        return;
+
+    std::vector<float> bounds(this->tileBounds.begin(), this->tileBounds.end());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->tileBoundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(float), bounds.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MGLEarthQuad::createTileErrorsTexture(const Vector& upperLeft, const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY)
+{
+    // 8 floats per tile, the last one unused
+    std::vector<float> errors(static_cast<size_t>(numTilesX) * numTilesY * 8, 0.0f);
+    if (!this->elevBounds.isEmpty()) {
+        float cellSize = static_cast<float>(this->elevBounds.getCellSize());
+        float texelsPerDegX = this->elevBounds.getHeight() / 180.0f;
+        float texelsPerDegY = this->elevBounds.getWidth() / 360.0f;
+        float tileLat = (lowerRight.x - upperLeft.x) / numTilesX;
+        float tileLon = (lowerRight.y - upperLeft.y) / numTilesY;
+
+        for (unsigned int x = 0; x < numTilesX; ++x) {
+            for (unsigned int y = 0; y < numTilesY; ++y) {
+                float* tileErrors = &errors[(y + static_cast<size_t>(x) * numTilesY) * 8];
+                float lat0 = upperLeft.x + tileLat * x;
+                float lon0 = upperLeft.y + tileLon * y;
+
+                for (unsigned int k = 0; k < NUM_TILE_ERRORS; ++k) {
+                    unsigned int n = 1u << k;
+                    float cellLat = tileLat / n;
+                    float cellLon = tileLon / n;
+
+                    // cells smaller than a pyramid cell can't get any tighter bounds than their parents
+                    bool tooSmall = std::fabs(cellLat) * texelsPerDegX < cellSize || std::fabs(cellLon) * texelsPerDegY < cellSize;
+                    if (k > 0 && tooSmall) {
+                        tileErrors[k] = tileErrors[k - 1];
+                        continue;
+                    }
+
+                    float error = 0.0f;
+                    for (unsigned int i = 0; i < n; ++i) {
+                        for (unsigned int j = 0; j < n; ++j) {
+                            GLshort lo = 0;
+                            GLshort hi = 0;
+                            getElevationBoundsWGS84(Vector(lat0 + cellLat * i, lon0 + cellLon * j, 0.0f),
+                                Vector(lat0 + cellLat * (i + 1), lon0 + cellLon * (j + 1), 0.0f), false, lo, hi);
+                            error = std::max(error, static_cast<float>(hi - lo));
+                        }
+                    }
+
+                    // more segments never make the error larger
+                    tileErrors[k] = k > 0 ? std::min(error, tileErrors[k - 1]) : error;
+                }
+            }
         }
     }
 
-    // create triangle skin
-    ModelMeshSkin skin1;
-    skin1.setGLPrimType(GL_PATCHES);
-    skin1.setMeshShadingType(MESH_SHADING_TYPE::mstNONE);
-    skin1.setShader(GLSLEarthShader::New(false, scale, tessellationFactor, maxTessellationFactor));
-    skin1.setPatchVertices(4);
-    skin1.getMultiTextureSet().at(0) = new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(elevTex->getTextureData()));
-    skin1.getMultiTextureSet().push_back(imageryTex);
+    GLuint texID;
+    glGenTextures(1, &texID);
+    glBindTexture(GL_TEXTURE_2D, texID);
+
+    // tiles are looked up by their centers, and the columns wrap around like the longitudes when the
+    // grid spans the whole Earth
+    bool wrap = std::fabs(lowerRight.y - upperLeft.y) >= 360.0f;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, numTilesY * 2, numTilesX);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numTilesY * 2, numTilesX, GL_RGBA, GL_FLOAT, errors.data());
+
+    // generate CPU side texture data
+    TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
+    tex->isMipmapped(false);
+    tex->setTextureDimensionality(GL_TEXTURE_2D);
+    tex->setGLInternalFormat(GL_RGBA32F);
+    tex->setGLRawTexelFormat(GL_RGBA);
+    tex->setGLRawTexelType(GL_FLOAT);
+    tex->setTextureDimensions(numTilesY * 2, numTilesX);
+    tex->setGLTex(texID);
+
+    tileErrorsTex = new TextureOwnsTexDataOwnsGLHandle(tex);
+}
+
+void MGLEarthQuad::computeTileElevationBounds()
+{
+    this->tileBounds.assign(static_cast<size_t>(this->numTilesX) * this->numTilesY * 2, 0);
+    if (this->elevBounds.isEmpty()) {
+        uploadTileElevationBounds();
+        return;
+    }
+
+    for (unsigned int x = 0; x < this->numTilesX; ++x) {
+        float lat0 = upperLeft.x + (lowerRight.x - upperLeft.x) * static_cast<float>(x) / numTilesX;
+        float lat1 = upperLeft.x + (lowerRight.x - upperLeft.x) * static_cast<float>(x + 1) / numTilesX;
 
-    // create line skin
-    ModelMeshSkin skin2;
-    skin2.setGLPrimType(GL_PATCHES);
-    skin2.setMeshShadingType(MESH_SHADING_TYPE::mstNONE);
-    skin2.setShader(GLSLEarthShader::New(true, scale, tessellationFactor, maxTessellationFactor));
-    skin2.setPatchVertices(4);
-    skin2.getMultiTextureSet().at(0) = new TextureSharesTexDataOwnsGLHandle(static_cast<TextureDataOwnsGLHandle*>(elevTex->getTextureData()));
-    skin2.getMultiTextureSet().push_back(imageryTex->cloneMe());
+        for (unsigned int y = 0; y < this->numTilesY; ++y) {
+            float lon0 = upperLeft.y + (lowerRight.y - upperLeft.y) * static_cast<float>(y) / numTilesY;
+            float lon1 = upperLeft.y + (lowerRight.y - upperLeft.y) * static_cast<float>(y + 1) / numTilesY;
 
-    // create mesh data with skin1 and our data generator
-    ModelMeshDataShared* dataShared = new ModelMeshDataShared(std::move(data));
-    ModelMesh mesh(skin1, dataShared);
-    mesh.setParentModel(this);
-    this->modelData = new ModelDataShared(std::vector<ModelMesh*>(1, &mesh));
+            size_t tile = y + static_cast<size_t>(x) * this->numTilesY;
+            getElevationBoundsWGS84(Vector(lat0, lon0, 0.0f), Vector(lat1, lon1, 0.0f), true, this->tileBounds[tile * 2], this->tileBounds[tile * 2 + 1]);
+        }
+    }
 
-    // add skin2 to the mesh data
-    this->getModelDataShared()->getModelMeshes().at(0)->addSkin(skin2);
+    uploadTileElevationBounds();
+}
+
+bool MGLEarthQuad::getElevationBoundsWGS84(const Vector& ul, const Vector& lr, bool margin, GLshort& minElev, GLshort& maxElev) const
+{
+    if (this->elevBounds.isEmpty())
+        return false;
+
+    // convert to texel space the same way WGS84ToUV does in the shaders
+    float width = static_cast<float>(this->elevBounds.getWidth());
+    float height = static_cast<float>(this->elevBounds.getHeight());
+    float x0 = (std::min(ul.y, lr.y) + 180.0f) / 360.0f * width;
+    float x1 = (std::max(ul.y, lr.y) + 180.0f) / 360.0f * width;
+    float y0 = (90.0f - std::max(ul.x, lr.x)) / 180.0f * height;
+    float y1 = (90.0f - std::min(ul.x, lr.x)) / 180.0f * height;
+
+    int pad = 0;
+    if (margin) {
+        // earth.tese bilinearly samples up to mipmap level ceil(6 - log2(maxTessellationFactor)), so a
+        // vertex can pick up texels one texel of that level (2^level base texels) outside the tile
+        float level = std::min(std::max(6.0f - std::log2(this->maxTessellationFactor), 0.0f), 6.0f);
+        pad = 2 << static_cast<int>(std::ceil(level));
+    }
 
-    // Note that mesh is deallocated when this function returns, but that's okay because
-    // the constructor of ModelDataShared actually makes a copy of it.
+    return this->elevBounds.getBounds(static_cast<int>(std::floor(x0)) - pad, static_cast<int>(std::floor(y0)) - pad,
+        static_cast<int>(std::ceil(x1)) + pad + 1, static_cast<int>(std::ceil(y1)) + pad + 1, minElev, maxElev);
 }
 
-void MGLEarthQuad::loadImageryTexture(const std::string& imagery)
+void MGLEarthQuad::loadImageryTexture(const std::string& imagery, bool virtualTexture)
 {
+    // stream the imagery through a fixed size page cache, shared with any other quad drawing the same image
+    if (virtualTexture) {
+        int slots = EarthConfig::getInt("imagerycacheslots", DEFAULT_IMAGERY_CACHE_SLOTS);
+        int pagesPerFrame = EarthConfig::getInt("imagerypagesperframe", DEFAULT_IMAGERY_PAGES_PER_FRAME);
+        this->virtualImagery = ImageryVirtualTexture::acquire(imagery, static_cast<unsigned int>(std::max(slots, 2)),
+            static_cast<unsigned int>(std::max(pagesPerFrame, 1)));
+
+        if (this->virtualImagery != nullptr) {
+            this->imageryTex = this->virtualImagery->getCacheTexture();
+
+            const ImageryPageFile& file = this->virtualImagery->getPageFile();
+            this->uniformBuffer->set(&EarthUniforms::imageryWidth, static_cast<GLint>(file.getWidth()));
+            this->uniformBuffer->set(&EarthUniforms::imageryHeight, static_cast<GLint>(file.getHeight()));
+            this->uniformBuffer->set(&EarthUniforms::imageryNumLevels, static_cast<GLint>(file.getNumLevels()));
+            this->uniformBuffer->set(&EarthUniforms::imageryLodBias, EarthConfig::getFloat("imagerylodbias", 0.0f));
+            return;
+        }
+
+        std::cout << "Unable to build the imagery pages of " << imagery << ", loading it as a single texture instead" << std::endl;
+    }
+
     imageryTex = ManagerTexture::loadTexture(imagery);
 }
 
 void MGLEarthQuad::loadElevationTexture(const std::string& dataset)
 {
+    // use the pyramid preprocessed by an earlier launch if the dataset hasn't changed since
+    bool useCache = EarthConfig::getBool("elevationpyramidcache", true);
+    if (useCache) {
+        std::unique_ptr<ElevationPyramidCache> cache = ElevationPyramidCache::open(dataset);
+        if (cache != nullptr) {
+            this->loadElevationTextureFromCache(*cache);
+            this->elevBounds = ElevationBoundsPyramid(cache->getWidth(), cache->getHeight());
+            this->elevBounds.setData(cache->getBoundsData());
+            return;
+        }
+    }
+
     GDALAllRegister(); // initialize GDAL
 
     // load dataset
@@ -215,20 +939,78 @@ void MGLEarthQuad::loadElevationTexture(const std::string& dataset)
     int nXSize = poBand->GetXSize();
     int nYSize = poBand->GetYSize();
 
-    // read all of band's data into pafScanline
-    GLshort* pafScanline = static_cast<GLshort*>(CPLMalloc(sizeof(GLshort) * nXSize * nYSize));
-    poBand->RasterIO(GF_Read, 0, 0, nXSize, nYSize, pafScanline, nXSize, nYSize, GDT_Int16, 0, 0);
+    // Stream the band in block-aligned strips instead of reading it all at once, so the peak
+    // memory is bounded by the strip budget rather than by the size of the dataset.
+    size_t stripBudget = static_cast<size_t>(EarthConfig::getInt("elevationstripbudgetmb", DEFAULT_STRIP_BUDGET_MB)) << 20;
+    ElevationStreamReader reader(poBand, stripBudget);
+
+    // write the pyramid out as it is built so the next launch can skip GDAL entirely
+    std::unique_ptr<ElevationPyramidCacheWriter> cacheWriter;
+    if (useCache)
+        cacheWriter = std::make_unique<ElevationPyramidCacheWriter>(dataset, nXSize, nYSize);
+
+    GLuint texID = createElevationTexture(nXSize, nYSize, reader.getNumLevels());
+    ElevationBoundsPyramid bounds(nXSize, nYSize);
+
+    // upload every level's rows as soon as the reader produces them
+    bool success = reader.read([&cacheWriter, &bounds](unsigned int level, unsigned int y, unsigned int width, unsigned int numRows, const GLshort* rows) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, width, numRows, GL_RED_INTEGER, GL_SHORT, rows);
+        if (level == 0)
+            bounds.addRows(y, numRows, rows);
+        if (cacheWriter != nullptr)
+            cacheWriter->writeRows(level, y, width, numRows, rows);
+    });
 
     // close the dataset since we're now done
     GDALClose(poDataset);
 
+    if (!success) {
+        std::cout << "Error: unable to read elevation dataset" << std::endl;
+        exit(-1);
+    }
+
+    const ElevationStreamStats& stats = reader.getStats();
+    std::cout << "Streamed elevation " << nXSize << "x" << nYSize << " (" << reader.getNumLevels() << " levels): "
+              << (stats.bytesRead >> 20) << " MB read in " << stats.numStrips << " strips of " << stats.stripRows << " rows, "
+              << "peak working set " << (stats.peakWorkingSet >> 10) << " KB, "
+              << stats.wallTimeMs << " ms" << std::endl;
+
+    bounds.finish();
+    this->elevBounds = std::move(bounds);
+
+    if (cacheWriter != nullptr)
+        cacheWriter->writeBounds(this->elevBounds);
+    if (cacheWriter != nullptr && !cacheWriter->commit())
+        std::cout << "Warning: unable to write elevation pyramid cache " << ElevationPyramidCache::getCachePath(dataset) << std::endl;
+
+    setElevationTexture(texID, nXSize, nYSize);
+}
+
+void MGLEarthQuad::loadElevationTextureFromCache(const ElevationPyramidCache& cache)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    GLuint texID = createElevationTexture(cache.getWidth(), cache.getHeight(), cache.getNumLevels());
+
+    // upload each level straight out of the mapping
+    for (unsigned int level = 0; level < cache.getNumLevels(); ++level) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, cache.getLevelWidth(level), cache.getLevelHeight(level),
+            GL_RED_INTEGER, GL_SHORT, cache.getLevel(level));
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded cached elevation " << cache.getWidth() << "x" << cache.getHeight() << " (" << cache.getNumLevels() << " levels, "
+              << (cache.getMappedSize() >> 20) << " MB mapped) in " << ms << " ms" << std::endl;
+
+    setElevationTexture(texID, cache.getWidth(), cache.getHeight());
+}
+
+GLuint MGLEarthQuad::createElevationTexture(unsigned int width, unsigned int height, unsigned int numLevels)
+{
     // Now manually create OpenGL texture using 4.2 features and generate mipmaps manually
     // (Because apparently OpenGL doesn't support mipmaps for integer textures, at least not on my
     //  hardware.)
 
-    // calculate number of mipmap levels to generate (including base level)
-    unsigned int numLevels = 1 + static_cast<unsigned int>(std::log2(std::max(nXSize, nYSize)));
-
     // generate texture
     GLuint texID;
     glGenTextures(1, &texID);
@@ -239,55 +1021,22 @@ void MGLEarthQuad::loadElevationTexture(const std::string& dataset)
     // set texture parameters
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    // integer textures can't be filtered (the shaders interpolate themselves), and with linear filters
+    // the texture is incomplete, which glGetTextureHandleARB rejects
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 
     // use tightly packed data
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
     // allocate space for all texture levels (OpenGL 4.2+ only)
-    glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_R16I, nXSize, nYSize);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, nXSize, nYSize, GL_RED_INTEGER, GL_SHORT, pafScanline); // upload base level
-
-    // generate mipmap levels
-    unsigned int dWidth = nXSize;
-    unsigned int dHeight = nYSize;
-    unsigned int level = 0;
-    GLshort* source = pafScanline;
-    while (dWidth > 1 || dHeight > 1) {
-        unsigned int sWidth = dWidth; // keep source width
-
-        dWidth = std::max(dWidth / 2, 1u);
-        dHeight = std::max(dHeight / 2, 1u);
-
-        // allocate space for dest data
-        GLshort* dest = static_cast<GLshort*>(CPLMalloc(sizeof(GLshort) * dWidth * dHeight));
-
-        // downscale the source data and put into dest
-        for (unsigned int j = 0; j < dHeight; ++j) {
-            for (unsigned int i = 0; i < dWidth; ++i) {
-                // take the average of the 4 pixels in the source image that make up this one pixel in
-                // the dest image. (Do summation as integer to avoid short overflow).
-                int sum = source[j * 2 * sWidth + i * 2];
-                sum += source[(j * 2 + 1) * sWidth + i * 2];
-                sum += source[j * 2 * sWidth + i * 2 + 1];
-                sum += source[(j * 2 + 1) * sWidth + i * 2 + 1];
-
-                dest[j * dWidth + i] = static_cast<GLshort>(sum / 4);
-            }
-        }
-
-        level++; // increment mipmap level
-
-        // send to OpenGL
-        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, dWidth, dHeight, GL_RED_INTEGER, GL_SHORT, dest);
-
-        CPLFree(source); // we no longer need the source data, free it
-        source = dest; // calculate next level from this dest
-    }
+    glTexStorage2D(GL_TEXTURE_2D, numLevels, GL_R16I, width, height);
 
-    CPLFree(source); // free the final level
+    return texID;
+}
 
+void MGLEarthQuad::setElevationTexture(GLuint texID, unsigned int width, unsigned int height)
+{
     // generate CPU side texture data
     TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
     tex->isMipmapped(true);
@@ -295,10 +1044,48 @@ void MGLEarthQuad::loadElevationTexture(const std::string& dataset)
     tex->setGLInternalFormat(GL_R16I);
     tex->setGLRawTexelFormat(GL_RED_INTEGER);
     tex->setGLRawTexelType(GL_SHORT);
-    tex->setTextureDimensions(nXSize, nYSize);
+    tex->setTextureDimensions(width, height);
     tex->setGLTex(texID);
 
     elevTex = new TextureOwnsTexDataOwnsGLHandle(tex);
 }
 
+void MGLEarthQuad::createElevationBoundsTexture()
+{
+    if (this->elevBounds.isEmpty())
+        return;
+
+    GLuint texID;
+    glGenTextures(1, &texID);
+    glBindTexture(GL_TEXTURE_2D, texID);
+
+    // min/max pairs must never be blended together
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    unsigned int width = this->elevBounds.getLevelWidth(0);
+    unsigned int height = this->elevBounds.getLevelHeight(0);
+    glTexStorage2D(GL_TEXTURE_2D, this->elevBounds.getNumLevels(), GL_RG16I, width, height);
+    for (unsigned int level = 0; level < this->elevBounds.getNumLevels(); ++level) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, this->elevBounds.getLevelWidth(level), this->elevBounds.getLevelHeight(level),
+            GL_RG_INTEGER, GL_SHORT, this->elevBounds.getLevel(level));
+    }
+
+    // generate CPU side texture data
+    TextureDataOwnsGLHandle* tex = new TextureDataOwnsGLHandle("DynamicTexture");
+    tex->isMipmapped(true);
+    tex->setTextureDimensionality(GL_TEXTURE_2D);
+    tex->setGLInternalFormat(GL_RG16I);
+    tex->setGLRawTexelFormat(GL_RG_INTEGER);
+    tex->setGLRawTexelType(GL_SHORT);
+    tex->setTextureDimensions(width, height);
+    tex->setGLTex(texID);
+
+    elevBoundsTex = new TextureOwnsTexDataOwnsGLHandle(tex);
+}
+
 #endif // AFTR_CONFIG_USE_GDAL
\ No newline at end of file
@@ -1,11 +1,51 @@
 #pragma once
 
+#include "EarthQuadtree.h"
+#include "EarthRenderProfiler.h"
+#include "ElevationBoundsPyramid.h"
+#include "GLSLEarthShader.h"
 #include "MGL.h"
 #include "Vector.h"
 
+#include <memory>
+#include <vector>
+
 namespace Aftr {
+class ElevationPyramidCache;
+struct EarthGridChunk;
+class GLSLShader;
+class ModelMeshRenderDataGenerator;
+class ImageryVirtualTexture;
+
 /**
    This class provides a model capable of rendering tessellated Earth quads.
+
+   The patches fed to the tessellation shaders either form a fixed grid of nTilesX by nTilesY tiles
+   (epmFIXED_GRID), or are the visible leaves of an EarthQuadtree that is refined for the camera
+   every frame (epmQUADTREE), which concentrates the patches where they cover the most pixels.
+
+   With the GPU patch list enabled (earthGPUPatchList), the fixed grid is not drawn as a whole.
+   Instead earth_cull.comp culls every tile and compacts the survivors and their tess levels into
+   buffers that are drawn with glDrawElementsIndirect, so earth.tesc never sees a culled patch and
+   the CPU never learns how many patches were drawn.
+
+   The tessellation levels of the fixed grid's patches come either from their projected edge
+   lengths (elmEDGE_LENGTH), or from the geometric error of each tile, which is the fewest segments
+   whose error projects to at most a target number of pixels (elmSCREEN_SPACE_ERROR). The errors
+   are bounded once from the min/max pyramid: with 2^k segments per edge, a tile's error is the
+   largest elevation range of the 2^k by 2^k cells those segments span, which is as far as the
+   elevation can deviate from the bilinear surface through the cell corners.
+
+   Where GL_ARB_bindless_texture is available (and earthBindlessTextures is on), the textures are
+   made resident once and the shaders read their handles from the uniform buffer, so the skin binds
+   no texture when drawing. Otherwise the skin binds them to the texture units of the samplers.
+
+   The imagery is streamed by an ImageryVirtualTexture (imageryVirtualTexture) from a page pyramid
+   built next to the image on the first launch, so its GPU memory is a fixed page cache however
+   large the image is. Without it, or if the pages can't be built, the image is one texture.
+
+   One program draws both render modes. The wireframe (useLines) rasterizes the tessellated
+   triangles as lines with glPolygonMode instead of running a geometry shader.
 */
 class MGLEarthQuad : public MGL {
 public:
@@ -23,9 +63,12 @@ public:
         maxTess - The tessellation factor max value for the LOD.
         elev - The path to the elevation dataset file used for displacement of the Earth's surface.
         imagery - The path to the imagery file of the Earth's surface used for texturing.
+        mode - How the patches are laid out. With epmQUADTREE, nTilesX and nTilesY are ignored and
+               the quadtree starts from 90 degree root tiles.
     */
     MGLEarthQuad(WO* parentWO, const Vector& ul, const Vector& lr, unsigned int nTilesX, unsigned int nTilesY,
-        float s, float tess, float maxTess, const std::string& elev, const std::string& imagery);
+        float s, float tess, float maxTess, const std::string& elev, const std::string& imagery,
+        EARTH_PATCH_MODE mode = EARTH_PATCH_MODE::epmFIXED_GRID);
     virtual ~MGLEarthQuad();
     virtual void render(const Camera& cam);
     virtual void renderSelection(const Camera& cam, GLubyte red, GLubyte green, GLubyte blue);
@@ -54,22 +97,208 @@ public:
     // Sets the maximum tessellation factor.
     void setMaxTessellationFactor(float t);
 
+    // Returns whether patches outside the view frustum or below the horizon are being culled.
+    bool isCullingEnabled() const { return this->cullingEnabled; }
+
+    // Sets whether to cull patches outside the view frustum or below the horizon in earth.tesc.
+    void setCullingEnabled(bool b);
+
+    // Returns whether the shaders count the drawn and culled patches.
+    bool isPatchStatsEnabled() const { return this->patchStatsEnabled; }
+
+    // Sets whether the shaders count the drawn and culled patches. Off, no atomics run and the counts read zero.
+    void setPatchStatsEnabled(bool b);
+
+    // Returns how the tessellation levels are picked.
+    EARTH_LOD_MODE getLODMode() const { return this->lodMode; }
+
+    // Sets how the tessellation levels are picked. The quadtree always uses elmEDGE_LENGTH.
+    void setLODMode(EARTH_LOD_MODE mode);
+
+    // Returns the largest projected geometric error in pixels of elmSCREEN_SPACE_ERROR.
+    float getTargetPixelError() const { return this->targetPixelError; }
+
+    // Sets the largest projected geometric error in pixels of elmSCREEN_SPACE_ERROR.
+    void setTargetPixelError(float pixels);
+
+    // Returns the height in pixels of the viewport the quad is drawn into.
+    float getViewportHeight() const { return this->uniformBuffer->getUniforms().viewportHeight; }
+
+    // Sets the height in pixels of the viewport the LOD metrics project to. Call it whenever the window is resized.
+    void setViewportHeight(float pixels);
+
+    // Returns the number of patches tessellated in a recent frame (the counts lag a couple of frames behind
+    // and stay zero unless isPatchStatsEnabled).
+    unsigned int getNumDrawnPatches() const { return this->numDrawnPatches; }
+
+    // Returns the number of patches culled in a recent frame (the counts lag a couple of frames behind).
+    unsigned int getNumCulledPatches() const { return this->numCulledPatches; }
+
+    // Returns the GPU time in milliseconds of drawing this quad in a recent frame (lags like the patch counts).
+    double getGPUTimeMs() const { return this->profiler->getStats().getTotalMs(); }
+
+    // Returns the per-stage GPU times and pipeline statistics of drawing this quad.
+    const EarthRenderProfiler& getProfiler() const { return *this->profiler; }
+
+    // Returns how many times the shader parameters were written to their uniform buffer in the last frame.
+    unsigned int getNumUniformWritesLastFrame() const { return this->uniformBuffer->getNumWritesLastFrame(); }
+
+    // Returns how many times the shader parameters' uniform buffer was bound in the last frame.
+    unsigned int getNumUniformBindsLastFrame() const { return this->uniformBuffer->getNumBindsLastFrame(); }
+
+    // Returns how the patches are laid out.
+    EARTH_PATCH_MODE getPatchMode() const { return this->patchMode; }
+
+    // Returns whether the fixed grid is culled into a patch list by earth_cull.comp before drawing.
+    bool isUsingGPUPatchList() const { return this->gpuPatchList; }
+
+    // Returns whether the shaders read the textures through bindless handles instead of texture units.
+    bool isUsingBindlessTextures() const { return this->bindlessTextures; }
+
+    // Returns whether the grid is split into meshes small enough to be drawn with 16 bit indices.
+    bool isUsingShortIndices() const { return this->shortIndices && !this->gpuPatchList; }
+
+    // Returns the quadtree selecting the patches, or nullptr when using the fixed grid.
+    EarthQuadtree* getQuadtree() const { return this->quadtree.get(); }
+
+    /**
+        Gets conservative bounds of the elevation (in meters, before the shaders exaggerate and
+        scale it) of the region between the WGS84 coordinates ul and lr (lattitude and longitude in
+        degrees, in the same form as the constructor's ul and lr). Returns false if no elevation
+        data is loaded.
+    */
+    bool getElevationBounds(const Vector& ul, const Vector& lr, float& minElev, float& maxElev) const;
+
+    /**
+        Gets the elevation bounds of tile (x, y) of the grid built by generateData, where x indexes
+        lattitude and y longitude. The bounds include every texel the tessellation evaluation shader
+        may sample for the tile at the current maximum tessellation factor.
+    */
+    void getTileElevationBounds(unsigned int x, unsigned int y, float& minElev, float& maxElev) const;
+
+    // Returns the number of tiles on the x axis (lattitude).
+    unsigned int getNumTilesX() const { return this->numTilesX; }
+
+    // Returns the number of tiles on the y axis (longitude).
+    unsigned int getNumTilesY() const { return this->numTilesY; }
+
+    // Returns the min/max pyramid of the elevation dataset.
+    const ElevationBoundsPyramid& getElevationBoundsPyramid() const { return this->elevBounds; }
+
+    // Returns the virtual texture streaming the imagery, or nullptr when the imagery is a single texture.
+    ImageryVirtualTexture* getVirtualImagery() const { return this->virtualImagery.get(); }
+
+    /**
+        Writes the patch vertices and indices of chunk, a part of the numTilesX x numTilesY grid spanning
+        upperLeft to lowerRight, into data for a GL_PATCHES, mstNONE mesh. With useArenas they are written
+        straight into data's arenas (as generateData does), otherwise pushed into getVerts() and getIndicies()
+        for generate to copy. Returns the first vertex position in the vertex arena, nullptr without arenas.
+    */
+    static GLfloat* writeChunkMesh(ModelMeshRenderDataGenerator& data, const EarthGridChunk& chunk, const Vector& upperLeft,
+        const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY, bool shortIndices, bool useArenas);
+
 protected:
+    // number of frames of patch counters in flight, so reading them back never waits on the GPU
+    const static unsigned int NUM_PATCH_STATS_BUFFERS = 3;
+
     bool usingLines;
+    bool cullingEnabled;
+    bool patchStatsEnabled;
+    bool gpuPatchList;
+    bool bindlessTextures;
+    bool shortIndices;
+    EARTH_PATCH_MODE patchMode;
+    EARTH_LOD_MODE lodMode;
+    float targetPixelError;
     float scale;
     float tessellationFactor;
     float maxTessellationFactor;
 
     Texture* elevTex;
-    Texture* imageryTex;
+    Texture* elevBoundsTex; // RG16I min/max pyramid, sampled by earth.tesc for culling
+    Texture* imageryTex; // the page cache of virtualImagery if there is one
+    Texture* tileErrorsTex; // RGBA32F geometric errors of every tile, sampled by earth.tesc
+
+    Vector upperLeft;
+    Vector lowerRight;
+    unsigned int numTilesX;
+    unsigned int numTilesY;
+
+    ElevationBoundsPyramid elevBounds;
+    std::vector<GLshort> tileBounds; // (min, max) of every tile, indexed by y + x * numTilesY
+
+    GLuint patchStatsBuffers[NUM_PATCH_STATS_BUFFERS]; // ring of (drawn, culled) counters written by earth.tesc
+    unsigned int patchStatsFrame;
+    unsigned int numDrawnPatches;
+    unsigned int numCulledPatches;
+    std::unique_ptr<EarthRenderProfiler> profiler; // GPU time and pipeline statistics of the cull and draw stages
+
+    std::shared_ptr<ImageryVirtualTexture> virtualImagery; // shared with every quad drawing the same imagery
+
+    std::unique_ptr<EarthQuadtree> quadtree;
+    GLuint patchVAO; // vertex layout of the quadtree patch buffer
+    GLuint patchVBO; // visible quadtree leaves, refilled every frame
 
-    // Generates the tile vertex data for rendering.
+    std::shared_ptr<EarthUniformBuffer> uniformBuffer; // parameters of the skin's shader and earth_cull.comp
+    GLSLShader* cullShader; // earth_cull.comp
+    GLuint gridVAO; // grid vertices with patchIndexBuffer as the element array
+    GLuint gridVBO; // (lat, lon, 0) of every grid vertex, also read by earth_cull.comp
+    GLuint tileBoundsBuffer; // tileBounds as floats
+    GLuint patchIndexBuffer; // indices of the patches that survived culling
+    GLuint patchLevelsBuffer; // tess levels of the patches that survived culling, read by earth.tesc
+    GLuint drawCommandBuffer; // DrawElementsIndirectCommand counting the surviving indices
+
+    // Returns the shader of the skin, which draws both triangles and lines.
+    GLSLEarthShader* getEarthShader();
+
+    // Generates the tile vertex data for rendering, one mesh per EarthGridChunk.
     void generateData(const Vector& upperLeft, const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY);
 
-    // Loads and prepares the elevation texture.
+    // Creates the quadtree and its dynamic patch buffer.
+    void createQuadtree(const Vector& upperLeft, const Vector& lowerRight);
+
+    // Refines the quadtree for the camera and draws its visible leaves with the current skin.
+    void renderQuadtree(const Camera& cam);
+
+    // Creates the cull shader and the buffers of the GPU patch list for numTiles tiles with the numVerts grid vertices
+    // at positions, stride bytes apart.
+    void createPatchList(const GLfloat* positions, size_t numVerts, GLsizei stride, unsigned int numTiles);
+
+    // Uploads tileBounds for earth_cull.comp.
+    void uploadTileElevationBounds();
+
+    // Culls the grid into the patch list with earth_cull.comp and draws it with the current skin.
+    void renderPatchList(const Camera& cam);
+
+    // Loads and prepares the elevation texture, from the pyramid cache when it is up to date.
     void loadElevationTexture(const std::string& dataset);
 
-    // Loads and prepares the imagery texture.
-    void loadImageryTexture(const std::string& imagery);
+    // Uploads every level of a memory mapped pyramid cache into the elevation texture.
+    void loadElevationTextureFromCache(const ElevationPyramidCache& cache);
+
+    // Creates and binds the immutable R16I elevation texture with storage for numLevels levels.
+    GLuint createElevationTexture(unsigned int width, unsigned int height, unsigned int numLevels);
+
+    // Wraps the elevation texture in elevTex.
+    void setElevationTexture(GLuint texID, unsigned int width, unsigned int height);
+
+    // Uploads elevBounds as the mipmapped RG16I texture elevBoundsTex.
+    void createElevationBoundsTexture();
+
+    /**
+        Computes the geometric error of every tile of a grid for 1, 2, 4, ... 64 segments per edge
+        and uploads them as tileErrorsTex. Each tile takes 2 texels of a row per latitude, holding
+        the errors of 1 to 8 segments and of 16 to 64 segments.
+    */
+    void createTileErrorsTexture(const Vector& upperLeft, const Vector& lowerRight, unsigned int numTilesX, unsigned int numTilesY);
+
+    // Recomputes tileBounds for the current maximum tessellation factor.
+    void computeTileElevationBounds();
+
+    // Gets the bounds of a region in elevation texels, widened by the shaders' sampling footprint when margin is true.
+    bool getElevationBoundsWGS84(const Vector& ul, const Vector& lr, bool margin, GLshort& minElev, GLshort& maxElev) const;
+
+    // Loads and prepares the imagery texture, streamed through virtualImagery if virtualTexture is set and its pages can be built.
+    void loadImageryTexture(const std::string& imagery, bool virtualTexture);
 };
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 // STEAMiE's Entry Point.
 //**********************************************************************************
 
+#include "EarthBenchmarks.h"
+#include "EarthDepthBenchmark.h"
+#include "EarthFlightBenchmark.h"
 #include "GLViewEarthTessellationModule.h" // GLView subclass instantiated to drive this simulation
 #include <iostream>
 #include <memory>
@@ -17,10 +20,23 @@ std::vector<std::string> saveInputParams(int argc, char** argv);
    request causes the entire GLView to be destroyed (since its exits scope) and
    begin again (simStatus == -1). This loop exits when a request to exit the 
    application is received (simStatus == 0 ).
+   Passing --benchmark <name> runs one of the offline benchmarks instead, --benchmark flight
+   replays a scripted camera flight (see EarthFlightBenchmark) and --benchmark depth renders a
+   z-fighting test scene (see EarthDepthBenchmark).
 */
 int main(int argc, char* argv[])
 {
     std::vector<std::string> args = saveInputParams(argc, argv); ///< Command line arguments passed via argc and argv, reserved to size of argc
+
+    // the flight and depth benchmarks render in the module itself, optionally through SDL's offscreen driver when there's no display
+    bool inModule = Aftr::EarthFlightBenchmark::isRequested(args) || Aftr::EarthDepthBenchmark::isRequested(args);
+    if (inModule && Aftr::EarthFlightBenchmark::isHeadless(args))
+        SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+
+    std::string benchmark;
+    if (!inModule && Aftr::EarthBenchmarks::isBenchmarkRequested(args, benchmark))
+        return Aftr::EarthBenchmarks::run(benchmark);
+
     int simStatus = 0;
 
     do {
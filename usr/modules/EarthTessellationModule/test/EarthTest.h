@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+
+/**
+   The checks of the module's unit tests. EARTH_CHECK prints the failed condition with its file and line and
+   counts it, EARTH_TEST_RESULT is the exit code of a test's main: 0 iff every check passed, which is what
+   ctest looks at.
+*/
+namespace Aftr {
+namespace EarthTest {
+    inline unsigned int& numFailures()
+    {
+        static unsigned int failures = 0;
+        return failures;
+    }
+}
+}
+
+#define EARTH_CHECK(condition)                                                                                      \
+    do {                                                                                                            \
+        if (!(condition)) {                                                                                         \
+            ++Aftr::EarthTest::numFailures();                                                                       \
+            std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl;             \
+        }                                                                                                           \
+    } while (0)
+
+#define EARTH_TEST_RESULT() (Aftr::EarthTest::numFailures() == 0 ? 0 : 1)
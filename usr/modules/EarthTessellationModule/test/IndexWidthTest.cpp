@@ -0,0 +1,93 @@
+#include "EarthTest.h"
+
+#include "EarthGridChunks.h"
+#include "ModelMeshRenderDataGenerator.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Aftr;
+
+// Tests the index types ModelMeshRenderDataGenerator picks, and that the fixed patch grid split into
+// EarthGridChunks small enough for 16 bit indices draws every tile with the same grid vertices as the
+// whole grid indexed with 32 bits.
+
+namespace {
+// the grid split for every chunk size
+const static unsigned int INDEX_TEST_TILES = 300;
+
+// Exposes the generator's index pass.
+class IndexTestGenerator : public ModelMeshRenderDataGenerator {
+public:
+    using ModelMeshRenderDataGenerator::populateIndicesSmooth;
+};
+
+void testIndexTypes()
+{
+    // 16 bits is the narrowest type, and the all ones value of each type is the primitive restart index
+    EARTH_CHECK(ModelMeshRenderDataGenerator::getIndexType(0) == GL_UNSIGNED_SHORT);
+    EARTH_CHECK(ModelMeshRenderDataGenerator::getIndexType(0xFF) == GL_UNSIGNED_SHORT);
+    EARTH_CHECK(ModelMeshRenderDataGenerator::getIndexType(0xFFFE) == GL_UNSIGNED_SHORT);
+    EARTH_CHECK(ModelMeshRenderDataGenerator::getIndexType(0xFFFF) == GL_UNSIGNED_INT);
+    EARTH_CHECK(ModelMeshRenderDataGenerator::getIndexType(0x10000) == GL_UNSIGNED_INT);
+}
+
+// Splits the grid into chunks of at most maxVerts vertices, generates each chunk's indices and checks
+// their type and that each tile is drawn once, with the corners of the reference grid.
+void testChunkedGrid(size_t maxVerts, GLenum expectedType)
+{
+    const unsigned int numTiles = INDEX_TEST_TILES;
+    const size_t numTileIndices = static_cast<size_t>(numTiles) * numTiles * 4;
+
+    // the whole grid as one 32 bit mesh, the indices every chunking has to reproduce
+    EarthGridChunk grid = { 0, 0, numTiles, numTiles };
+    std::vector<unsigned int> reference(numTileIndices);
+    grid.writePatchIndices(reference.data());
+
+    std::vector<EarthGridChunk> chunks = EarthGridChunk::split(numTiles, numTiles, maxVerts);
+    std::vector<unsigned int> covered(numTileIndices / 4, 0);
+    for (const EarthGridChunk& chunk : chunks) {
+        EARTH_CHECK(chunk.getNumVerts() <= maxVerts);
+
+        IndexTestGenerator data;
+        data.getIndicies()->resize(chunk.getNumIndices());
+        chunk.writePatchIndices(data.getIndicies()->data());
+
+        GLenum type = GL_OUT_OF_MEMORY;
+        GLvoid* indices = nullptr;
+        data.populateIndicesSmooth(type, &indices);
+        EARTH_CHECK(type == expectedType);
+
+        // every tile's corners, mapped back to the grid's vertices, must be the reference corners
+        bool matches = true;
+        for (size_t i = 0; i < chunk.getNumIndices(); ++i) {
+            size_t local = type == GL_UNSIGNED_SHORT ? static_cast<GLushort*>(indices)[i] : static_cast<GLuint*>(indices)[i];
+            size_t x = chunk.x + local / (chunk.numTilesY + 1);
+            size_t y = chunk.y + local % (chunk.numTilesY + 1);
+            size_t tileX = chunk.x + i / 4 / chunk.numTilesY;
+            size_t tileY = chunk.y + i / 4 % chunk.numTilesY;
+            size_t tile = tileY + tileX * numTiles;
+            matches = matches && reference[tile * 4 + i % 4] == y + x * (numTiles + 1);
+            covered[tile] += i % 4 == 0 ? 1 : 0;
+        }
+        EARTH_CHECK(matches);
+
+        if (type == GL_UNSIGNED_SHORT)
+            delete[] static_cast<GLushort*>(indices);
+        else
+            delete[] static_cast<GLuint*>(indices);
+    }
+    EARTH_CHECK(std::all_of(covered.begin(), covered.end(), [](unsigned int n) { return n == 1; }));
+}
+}
+
+int main()
+{
+    testIndexTypes();
+
+    // chunks small enough for 8 bits still get 16 bit indices
+    testChunkedGrid(0xFF, GL_UNSIGNED_SHORT);
+    testChunkedGrid(0xFFFF, GL_UNSIGNED_SHORT);
+    testChunkedGrid(static_cast<size_t>(INDEX_TEST_TILES + 1) * (INDEX_TEST_TILES + 1), GL_UNSIGNED_INT);
+    return EARTH_TEST_RESULT();
+}
@@ -0,0 +1,132 @@
+#include "EarthTest.h"
+
+#include "GLSLShaderDataShared.h"
+#include "GLSLShaderDescriptor.h"
+#include "ManagerShader.h"
+
+#include <vector>
+
+using namespace Aftr;
+
+// Tests the descriptor hash and comparisons of GLSLShaderDataShared, and that ManagerShader keeps one
+// program per descriptor and follows a path setter to a shader's new key. Nothing is compiled, so no
+// OpenGL context is needed.
+
+namespace {
+// Returns the tessellated program every case starts from.
+GLSLShaderDescriptor baseDescriptor()
+{
+    GLSLShaderDescriptor desc;
+    desc.vertexShader = "test.vert";
+    desc.tessellationControlShader = "test.tesc";
+    desc.tessellationEvalShader = "test.tese";
+    desc.geometryShader = "test.geom";
+    desc.fragmentShader = "test.frag";
+    desc.tessellationMaxVerticesPerPatch = 4;
+    return desc;
+}
+
+// Returns descriptors that each differ from the base in one stage or parameter, the base first.
+std::vector<GLSLShaderDescriptor> variedDescriptors()
+{
+    std::vector<GLSLShaderDescriptor> descs(9, baseDescriptor());
+    descs[1].vertexShader = "other.vert";
+    descs[2].tessellationControlShader = "other.tesc";
+    descs[3].tessellationEvalShader = "other.tese";
+    descs[4].fragmentShader = "other.frag";
+    descs[5].tessellationMaxVerticesPerPatch = 3;
+    descs[6].geometryInputPrimitiveType = GL_LINES;
+    descs[7].geometryOutputPrimitiveType = GL_POINTS;
+    descs[8].defines["EARTH_TEST"] = "1";
+    return descs;
+}
+
+void testIdenticalDescriptorsAreEqual()
+{
+    GLSLShaderDataShared a(baseDescriptor());
+    GLSLShaderDataShared b(baseDescriptor());
+    EARTH_CHECK(a.getDescriptorHash() == b.getDescriptorHash());
+    EARTH_CHECK(a == b);
+    EARTH_CHECK(!(a != b));
+    EARTH_CHECK(!(a < b) && !(b < a));
+}
+
+void testDifferentDescriptorsAreNotEqual()
+{
+    std::vector<GLSLShaderDescriptor> descs = variedDescriptors();
+    for (size_t i = 0; i < descs.size(); ++i) {
+        for (size_t j = i + 1; j < descs.size(); ++j) {
+            GLSLShaderDataShared a(descs[i]);
+            GLSLShaderDataShared b(descs[j]);
+            EARTH_CHECK(a.getDescriptorHash() != b.getDescriptorHash());
+            EARTH_CHECK(a != b);
+            EARTH_CHECK(!(a == b));
+            EARTH_CHECK((a < b) != (b < a));
+        }
+    }
+}
+
+void testPathSetterRehashes()
+{
+    GLSLShaderDescriptor renamed = baseDescriptor();
+    renamed.tessellationEvalShader = "renamed.tese";
+
+    GLSLShaderDataShared shader(baseDescriptor());
+    GLSLShaderDataShared expected(renamed);
+    shader.setTessellationEvalShaderPath("renamed.tese");
+    EARTH_CHECK(shader.getDescriptorHash() == expected.getDescriptorHash());
+    EARTH_CHECK(shader == expected);
+
+    // setting the path it already has keeps the hash
+    uint64_t hash = shader.getDescriptorHash();
+    shader.setTessellationEvalShaderPath("renamed.tese");
+    EARTH_CHECK(shader.getDescriptorHash() == hash);
+}
+
+void testManagerShaderKeepsOneProgramPerDescriptor()
+{
+    size_t numShadersBefore = ManagerShader::getNumberOfShaders();
+    std::vector<GLSLShaderDataShared*> shaders;
+    for (const GLSLShaderDescriptor& desc : variedDescriptors()) {
+        shaders.push_back(new GLSLShaderDataShared(desc));
+        EARTH_CHECK(ManagerShader::registerShaderDataShared(shaders.back()));
+    }
+    EARTH_CHECK(ManagerShader::getNumberOfShaders() == numShadersBefore + shaders.size());
+
+    // an identical descriptor shares the loaded program
+    GLSLShaderDataShared* duplicate = new GLSLShaderDataShared(baseDescriptor());
+    EARTH_CHECK(!ManagerShader::registerShaderDataShared(duplicate));
+
+    // a path setter moves the loaded shader to its new key, the old key is free for the duplicate and the
+    // new one is taken
+    shaders[0]->setTessellationEvalShaderPath("renamed.tese");
+    GLSLShaderDescriptor renamed = baseDescriptor();
+    renamed.tessellationEvalShader = "renamed.tese";
+    GLSLShaderDataShared* renamedCopy = new GLSLShaderDataShared(renamed);
+    EARTH_CHECK(!ManagerShader::registerShaderDataShared(renamedCopy));
+    EARTH_CHECK(ManagerShader::registerShaderDataShared(duplicate));
+    EARTH_CHECK(ManagerShader::getNumberOfShaders() == numShadersBefore + shaders.size() + 1);
+
+    // renaming a shader back onto the key of another keeps it out of the set
+    shaders[0]->setTessellationEvalShaderPath("test.tese");
+    EARTH_CHECK(!ManagerShader::unregisterShaderDataShared(shaders[0]));
+    EARTH_CHECK(ManagerShader::getNumberOfShaders() == numShadersBefore + shaders.size());
+
+    shaders.push_back(duplicate);
+    for (GLSLShaderDataShared* shader : shaders) {
+        ManagerShader::unregisterShaderDataShared(shader);
+        delete shader;
+    }
+    delete renamedCopy;
+    EARTH_CHECK(ManagerShader::getNumberOfShaders() == numShadersBefore);
+}
+}
+
+int main()
+{
+    testIdenticalDescriptorsAreEqual();
+    testDifferentDescriptorsAreNotEqual();
+    testPathSetterRehashes();
+    testManagerShaderKeepsOneProgramPerDescriptor();
+    return EARTH_TEST_RESULT();
+}